@@ -1,9 +1,19 @@
+import gzip
+import hashlib
+from pathlib import Path
+
 import esphome.codegen as cg
 import esphome.config_validation as cv
-from esphome.components import web_server_base
+from esphome.components import sensor, web_server_base
 from esphome.components.web_server_base import CONF_WEB_SERVER_BASE_ID
 from esphome.const import (
-    CONF_ID
+    CONF_ID,
+    CONF_UPDATE_INTERVAL,
+    ENTITY_CATEGORY_DIAGNOSTIC,
+    STATE_CLASS_MEASUREMENT,
+    STATE_CLASS_TOTAL_INCREASING,
+    UNIT_BYTES,
+    UNIT_MILLISECOND,
 )
 from esphome.core import coroutine_with_priority, CORE
 from .. import sd_mmc_card
@@ -13,12 +23,161 @@ CONF_ROOT_PATH = "root_path"
 CONF_ENABLE_DELETION = "enable_deletion"
 CONF_ENABLE_DOWNLOAD = "enable_download"
 CONF_ENABLE_UPLOAD = "enable_upload"
+CONF_BUFFER_POOL = "buffer_pool"
+CONF_COUNT = "count"
+CONF_PER_REQUEST = "per_request"
+CONF_UPLOAD_PIPELINE = "upload_pipeline"
+CONF_RESUMABLE_UPLOAD_EXPIRY = "resumable_upload_expiry"
+CONF_ADMISSION = "admission"
+CONF_MAX_DOWNLOADS = "max_downloads"
+CONF_MAX_UPLOADS = "max_uploads"
+CONF_PER_CLIENT_DOWNLOADS = "per_client_downloads"
+CONF_PER_CLIENT_UPLOADS = "per_client_uploads"
+CONF_DOWNLOAD_RATE = "download_rate"
+CONF_UPLOAD_RATE = "upload_rate"
+CONF_BURST = "burst"
+CONF_QUEUE_SIZE = "queue_size"
+CONF_QUEUE_TIMEOUT = "queue_timeout"
+CONF_RETRY_AFTER = "retry_after"
+CONF_LISTING_CACHE_SIZE = "listing_cache_size"
+CONF_INDEX_SORT_LIMIT = "index_sort_limit"
+CONF_CACHE_CONTROL = "cache_control"
+CONF_CONTENT_TYPE = "content_type"
+CONF_VALUE = "value"
+CONF_MOUNTS = "mounts"
+CONF_CONTENT_TYPES = "content_types"
+CONF_EXTENSION = "extension"
+CONF_CATEGORY = "category"
+CONF_COMPRESS_LISTINGS = "compress_listings"
+CONF_COMPRESSION_WINDOW = "compression_window"
+CONF_BUFFER_SIZE = "buffer_size"
+CONF_TASK_PRIORITY = "task_priority"
+CONF_READ_AHEAD = "read_ahead"
+CONF_DEPTH = "depth"
+CONF_SEARCH_INDEX = "search_index"
+CONF_REFRESH_INTERVAL = "refresh_interval"
+CONF_MAX_ENTRIES = "max_entries"
+CONF_METRICS = "metrics"
+CONF_CHANGE_FEED = "change_feed"
+CONF_MAX_SUBSCRIBERS = "max_subscribers"
+CONF_KEEPALIVE = "keepalive"
+CONF_REQUESTS = "requests"
+CONF_ERRORS = "errors"
+CONF_BYTES_SENT = "bytes_sent"
+CONF_BYTES_RECEIVED = "bytes_received"
+CONF_ACTIVE_TRANSFERS = "active_transfers"
+CONF_CARD_READ_LATENCY = "card_read_latency"
+CONF_CARD_WRITE_LATENCY = "card_write_latency"
+CONF_STYLE_DATA_ID = "style_data_id"
+CONF_SCRIPT_DATA_ID = "script_data_id"
+
+UI_DIR = Path(__file__).parent / "ui"
+# File under ui/, content type and id of the flash array of each asset of the folder page.
+UI_ASSETS = [
+    ("box3web.css", "text/css", CONF_STYLE_DATA_ID),
+    ("box3web.js", "text/javascript", CONF_SCRIPT_DATA_ID),
+]
 
-AUTO_LOAD = ["web_server_base"]
+AUTO_LOAD = ["web_server_base", "sensor"]
 DEPENDENCIES = ["sd_mmc_card"]
 
 Box3Web_ns = cg.esphome_ns.namespace("box3web")
 Box3Web = Box3Web_ns.class_("Box3Web", cg.Component)
+ContentCategory = Box3Web_ns.enum("ContentCategory", is_class=True)
+
+CONTENT_CATEGORIES = {
+    "file": ContentCategory.FILE,
+    "text": ContentCategory.TEXT,
+    "image": ContentCategory.IMAGE,
+    "audio": ContentCategory.AUDIO,
+    "video": ContentCategory.VIDEO,
+}
+
+
+def validate_cluster_multiple(value):
+    value = cv.int_range(min=512, max=65536)(value)
+    if value % 512 != 0:
+        raise cv.Invalid("must be a multiple of 512 bytes")
+    return value
+
+
+def validate_extension(value):
+    value = cv.string_strict(value).lower()
+    if value.startswith("."):
+        value = value[1:]
+    if not value or len(value) > 15 or not value.isalnum():
+        raise cv.Invalid("extension must be 1 to 15 letters or digits")
+    return value
+
+
+def mount_key(url_prefix):
+    return "/" + url_prefix.strip("/")
+
+
+def validate_unique_mounts(config):
+    seen = {mount_key(config[CONF_URL_PREFIX])}
+    for mount in config[CONF_MOUNTS]:
+        key = mount_key(mount[CONF_URL_PREFIX])
+        if key in seen:
+            raise cv.Invalid(f"url_prefix {key} is used by more than one mount", path=[CONF_MOUNTS])
+        seen.add(key)
+    return config
+
+
+COUNTER_SENSOR_SCHEMA = sensor.sensor_schema(
+    accuracy_decimals=0,
+    state_class=STATE_CLASS_TOTAL_INCREASING,
+    entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+)
+BYTES_SENSOR_SCHEMA = sensor.sensor_schema(
+    unit_of_measurement=UNIT_BYTES,
+    accuracy_decimals=0,
+    state_class=STATE_CLASS_TOTAL_INCREASING,
+    entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+)
+LATENCY_SENSOR_SCHEMA = sensor.sensor_schema(
+    unit_of_measurement=UNIT_MILLISECOND,
+    accuracy_decimals=2,
+    state_class=STATE_CLASS_MEASUREMENT,
+    entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+)
+
+# Sensor key, codegen setter and schema of each metric that can be published as a sensor.
+METRIC_SENSORS = [
+    (CONF_REQUESTS, "set_requests_sensor", COUNTER_SENSOR_SCHEMA),
+    (CONF_ERRORS, "set_errors_sensor", COUNTER_SENSOR_SCHEMA),
+    (CONF_BYTES_SENT, "set_bytes_sent_sensor", BYTES_SENSOR_SCHEMA),
+    (CONF_BYTES_RECEIVED, "set_bytes_received_sensor", BYTES_SENSOR_SCHEMA),
+    (
+        CONF_ACTIVE_TRANSFERS,
+        "set_active_transfers_sensor",
+        sensor.sensor_schema(
+            accuracy_decimals=0,
+            state_class=STATE_CLASS_MEASUREMENT,
+            entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+        ),
+    ),
+    (CONF_CARD_READ_LATENCY, "set_card_read_latency_sensor", LATENCY_SENSOR_SCHEMA),
+    (CONF_CARD_WRITE_LATENCY, "set_card_write_latency_sensor", LATENCY_SENSOR_SCHEMA),
+]
+
+CACHE_CONTROL_SCHEMA = cv.Schema(
+    {
+        cv.Required(CONF_CONTENT_TYPE): cv.string_strict,
+        cv.Required(CONF_VALUE): cv.string_strict,
+    }
+)
+
+MOUNT_SCHEMA = cv.Schema(
+    {
+        cv.Required(CONF_URL_PREFIX): cv.string_strict,
+        cv.Required(CONF_ROOT_PATH): cv.string_strict,
+        cv.Optional(CONF_ENABLE_DELETION, default=False): cv.boolean,
+        cv.Optional(CONF_ENABLE_DOWNLOAD, default=False): cv.boolean,
+        cv.Optional(CONF_ENABLE_UPLOAD, default=False): cv.boolean,
+        cv.Optional(CONF_CACHE_CONTROL, default=[]): cv.ensure_list(CACHE_CONTROL_SCHEMA),
+    }
+)
 
 CONFIG_SCHEMA = cv.All(
     cv.Schema(
@@ -28,15 +187,112 @@ CONFIG_SCHEMA = cv.All(
                 web_server_base.WebServerBase
             ),
             cv.GenerateID(sd_mmc_card.CONF_SD_MMC_CARD_ID): cv.use_id(sd_mmc_card.SdMmc),
+            cv.GenerateID(CONF_STYLE_DATA_ID): cv.declare_id(cg.uint8),
+            cv.GenerateID(CONF_SCRIPT_DATA_ID): cv.declare_id(cg.uint8),
             cv.Optional(CONF_URL_PREFIX, default="file"): cv.string_strict,
             cv.Optional(CONF_ROOT_PATH, default="/"): cv.string_strict,
             cv.Optional(CONF_ENABLE_DELETION, default=False): cv.boolean,
             cv.Optional(CONF_ENABLE_DOWNLOAD, default=False): cv.boolean,
             cv.Optional(CONF_ENABLE_UPLOAD, default=False): cv.boolean,
+            cv.Optional(CONF_BUFFER_POOL, default={}): cv.Schema(
+                {
+                    cv.Optional(CONF_BUFFER_SIZE, default=16384): validate_cluster_multiple,
+                    cv.Optional(CONF_COUNT, default=6): cv.int_range(min=2, max=64),
+                    cv.Optional(CONF_PER_REQUEST, default=3): cv.int_range(min=1, max=16),
+                }
+            ),
+            cv.Optional(CONF_RESUMABLE_UPLOAD_EXPIRY, default="24h"): cv.All(
+                cv.positive_time_period_milliseconds, cv.Range(min=cv.TimePeriod(minutes=1))
+            ),
+            # 0 leaves a cap or rate unlimited; rates are bytes per second per client.
+            cv.Optional(CONF_ADMISSION, default={}): cv.Schema(
+                {
+                    cv.Optional(CONF_MAX_DOWNLOADS, default=2): cv.int_range(min=0, max=16),
+                    cv.Optional(CONF_MAX_UPLOADS, default=1): cv.int_range(min=0, max=16),
+                    cv.Optional(CONF_PER_CLIENT_DOWNLOADS, default=0): cv.int_range(min=0, max=16),
+                    cv.Optional(CONF_PER_CLIENT_UPLOADS, default=0): cv.int_range(min=0, max=16),
+                    cv.Optional(CONF_DOWNLOAD_RATE, default=0): cv.int_range(min=0, max=10000000),
+                    cv.Optional(CONF_UPLOAD_RATE, default=0): cv.int_range(min=0, max=10000000),
+                    cv.Optional(CONF_BURST, default=16384): cv.int_range(min=1460, max=1048576),
+                    cv.Optional(CONF_QUEUE_SIZE, default=4): cv.int_range(min=0, max=16),
+                    cv.Optional(CONF_QUEUE_TIMEOUT, default="5s"): cv.positive_time_period_milliseconds,
+                    cv.Optional(CONF_RETRY_AFTER, default="2s"): cv.All(
+                        cv.positive_time_period_seconds, cv.Range(min=cv.TimePeriod(seconds=1))
+                    ),
+                }
+            ),
+            cv.Optional(CONF_LISTING_CACHE_SIZE, default=32768): cv.int_range(min=0, max=1048576),
+            cv.Optional(CONF_INDEX_SORT_LIMIT, default=256): cv.int_range(min=0, max=4096),
+            cv.Optional(CONF_MOUNTS, default=[]): cv.ensure_list(MOUNT_SCHEMA),
+            cv.Optional(CONF_CACHE_CONTROL, default=[]): cv.ensure_list(CACHE_CONTROL_SCHEMA),
+            cv.Optional(CONF_CONTENT_TYPES, default=[]): cv.ensure_list(
+                cv.Schema(
+                    {
+                        cv.Required(CONF_EXTENSION): validate_extension,
+                        cv.Required(CONF_CONTENT_TYPE): cv.string_strict,
+                        cv.Optional(CONF_CATEGORY, default="file"): cv.enum(CONTENT_CATEGORIES, lower=True),
+                    }
+                )
+            ),
+            cv.Optional(CONF_COMPRESS_LISTINGS, default=False): cv.boolean,
+            cv.Optional(CONF_COMPRESSION_WINDOW, default=2048): cv.one_of(1024, 2048, 4096, 8192, 16384, int=True),
+            # The block table takes about 48 bytes of RAM per 64 entries.
+            cv.Optional(CONF_SEARCH_INDEX): cv.Schema(
+                {
+                    cv.Optional(CONF_REFRESH_INTERVAL, default="24h"): cv.positive_time_period_milliseconds,
+                    cv.Optional(CONF_MAX_ENTRIES, default=16384): cv.int_range(min=64, max=262144),
+                }
+            ),
+            # Enables GET <dir>?events, server-sent events the folder page follows instead of reloading. Every
+            # subscriber keeps a socket of the web server open.
+            cv.Optional(CONF_CHANGE_FEED): cv.Schema(
+                {
+                    cv.Optional(CONF_MAX_SUBSCRIBERS, default=4): cv.int_range(min=1, max=16),
+                    cv.Optional(CONF_KEEPALIVE, default="15s"): cv.All(
+                        cv.positive_time_period_milliseconds, cv.Range(min=cv.TimePeriod(seconds=1))
+                    ),
+                }
+            ),
+            # Enables GET /<url_prefix>/_metrics (Prometheus text format) and the sensors below.
+            cv.Optional(CONF_METRICS): cv.Schema(
+                {
+                    cv.Optional(CONF_UPDATE_INTERVAL, default="60s"): cv.All(
+                        cv.positive_time_period_milliseconds, cv.Range(min=cv.TimePeriod(seconds=1))
+                    ),
+                    **{cv.Optional(key): schema for key, _, schema in METRIC_SENSORS},
+                }
+            ),
+            cv.Optional(CONF_READ_AHEAD): cv.All(
+                cv.Schema(
+                    {
+                        cv.Optional(CONF_DEPTH, default=2): cv.int_range(min=2, max=8),
+                    }
+                ),
+                cv.only_on_esp32,
+            ),
+            cv.Optional(CONF_UPLOAD_PIPELINE): cv.All(
+                cv.Schema(
+                    {
+                        cv.Optional(CONF_BUFFER_SIZE, default=65536): cv.int_range(min=4096, max=1048576),
+                        cv.Optional(CONF_TASK_PRIORITY, default=5): cv.int_range(min=1, max=24),
+                    }
+                ),
+                cv.only_on_esp32,
+            ),
         }
     ).extend(cv.COMPONENT_SCHEMA),
+    validate_unique_mounts,
 )
 
+def ui_asset(file_name):
+    """Gzip compressed content of a ui/ file and the name it is served under, with a hash of the content."""
+    raw = (UI_DIR / file_name).read_bytes()
+    # A fixed mtime keeps the output, and so the firmware, the same from build to build.
+    compressed = gzip.compress(raw, compresslevel=9, mtime=0)
+    stem, extension = file_name.rsplit(".", 1)
+    return f"{stem}.{hashlib.sha256(raw).hexdigest()[:10]}.{extension}", compressed
+
+
 @coroutine_with_priority(45.0)
 async def to_code(config):
     paren = await cg.get_variable(config[CONF_WEB_SERVER_BASE_ID])
@@ -50,6 +306,49 @@ async def to_code(config):
     cg.add(var.set_deletion_enabled(config[CONF_ENABLE_DELETION]))
     cg.add(var.set_download_enabled(config[CONF_ENABLE_DOWNLOAD]))
     cg.add(var.set_upload_enabled(config[CONF_ENABLE_UPLOAD]))
+    for mount in config[CONF_MOUNTS]:
+        cg.add(var.add_mount(mount[CONF_URL_PREFIX], mount[CONF_ROOT_PATH], mount[CONF_ENABLE_DELETION],
+                             mount[CONF_ENABLE_DOWNLOAD], mount[CONF_ENABLE_UPLOAD]))
+        for rule in mount[CONF_CACHE_CONTROL]:
+            cg.add(var.add_mount_cache_control(mount[CONF_URL_PREFIX], rule[CONF_CONTENT_TYPE], rule[CONF_VALUE]))
+    pool = config[CONF_BUFFER_POOL]
+    cg.add(var.set_buffer_pool(pool[CONF_BUFFER_SIZE], pool[CONF_COUNT], pool[CONF_PER_REQUEST]))
+    cg.add(var.set_resumable_upload_expiry(config[CONF_RESUMABLE_UPLOAD_EXPIRY].total_milliseconds))
+    admission = config[CONF_ADMISSION]
+    cg.add(var.set_transfer_limits(admission[CONF_MAX_DOWNLOADS], admission[CONF_MAX_UPLOADS],
+                                   admission[CONF_PER_CLIENT_DOWNLOADS], admission[CONF_PER_CLIENT_UPLOADS]))
+    cg.add(var.set_transfer_rates(admission[CONF_DOWNLOAD_RATE], admission[CONF_UPLOAD_RATE], admission[CONF_BURST]))
+    cg.add(var.set_admission_queue(admission[CONF_QUEUE_SIZE], admission[CONF_QUEUE_TIMEOUT].total_milliseconds,
+                                   admission[CONF_RETRY_AFTER].total_seconds))
+    cg.add(var.set_listing_cache_size(config[CONF_LISTING_CACHE_SIZE]))
+    cg.add(var.set_index_sort_limit(config[CONF_INDEX_SORT_LIMIT]))
+    cg.add(var.set_listing_compression(config[CONF_COMPRESS_LISTINGS], config[CONF_COMPRESSION_WINDOW]))
+    for content_type in config[CONF_CONTENT_TYPES]:
+        cg.add(var.add_content_type(content_type[CONF_EXTENSION], content_type[CONF_CONTENT_TYPE],
+                                    content_type[CONF_CATEGORY]))
+    for rule in config[CONF_CACHE_CONTROL]:
+        cg.add(var.add_cache_control(rule[CONF_CONTENT_TYPE], rule[CONF_VALUE]))
+    for file_name, content_type, data_id in UI_ASSETS:
+        name, data = ui_asset(file_name)
+        array = cg.progmem_array(config[data_id], list(data))
+        cg.add(var.add_ui_asset(name, content_type, array, len(data)))
+    if search_index := config.get(CONF_SEARCH_INDEX):
+        cg.add(var.set_search_index(search_index[CONF_REFRESH_INTERVAL].total_milliseconds,
+                                    search_index[CONF_MAX_ENTRIES]))
+    if change_feed := config.get(CONF_CHANGE_FEED):
+        cg.add(var.set_change_feed(change_feed[CONF_MAX_SUBSCRIBERS], change_feed[CONF_KEEPALIVE].total_milliseconds))
+    if metrics := config.get(CONF_METRICS):
+        cg.add(var.set_metrics(metrics[CONF_UPDATE_INTERVAL].total_milliseconds))
+        for key, setter, _ in METRIC_SENSORS:
+            if key in metrics:
+                sens = await sensor.new_sensor(metrics[key])
+                cg.add(getattr(var, setter)(sens))
+    if read_ahead := config.get(CONF_READ_AHEAD):
+        cg.add_define("USE_BOX3WEB_READ_AHEAD")
+        cg.add(var.set_read_ahead(read_ahead[CONF_DEPTH]))
+    if pipeline := config.get(CONF_UPLOAD_PIPELINE):
+        cg.add_define("USE_BOX3WEB_UPLOAD_PIPELINE")
+        cg.add(var.set_upload_pipeline(pipeline[CONF_BUFFER_SIZE], pipeline[CONF_TASK_PRIORITY]))
     
     cg.add_define("USE_SD_CARD_WEBSERVER")
     
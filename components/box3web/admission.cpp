@@ -0,0 +1,255 @@
+#include "admission.h"
+#include "esphome/core/hal.h"
+#include "esphome/core/log.h"
+
+#include <algorithm>
+#include <cstring>
+#ifdef USE_ESP_IDF
+#include <lwip/sockets.h>
+#endif
+
+namespace esphome {
+namespace box3web {
+
+static const char *TAG = "box3web.admission";
+
+// Queued callers look for a free slot this often.
+static const uint32_t QUEUE_POLL_MS = 20;
+// Longest single sleep of a paced transfer, so a huge debt cannot park a task for good.
+static const uint32_t MAX_PACE_MS = 1000;
+// Callback driven senders are not handed slivers smaller than about one TCP segment.
+static const size_t MIN_GRANT = 1436;
+// A client without transfers keeps its buckets at least this long.
+static const uint32_t CLIENT_IDLE_MS = 60000;
+
+void TokenBucket::configure(uint32_t rate, uint32_t burst, uint32_t now_us) {
+    this->rate_ = rate;
+    this->burst_ = std::max<uint32_t>(burst, 1);
+    this->tokens_ = this->burst_;
+    this->last_us_ = now_us;
+}
+
+void TokenBucket::refill_(uint32_t now_us) {
+    uint32_t elapsed = now_us - this->last_us_;
+    int64_t added = static_cast<int64_t>(elapsed) * this->rate_ / 1000000;
+    if (this->tokens_ + added >= this->burst_) {
+        this->tokens_ = this->burst_;
+        this->last_us_ = now_us;
+        return;
+    }
+    // Only the time that earned whole bytes is spent, slow rates would otherwise never refill.
+    this->tokens_ += added;
+    this->last_us_ += static_cast<uint32_t>(added * 1000000 / this->rate_);
+}
+
+size_t TokenBucket::available(size_t wanted, size_t min_grant, uint32_t now_us) {
+    if (!this->limited())
+        return wanted;
+    this->refill_(now_us);
+    if (this->tokens_ < static_cast<int64_t>(std::min(wanted, min_grant)))
+        return 0;
+    return std::min<size_t>(wanted, this->tokens_);
+}
+
+uint32_t TokenBucket::consume(size_t len, uint32_t now_us) {
+    if (!this->limited())
+        return 0;
+    this->refill_(now_us);
+    this->tokens_ -= len;
+    if (this->tokens_ >= 0)
+        return 0;
+    return static_cast<uint32_t>((-this->tokens_ * 1000 + this->rate_ - 1) / this->rate_);
+}
+
+bool TokenBucket::overdrawn(uint32_t now_us) {
+    if (!this->limited())
+        return false;
+    this->refill_(now_us);
+    return this->tokens_ < 0;
+}
+
+bool TokenBucket::full(uint32_t now_us) {
+    if (!this->limited())
+        return true;
+    this->refill_(now_us);
+    return this->tokens_ >= this->burst_;
+}
+
+TransferTicket::TransferTicket(TransferTicket &&other) noexcept
+    : control_(other.control_), client_(other.client_), direction_(other.direction_) {
+    other.control_ = nullptr;
+}
+
+TransferTicket &TransferTicket::operator=(TransferTicket &&other) noexcept {
+    if (this != &other) {
+        this->release();
+        this->control_ = other.control_;
+        this->client_ = other.client_;
+        this->direction_ = other.direction_;
+        other.control_ = nullptr;
+    }
+    return *this;
+}
+
+void TransferTicket::release() {
+    if (this->control_ != nullptr)
+        this->control_->release_(this->client_, this->direction_);
+    this->control_ = nullptr;
+}
+
+size_t TransferTicket::grant(size_t wanted) {
+    if (this->control_ == nullptr)
+        return wanted;
+    return this->control_->grant_(this->client_, this->direction_, wanted);
+}
+
+void TransferTicket::consume(size_t len) {
+    if (this->control_ != nullptr)
+        this->control_->consume_(this->client_, this->direction_, len);
+}
+
+void TransferTicket::pace(size_t len) {
+    if (this->control_ == nullptr)
+        return;
+    uint32_t wait_ms = this->control_->consume_(this->client_, this->direction_, len);
+    if (wait_ms > 0)
+        delay(std::min(wait_ms, MAX_PACE_MS));
+}
+
+void AdmissionControl::set_limits(TransferDirection direction, uint8_t max_active, uint8_t per_client) {
+    this->limits_[index(direction)].max_active = max_active;
+    this->limits_[index(direction)].per_client = per_client;
+}
+
+void AdmissionControl::set_rate(TransferDirection direction, uint32_t bytes_per_second, uint32_t burst) {
+    this->limits_[index(direction)].rate = bytes_per_second;
+    this->limits_[index(direction)].burst = burst;
+}
+
+void AdmissionControl::set_queue(uint8_t size, uint32_t timeout_ms) {
+    this->queue_size_ = size;
+    this->queue_timeout_ms_ = timeout_ms;
+}
+
+TransferTicket AdmissionControl::admit(uint32_t client, TransferDirection direction, bool wait) {
+    if (this->try_admit_(client, direction))
+        return TransferTicket(this, client, direction);
+    if (wait && this->queue_size_ > 0 && this->queue_timeout_ms_ > 0) {
+        bool admitted = false;
+        if (this->waiting_.fetch_add(1) < this->queue_size_) {
+            this->queued_++;
+            for (uint32_t waited = 0; !admitted && waited < this->queue_timeout_ms_; waited += QUEUE_POLL_MS) {
+                delay(QUEUE_POLL_MS);
+                admitted = this->try_admit_(client, direction);
+            }
+        }
+        this->waiting_--;
+        if (admitted)
+            return TransferTicket(this, client, direction);
+    }
+    uint32_t refused = ++this->refused_[index(direction)];
+    // The first refusal and then every 16th, a busy client retrying should not flood the log.
+    if (refused % 16 == 1) {
+        ESP_LOGW(TAG, "%s cap or rate reached, refused %u so far",
+                 direction == TransferDirection::UPLOAD ? "Upload" : "Download", (unsigned) refused);
+    }
+    return TransferTicket();
+}
+
+bool AdmissionControl::try_admit_(uint32_t client, TransferDirection direction) {
+    size_t i = index(direction);
+    Limits const &limits = this->limits_[i];
+    LockGuard guard(this->lock_);
+    if (limits.max_active != 0 && this->active_[i] >= limits.max_active)
+        return false;
+    auto it = this->clients_.find(client);
+    if (it != this->clients_.end() && limits.per_client != 0 && it->second.active[i] >= limits.per_client)
+        return false;
+    uint32_t now = micros();
+    this->expire_idle_(now);
+    it = this->clients_.find(client);
+    if (it == this->clients_.end()) {
+        it = this->clients_.emplace(client, Client()).first;
+        for (size_t d = 0; d < 2; d++)
+            it->second.buckets[d].configure(this->limits_[d].rate, this->limits_[d].burst, now);
+    }
+    // Transfers on a web server task spend their budget without waiting, the client waits here instead.
+    if (it->second.buckets[i].overdrawn(now))
+        return false;
+    it->second.active[i]++;
+    this->active_[i]++;
+    return true;
+}
+
+void AdmissionControl::release_(uint32_t client, TransferDirection direction) {
+    size_t i = index(direction);
+    LockGuard guard(this->lock_);
+    auto it = this->clients_.find(client);
+    if (it == this->clients_.end())
+        return;
+    it->second.active[i]--;
+    this->active_[i]--;
+    if (it->second.active[0] == 0 && it->second.active[1] == 0)
+        it->second.idle_since_ms = millis();
+}
+
+void AdmissionControl::expire_idle_(uint32_t now_us) {
+    uint32_t now_ms = millis();
+    for (auto it = this->clients_.begin(); it != this->clients_.end();) {
+        Client &client = it->second;
+        // A bucket still in debt or short of its burst would hand the client a fresh one.
+        if (client.active[0] == 0 && client.active[1] == 0 && now_ms - client.idle_since_ms >= CLIENT_IDLE_MS &&
+            client.buckets[0].full(now_us) && client.buckets[1].full(now_us)) {
+            it = this->clients_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+size_t AdmissionControl::grant_(uint32_t client, TransferDirection direction, size_t wanted) {
+    LockGuard guard(this->lock_);
+    auto it = this->clients_.find(client);
+    if (it == this->clients_.end())
+        return wanted;
+    return it->second.buckets[index(direction)].available(wanted, MIN_GRANT, micros());
+}
+
+uint32_t AdmissionControl::consume_(uint32_t client, TransferDirection direction, size_t len) {
+    LockGuard guard(this->lock_);
+    auto it = this->clients_.find(client);
+    if (it == this->clients_.end())
+        return 0;
+    return it->second.buckets[index(direction)].consume(len, micros());
+}
+
+#ifdef USE_ESP_IDF
+uint32_t client_address(httpd_req_t *req) {
+    int fd = httpd_req_to_sockfd(req);
+    struct sockaddr_in6 peer;
+    socklen_t len = sizeof(peer);
+    if (fd < 0 || getpeername(fd, reinterpret_cast<struct sockaddr *>(&peer), &len) != 0)
+        return 0;
+    uint32_t address;
+    if (peer.sin6_family == AF_INET) {
+        address = reinterpret_cast<struct sockaddr_in *>(&peer)->sin_addr.s_addr;
+    } else {
+        // IPv4-mapped addresses keep the IPv4 one in the low word.
+        memcpy(&address, peer.sin6_addr.s6_addr + 12, sizeof(address));
+    }
+    return address;
+}
+
+uint32_t client_address(AsyncWebServerRequest *request) {
+    httpd_req_t *req = *request;
+    return client_address(req);
+}
+#else
+uint32_t client_address(AsyncWebServerRequest *request) {
+    AsyncClient *client = request->client();
+    return client != nullptr ? static_cast<uint32_t>(client->remoteIP()) : 0;
+}
+#endif
+
+}  // namespace box3web
+}  // namespace esphome
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include "esphome/components/web_server_base/web_server_base.h"
+#include "esphome/core/defines.h"
+#include "esphome/core/helpers.h"
+#ifdef USE_ESP_IDF
+#include <esp_http_server.h>
+#endif
+
+namespace esphome {
+namespace box3web {
+
+enum class TransferDirection : uint8_t { DOWNLOAD = 0, UPLOAD = 1 };
+
+// Byte budget refilled at a steady rate up to a burst. Spending may run it into debt, which the
+// caller then waits off, so one oversized chunk still averages out to the configured rate.
+class TokenBucket {
+ public:
+  void configure(uint32_t rate, uint32_t burst, uint32_t now_us);
+  bool limited() const { return this->rate_ != 0; }
+  // Bytes that may go out right now, at most wanted. 0 while fewer than min(wanted, min_grant) are available.
+  size_t available(size_t wanted, size_t min_grant, uint32_t now_us);
+  // Spends len bytes and returns how many ms the bucket needs to get out of debt again.
+  uint32_t consume(size_t len, uint32_t now_us);
+  // Spent past zero and not yet refilled back.
+  bool overdrawn(uint32_t now_us);
+  // Refilled to the burst, a new bucket would be the same.
+  bool full(uint32_t now_us);
+
+ protected:
+  void refill_(uint32_t now_us);
+
+  uint32_t rate_{0};  // bytes per second, 0 = unlimited
+  uint32_t burst_{0};
+  int64_t tokens_{0};
+  uint32_t last_us_{0};
+};
+
+class AdmissionControl;
+
+// Admitted transfer, counted against the caps until destroyed. Also the handle to the client's shaper.
+class TransferTicket {
+ public:
+  TransferTicket() = default;
+  TransferTicket(AdmissionControl *control, uint32_t client, TransferDirection direction)
+      : control_(control), client_(client), direction_(direction) {}
+  TransferTicket(TransferTicket &&other) noexcept;
+  TransferTicket &operator=(TransferTicket &&other) noexcept;
+  TransferTicket(TransferTicket const &) = delete;
+  TransferTicket &operator=(TransferTicket const &) = delete;
+  ~TransferTicket() { this->release(); }
+
+  void release();
+  explicit operator bool() const { return this->control_ != nullptr; }
+
+  // Non-blocking shaping for callback driven senders: bytes allowed now, 0 asks to come back later.
+  size_t grant(size_t wanted);
+  // Spends len bytes without waiting. This is all a task serving every client may do; the debt it leaves
+  // keeps the client's next transfer from being admitted until it is paid off.
+  void consume(size_t len);
+  // Blocking shaping: spends len bytes and sleeps the calling task until the client is back under its rate.
+  // Only for tasks that serve this one transfer, never for a web server task.
+  void pace(size_t len);
+
+ protected:
+  AdmissionControl *control_{nullptr};
+  uint32_t client_{0};
+  TransferDirection direction_{TransferDirection::DOWNLOAD};
+};
+
+// Global and per-client caps on concurrent transfers, plus a token bucket per client and direction.
+// Clients are told apart by their IPv4 address (the low word of an IPv6 one).
+class AdmissionControl {
+ public:
+  // 0 means unlimited for every cap and rate.
+  void set_limits(TransferDirection direction, uint8_t max_active, uint8_t per_client);
+  void set_rate(TransferDirection direction, uint32_t bytes_per_second, uint32_t burst);
+  // Callers allowed to wait queue for at most timeout_ms, no more than size of them at a time.
+  void set_queue(uint8_t size, uint32_t timeout_ms);
+  void set_retry_after(uint32_t seconds) { this->retry_after_ = seconds; }
+
+  // Empty ticket when a cap is reached or the client has overdrawn its rate. Only tasks that never complete
+  // transfers themselves may wait, a web server task waiting for a slot would hold up the very transfer that
+  // frees it.
+  TransferTicket admit(uint32_t client, TransferDirection direction, bool wait = false);
+
+  uint32_t retry_after() const { return this->retry_after_; }
+  size_t active(TransferDirection direction) const { return this->active_[index(direction)]; }
+  uint32_t refused(TransferDirection direction) const { return this->refused_[index(direction)]; }
+  uint32_t queued() const { return this->queued_; }
+  uint8_t max_active(TransferDirection direction) const { return this->limits_[index(direction)].max_active; }
+  uint8_t per_client(TransferDirection direction) const { return this->limits_[index(direction)].per_client; }
+  uint32_t rate(TransferDirection direction) const { return this->limits_[index(direction)].rate; }
+
+ protected:
+  friend class TransferTicket;
+
+  struct Limits {
+    uint8_t max_active{0};
+    uint8_t per_client{0};
+    uint32_t rate{0};
+    uint32_t burst{0};
+  };
+  struct Client {
+    uint8_t active[2]{0, 0};
+    TokenBucket buckets[2];
+    uint32_t idle_since_ms{0};
+  };
+
+  static size_t index(TransferDirection direction) { return static_cast<size_t>(direction); }
+
+  bool try_admit_(uint32_t client, TransferDirection direction);
+  void release_(uint32_t client, TransferDirection direction);
+  size_t grant_(uint32_t client, TransferDirection direction, size_t wanted);
+  uint32_t consume_(uint32_t client, TransferDirection direction, size_t len);
+  void expire_idle_(uint32_t now_us);
+
+  Limits limits_[2];
+  uint8_t queue_size_{0};
+  uint32_t queue_timeout_ms_{0};
+  uint32_t retry_after_{2};
+
+  Mutex lock_;
+  // Clients outlive their transfers, so sequential requests share one budget. Idle ones are dropped once
+  // their buckets have refilled.
+  std::map<uint32_t, Client> clients_;
+  std::atomic<size_t> active_[2]{{0}, {0}};
+  std::atomic<uint32_t> refused_[2]{{0}, {0}};
+  std::atomic<uint32_t> queued_{0};
+  std::atomic<uint8_t> waiting_{0};
+};
+
+// Key the caps and shapers use for the peer of a request.
+uint32_t client_address(AsyncWebServerRequest *request);
+#ifdef USE_ESP_IDF
+uint32_t client_address(httpd_req_t *req);
+#endif
+
+}  // namespace box3web
+}  // namespace esphome
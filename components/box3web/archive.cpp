@@ -0,0 +1,361 @@
+#include "archive.h"
+#include "crc32.h"
+#include "esphome/core/helpers.h"
+#include "esphome/core/log.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace esphome {
+namespace box3web {
+
+static const char *TAG = "box3web.archive";
+
+static const size_t TAR_BLOCK = 512;
+static const size_t TAR_NAME_LENGTH = 100;
+// Largest value of the 11 octal digits of the ustar size and mtime fields, 8 GiB - 1.
+static const uint64_t TAR_MAX_NUMBER = 077777777777ULL;
+// Central directory records are kept in RAM, about 24 bytes each.
+static const size_t MAX_ZIP_ENTRIES = 8192;
+
+static const uint32_t ZIP_LOCAL_HEADER = 0x04034b50;
+static const uint32_t ZIP_DATA_DESCRIPTOR = 0x08074b50;
+static const uint32_t ZIP_CENTRAL_HEADER = 0x02014b50;
+static const uint32_t ZIP64_END_OF_CENTRAL = 0x06064b50;
+static const uint32_t ZIP64_END_LOCATOR = 0x07064b50;
+static const uint32_t ZIP_END_OF_CENTRAL = 0x06054b50;
+// Sizes and CRC follow the data, names are UTF-8.
+static const uint16_t ZIP_FLAGS = 0x0008 | 0x0800;
+static const uint16_t ZIP_VERSION = 20;
+static const uint16_t ZIP64_VERSION = 45;
+
+static void put16(std::string &out, uint16_t value) {
+    out += static_cast<char>(value & 0xff);
+    out += static_cast<char>(value >> 8);
+}
+
+static void put32(std::string &out, uint32_t value) {
+    put16(out, value & 0xffff);
+    put16(out, value >> 16);
+}
+
+static void put64(std::string &out, uint64_t value) {
+    put32(out, value & 0xffffffff);
+    put32(out, value >> 32);
+}
+
+// Zero padded octal number filling a ustar field of width bytes, NUL terminated. value must fit.
+static void put_octal(char *field, size_t width, uint64_t value) {
+    field[width - 1] = '\0';
+    for (size_t i = width - 1; i > 0; i--) {
+        field[i - 1] = static_cast<char>('0' + (value & 7));
+        value >>= 3;
+    }
+}
+
+// "<length> <key>=<value>\n", the length counting itself.
+static std::string pax_record(const char *key, std::string const &value) {
+    std::string record = std::string(" ") + key + "=" + value + "\n";
+    size_t length = record.size() + std::to_string(record.size()).size();
+    length += std::to_string(length).size() - std::to_string(record.size()).size();
+    record.insert(0, std::to_string(length));
+    return record;
+}
+
+// MS-DOS date in the high and time in the low half, as zip headers store them.
+static uint32_t dos_time(time_t time) {
+    struct tm tm;
+    if (time == 0 || localtime_r(&time, &tm) == nullptr || tm.tm_year < 80)
+        return (1 << 21) | (1 << 16);  // 1980-01-01 00:00
+    return ((tm.tm_year - 80) << 25) | ((tm.tm_mon + 1) << 21) | (tm.tm_mday << 16) | (tm.tm_hour << 11) |
+           (tm.tm_min << 5) | (tm.tm_sec / 2);
+}
+
+bool TreeWalker::open(std::string const &root) {
+    this->stack_.clear();
+    auto dir = std::unique_ptr<DirIterator>(new DirIterator());
+    if (!dir->open(root))
+        return false;
+    this->stack_.push_back(std::move(dir));
+    return true;
+}
+
+bool TreeWalker::next(sd_mmc_card::FileInfo &info) {
+    while (!this->stack_.empty()) {
+        if (!this->stack_.back()->next(info)) {
+            this->stack_.pop_back();
+            continue;
+        }
+        this->mtime_ = this->stack_.back()->mtime();
+        if (info.is_directory) {
+            auto dir = std::unique_ptr<DirIterator>(new DirIterator());
+            if (this->stack_.size() >= MAX_DEPTH) {
+                ESP_LOGW(TAG, "Skipping %s, nested too deep", info.path.c_str());
+                continue;
+            }
+            if (dir->open(info.path))
+                this->stack_.push_back(std::move(dir));
+        }
+        return true;
+    }
+    return false;
+}
+
+ArchiveSource::ArchiveSource(std::string const &root, ArchiveFormat format) : root_(root), format_(format) {
+    while (this->root_.size() > 1 && this->root_.back() == '/')
+        this->root_.pop_back();
+    size_t pos = this->root_.rfind('/');
+    this->base_ = pos == std::string::npos ? this->root_ : this->root_.substr(pos + 1);
+    if (this->base_.empty())
+        this->base_ = "sdcard";
+}
+
+bool ArchiveSource::open() { return this->walker_.open(this->root_); }
+
+std::string ArchiveSource::entry_name(sd_mmc_card::FileInfo const &info) const {
+    size_t skip = this->root_ == "/" ? 0 : this->root_.size();
+    std::string name = this->base_ + info.path.substr(skip);
+    if (info.is_directory)
+        name += '/';
+    return name;
+}
+
+void ArchiveSource::write_tar_header(std::string const &name, char type, size_t size, time_t mtime) {
+    char header[TAR_BLOCK] = {};
+    memcpy(header, name.data(), std::min(name.size(), TAR_NAME_LENGTH));
+    put_octal(header + 100, 8, type == '5' ? 0755 : 0644);
+    put_octal(header + 108, 8, 0);
+    put_octal(header + 116, 8, 0);
+    // A larger size has gone into a pax record already.
+    put_octal(header + 124, 12, static_cast<uint64_t>(size) > TAR_MAX_NUMBER ? 0 : size);
+    put_octal(header + 136, 12, std::min<uint64_t>(std::max<time_t>(mtime, 0), TAR_MAX_NUMBER));
+    memset(header + 148, ' ', 8);
+    header[156] = type;
+    memcpy(header + 257, "ustar", 6);
+    memcpy(header + 263, "00", 2);
+    unsigned checksum = 0;
+    for (size_t i = 0; i < TAR_BLOCK; i++)
+        checksum += static_cast<unsigned char>(header[i]);
+    put_octal(header + 148, 7, checksum);
+    header[155] = ' ';
+    this->pending_.append(header, TAR_BLOCK);
+}
+
+bool ArchiveSource::next_entry() {
+    sd_mmc_card::FileInfo info;
+    while (this->walker_.next(info)) {
+        std::string name = this->entry_name(info);
+        time_t mtime;
+        if (info.is_directory) {
+            mtime = this->walker_.mtime();
+        } else {
+            if (!this->file_.open(info.path)) {
+                ESP_LOGW(TAG, "Skipping %s, cannot open it", info.path.c_str());
+                continue;
+            }
+            mtime = this->file_.mtime();
+        }
+        if (this->format_ == ArchiveFormat::ZIP && this->records_.size() >= MAX_ZIP_ENTRIES) {
+            ESP_LOGW(TAG, "More than %u entries below %s, the archive stops here", (unsigned) MAX_ZIP_ENTRIES,
+                     this->root_.c_str());
+            this->file_.close();
+            return false;
+        }
+        size_t size = info.is_directory ? 0 : this->file_.size();
+        if (this->format_ == ArchiveFormat::TAR) {
+            // A pax extended header carries what the ustar one cannot: the full name, of which the ustar header
+            // keeps a truncated copy, and a size past 11 octal digits.
+            std::string pax;
+            if (name.size() > TAR_NAME_LENGTH)
+                pax += pax_record("path", name);
+            if (static_cast<uint64_t>(size) > TAR_MAX_NUMBER)
+                pax += pax_record("size", std::to_string(size));
+            if (!pax.empty()) {
+                this->write_tar_header("PaxHeader", 'x', pax.size(), mtime);
+                this->pending_ += pax;
+                this->pending_.append((TAR_BLOCK - pax.size() % TAR_BLOCK) % TAR_BLOCK, '\0');
+            }
+            this->write_tar_header(name, info.is_directory ? '5' : '0', size, mtime);
+        } else {
+            ZipRecord record{};
+            record.offset = this->offset_;
+            record.dos_time = dos_time(mtime);
+            record.name_hash = fnv1_hash(name);
+            this->records_.push_back(record);
+            put32(this->pending_, ZIP_LOCAL_HEADER);
+            put16(this->pending_, ZIP_VERSION);
+            // Directories have no data, their all-zero CRC and sizes are known up front.
+            put16(this->pending_, info.is_directory ? 0x0800 : ZIP_FLAGS);
+            put16(this->pending_, 0);  // stored
+            put32(this->pending_, record.dos_time);
+            put32(this->pending_, 0);
+            put32(this->pending_, 0);
+            put32(this->pending_, 0);
+            put16(this->pending_, name.size());
+            put16(this->pending_, 0);
+            this->pending_ += name;
+        }
+        if (!info.is_directory) {
+            this->in_file_ = true;
+            this->declared_ = size;
+            this->remaining_ = size;
+            this->crc_ = 0;
+        }
+        return true;
+    }
+    return false;
+}
+
+void ArchiveSource::finish_entry() {
+    this->file_.close();
+    this->in_file_ = false;
+    if (this->format_ == ArchiveFormat::TAR) {
+        this->pending_.append((TAR_BLOCK - this->declared_ % TAR_BLOCK) % TAR_BLOCK, '\0');
+        return;
+    }
+    ZipRecord &record = this->records_.back();
+    record.crc = this->crc_;
+    record.size = this->declared_ - this->remaining_;
+    put32(this->pending_, ZIP_DATA_DESCRIPTOR);
+    put32(this->pending_, record.crc);
+    put32(this->pending_, record.size);
+    put32(this->pending_, record.size);
+}
+
+bool ArchiveSource::next_central() {
+    sd_mmc_card::FileInfo info;
+    while (this->central_index_ < this->records_.size() && this->walker_.next(info)) {
+        std::string name = this->entry_name(info);
+        ZipRecord const &record = this->records_[this->central_index_];
+        if (fnv1_hash(name) != record.name_hash) {
+            // Entries the first walk skipped (unreadable files) are skipped again, anything else means the
+            // folder changed under the transfer.
+            if (!info.is_directory && !SdFile().open(info.path))
+                continue;
+            ESP_LOGE(TAG, "%s changed while it was archived, the archive is corrupt", this->root_.c_str());
+            return false;
+        }
+        this->central_index_++;
+        bool zip64 = record.offset >= 0xffffffff;
+        put32(this->pending_, ZIP_CENTRAL_HEADER);
+        put16(this->pending_, (3 << 8) | (zip64 ? ZIP64_VERSION : ZIP_VERSION));  // made by Unix
+        put16(this->pending_, zip64 ? ZIP64_VERSION : ZIP_VERSION);
+        put16(this->pending_, info.is_directory ? 0x0800 : ZIP_FLAGS);
+        put16(this->pending_, 0);
+        put32(this->pending_, record.dos_time);
+        put32(this->pending_, record.crc);
+        put32(this->pending_, record.size);
+        put32(this->pending_, record.size);
+        put16(this->pending_, name.size());
+        put16(this->pending_, zip64 ? 12 : 0);
+        put16(this->pending_, 0);  // comment
+        put16(this->pending_, 0);  // disk
+        put16(this->pending_, 0);  // internal attributes
+        put32(this->pending_, info.is_directory ? (040755u << 16) | 0x10 : 0100644u << 16);
+        put32(this->pending_, zip64 ? 0xffffffff : record.offset);
+        this->pending_ += name;
+        if (zip64) {
+            put16(this->pending_, 0x0001);
+            put16(this->pending_, 8);
+            put64(this->pending_, record.offset);
+        }
+        return true;
+    }
+    return false;
+}
+
+void ArchiveSource::write_trailer() {
+    if (this->format_ == ArchiveFormat::TAR) {
+        this->pending_.append(2 * TAR_BLOCK, '\0');
+        return;
+    }
+    uint64_t end = this->offset_;
+    uint64_t count = this->records_.size();
+    uint64_t size = end - this->central_offset_;
+    bool zip64 = count >= 0xffff || this->central_offset_ >= 0xffffffff || end >= 0xffffffff;
+    if (zip64) {
+        put32(this->pending_, ZIP64_END_OF_CENTRAL);
+        put64(this->pending_, 44);
+        put16(this->pending_, (3 << 8) | ZIP64_VERSION);
+        put16(this->pending_, ZIP64_VERSION);
+        put32(this->pending_, 0);
+        put32(this->pending_, 0);
+        put64(this->pending_, count);
+        put64(this->pending_, count);
+        put64(this->pending_, size);
+        put64(this->pending_, this->central_offset_);
+        put32(this->pending_, ZIP64_END_LOCATOR);
+        put32(this->pending_, 0);
+        put64(this->pending_, end);
+        put32(this->pending_, 1);
+    }
+    put32(this->pending_, ZIP_END_OF_CENTRAL);
+    put16(this->pending_, 0);
+    put16(this->pending_, 0);
+    put16(this->pending_, std::min<uint64_t>(count, 0xffff));
+    put16(this->pending_, std::min<uint64_t>(count, 0xffff));
+    put32(this->pending_, std::min<uint64_t>(size, 0xffffffff));
+    put32(this->pending_, std::min<uint64_t>(this->central_offset_, 0xffffffff));
+    put16(this->pending_, 0);
+}
+
+size_t ArchiveSource::fill(uint8_t *buffer, size_t len) {
+    size_t written = 0;
+    while (written < len) {
+        if (this->pending_pos_ < this->pending_.size()) {
+            size_t count = std::min(len - written, this->pending_.size() - this->pending_pos_);
+            memcpy(buffer + written, this->pending_.data() + this->pending_pos_, count);
+            this->pending_pos_ += count;
+            this->offset_ += count;
+            written += count;
+            continue;
+        }
+        this->pending_.clear();
+        this->pending_pos_ = 0;
+        if (this->in_file_) {
+            size_t count = 0;
+            if (this->remaining_ > 0)
+                count = this->file_.read(buffer + written, std::min(len - written, this->remaining_));
+            if (count == 0 && this->remaining_ > 0 && this->format_ == ArchiveFormat::TAR) {
+                // The tar header already promised the size, a file that shrank is padded with zeros.
+                ESP_LOGW(TAG, "File shrank while it was archived, padding it");
+                count = std::min(len - written, this->remaining_);
+                memset(buffer + written, 0, count);
+            }
+            this->crc_ = crc32_update(this->crc_, buffer + written, count);
+            this->remaining_ -= count;
+            this->offset_ += count;
+            written += count;
+            if (count == 0 || this->remaining_ == 0)
+                this->finish_entry();
+            continue;
+        }
+        switch (this->state_) {
+            case State::ENTRIES:
+                if (!this->next_entry()) {
+                    if (this->format_ == ArchiveFormat::ZIP) {
+                        this->central_offset_ = this->offset_;
+                        this->walker_.open(this->root_);
+                        this->state_ = State::CENTRAL;
+                    } else {
+                        this->state_ = State::TRAILER;
+                    }
+                }
+                break;
+            case State::CENTRAL:
+                if (!this->next_central())
+                    this->state_ = this->central_index_ == this->records_.size() ? State::TRAILER : State::DONE;
+                break;
+            case State::TRAILER:
+                this->write_trailer();
+                this->state_ = State::DONE;
+                break;
+            case State::DONE:
+                return written;
+        }
+    }
+    return written;
+}
+
+}  // namespace box3web
+}  // namespace esphome
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "../sd_mmc_card/sd_mmc_card.h"
+#include "directory.h"
+#include "transfer.h"
+
+namespace esphome {
+namespace box3web {
+
+enum class ArchiveFormat { ZIP, TAR };
+
+// Depth-first walk below a directory of the card, each directory reported before its contents. Holds one
+// directory handle per level; levels deeper than MAX_DEPTH are left out.
+class TreeWalker {
+ public:
+  static const size_t MAX_DEPTH = 16;
+
+  bool open(std::string const &root);
+  bool next(sd_mmc_card::FileInfo &info);
+  // Modification time of the entry next() returned last.
+  time_t mtime() const { return this->mtime_; }
+
+ protected:
+  std::vector<std::unique_ptr<DirIterator>> stack_;
+  time_t mtime_{0};
+};
+
+// Streams a directory tree as a ZIP (stored, CRCs and sizes in data descriptors, ZIP64 past 4 GiB) or a
+// ustar archive, reading each file straight into the send buffer. Memory stays bounded: one open file, the
+// walker and, for ZIP, a fixed-size record per entry. The central directory takes its names from a second
+// walk, checked against a hash of the first one so a folder changing meanwhile fails loudly.
+class ArchiveSource : public ChunkSource {
+ public:
+  ArchiveSource(std::string const &root, ArchiveFormat format);
+
+  bool open();
+  size_t fill(uint8_t *buffer, size_t len) override;
+  // Name of the top folder inside the archive, also used for the download file name.
+  std::string const &base_name() const { return this->base_; }
+
+ protected:
+  enum class State { ENTRIES, CENTRAL, TRAILER, DONE };
+
+  struct ZipRecord {
+    uint64_t offset;
+    uint32_t crc;
+    uint32_t size;
+    uint32_t dos_time;
+    uint32_t name_hash;
+  };
+
+  std::string entry_name(sd_mmc_card::FileInfo const &info) const;
+  // The helpers below queue headers and trailers in pending_, always empty when they are called.
+  // next_entry() is false once the tree is exhausted.
+  bool next_entry();
+  void finish_entry();
+  bool next_central();
+  void write_trailer();
+  void write_tar_header(std::string const &name, char type, size_t size, time_t mtime);
+
+  std::string root_;
+  std::string base_;
+  ArchiveFormat format_;
+  State state_{State::ENTRIES};
+  TreeWalker walker_;
+
+  std::string pending_;
+  size_t pending_pos_{0};
+  uint64_t offset_{0};
+
+  SdFile file_;
+  bool in_file_{false};
+  size_t declared_{0};
+  size_t remaining_{0};
+  uint32_t crc_{0};
+
+  std::vector<ZipRecord> records_;
+  size_t central_index_{0};
+  uint64_t central_offset_{0};
+};
+
+}  // namespace box3web
+}  // namespace esphome
@@ -0,0 +1,576 @@
+#include "batch.h"
+#include "box3web.h"
+#include "directory.h"
+#include "esphome/core/log.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace esphome {
+namespace box3web {
+
+static const char *TAG = "box3web.batch";
+
+// Longest true/false/null or number token accepted.
+static const size_t MAX_SCALAR_LENGTH = 32;
+
+static bool is_space(char c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r'; }
+
+static bool is_number_char(char c) {
+    return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E';
+}
+
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+static void append_utf8(std::string &out, uint32_t code_point) {
+    if (code_point < 0x80) {
+        out += static_cast<char>(code_point);
+    } else if (code_point < 0x800) {
+        out += static_cast<char>(0xC0 | (code_point >> 6));
+        out += static_cast<char>(0x80 | (code_point & 0x3F));
+    } else if (code_point < 0x10000) {
+        out += static_cast<char>(0xE0 | (code_point >> 12));
+        out += static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (code_point & 0x3F));
+    } else {
+        out += static_cast<char>(0xF0 | (code_point >> 18));
+        out += static_cast<char>(0x80 | ((code_point >> 12) & 0x3F));
+        out += static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (code_point & 0x3F));
+    }
+}
+
+bool BatchParser::fail(int status, const char *error) {
+    this->state_ = State::FAILED;
+    this->status_ = status;
+    this->error_ = error;
+    this->ops_.clear();
+    return false;
+}
+
+bool BatchParser::feed(const char *data, size_t len) {
+    if (this->state_ == State::FAILED)
+        return false;
+    this->consumed_ += len;
+    if (this->consumed_ > MAX_BATCH_BODY)
+        return this->fail(413, "batch body too large");
+    for (size_t i = 0; i < len; i++) {
+        if (!this->step(data[i]))
+            return false;
+    }
+    return true;
+}
+
+bool BatchParser::finish() {
+    if (this->state_ == State::END)
+        return true;
+    if (this->state_ != State::FAILED)
+        this->fail(400, "truncated batch");
+    return false;
+}
+
+bool BatchParser::step(char c) {
+    switch (this->state_) {
+        case State::STRING:
+            return this->string_char(c);
+        case State::LITERAL:
+        case State::NUMBER: {
+            bool member = this->state_ == State::LITERAL ? (c >= 'a' && c <= 'z') : is_number_char(c);
+            if (member) {
+                if (this->token_.size() >= MAX_SCALAR_LENGTH)
+                    return this->fail(400, "invalid value");
+                this->token_ += c;
+                return true;
+            }
+            if (!this->end_scalar())
+                return false;
+            this->state_ = State::AFTER_VALUE;
+            break;
+        }
+        default:
+            break;
+    }
+    if (is_space(c))
+        return true;
+    switch (this->state_) {
+        case State::START:
+            if (c != '[')
+                return this->fail(400, "batch must be a JSON array");
+            this->state_ = State::FIRST_ITEM;
+            return true;
+        case State::FIRST_ITEM:
+        case State::ITEM:
+            if (c == ']' && this->state_ == State::FIRST_ITEM) {
+                this->state_ = State::END;
+                return true;
+            }
+            if (c != '{')
+                return this->fail(400, "batch items must be objects");
+            this->current_ = BatchOp();
+            this->state_ = State::FIRST_KEY;
+            return true;
+        case State::FIRST_KEY:
+        case State::KEY:
+            if (c == '}' && this->state_ == State::FIRST_KEY)
+                break;
+            if (c != '"')
+                return this->fail(400, "expected a key");
+            this->in_key_ = true;
+            this->token_.clear();
+            this->state_ = State::STRING;
+            return true;
+        case State::COLON:
+            if (c != ':')
+                return this->fail(400, "expected ':'");
+            this->state_ = State::VALUE;
+            return true;
+        case State::VALUE:
+            this->token_.clear();
+            if (c == '"') {
+                this->in_key_ = false;
+                this->state_ = State::STRING;
+            } else if (c >= 'a' && c <= 'z') {
+                this->token_ += c;
+                this->state_ = State::LITERAL;
+            } else if (c == '-' || (c >= '0' && c <= '9')) {
+                this->token_ += c;
+                this->state_ = State::NUMBER;
+            } else {
+                // Nested objects and arrays have no meaning in an item.
+                return this->fail(400, "invalid value");
+            }
+            return true;
+        case State::AFTER_VALUE:
+            if (c == ',') {
+                this->state_ = State::KEY;
+                return true;
+            }
+            if (c != '}')
+                return this->fail(400, "expected ',' or '}'");
+            break;
+        case State::AFTER_ITEM:
+            if (c == ',') {
+                this->state_ = State::ITEM;
+            } else if (c == ']') {
+                this->state_ = State::END;
+            } else {
+                return this->fail(400, "expected ',' or ']'");
+            }
+            return true;
+        default:
+            return this->fail(400, "unexpected data after the batch");
+    }
+    // Only a closing brace gets here.
+    if (this->ops_.size() >= MAX_BATCH_OPS)
+        return this->fail(413, "too many operations");
+    this->ops_.push_back(std::move(this->current_));
+    this->state_ = State::AFTER_ITEM;
+    return true;
+}
+
+bool BatchParser::string_char(char c) {
+    if (this->escape_ != 0)
+        return this->escape_char(c);
+    // A high surrogate must be followed by the escaped low one.
+    if (this->high_surrogate_ != 0 && c != '\\')
+        return this->fail(400, "invalid escape");
+    if (c == '\\') {
+        this->escape_ = 1;
+        return true;
+    }
+    if (c == '"') {
+        if (this->in_key_) {
+            this->key_ = std::move(this->token_);
+            this->state_ = State::COLON;
+        } else {
+            this->assign_string();
+            this->state_ = State::AFTER_VALUE;
+        }
+        return true;
+    }
+    if (static_cast<unsigned char>(c) < 0x20)
+        return this->fail(400, "control character in string");
+    if (this->token_.size() >= MAX_PATH_LENGTH)
+        return this->fail(400, "string too long");
+    this->token_ += c;
+    return true;
+}
+
+bool BatchParser::escape_char(char c) {
+    if (this->escape_ == 1) {
+        if (this->high_surrogate_ != 0 && c != 'u')
+            return this->fail(400, "invalid escape");
+        char plain = 0;
+        switch (c) {
+            case '"': plain = '"'; break;
+            case '\\': plain = '\\'; break;
+            case '/': plain = '/'; break;
+            case 'b': plain = '\b'; break;
+            case 'f': plain = '\f'; break;
+            case 'n': plain = '\n'; break;
+            case 'r': plain = '\r'; break;
+            case 't': plain = '\t'; break;
+            case 'u':
+                this->escape_ = 2;
+                this->code_point_ = 0;
+                return true;
+            default:
+                return this->fail(400, "invalid escape");
+        }
+        this->escape_ = 0;
+        if (this->token_.size() >= MAX_PATH_LENGTH)
+            return this->fail(400, "string too long");
+        this->token_ += plain;
+        return true;
+    }
+    int digit = hex_digit(c);
+    if (digit < 0)
+        return this->fail(400, "invalid escape");
+    this->code_point_ = this->code_point_ * 16 + digit;
+    if (++this->escape_ < 6)
+        return true;
+    this->escape_ = 0;
+    uint32_t code_point = this->code_point_;
+    if (code_point >= 0xD800 && code_point < 0xDC00) {
+        if (this->high_surrogate_ != 0)
+            return this->fail(400, "invalid escape");
+        this->high_surrogate_ = code_point;
+        return true;
+    }
+    if (code_point >= 0xDC00 && code_point < 0xE000) {
+        if (this->high_surrogate_ == 0)
+            return this->fail(400, "invalid escape");
+        code_point = 0x10000 + ((this->high_surrogate_ - 0xD800) << 10) + (code_point - 0xDC00);
+        this->high_surrogate_ = 0;
+    } else if (this->high_surrogate_ != 0) {
+        return this->fail(400, "invalid escape");
+    }
+    if (code_point == 0)
+        return this->fail(400, "NUL in string");
+    if (this->token_.size() + 4 > MAX_PATH_LENGTH)
+        return this->fail(400, "string too long");
+    append_utf8(this->token_, code_point);
+    return true;
+}
+
+bool BatchParser::end_scalar() {
+    if (this->state_ == State::LITERAL) {
+        if (this->token_ != "true" && this->token_ != "false" && this->token_ != "null")
+            return this->fail(400, "invalid value");
+        // null stands for a missing value.
+        if (this->token_ == "null")
+            return true;
+        if (this->key_ == "recursive") {
+            this->current_.recursive = this->token_ == "true";
+            return true;
+        }
+    }
+    this->assign_type_error();
+    return true;
+}
+
+void BatchParser::assign_string() {
+    if (this->key_ == "op") {
+        if (this->token_ == "delete") {
+            this->current_.type = BatchOpType::DELETE;
+        } else if (this->token_ == "mkdir") {
+            this->current_.type = BatchOpType::MKDIR;
+        } else if (this->token_ == "move" || this->token_ == "rename") {
+            this->current_.type = BatchOpType::MOVE;
+        } else if (this->current_.error == nullptr) {
+            this->current_.error = "unknown op";
+        }
+    } else if (this->key_ == "path") {
+        this->current_.path = std::move(this->token_);
+    } else if (this->key_ == "to") {
+        this->current_.to = std::move(this->token_);
+    } else {
+        this->assign_type_error();
+    }
+}
+
+void BatchParser::assign_type_error() {
+    // Unknown keys are ignored whatever their value, known ones must have the right type.
+    const char *error = nullptr;
+    if (this->key_ == "op" || this->key_ == "path" || this->key_ == "to") {
+        error = "op, path and to must be strings";
+    } else if (this->key_ == "recursive") {
+        error = "recursive must be true or false";
+    }
+    if (error != nullptr && this->current_.error == nullptr)
+        this->current_.error = error;
+}
+
+static int path_error_status(PathError error, const char *&message) {
+    switch (error) {
+        case PathError::TRAVERSAL:
+            message = "path traversal is not allowed";
+            return 403;
+        case PathError::RESERVED:
+            message = "reserved name";
+            return 403;
+        case PathError::TOO_LONG:
+            message = "path too long";
+            return 414;
+        default:
+            message = "malformed path";
+            return 400;
+    }
+}
+
+// Removes a folder with everything below it, internal files included since they would keep it from going.
+// Folders are emptied top down and removed deepest first; only their names are held meanwhile.
+static bool remove_tree(std::string const &root) {
+    std::vector<std::string> pending{root};
+    std::vector<std::string> directories;
+    while (!pending.empty()) {
+        std::string directory = std::move(pending.back());
+        pending.pop_back();
+        DIR *dir = opendir(SdFile::real_path(directory).c_str());
+        if (dir == nullptr)
+            return false;
+        bool ok = true;
+        struct dirent *entry;
+        while (ok && (entry = readdir(dir)) != nullptr) {
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+                continue;
+            std::string path = directory + "/" + entry->d_name;
+            if (entry->d_type == DT_DIR) {
+                pending.push_back(std::move(path));
+            } else {
+                ok = remove(SdFile::real_path(path).c_str()) == 0;
+            }
+        }
+        closedir(dir);
+        if (!ok)
+            return false;
+        directories.push_back(std::move(directory));
+    }
+    for (auto it = directories.rbegin(); it != directories.rend(); ++it) {
+        if (rmdir(SdFile::real_path(*it).c_str()) != 0)
+            return false;
+    }
+    return true;
+}
+
+static bool is_empty_directory(std::string const &path) {
+    DIR *dir = opendir(SdFile::real_path(path).c_str());
+    if (dir == nullptr)
+        return false;
+    bool empty = true;
+    struct dirent *entry;
+    while (empty && (entry = readdir(dir)) != nullptr)
+        empty = strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0;
+    closedir(dir);
+    return empty;
+}
+
+BatchSource::BatchSource(Box3Web *parent, const Mount *mount, std::string const &directory, std::vector<BatchOp> ops)
+    : parent_(parent), mount_(mount), base_(directory), ops_(std::move(ops)) {
+    while (!this->base_.empty() && this->base_.back() == '/')
+        this->base_.pop_back();
+}
+
+BatchSource::~BatchSource() {
+    // A client gone halfway leaves the rest of the batch undone, what ran must still show.
+    if (!this->directories_.empty() || !this->trees_.empty())
+        this->parent_->invalidate_batch(this->directories_, this->trees_);
+}
+
+bool BatchSource::produce(std::string &out) {
+    if (this->index_ == this->ops_.size()) {
+        if (this->summarized_)
+            return false;
+        this->summarized_ = true;
+        if (this->failed_ > 0) {
+            ESP_LOGD(TAG, "Batch in %s: %u of %u items failed", this->base_.c_str(), (unsigned) this->failed_,
+                     (unsigned) this->ops_.size());
+        }
+        out += "{\"done\":true,\"succeeded\":";
+        out += std::to_string(this->ops_.size() - this->failed_);
+        out += ",\"failed\":";
+        out += std::to_string(this->failed_);
+        out += "}\n";
+        return true;
+    }
+    BatchOp const &op = this->ops_[this->index_];
+    const char *error = nullptr;
+    int status = this->run(op, error);
+    if (error != nullptr)
+        this->failed_++;
+    out += "{\"index\":";
+    out += std::to_string(this->index_);
+    out += ",\"path\":\"";
+    out += json_escape(op.path);
+    out += "\",\"status\":";
+    out += std::to_string(status);
+    if (error != nullptr) {
+        out += ",\"error\":\"";
+        out += error;
+        out += "\"";
+    }
+    out += "}\n";
+    this->index_++;
+    return true;
+}
+
+int BatchSource::run(BatchOp const &op, const char *&error) {
+    if (op.error != nullptr) {
+        error = op.error;
+        return 400;
+    }
+    const char *disabled = nullptr;
+    switch (op.type) {
+        case BatchOpType::DELETE:
+            if (!this->mount_->deletion_enabled)
+                disabled = "file deletion is disabled";
+            break;
+        case BatchOpType::MKDIR:
+            if (!this->mount_->upload_enabled)
+                disabled = "file upload is disabled";
+            break;
+        case BatchOpType::MOVE:
+            // A move takes a name away and creates another one.
+            if (!this->mount_->deletion_enabled || !this->mount_->upload_enabled)
+                disabled = "moving needs deletion and upload enabled";
+            break;
+        default:
+            error = "missing op";
+            return 400;
+    }
+    if (disabled != nullptr) {
+        error = disabled;
+        return 401;
+    }
+    PathBuffer path;
+    int status = this->resolve(op.path, path, error);
+    if (status != 0)
+        return status;
+    if (op.type == BatchOpType::DELETE)
+        return this->remove_entry(path.str(), op.recursive, error);
+    if (op.type == BatchOpType::MKDIR)
+        return this->make_directory(path.str(), error);
+    PathBuffer to;
+    status = this->resolve(op.to, to, error);
+    if (status != 0)
+        return status;
+    return this->move_entry(path.str(), to.str(), error);
+}
+
+int BatchSource::resolve(std::string const &path, PathBuffer &out, const char *&error) const {
+    if (!out.append(this->base_))
+        return path_error_status(PathError::TOO_LONG, error);
+    PathError result = append_url_path(path, false, out);
+    // Every item names something inside the batch folder, never the folder itself.
+    if (result == PathError::NONE && out.size() == this->base_.size())
+        result = PathError::MALFORMED;
+    if (result != PathError::NONE)
+        return path_error_status(result, error);
+    return 0;
+}
+
+int BatchSource::remove_entry(std::string const &path, bool recursive, const char *&error) {
+    struct stat st;
+    if (stat(SdFile::real_path(path).c_str(), &st) != 0) {
+        error = "not found";
+        return 404;
+    }
+    bool ok;
+    bool directory = S_ISDIR(st.st_mode);
+    if (!directory) {
+        ok = remove(SdFile::real_path(path).c_str()) == 0;
+        remove_digest(path);
+    } else if (recursive) {
+        ok = remove_tree(path);
+        // Whatever went before a failure is gone too.
+        this->trees_.insert(path);
+    } else if (!is_empty_directory(path)) {
+        error = "directory not empty";
+        return 409;
+    } else {
+        ok = rmdir(SdFile::real_path(path).c_str()) == 0;
+        this->trees_.insert(path);
+    }
+    this->directories_.insert(Path::parent(path));
+    this->parent_->index_change(path, directory);
+    // Published as a change after a failure, which reports whatever is left.
+    this->parent_->notify_change(ok ? ChangeKind::REMOVE : ChangeKind::UPDATE, path, directory);
+    if (!ok) {
+        error = "failed to delete";
+        return 500;
+    }
+    return 204;
+}
+
+int BatchSource::make_directory(std::string const &path, const char *&error) {
+    struct stat st;
+    if (stat(SdFile::real_path(path).c_str(), &st) == 0) {
+        error = "already exists";
+        return 409;
+    }
+    if (stat(SdFile::real_path(Path::parent(path)).c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+        error = "parent folder not found";
+        return 404;
+    }
+    if (mkdir(SdFile::real_path(path).c_str(), 0775) != 0) {
+        error = "failed to create folder";
+        return 500;
+    }
+    this->directories_.insert(Path::parent(path));
+    this->parent_->index_change(path);
+    this->parent_->notify_change(ChangeKind::ADD, path);
+    return 201;
+}
+
+int BatchSource::move_entry(std::string const &from, std::string const &to, const char *&error) {
+    struct stat st;
+    if (stat(SdFile::real_path(from).c_str(), &st) != 0) {
+        error = "not found";
+        return 404;
+    }
+    bool directory = S_ISDIR(st.st_mode);
+    if (directory && to.size() > from.size() && to.compare(0, from.size(), from) == 0 && to[from.size()] == '/') {
+        error = "cannot move a folder into itself";
+        return 409;
+    }
+    // FAT cannot rename over an existing entry, and silently replacing one is not what a move should do.
+    if (stat(SdFile::real_path(to).c_str(), &st) == 0) {
+        error = "target already exists";
+        return 409;
+    }
+    if (stat(SdFile::real_path(Path::parent(to)).c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+        error = "target folder not found";
+        return 404;
+    }
+    if (rename(SdFile::real_path(from).c_str(), SdFile::real_path(to).c_str()) != 0) {
+        error = "failed to move";
+        return 500;
+    }
+    // Sidecars of files in a moved folder travel with it.
+    if (!directory)
+        move_digest(from, to);
+    this->directories_.insert(Path::parent(from));
+    this->directories_.insert(Path::parent(to));
+    if (directory)
+        this->trees_.insert(from);
+    this->parent_->index_change(from, directory);
+    this->parent_->index_change(to, directory);
+    this->parent_->notify_change(ChangeKind::REMOVE, from, directory);
+    this->parent_->notify_change(ChangeKind::ADD, to);
+    return 204;
+}
+
+}  // namespace box3web
+}  // namespace esphome
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <cstdint>
+#include <set>
+#include <string>
+#include <vector>
+#include "transfer.h"
+#include "url_path.h"
+
+namespace esphome {
+namespace box3web {
+
+class Box3Web;
+struct Mount;
+
+// Limits of one batch, larger jobs are split by the client.
+static const size_t MAX_BATCH_OPS = 256;
+static const size_t MAX_BATCH_BODY = 32768;
+
+enum class BatchOpType { INVALID, DELETE, MKDIR, MOVE };
+
+// One item of a batch. Paths are relative to the folder the batch was posted to.
+struct BatchOp {
+  BatchOpType type{BatchOpType::INVALID};
+  std::string path;
+  std::string to;
+  bool recursive{false};
+  // Set when the item itself is unusable; it then fails alone and the rest of the batch still runs.
+  const char *error{nullptr};
+};
+
+// Incremental parser for a batch body, a JSON array of flat objects:
+// [{"op":"delete","path":"a.mp4"},{"op":"delete","path":"old","recursive":true},
+//  {"op":"move","path":"b.mp4","to":"keep/b.mp4"},{"op":"mkdir","path":"keep"}]
+// The body is consumed as it arrives, only the parsed items are kept.
+class BatchParser {
+ public:
+  // False once the body turned out malformed or over the limits; status() and error() then say why.
+  bool feed(const char *data, size_t len);
+  // True if the body was one complete array.
+  bool finish();
+  int status() const { return this->status_; }
+  const char *error() const { return this->error_; }
+  std::vector<BatchOp> take_ops() { return std::move(this->ops_); }
+
+ protected:
+  enum class State {
+    START,
+    FIRST_ITEM,
+    ITEM,
+    FIRST_KEY,
+    KEY,
+    COLON,
+    VALUE,
+    STRING,
+    LITERAL,
+    NUMBER,
+    AFTER_VALUE,
+    AFTER_ITEM,
+    END,
+    FAILED
+  };
+
+  bool step(char c);
+  bool string_char(char c);
+  bool escape_char(char c);
+  bool end_scalar();
+  void assign_string();
+  void assign_type_error();
+  bool fail(int status, const char *error);
+
+  State state_{State::START};
+  bool in_key_{false};
+  std::string key_;
+  std::string token_;
+  // 0 outside escapes, 1 right after the backslash, 2 to 5 while reading the hex digits of \u.
+  uint8_t escape_{0};
+  uint32_t code_point_{0};
+  uint32_t high_surrogate_{0};
+  size_t consumed_{0};
+  BatchOp current_;
+  std::vector<BatchOp> ops_;
+  int status_{0};
+  const char *error_{nullptr};
+};
+
+// Runs the items of a batch one at a time as the response asks for more, answering each with a line of
+// NDJSON: {"index":0,"path":"a.mp4","status":204} or with an "error" added, then a closing
+// {"done":true,"succeeded":n,"failed":m}. An item failing does not stop the ones after it. Listings are
+// invalidated once, when the source goes away, for what ran up to then.
+class BatchSource : public TextSource {
+ public:
+  BatchSource(Box3Web *parent, const Mount *mount, std::string const &directory, std::vector<BatchOp> ops);
+  ~BatchSource() override;
+
+ protected:
+  bool produce(std::string &out) override;
+  // The HTTP status of the item, error is set for failures.
+  int run(BatchOp const &op, const char *&error);
+  int resolve(std::string const &path, PathBuffer &out, const char *&error) const;
+  int remove_entry(std::string const &path, bool recursive, const char *&error);
+  int make_directory(std::string const &path, const char *&error);
+  int move_entry(std::string const &from, std::string const &to, const char *&error);
+
+  Box3Web *parent_;
+  const Mount *mount_;
+  // Batch folder without a trailing separator, "" for the card root.
+  std::string base_;
+  std::vector<BatchOp> ops_;
+  size_t index_{0};
+  size_t failed_{0};
+  bool summarized_{false};
+  // Folders whose entries changed, and folders removed or moved away together with all below them.
+  std::set<std::string> directories_;
+  std::set<std::string> trees_;
+};
+
+}  // namespace box3web
+}  // namespace esphome
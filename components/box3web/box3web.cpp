@@ -2,84 +2,630 @@
 #include "esphome/core/log.h"
 #include "esphome/components/network/util.h"
 #include "esphome/core/helpers.h"
+#include "esphome/core/hal.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cmath>
+#include <cstring>
+#ifdef USE_ESP_IDF
+#include "esp_http_server.h"
+#endif
 
 namespace esphome {
 namespace box3web {
 
 static const char *TAG = "box3web";
 
-// Fonctions utilitaires pour remplacer endsWith et startsWith
-bool endsWith(const std::string &str, const std::string &suffix) {
-    if (suffix.size() > str.size()) return false;
-    return std::equal(suffix.rbegin(), suffix.rend(), str.rbegin());
+static const uint32_t UPLOAD_IDLE_TIMEOUT = 30000;
+static const size_t JSON_LISTING_DEFAULT_LIMIT = 200;
+static const size_t JSON_LISTING_MAX_LIMIT = 1000;
+// Clock readings before 2020 mean SNTP has not synced yet.
+static const time_t MIN_VALID_TIME = 1577836800;
+static const char *const TUS_VERSION = "1.0.0";
+// Directories walked per second while looking for partial uploads left behind by a reboot.
+static const uint32_t RESUMABLE_SCAN_INTERVAL = 1000;
+// Receive timeouts tolerated in a row while reading a PATCH body on ESP-IDF.
+static const int PATCH_RECV_RETRIES = 3;
+// The search index is built from the main loop in slices of at most SEARCH_INDEX_BUDGET ms.
+static const uint32_t SEARCH_INDEX_INTERVAL = 50;
+static const uint32_t SEARCH_INDEX_BUDGET = 10;
+static const size_t SEARCH_DEFAULT_LIMIT = 100;
+static const size_t SEARCH_MAX_LIMIT = 1000;
+#ifdef USE_ESP_IDF
+// How often events queued for web_server_idf subscribers are written out.
+static const uint32_t FEED_FLUSH_INTERVAL = 250;
+#endif
+// Names the component serves itself below every mount, shadowing card entries in the mount root.
+static const char *const METRICS_PATH = "/_metrics";
+static const char *const ASSETS_PATH = "/_assets/";
+// The asset names carry a hash of their content, a new build links to new names.
+static const char *const IMMUTABLE_CACHE_CONTROL = "public, max-age=31536000, immutable";
+
+// Clients that cannot send PATCH, HEAD or DELETE tunnel them through POST, as tus allows.
+static int effective_method(AsyncWebServerRequest *request) {
+    if (request->method() != HTTP_POST)
+        return request->method();
+    std::string method = get_header(request, "X-HTTP-Method-Override");
+    if (method == "PATCH")
+        return HTTP_PATCH;
+    if (method == "HEAD")
+        return HTTP_HEAD;
+    if (method == "DELETE")
+        return HTTP_DELETE;
+    return HTTP_POST;
 }
 
-bool startsWith(const std::string &str, const std::string &prefix) {
-    if (prefix.size() > str.size()) return false;
-    return std::equal(prefix.begin(), prefix.end(), str.begin());
+static bool is_batch_request(AsyncWebServerRequest *request, int method) {
+    return method == HTTP_POST && request->hasArg("batch");
+}
+
+static bool is_resumable_request(AsyncWebServerRequest *request, int method) {
+    return request->hasArg("upload") || (method == HTTP_POST && !get_header(request, "Upload-Length").empty());
+}
+
+// Request url below the mount prefix, starting with a separator.
+static std::string mount_url(AsyncWebServerRequest *request, Mount const &mount) {
+    std::string url = request->url().c_str();
+    if (mount.prefix.size() > 1)
+        url.erase(0, mount.prefix.size());
+    return url;
 }
 
 Box3Web::Box3Web(web_server_base::WebServerBase *base) : base_(base) {}
 
-void Box3Web::setup() { this->base_->add_handler(this); }
+void Box3Web::setup() {
+    this->boot_id_ = random_uint32();
+    if (this->buffer_pool_ == nullptr)
+        this->set_buffer_pool(16384, 6, 3);
+    if (!this->buffer_pool_->setup()) {
+        this->mark_failed();
+        return;
+    }
+    Mount *primary = this->mounts_.add(this->url_prefix_, this->root_path_);
+    if (primary != nullptr) {
+        primary->deletion_enabled = this->deletion_enabled_;
+        primary->download_enabled = this->download_enabled_;
+        primary->upload_enabled = this->upload_enabled_;
+    } else {
+        ESP_LOGE(TAG, "Url prefix %s is already used by another mount", this->url_prefix_.c_str());
+    }
+    this->base_->add_handler(this);
+#ifdef USE_BOX3WEB_UPLOAD_PIPELINE
+    if (this->upload_pipeline_ != nullptr && !this->upload_pipeline_->start())
+        this->upload_pipeline_.reset();
+#endif
+    this->set_interval("upload_expiry", UPLOAD_IDLE_TIMEOUT / 2, [this]() { this->expire_uploads(); });
+    for (auto const &mount : this->mounts_.mounts())
+        this->resumable_->start_scan(mount->root_base);
+    this->set_interval("resumable_scan", RESUMABLE_SCAN_INTERVAL, [this]() {
+        if (!this->resumable_->scan_step())
+            this->cancel_interval("resumable_scan");
+    });
+    if (this->search_index_ != nullptr) {
+        this->set_interval("search_index", SEARCH_INDEX_INTERVAL,
+                           [this]() { this->search_index_->step(SEARCH_INDEX_BUDGET); });
+    }
+    if (this->metrics_enabled_)
+        this->set_interval("metrics", this->metrics_interval_, [this]() { this->publish_metrics(); });
+#ifdef USE_ESP_IDF
+    if (this->change_feed_ != nullptr)
+        this->set_interval("change_feed", FEED_FLUSH_INTERVAL, [this]() { this->change_feed_->flush(); });
+#endif
+}
 
 void Box3Web::dump_config() {
     ESP_LOGCONFIG(TAG, "Box3Web:");
     ESP_LOGCONFIG(TAG, "  Address: %s:%u", network::get_use_address().c_str(), this->base_->get_port());
-    ESP_LOGCONFIG(TAG, "  Url Prefix: %s", this->url_prefix_.c_str());
-    ESP_LOGCONFIG(TAG, "  Root Path: %s", this->root_path_.c_str());
-    ESP_LOGCONFIG(TAG, "  Deletion Enabled: %s", TRUEFALSE(this->deletion_enabled_));
-    ESP_LOGCONFIG(TAG, "  Download Enabled: %s", TRUEFALSE(this->download_enabled_));
-    ESP_LOGCONFIG(TAG, "  Upload Enabled: %s", TRUEFALSE(this->upload_enabled_));
+    for (auto const &mount : this->mounts_.mounts()) {
+        ESP_LOGCONFIG(TAG, "  Mount %s -> %s", mount->prefix.c_str(), mount->mapping.root_path.c_str());
+        ESP_LOGCONFIG(TAG, "    Deletion Enabled: %s", TRUEFALSE(mount->deletion_enabled));
+        ESP_LOGCONFIG(TAG, "    Download Enabled: %s", TRUEFALSE(mount->download_enabled));
+        ESP_LOGCONFIG(TAG, "    Upload Enabled: %s", TRUEFALSE(mount->upload_enabled));
+        for (auto const &rule : mount->cache_control)
+            ESP_LOGCONFIG(TAG, "    Cache-Control %s*: %s", rule.first.c_str(), rule.second.c_str());
+    }
+    ESP_LOGCONFIG(TAG, "  Transfer Buffers: %u x %u bytes, %u per request", (unsigned) this->buffer_pool_->count(),
+                  (unsigned) this->buffer_pool_->buffer_size(), (unsigned) this->buffer_pool_->per_request());
+    ESP_LOGCONFIG(TAG, "  Transfer Buffers Free: %u (low %u), exhausted %u times",
+                  (unsigned) this->buffer_pool_->available(), (unsigned) this->buffer_pool_->low_water(),
+                  (unsigned) this->buffer_pool_->exhaustions());
+    for (auto direction : {TransferDirection::DOWNLOAD, TransferDirection::UPLOAD}) {
+        ESP_LOGCONFIG(TAG, "  %s: %u active (max %u, %u per client), %u bytes/s per client, refused %u times",
+                      direction == TransferDirection::UPLOAD ? "Uploads" : "Downloads",
+                      (unsigned) this->admission_->active(direction), (unsigned) this->admission_->max_active(direction),
+                      (unsigned) this->admission_->per_client(direction), (unsigned) this->admission_->rate(direction),
+                      (unsigned) this->admission_->refused(direction));
+    }
+    ESP_LOGCONFIG(TAG, "  Resumable Uploads: %u pending, expire after %u s", (unsigned) this->resumable_->size(),
+                  (unsigned) (this->resumable_->expiry_ms() / 1000));
+    ESP_LOGCONFIG(TAG, "  Index Sort Limit: %u", (unsigned) this->index_sort_limit_);
+    if (this->search_index_ != nullptr) {
+        ESP_LOGCONFIG(TAG, "  Search Index: %s, %u entries, %u journaled changes",
+                      this->search_index_->ready() ? "ready" : (this->search_index_->building() ? "building" : "not built"),
+                      (unsigned) this->search_index_->entries(), (unsigned) this->search_index_->journal_size());
+    }
+    if (this->change_feed_ != nullptr) {
+        ESP_LOGCONFIG(TAG, "  Change Feed: %u/%u subscribers, keepalive %u s",
+                      (unsigned) this->change_feed_->subscribers(), (unsigned) this->change_feed_->max_subscribers(),
+                      (unsigned) (this->change_feed_->keepalive_ms() / 1000));
+    }
+    if (this->metrics_enabled_) {
+        ESP_LOGCONFIG(TAG, "  Metrics: <mount>%s, sensors every %u s", METRICS_PATH,
+                      (unsigned) (this->metrics_interval_ / 1000));
+    }
+    ESP_LOGCONFIG(TAG, "  Listing Compression: %s (window %u)", TRUEFALSE(this->compress_listings_),
+                  (unsigned) this->compression_window_);
+    for (auto const &rule : this->cache_control_)
+        ESP_LOGCONFIG(TAG, "  Cache-Control %s*: %s", rule.first.c_str(), rule.second.c_str());
+    if (this->listing_cache_ != nullptr) {
+        ESP_LOGCONFIG(TAG, "  Listing Cache: %u/%u bytes, %u hits, %u misses", (unsigned) this->listing_cache_->bytes(),
+                      (unsigned) this->listing_cache_->max_bytes(), (unsigned) this->listing_cache_->hits(),
+                      (unsigned) this->listing_cache_->misses());
+    }
+#ifdef USE_BOX3WEB_READ_AHEAD
+    ESP_LOGCONFIG(TAG, "  Read Ahead: %u buffers", (unsigned) this->read_ahead_depth_);
+#endif
+#ifdef USE_BOX3WEB_UPLOAD_PIPELINE
+    if (this->upload_pipeline_ != nullptr) {
+        ESP_LOGCONFIG(TAG, "  Upload Pipeline Buffer: %u", (unsigned) this->upload_pipeline_->buffer_size());
+        ESP_LOGCONFIG(TAG, "  Upload Backpressure: %u events, %u ms", (unsigned) this->upload_pipeline_->backpressure_events(),
+                      (unsigned) this->upload_pipeline_->backpressure_ms());
+    }
+#endif
 }
 
 bool Box3Web::canHandle(AsyncWebServerRequest *request) {
-    return str_startswith(std::string(request->url().c_str()), this->build_prefix());
+    const auto &url = request->url();
+    std::string_view rest;
+    return this->mounts_.find(std::string_view(url.c_str(), url.length()), rest) != nullptr;
 }
 
 void Box3Web::handleRequest(AsyncWebServerRequest *request) {
-    if (str_startswith(std::string(request->url().c_str()), this->build_prefix())) {
-        if (request->method() == HTTP_GET) {
-            this->handle_get(request);
-            return;
-        }
-        if (request->method() == HTTP_DELETE) {
-            this->handle_delete(request);
+    RequestScope scope;
+    const Mount *mount = nullptr;
+    PathBuffer resolved;
+    PathError error = this->resolve_path(request, mount, resolved);
+    if (mount == nullptr)
+        return;
+    int method = effective_method(request);
+    if (method == HTTP_GET) {
+        std::string url = mount_url(request, *mount);
+        if (this->metrics_enabled_ && url == METRICS_PATH) {
+            this->handle_metrics(request);
             return;
         }
-        if (request->method() == HTTP_POST && this->upload_enabled_) {
+        if (str_startswith(url, ASSETS_PATH)) {
+            this->handle_asset(request, url.substr(strlen(ASSETS_PATH)));
             return;
         }
-        request->send(405, "application/json", "{ \"error\": \"Method not allowed\" }");
+    }
+    bool resumable = is_resumable_request(request, method);
+    bool batch = is_batch_request(request, method);
+    if (method == HTTP_POST && mount->upload_enabled && !resumable && !batch) {
+        return;
+    }
+    if (!resumable && !batch && method != HTTP_GET && method != HTTP_DELETE) {
+        send_text(request, 405, "application/json", "{ \"error\": \"Method not allowed\" }");
+        return;
+    }
+    if (error != PathError::NONE) {
+        this->send_path_error(request, error);
+        return;
+    }
+    std::string path = resolved.str();
+    if (resumable) {
+        this->handle_resumable(request, method, *mount, path);
+    } else if (batch) {
+        this->handle_batch(request, *mount, path);
+    } else if (method == HTTP_GET) {
+        this->handle_get(request, *mount, path);
+    } else {
+        this->handle_delete(request, *mount, path);
     }
 }
 
 void Box3Web::handleUpload(AsyncWebServerRequest *request, const String &filename, size_t index, uint8_t *data,
                             size_t len, bool final) {
-    if (!this->upload_enabled_) {
-        request->send(401, "application/json", "{ \"error\": \"file upload is disabled\" }");
+    LockGuard guard(this->uploads_mutex_);
+    if (index == 0) {
+        // A leftover session under the same key belongs to a dead request.
+        auto stale = this->uploads_.find(request);
+        if (stale != this->uploads_.end()) {
+            stale->second->abort();
+            this->invalidate_directory(Path::parent(stale->second->path()));
+            if (stale->second->replaced())
+                this->notify_change(ChangeKind::REMOVE, stale->second->path());
+            this->uploads_.erase(stale);
+        }
+        const Mount *mount = nullptr;
+        PathBuffer target;
+        PathError error = this->resolve_path(request, mount, target);
+        global_metrics.request(RequestKind::UPLOAD);
+        if (mount == nullptr || !mount->upload_enabled) {
+            send_text(request, 401, "application/json", "{ \"error\": \"file upload is disabled\" }");
+            return;
+        }
+        std::string path = target.str();
+        if (error == PathError::NONE && !this->sd_mmc_card_->is_directory(path)) {
+            send_text(request, 401, "application/json", "{ \"error\": \"invalid upload folder\" }",
+                      {{"Connection", "close"}});
+            return;
+        }
+        if (error == PathError::NONE)
+            error = append_file_name(std::string_view(filename.c_str(), filename.length()), target);
+        if (error != PathError::NONE) {
+            this->send_path_error(request, error);
+            return;
+        }
+        TransferTicket ticket = this->admission_->admit(client_address(request), TransferDirection::UPLOAD);
+        if (!ticket) {
+            send_busy(request, this->admission_->retry_after());
+            return;
+        }
+        PoolBuffer buffer = this->buffer_pool_->acquire(BUFFER_WAIT_MS);
+        if (!buffer) {
+            send_busy(request);
+            return;
+        }
+        auto session = std::unique_ptr<UploadSession>(new UploadSession(target.str(), std::move(buffer)));
+        session->set_ticket(std::move(ticket));
+        if (!session->open()) {
+            send_text(request, 500, "application/json", "{ \"error\": \"failed to open file\" }",
+                      {{"Connection", "close"}});
+            return;
+        }
+#ifdef USE_BOX3WEB_UPLOAD_PIPELINE
+        if (this->upload_pipeline_ != nullptr && !session->attach_pipeline(this->upload_pipeline_.get()))
+            ESP_LOGD(TAG, "Upload pipeline busy, writing %s inline", session->path().c_str());
+#endif
+#ifndef USE_ESP_IDF
+        request->onDisconnect([this, request]() { this->abort_upload(request); });
+#endif
+        this->invalidate_directory(path);
+        this->uploads_[request] = std::move(session);
+    }
+    auto it = this->uploads_.find(request);
+    if (it == this->uploads_.end())
+        return;
+    UploadSession *session = it->second.get();
+    global_metrics.received(len);
+    bool ok = session->write(data, len);
+    if (ok && !final)
+        return;
+    if (ok) {
+        ok = session->finish();
+    } else {
+        session->abort();
+    }
+    this->invalidate_directory(Path::parent(session->path()));
+    this->index_change(session->path());
+    this->notify_change(session->replaced() ? ChangeKind::UPDATE : ChangeKind::ADD, session->path());
+    Headers headers{{"Connection", "close"}};
+    // The client can check what reached the card without downloading it again.
+    if (ok && session->digest() != nullptr) {
+        headers.emplace_back("ETag", "\"" + session->digest()->sha256_hex() + "\"");
+        headers.emplace_back("Digest", session->digest()->digest_header());
+        headers.emplace_back("X-Checksum-CRC32", session->digest()->crc32_hex());
+    }
+    this->uploads_.erase(it);
+    if (!ok) {
+        send_text(request, 500, "application/json", "{ \"error\": \"failed to write file\" }", headers);
         return;
     }
-    std::string extracted = this->extract_path_from_url(std::string(request->url().c_str()));
-    std::string path = this->build_absolute_path(extracted);
-    if (index == 0 && !this->sd_mmc_card_->is_directory(path)) {
-        auto response = request->beginResponse(401, "application/json", "{ \"error\": \"invalid upload folder\" }");
-        response->addHeader("Connection", "close");
-        request->send(response);
+#ifdef USE_BOX3WEB_UPLOAD_PIPELINE
+    if (this->upload_pipeline_ != nullptr) {
+        ESP_LOGD(TAG, "Upload backpressure so far: %u events, %u ms",
+                 (unsigned) this->upload_pipeline_->backpressure_events(),
+                 (unsigned) this->upload_pipeline_->backpressure_ms());
+    }
+#endif
+    send_text(request, 201, "text/html", "upload success", headers);
+}
+
+void Box3Web::handleBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+    // Only the Arduino backend delivers bodies here, ESP-IDF bodies are read in handle_patch() and handle_batch().
+    int method = effective_method(request);
+    if (is_batch_request(request, method)) {
+        LockGuard guard(this->uploads_mutex_);
+        auto &parser = this->batches_[request];
+        if (index == 0) {
+            parser.reset(new BatchParser());
+#ifndef USE_ESP_IDF
+            request->onDisconnect([this, request]() { this->abort_upload(request); });
+#endif
+        }
+        global_metrics.received(len);
+        if (parser != nullptr)
+            parser->feed(reinterpret_cast<const char *>(data), len);
         return;
     }
-    std::string file_name(filename.c_str());
+    if (method != HTTP_PATCH || !request->hasArg("upload"))
+        return;
+    LockGuard guard(this->uploads_mutex_);
     if (index == 0) {
-        this->sd_mmc_card_->write_file(Path::join(path, file_name).c_str(), data, len);
+        auto stale = this->uploads_.find(request);
+        if (stale != this->uploads_.end()) {
+            stale->second->abort();
+            this->uploads_.erase(stale);
+        }
+        this->refused_bodies_.erase(request);
+        ResumableTarget target;
+        int status = this->find_resumable(request, target);
+        if (status == 0)
+            status = this->begin_patch(request, target);
+        if (status != 0) {
+            this->refused_bodies_[request] = status;
+            return;
+        }
+    }
+    auto it = this->uploads_.find(request);
+    if (it == this->uploads_.end())
         return;
+    global_metrics.received(len);
+    if (!it->second->write(data, len)) {
+        it->second->abort();
+        this->uploads_.erase(it);
+        this->refused_bodies_[request] = 500;
     }
-    this->sd_mmc_card_->append_file(Path::join(path, file_name).c_str(), data, len);
-    if (final) {
-        auto response = request->beginResponse(201, "text/html", "upload success");
-        response->addHeader("Connection", "close");
-        request->send(response);
+}
+
+void Box3Web::abort_upload(AsyncWebServerRequest *request) {
+    LockGuard guard(this->uploads_mutex_);
+    this->refused_bodies_.erase(request);
+    this->batches_.erase(request);
+    auto it = this->uploads_.find(request);
+    if (it == this->uploads_.end())
         return;
+    it->second->abort();
+    this->invalidate_directory(Path::parent(it->second->path()));
+    if (it->second->replaced())
+        this->notify_change(ChangeKind::REMOVE, it->second->path());
+    this->uploads_.erase(it);
+}
+
+void Box3Web::expire_uploads() {
+    this->resumable_->expire();
+    // Never stall the main loop behind an upload chunk being written.
+    if (!this->uploads_mutex_.try_lock())
+        return;
+    uint32_t now = millis();
+    for (auto it = this->uploads_.begin(); it != this->uploads_.end();) {
+        if (now - it->second->last_activity() > UPLOAD_IDLE_TIMEOUT) {
+            it->second->abort();
+            this->invalidate_directory(Path::parent(it->second->path()));
+            if (it->second->replaced())
+                this->notify_change(ChangeKind::REMOVE, it->second->path());
+            it = this->uploads_.erase(it);
+        } else {
+            ++it;
+        }
     }
+    this->uploads_mutex_.unlock();
+}
+
+int Box3Web::find_resumable(AsyncWebServerRequest *request, ResumableTarget &target) {
+    const Mount *mount = nullptr;
+    PathBuffer resolved;
+    PathError error = this->resolve_path(request, mount, resolved);
+    if (mount == nullptr || !mount->upload_enabled)
+        return 401;
+    if (error != PathError::NONE)
+        return 400;
+    target.path = resolved.str();
+    if (!this->resumable_->find(target.path, request->arg("upload").c_str(), target.partial, target.length))
+        return 404;
+    return 0;
+}
+
+int Box3Web::check_patch_offset(AsyncWebServerRequest *request, ResumableTarget const &target) const {
+    size_t offset;
+    if (!parse_decimal(get_header(request, "Upload-Offset"), offset))
+        return 400;
+    if (offset != ResumableUploads::offset(target.partial))
+        return 409;
+    if (request->contentLength() > target.length - offset)
+        return 413;
+    return 0;
+}
+
+int Box3Web::begin_patch(AsyncWebServerRequest *request, ResumableTarget const &target) {
+    // Both would pass the offset check against the same size and interleave their appends.
+    for (auto const &upload : this->uploads_) {
+        if (upload.first != request && upload.second->path() == target.partial)
+            return 423;
+    }
+    int status = this->check_patch_offset(request, target);
+    if (status != 0)
+        return status;
+    TransferTicket ticket = this->admission_->admit(client_address(request), TransferDirection::UPLOAD);
+    PoolBuffer buffer;
+    if (ticket)
+        buffer = this->buffer_pool_->acquire(BUFFER_WAIT_MS);
+    if (!buffer)
+        return 503;
+    auto session = std::unique_ptr<UploadSession>(new UploadSession(target.partial, std::move(buffer), true));
+    session->set_ticket(std::move(ticket));
+    if (!session->open())
+        return 500;
+#ifdef USE_BOX3WEB_UPLOAD_PIPELINE
+    if (this->upload_pipeline_ != nullptr && !session->attach_pipeline(this->upload_pipeline_.get()))
+        ESP_LOGD(TAG, "Upload pipeline busy, writing %s inline", session->path().c_str());
+#endif
+#ifndef USE_ESP_IDF
+    request->onDisconnect([this, request]() { this->abort_upload(request); });
+#endif
+    this->uploads_[request] = std::move(session);
+    return 0;
+}
+
+void Box3Web::handle_resumable(AsyncWebServerRequest *request, int method, Mount const &mount,
+                               std::string const &path) {
+    global_metrics.request(RequestKind::RESUMABLE);
+    if (!mount.upload_enabled) {
+        send_text(request, 401, "application/json", "{ \"error\": \"file upload is disabled\" }");
+        return;
+    }
+    if (method == HTTP_POST) {
+        this->handle_resumable_create(request, mount, path);
+        return;
+    }
+    ResumableTarget target;
+    int status = this->find_resumable(request, target);
+    if (status != 0) {
+        this->send_resumable_error(request, status, target);
+        return;
+    }
+    if (method == HTTP_PATCH) {
+        this->handle_patch(request, target);
+    } else if (method == HTTP_HEAD) {
+        send_text(request, 200, "application/json", "",
+                  {{"Upload-Offset", std::to_string(ResumableUploads::offset(target.partial))},
+                   {"Upload-Length", std::to_string(target.length)},
+                   {"Cache-Control", "no-store"},
+                   {"Tus-Resumable", TUS_VERSION}});
+    } else if (method == HTTP_DELETE) {
+        this->resumable_->cancel(target.partial);
+        send_text(request, 204, "application/json", "{}");
+    } else {
+        send_text(request, 405, "application/json", "{ \"error\": \"Method not allowed\" }");
+    }
+}
+
+void Box3Web::handle_resumable_create(AsyncWebServerRequest *request, Mount const &mount, std::string const &path) {
+    size_t length;
+    if (!parse_decimal(get_header(request, "Upload-Length"), length)) {
+        send_text(request, 400, "application/json", "{ \"error\": \"invalid Upload-Length\" }");
+        return;
+    }
+    if (this->sd_mmc_card_->is_directory(path)) {
+        send_text(request, 409, "application/json", "{ \"error\": \"target is a directory\" }");
+        return;
+    }
+    if (!this->sd_mmc_card_->is_directory(Path::parent(path))) {
+        send_text(request, 401, "application/json", "{ \"error\": \"invalid upload folder\" }");
+        return;
+    }
+    std::string id = this->resumable_->create(path, length);
+    if (id.empty()) {
+        send_text(request, 500, "application/json", "{ \"error\": \"failed to open file\" }");
+        return;
+    }
+    std::string partial;
+    this->resumable_->find(path, id, partial, length);
+    bool replaced;
+    if (length == 0 && this->resumable_->complete(partial, path, replaced)) {
+        this->invalidate_directory(Path::parent(path));
+        this->index_change(path);
+        this->notify_change(replaced ? ChangeKind::UPDATE : ChangeKind::ADD, path);
+    }
+    std::string location = mount.mapping.uri_for(path) + "?upload=" + id;
+    send_text(request, 201, "application/json", "{ \"upload\": \"" + id + "\" }",
+              {{"Location", location}, {"Upload-Offset", "0"}, {"Tus-Resumable", TUS_VERSION}});
+}
+
+void Box3Web::handle_patch(AsyncWebServerRequest *request, ResumableTarget const &target) {
+#ifdef USE_ESP_IDF
+    // web_server_idf leaves bodies it does not parse itself unread, so the PATCH body is pulled here.
+    PoolBuffer chunk = this->buffer_pool_->acquire(BUFFER_WAIT_MS);
+    {
+        LockGuard guard(this->uploads_mutex_);
+        int status = chunk ? this->begin_patch(request, target) : 503;
+        if (status != 0) {
+            this->send_resumable_error(request, status, target);
+            return;
+        }
+    }
+    httpd_req_t *req = *request;
+    size_t remaining = request->contentLength();
+    int timeouts = 0;
+    while (remaining > 0) {
+        int received = httpd_req_recv(req, reinterpret_cast<char *>(chunk.data()), std::min(remaining, chunk.size()));
+        if (received == HTTPD_SOCK_ERR_TIMEOUT && ++timeouts < PATCH_RECV_RETRIES)
+            continue;
+        timeouts = 0;
+        LockGuard guard(this->uploads_mutex_);
+        auto it = this->uploads_.find(request);
+        if (it == this->uploads_.end())
+            return;
+        if (received > 0)
+            global_metrics.received(received);
+        if (received <= 0 || !it->second->write(chunk.data(), received)) {
+            // What reached the card stays committed, the client resumes from there.
+            it->second->abort();
+            this->uploads_.erase(it);
+            if (received > 0)
+                this->send_resumable_error(request, 500, target);
+            return;
+        }
+        remaining -= received;
+    }
+#endif
+    std::unique_ptr<UploadSession> session;
+    int status = 0;
+    {
+        LockGuard guard(this->uploads_mutex_);
+        auto refused = this->refused_bodies_.find(request);
+        if (refused != this->refused_bodies_.end()) {
+            status = refused->second;
+            this->refused_bodies_.erase(refused);
+        }
+        auto it = this->uploads_.find(request);
+        if (it != this->uploads_.end()) {
+            session = std::move(it->second);
+            this->uploads_.erase(it);
+        }
+    }
+    // An empty body never opens a session, it only checks where the upload stands.
+    if (status == 0 && session == nullptr)
+        status = this->check_patch_offset(request, target);
+    if (status == 0 && session != nullptr && !session->finish())
+        status = 500;
+    if (status != 0) {
+        this->send_resumable_error(request, status, target);
+        return;
+    }
+    size_t offset = ResumableUploads::offset(target.partial);
+    this->resumable_->touch(target.partial);
+    if (offset == target.length) {
+        bool replaced;
+        if (!this->resumable_->complete(target.partial, target.path, replaced)) {
+            this->send_resumable_error(request, 500, target);
+            return;
+        }
+        this->invalidate_directory(Path::parent(target.path));
+        this->index_change(target.path);
+        this->notify_change(replaced ? ChangeKind::UPDATE : ChangeKind::ADD, target.path);
+    }
+    send_text(request, 204, "application/json", "",
+              {{"Upload-Offset", std::to_string(offset)}, {"Tus-Resumable", TUS_VERSION}});
+}
+
+void Box3Web::send_resumable_error(AsyncWebServerRequest *request, int status, ResumableTarget const &target) {
+    const char *message;
+    switch (status) {
+        case 400: message = "{ \"error\": \"invalid Upload-Offset\" }"; break;
+        case 401: message = "{ \"error\": \"file upload is disabled\" }"; break;
+        case 404: message = "{ \"error\": \"unknown upload\" }"; break;
+        case 409: message = "{ \"error\": \"Upload-Offset does not match\" }"; break;
+        case 413: message = "{ \"error\": \"body exceeds Upload-Length\" }"; break;
+        case 423:
+            // tus answers a PATCH racing another one on the same upload, e.g. a retry while the old connection
+            // is still alive, with a conflict; the client retries once that one has ended.
+            send_text(request, 409, "application/json", "{ \"error\": \"upload in progress\" }",
+                      {{"Tus-Resumable", TUS_VERSION}});
+            return;
+        case 503:
+            send_busy(request, this->admission_->retry_after());
+            return;
+        default: message = "{ \"error\": \"failed to write file\" }"; break;
+    }
+    Headers headers;
+    // A client that lost track of the offset can pick it up from the conflict.
+    if (status == 409)
+        headers.emplace_back("Upload-Offset", std::to_string(ResumableUploads::offset(target.partial)));
+    headers.emplace_back("Tus-Resumable", TUS_VERSION);
+    send_text(request, status, "application/json", message, headers);
 }
 
 void Box3Web::set_url_prefix(std::string const &prefix) { this->url_prefix_ = prefix; }
@@ -94,119 +640,194 @@ void Box3Web::set_download_enabled(bool allow) { this->download_enabled_ = allow
 
 void Box3Web::set_upload_enabled(bool allow) { this->upload_enabled_ = allow; }
 
-void Box3Web::handle_get(AsyncWebServerRequest *request) const {
-    std::string extracted = this->extract_path_from_url(std::string(request->url().c_str()));
-    std::string path = this->build_absolute_path(extracted);
+void Box3Web::add_mount(std::string const &url_prefix, std::string const &root_path, bool deletion, bool download,
+                        bool upload) {
+    Mount *mount = this->mounts_.add(url_prefix, root_path);
+    if (mount == nullptr) {
+        ESP_LOGE(TAG, "Url prefix %s is already used by another mount", url_prefix.c_str());
+        return;
+    }
+    mount->deletion_enabled = deletion;
+    mount->download_enabled = download;
+    mount->upload_enabled = upload;
+}
+
+void Box3Web::add_mount_cache_control(std::string const &url_prefix, std::string const &content_type,
+                                      std::string const &value) {
+    Mount *mount = this->mounts_.get(url_prefix);
+    if (mount != nullptr)
+        mount->cache_control.emplace_back(content_type, value);
+}
+
+void Box3Web::set_buffer_pool(size_t buffer_size, size_t count, size_t per_request) {
+    this->buffer_pool_ = std::unique_ptr<BufferPool>(new BufferPool(buffer_size, count, per_request));
+}
+
+
+void Box3Web::set_index_sort_limit(size_t limit) { this->index_sort_limit_ = limit; }
+
+void Box3Web::add_ui_asset(const char *name, const char *content_type, const uint8_t *data, size_t size) {
+    this->ui_assets_.push_back(UiAsset{name, content_type, data, size});
+}
+
+void Box3Web::set_metrics(uint32_t update_interval) {
+    this->metrics_enabled_ = true;
+    this->metrics_interval_ = update_interval;
+}
+
+void Box3Web::set_listing_compression(bool enabled, size_t window) {
+    this->compress_listings_ = enabled;
+    this->compression_window_ = window;
+}
+
+void Box3Web::add_content_type(const char *extension, const char *mime, ContentCategory category) {
+    register_content_type(extension, mime, category);
+}
+
+void Box3Web::add_cache_control(std::string const &content_type, std::string const &value) {
+    this->cache_control_.emplace_back(content_type, value);
+}
+
+void Box3Web::set_transfer_limits(uint8_t max_downloads, uint8_t max_uploads, uint8_t per_client_downloads,
+                                  uint8_t per_client_uploads) {
+    this->admission_->set_limits(TransferDirection::DOWNLOAD, max_downloads, per_client_downloads);
+    this->admission_->set_limits(TransferDirection::UPLOAD, max_uploads, per_client_uploads);
+}
+
+void Box3Web::set_transfer_rates(uint32_t download_rate, uint32_t upload_rate, uint32_t burst) {
+    this->admission_->set_rate(TransferDirection::DOWNLOAD, download_rate, burst);
+    this->admission_->set_rate(TransferDirection::UPLOAD, upload_rate, burst);
+}
+
+void Box3Web::set_admission_queue(uint8_t size, uint32_t timeout_ms, uint32_t retry_after) {
+    this->admission_->set_queue(size, timeout_ms);
+    this->admission_->set_retry_after(retry_after);
+}
+
+void Box3Web::set_resumable_upload_expiry(uint32_t expiry_ms) { this->resumable_->set_expiry_ms(expiry_ms); }
+
+void Box3Web::set_search_index(uint32_t refresh_ms, size_t max_entries) {
+    this->search_index_ = std::unique_ptr<SearchIndex>(new SearchIndex(refresh_ms, max_entries));
+}
+
+void Box3Web::set_change_feed(size_t max_subscribers, uint32_t keepalive_ms) {
+    this->change_feed_ = std::unique_ptr<ChangeFeed>(new ChangeFeed(max_subscribers, keepalive_ms));
+}
+
+void Box3Web::set_listing_cache_size(size_t size) {
+    this->listing_cache_ = size > 0 ? std::unique_ptr<ListingCache>(new ListingCache(size)) : nullptr;
+}
+
+#ifdef USE_BOX3WEB_READ_AHEAD
+void Box3Web::set_read_ahead(size_t depth) { this->read_ahead_depth_ = depth; }
+#endif
+
+#ifdef USE_BOX3WEB_UPLOAD_PIPELINE
+void Box3Web::set_upload_pipeline(size_t buffer_size, uint8_t task_priority) {
+    this->upload_pipeline_ = std::unique_ptr<UploadPipeline>(new UploadPipeline(buffer_size, task_priority));
+}
+#endif
+
+void Box3Web::handle_get(AsyncWebServerRequest *request, Mount const &mount, std::string const &path) const {
     if (!this->sd_mmc_card_->is_directory(path)) {
-        handle_download(request, path);
-        return;
-    }
-    handle_index(request, path);
-}
-
-String Box3Web::get_content_type(const std::string &path) const {
-    if (endsWith(path, ".html")) return "text/html";
-    else if (endsWith(path, ".css")) return "text/css";
-    else if (endsWith(path, ".js")) return "application/javascript";
-    else if (endsWith(path, ".json")) return "application/json";
-    else if (endsWith(path, ".png")) return "image/png";
-    else if (endsWith(path, ".jpg") || endsWith(path, ".jpeg")) return "image/jpeg";
-    else if (endsWith(path, ".gif")) return "image/gif";
-    else if (endsWith(path, ".svg")) return "image/svg+xml";
-    else if (endsWith(path, ".ico")) return "image/x-icon";
-    else if (endsWith(path, ".mp3")) return "audio/mpeg";
-    else if (endsWith(path, ".wav")) return "audio/wav";
-    else if (endsWith(path, ".mp4")) return "video/mp4";
-    else if (endsWith(path, ".pdf")) return "application/pdf";
-    else if (endsWith(path, ".zip")) return "application/zip";
-    else if (endsWith(path, ".txt")) return "text/plain";
-    else if (endsWith(path, ".xml")) return "application/xml";
-    return "application/octet-stream";
-}
-
-void Box3Web::write_row(AsyncResponseStream *response, sd_mmc_card::FileInfo const &info) const {
-    std::string uri = "/" + Path::join(this->url_prefix_, Path::remove_root_path(info.path, this->root_path_));
-    std::string file_name = Path::file_name(info.path);
+        handle_download(request, mount, path);
+        return;
+    }
+    if (request->hasArg("archive")) {
+        handle_archive(request, mount, path);
+        return;
+    }
+    if (request->hasArg("search")) {
+        handle_search(request, mount, path);
+        return;
+    }
+    if (request->hasArg("events")) {
+        handle_events(request, path);
+        return;
+    }
+    if (request->hasArg("format") && std::string(request->arg("format").c_str()) == "json") {
+        handle_json_index(request, mount, path);
+        return;
+    }
+    handle_index(request, mount, path);
+}
+
+void Box3Web::write_row(std::string &out, Mount const &mount, sd_mmc_card::FileInfo const &info) const {
+    // Names come from the card and from multipart filenames, either may carry markup.
+    std::string uri = html_escape(mount.mapping.uri_for(info.path));
+    std::string file_name = html_escape(Path::file_name(info.path));
     std::string file_size = info.is_directory ? "-" : std::to_string(info.size);
 
-    std::string file_type;
-    if (info.is_directory) {
-        file_type = "Directory";
-    } else {
-        String content_type = get_content_type(info.path);
-        if (startsWith(content_type.c_str(), "image/")) file_type = "Image";
-        else if (startsWith(content_type.c_str(), "audio/")) file_type = "Audio";
-        else if (startsWith(content_type.c_str(), "video/")) file_type = "Video";
-        else if (startsWith(content_type.c_str(), "text/")) file_type = "Text";
-        else file_type = "File";
-    }
+    const char *file_type = info.is_directory ? "Directory" : category_name(content_type_for(info.path).category);
 
-    response->print("<tr><td>");
+    out += "<tr data-name=\"";
+    out += file_name;
+    out += "\"><td>";
+    if (mount.deletion_enabled) {
+        out += "<input type=\"checkbox\" class=\"select\" value=\"";
+        out += file_name;
+        out += "\">";
+    }
     if (info.is_directory) {
-        response->print("<a href=\"");
-        response->print(uri.c_str());
-        response->print("\">");
-        response->print(file_name.c_str());
-        response->print("/</a>");
+        out += "<a href=\"";
+        out += uri;
+        out += "\">";
+        out += file_name;
+        out += "/</a>";
     } else {
-        response->print("<a href=\"");
-        response->print(uri.c_str());
-        response->print("\">");
-        response->print(file_name.c_str());
-        response->print("</a>");
-    }
-    response->print("</td><td>");
-    response->print(file_type.c_str());
-    response->print("</td><td>");
-    response->print(file_size.c_str());
-    response->print("</td><td>");
+        out += "<a href=\"";
+        out += uri;
+        out += "\">";
+        out += file_name;
+        out += "</a>";
+    }
+    out += "</td><td>";
+    out += file_type;
+    out += "</td><td>";
+    out += file_size;
+    out += "</td><td>";
     if (!info.is_directory) {
-        if (this->download_enabled_) {
-            response->print("<button onClick=\"download_file('");
-            response->print(uri.c_str());
-            response->print("','");
-            response->print(file_name.c_str());
-            response->print("')\">Download</button>");
+        // A plain link lets the browser stream the file to disk instead of buffering it in the page.
+        if (mount.download_enabled) {
+            out += "<a class=\"button\" href=\"";
+            out += uri;
+            out += "\" download=\"";
+            out += file_name;
+            out += "\">Download</a>";
         }
-        if (this->deletion_enabled_) {
-            response->print("<button onClick=\"delete_file('");
-            response->print(uri.c_str());
-            response->print("')\">Delete</button>");
+        if (mount.deletion_enabled) {
+            out += "<button class=\"delete\" data-delete=\"";
+            out += uri;
+            out += "\">Delete</button>";
         }
     }
-    response->print("</td></tr>");
-}
-
-void Box3Web::handle_index(AsyncWebServerRequest *request, std::string const &path) const {
-    AsyncResponseStream *response = request->beginResponseStream("text/html");
-    response->print(F("<!DOCTYPE html><html lang=\"en\"><head><meta charset=UTF-8><meta "
-                      "name=viewport content=\"width=device-width, initial-scale=1,user-scalable=no\">"
-                      "<style>"
-                      "body { font-family: Arial, sans-serif; margin: 0; padding: 20px; }"
-                      "h1, h2 { color: #333; }"
-                      "table { width: 100%; border-collapse: collapse; margin-top: 20px; }"
-                      "th, td { padding: 8px; text-align: left; border-bottom: 1px solid #ddd; }"
-                      "th { background-color: #f2f2f2; }"
-                      "tr:hover { background-color: #f5f5f5; }"
-                      "button { margin: 2px; padding: 5px 10px; background-color: #4CAF50; color: white; "
-                      "border: none; border-radius: 4px; cursor: pointer; }"
-                      "button:hover { background-color: #45a049; }"
-                      ".delete { background-color: #f44336; }"
-                      ".delete:hover { background-color: #d32f2f; }"
-                      "a { color: #2196F3; text-decoration: none; }"
-                      "a:hover { text-decoration: underline; }"
-                      ".upload-form { margin: 20px 0; padding: 15px; background-color: #f9f9f9; border-radius: 4px; }"
-                      "</style>"
-                      "</head><body>"
-                      "<h1>SD Card Content</h1><h2>Folder "));
-    response->print(path.c_str());
-    response->print(F("</h2>"));
+    out += "</td></tr>";
+}
+
+void Box3Web::write_index_head(std::string &out, Mount const &mount, std::string const &path) const {
+    out += "<!DOCTYPE html><html lang=\"en\"><head><meta charset=UTF-8><meta "
+           "name=viewport content=\"width=device-width, initial-scale=1,user-scalable=no\">";
+    // Style and script come from the precompressed assets, cached by the browser for good.
+    std::string base = mount.prefix.size() > 1 ? mount.prefix : "";
+    for (auto const &asset : this->ui_assets_) {
+        bool script = str_startswith(asset.content_type, "text/javascript");
+        out += script ? "<script defer src=\"" : "<link rel=stylesheet href=\"";
+        out += base;
+        out += ASSETS_PATH;
+        out += asset.name;
+        out += script ? "\"></script>" : "\">";
+    }
+    out += "</head><body>"
+           "<h1>SD Card Content</h1><h2>Folder ";
+    out += html_escape(path);
+    out += "</h2>";
     // Add breadcrumb navigation
-    std::string current_path = Path::remove_root_path(path, this->root_path_);
+    std::string current_path = Path::remove_root_path(path, mount.mapping.root_path);
+    // base is also what the breadcrumb links are relative to, empty for a mount at the server root.
     if (current_path != "/") {
-        response->print("<div class=\"breadcrumb\"><a href=\"/");
-        response->print(this->url_prefix_.c_str());
-        response->print("\">Home</a> / ");
+        out += "<div class=\"breadcrumb\"><a href=\"";
+        out += mount.prefix;
+        out += "\">Home</a> / ";
         std::vector<std::string> parts;
         std::string part;
         for (char c : current_path) {
@@ -225,134 +846,644 @@ void Box3Web::handle_index(AsyncWebServerRequest *request, std::string const &pa
         std::string cumulative_path = "";
         for (size_t i = 0; i < parts.size(); i++) {
             cumulative_path += "/" + parts[i];
-            response->print("<a href=\"/");
-            response->print(this->url_prefix_.c_str());
-            response->print(cumulative_path.c_str());
-            response->print("\">");
-            response->print(parts[i].c_str());
-            response->print("</a>");
+            out += "<a href=\"";
+            out += base;
+            out += html_escape(cumulative_path);
+            out += "\">";
+            out += html_escape(parts[i]);
+            out += "</a>";
             if (i < parts.size() - 1) {
-                response->print(" / ");
+                out += " / ";
             }
         }
-        response->print("</div><br>");
+        out += "</div><br>";
     }
-    if (this->upload_enabled_) {
-        response->print(F("<div class=\"upload-form\">"
+    if (mount.download_enabled) {
+        out += "<div>Download folder as <a href=\"?archive=zip\">ZIP</a> or <a href=\"?archive=tar\">TAR</a></div>";
+    }
+    if (mount.deletion_enabled) {
+        out += "<div><button id=\"delete-selected\" class=\"delete\">Delete selected</button></div>";
+    }
+    if (mount.upload_enabled) {
+        out += "<div class=\"upload-form\">"
                           "<form method=\"POST\" enctype=\"multipart/form-data\">"
                           "<input type=\"file\" name=\"file\" multiple>"
                           "<input type=\"submit\" value=\"Upload File(s)\">"
-                          "</form></div>"));
-    }
-    response->print(F("<table id=\"files\">"
-                      "<thead><tr>"
-                      "<th>Name</th>"
-                      "<th>Type</th>"
-                      "<th>Size</th>"
-                      "<th>Actions</th>"
-                      "</tr></thead><tbody>"));
-    auto entries = this->sd_mmc_card_->list_directory_file_info(path, 0);
-    for (auto const &entry : entries)
-        write_row(response, entry);
-    response->print(F("</tbody></table>"
-                      "<script>"
-                      "function delete_file(path) {"
-                      "  if(confirm('Are you sure you want to delete this file?')) {"
-                      "    fetch(path, {method: 'DELETE'})"
-                      "    .then(response => {"
-                      "      if(response.ok) {"
-                      "        alert('File deleted successfully');"
-                      "        location.reload();"
-                      "      } else {"
-                      "        alert('Error deleting file');"
-                      "      }"
-                      "    }).catch(error => {"
-                      "      alert('Error: ' + error);"
-                      "    });"
-                      "  }"
-                      "}"
-                      "function download_file(path, filename) {"
-                      "  fetch(path).then(response => response.blob())"
-                      "  .then(blob => {"
-                      "    const link = document.createElement('a');"
-                      "    link.href = URL.createObjectURL(blob);"
-                      "    link.download = filename;"
-                      "    link.click();"
-                      "  }).catch(error => {"
-                      "    alert('Error downloading file: ' + error);"
-                      "  });"
-                      "}"
-                      "</script>"
-                      "</body></html>"));
-    request->send(response);
-}
-
-void Box3Web::handle_download(AsyncWebServerRequest *request, std::string const &path) const {
-    if (!this->download_enabled_) {
-        request->send(401, "application/json", "{ \"error\": \"file download is disabled\" }");
-        return;
-    }
-    auto file = this->sd_mmc_card_->read_file(path);
-    if (file.size() == 0) {
-        request->send(404, "application/json", "{ \"error\": \"failed to read file or file is empty\" }");
-        return;
-    }
-    String content_type = get_content_type(path);
-#ifdef USE_ESP_IDF
-    auto *response = request->beginResponse_P(200, content_type.c_str(), file.data(), file.size());
-    if (content_type == "audio/mpeg" || content_type == "audio/wav" ||
-        content_type == "video/mp4" || startsWith(content_type.c_str(), "image/")) {
-        response->addHeader("Accept-Ranges", "bytes");
+                          "</form></div>";
     }
-    std::string filename = Path::file_name(path);
-    response->addHeader("Content-Disposition", ("inline; filename=\"" + String(filename.c_str()) + "\"").c_str());
-#else
-    auto *response = request->beginResponseStream(content_type.c_str(), file.size());
-    if (content_type == "audio/mpeg" || content_type == "audio/wav" ||
-        content_type == "video/mp4" || startsWith(content_type.c_str(), "image/")) {
-        response->addHeader("Accept-Ranges", "bytes");
+    out += "<table id=\"files\"";
+    // The script keeps the rows current from the change this page was rendered at, and builds new ones with
+    // the actions of the mount.
+    if (this->change_feed_ != nullptr) {
+        out += " data-events=\"";
+        out += this->change_feed_->last_id();
+        out += '"';
+        if (mount.download_enabled)
+            out += " data-download";
+        if (mount.deletion_enabled)
+            out += " data-deletion";
+    }
+    out += "><thead><tr>"
+           "<th><a href=\"?sort=name\">Name</a></th>"
+           "<th>Type</th>"
+           "<th><a href=\"?sort=size\">Size</a></th>"
+           "<th>Actions</th>"
+           "</tr></thead><tbody>";
+}
+
+void Box3Web::write_index_tail(std::string &out) const { out += "</tbody></table></body></html>"; }
+
+void Box3Web::handle_index(AsyncWebServerRequest *request, Mount const &mount, std::string const &path) const {
+    global_metrics.request(RequestKind::INDEX);
+    IndexSort sort = IndexSort::NONE;
+    if (request->hasArg("sort")) {
+        std::string order = request->arg("sort").c_str();
+        if (order == "name") {
+            sort = IndexSort::NAME;
+        } else if (order == "size") {
+            sort = IndexSort::SIZE;
+        }
+    }
+    Headers validators = this->listing_validators(request, mount, path, "text/html");
+    bool gzip = this->listing_gzip(request, validators);
+    if (is_not_modified(request, validators[0].second, this->last_write_)) {
+        send_not_modified(request, validators);
+        return;
+    }
+    auto source = std::make_shared<HtmlListingSource>(this, &mount, path, sort, this->index_sort_limit_);
+    if (!source->open()) {
+        send_text(request, 404, "application/json", "{ \"error\": \"failed to open directory\" }");
+        return;
+    }
+    if (this->listing_cache_ != nullptr) {
+        ESP_LOGD(TAG, "Listing cache: %u hits, %u misses, %u entries, %u/%u bytes", (unsigned) this->listing_cache_->hits(),
+                 (unsigned) this->listing_cache_->misses(), (unsigned) this->listing_cache_->size(),
+                 (unsigned) this->listing_cache_->bytes(), (unsigned) this->listing_cache_->max_bytes());
+    }
+    StreamHead head;
+    head.content_type = "text/html";
+    head.headers = std::move(validators);
+    this->send_listing(request, head, source, gzip);
+}
+
+bool Box3Web::listing_gzip(AsyncWebServerRequest *request, Headers &validators) const {
+    if (!this->compress_listings_)
+        return false;
+    validators.emplace_back("Vary", "Accept-Encoding");
+    if (!accepts_gzip(get_header(request, "Accept-Encoding")))
+        return false;
+    // The compressed page is its own representation, validators[0] is the ETag.
+    std::string &etag = validators[0].second;
+    etag.insert(etag.size() - 1, "-gz");
+    return true;
+}
+
+void Box3Web::send_listing(AsyncWebServerRequest *request, StreamHead &head, std::shared_ptr<ChunkSource> source,
+                           bool gzip) const {
+    if (gzip) {
+        auto compressed = std::make_shared<GzipSource>(source, this->compression_window_);
+        if (compressed->start()) {
+            head.headers.emplace_back("Content-Encoding", "gzip");
+            source = compressed;
+        } else {
+            ESP_LOGW(TAG, "Not enough memory to compress listing, sending it uncompressed");
+            std::string &etag = head.headers[0].second;
+            etag.erase(etag.size() - 4, 3);
+        }
+    }
+    send_stream(request, head, source, this->buffer_pool_.get());
+}
+
+void Box3Web::handle_json_index(AsyncWebServerRequest *request, Mount const &mount,
+                                std::string const &path) const {
+    global_metrics.request(RequestKind::JSON_INDEX);
+    size_t limit = JSON_LISTING_DEFAULT_LIMIT;
+    size_t cursor = 0;
+    if (request->hasArg("limit") && (!parse_decimal(request->arg("limit").c_str(), limit) || limit == 0)) {
+        send_text(request, 400, "application/json", "{ \"error\": \"invalid limit\" }");
+        return;
+    }
+    if (request->hasArg("cursor") && !parse_decimal(request->arg("cursor").c_str(), cursor)) {
+        send_text(request, 400, "application/json", "{ \"error\": \"invalid cursor\" }");
+        return;
+    }
+    limit = std::min(limit, JSON_LISTING_MAX_LIMIT);
+    Headers validators = this->listing_validators(request, mount, path, "application/json");
+    bool gzip = this->listing_gzip(request, validators);
+    if (is_not_modified(request, validators[0].second, this->last_write_)) {
+        send_not_modified(request, validators);
+        return;
     }
+    auto dir = std::unique_ptr<DirIterator>(new DirIterator());
+    if (!dir->open(path)) {
+        send_text(request, 404, "application/json", "{ \"error\": \"failed to open directory\" }");
+        return;
+    }
+    dir->skip(cursor);
+    StreamHead head;
+    head.content_type = "application/json";
+    head.headers = std::move(validators);
+    this->send_listing(request, head,
+                       std::make_shared<JsonListingSource>(std::move(dir), path, mount.mapping, cursor, limit), gzip);
+}
+
+void Box3Web::handle_download(AsyncWebServerRequest *request, Mount const &mount, std::string const &path) const {
+    global_metrics.request(RequestKind::DOWNLOAD);
+    if (!mount.download_enabled) {
+        send_text(request, 401, "application/json", "{ \"error\": \"file download is disabled\" }");
+        return;
+    }
+    const char *content_type = content_type_for(path).mime;
+    bool compressible = is_compressible(content_type);
+    auto file = std::unique_ptr<SdFile>(new SdFile());
+    // A precompressed sibling (file.ext.gz) wins for clients that accept it.
+    bool gzip = compressible && accepts_gzip(get_header(request, "Accept-Encoding")) && file->open(path + ".gz");
+    if (!gzip && !file->open(path)) {
+        send_text(request, 404, "application/json", "{ \"error\": \"failed to read file\" }");
+        return;
+    }
+    size_t size = file->size();
     std::string filename = Path::file_name(path);
-    response->addHeader("Content-Disposition", ("inline; filename=\"" + String(filename.c_str()) + "\"").c_str());
-    response->write(file.data(), file.size());
+
+    Headers validators;
+    // Files uploaded whole carry their SHA-256, a strong validator read from the sidecar, not from the file.
+    ContentDigest digest;
+    bool digested = !gzip && read_digest(path, size, file->mtime(), digest);
+    std::string etag = digested ? "\"" + digest.sha256_hex() + "\"" : make_etag(size, file->mtime());
+    validators.emplace_back("ETag", etag);
+    if (digested) {
+        validators.emplace_back("Digest", digest.digest_header());
+        validators.emplace_back("X-Checksum-CRC32", digest.crc32_hex());
+    }
+    validators.emplace_back("Last-Modified", http_date(file->mtime()));
+    validators.emplace_back("Cache-Control", this->cache_control_for(mount, content_type));
+    if (compressible)
+        validators.emplace_back("Vary", "Accept-Encoding");
+    if (is_not_modified(request, etag, file->mtime())) {
+        send_not_modified(request, validators);
+        return;
+    }
+
+    std::vector<ByteRange> ranges;
+    RangeResult range_result = RangeResult::NONE;
+    // A stale If-Range validator turns the range request into a full download.
+    std::string if_range = get_header(request, "If-Range");
+    if (if_range.empty() || if_range == etag || if_range == http_date(file->mtime()))
+        range_result = parse_range_header(get_header(request, "Range"), size, ranges);
+    if (range_result == RangeResult::UNSATISFIABLE) {
+        send_text(request, 416, "application/json", "{ \"error\": \"range not satisfiable\" }",
+                  {{"Content-Range", "bytes */" + std::to_string(size)}});
+        return;
+    }
+    // Only real bodies count against the caps, validations and errors above are cheap.
+    auto ticket = std::make_shared<TransferTicket>(
+        this->admission_->admit(client_address(request), TransferDirection::DOWNLOAD));
+    if (!*ticket) {
+        send_busy(request, this->admission_->retry_after());
+        return;
+    }
+
+    StreamHead head;
+    head.content_type = content_type;
+    head.headers = std::move(validators);
+    head.headers.emplace_back("Accept-Ranges", "bytes");
+    head.headers.emplace_back("Content-Disposition", "inline; filename=\"" + filename + "\"");
+    if (gzip)
+        head.headers.emplace_back("Content-Encoding", "gzip");
+    std::shared_ptr<ChunkSource> source;
+    if (range_result == RangeResult::NONE) {
+        head.code = 200;
+        head.content_length = size;
+        source = this->make_file_source(std::move(file), 0, size);
+    } else if (ranges.size() == 1) {
+        head.code = 206;
+        head.content_length = ranges[0].length();
+        head.headers.emplace_back("Content-Range", content_range(ranges[0], size));
+        source = this->make_file_source(std::move(file), ranges[0].first, ranges[0].length());
+    } else {
+        char boundary[24];
+        snprintf(boundary, sizeof(boundary), "box3web-%08x", (unsigned) random_uint32());
+        auto multipart = std::make_shared<MultipartRangeSource>(std::move(file), std::move(ranges), head.content_type,
+                                                                boundary);
+        head.code = 206;
+        head.content_type = std::string("multipart/byteranges; boundary=") + boundary;
+        head.content_length = multipart->content_length();
+        source = multipart;
+    }
+    send_stream(request, head, source, this->buffer_pool_.get(), ticket);
+}
+
+void Box3Web::handle_archive(AsyncWebServerRequest *request, Mount const &mount, std::string const &path) const {
+    global_metrics.request(RequestKind::ARCHIVE);
+    if (!mount.download_enabled) {
+        send_text(request, 401, "application/json", "{ \"error\": \"file download is disabled\" }");
+        return;
+    }
+    std::string kind = request->arg("archive").c_str();
+    if (kind != "zip" && kind != "tar") {
+        send_text(request, 400, "application/json", "{ \"error\": \"archive must be zip or tar\" }");
+        return;
+    }
+    auto source = std::make_shared<ArchiveSource>(path, kind == "zip" ? ArchiveFormat::ZIP : ArchiveFormat::TAR);
+    if (!source->open()) {
+        send_text(request, 404, "application/json", "{ \"error\": \"failed to open directory\" }");
+        return;
+    }
+    auto ticket = std::make_shared<TransferTicket>(
+        this->admission_->admit(client_address(request), TransferDirection::DOWNLOAD));
+    if (!*ticket) {
+        send_busy(request, this->admission_->retry_after());
+        return;
+    }
+    // The size is only known once the last file was read, so the archive goes out chunked.
+    StreamHead head;
+    head.content_type = kind == "zip" ? "application/zip" : "application/x-tar";
+    head.headers.emplace_back("Content-Disposition", "attachment; filename=\"" + source->base_name() + "." + kind + "\"");
+    head.headers.emplace_back("Cache-Control", "no-store");
+    send_stream(request, head, source, this->buffer_pool_.get(), ticket);
+}
+
+void Box3Web::handle_search(AsyncWebServerRequest *request, Mount const &mount, std::string const &path) const {
+    global_metrics.request(RequestKind::SEARCH);
+    if (this->search_index_ == nullptr) {
+        send_text(request, 401, "application/json", "{ \"error\": \"search is disabled\" }");
+        return;
+    }
+    SearchQuery query;
+    query.pattern = request->arg("search").c_str();
+    query.scope = path;
+    query.limit = SEARCH_DEFAULT_LIMIT;
+    // Bounds are optional, each one must be a plain number when given.
+    struct Bound {
+        const char *arg;
+        uint32_t *value;
+    };
+    for (Bound bound : {Bound{"min_size", &query.min_size}, Bound{"max_size", &query.max_size},
+                        Bound{"after", &query.after}, Bound{"before", &query.before}}) {
+        size_t value;
+        if (!request->hasArg(bound.arg))
+            continue;
+        if (!parse_decimal(request->arg(bound.arg).c_str(), value) || value > UINT32_MAX) {
+            send_text(request, 400, "application/json", "{ \"error\": \"invalid search bound\" }");
+            return;
+        }
+        *bound.value = value;
+    }
+    if (request->hasArg("limit") && (!parse_decimal(request->arg("limit").c_str(), query.limit) || query.limit == 0)) {
+        send_text(request, 400, "application/json", "{ \"error\": \"invalid limit\" }");
+        return;
+    }
+    query.limit = std::min(query.limit, SEARCH_MAX_LIMIT);
+    if (request->hasArg("type")) {
+        std::string type = request->arg("type").c_str();
+        if (type == "file") {
+            query.type = SearchType::FILES;
+        } else if (type == "directory") {
+            query.type = SearchType::DIRECTORIES;
+        } else {
+            send_text(request, 400, "application/json", "{ \"error\": \"type must be file or directory\" }");
+            return;
+        }
+    }
+    std::vector<IndexEntry> results;
+    bool truncated;
+    if (!this->search_index_->search(query, results, truncated)) {
+        send_text(request, 503, "application/json", "{ \"error\": \"search index is being built\" }",
+                  {{"Retry-After", "5"}});
+        return;
+    }
+    StreamHead head;
+    head.content_type = "application/json";
+    head.headers.emplace_back("Cache-Control", "no-store");
+    send_stream(request, head, std::make_shared<JsonSearchSource>(std::move(results), path, mount.mapping, truncated),
+                this->buffer_pool_.get());
+}
+
+void Box3Web::handle_events(AsyncWebServerRequest *request, std::string const &path) const {
+    global_metrics.request(RequestKind::EVENTS);
+    if (this->change_feed_ == nullptr) {
+        send_text(request, 401, "application/json", "{ \"error\": \"change feed is disabled\" }");
+        return;
+    }
+    // A reconnecting EventSource names the last event it got, a page the id it was rendered at.
+    std::string since = get_header(request, "Last-Event-ID");
+    if (since.empty())
+        since = request->arg("events").c_str();
+    this->change_feed_->serve(request, path, since);
+}
+
+void Box3Web::handle_asset(AsyncWebServerRequest *request, std::string const &name) const {
+    global_metrics.request(RequestKind::ASSET);
+    auto asset = std::find_if(this->ui_assets_.begin(), this->ui_assets_.end(),
+                              [&name](UiAsset const &asset) { return name == asset.name; });
+    if (asset == this->ui_assets_.end()) {
+        send_text(request, 404, "application/json", "{ \"error\": \"unknown asset\" }");
+        return;
+    }
+    Headers validators;
+    validators.emplace_back("ETag", "\"" + name + "\"");
+    validators.emplace_back("Cache-Control", IMMUTABLE_CACHE_CONTROL);
+    if (is_not_modified(request, validators[0].second, 0)) {
+        send_not_modified(request, validators);
+        return;
+    }
+    // Stored gzip compressed only: every browser the page works in accepts it.
+    StreamHead head;
+    head.content_type = asset->content_type;
+    head.content_length = asset->size;
+    head.headers = std::move(validators);
+    head.headers.emplace_back("Content-Encoding", "gzip");
+    send_stream(request, head, std::make_shared<StaticSource>(asset->data, asset->size), this->buffer_pool_.get());
+}
+
+// Appends one sample, preceded by the HELP and TYPE lines when help is given.
+static void write_sample(std::string &out, const char *name, const char *type, const char *help, const char *labels,
+                         uint64_t value) {
+    char line[160];
+    if (help != nullptr) {
+        snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+        out += line;
+    }
+    snprintf(line, sizeof(line), "%s%s %" PRIu64 "\n", name, labels, value);
+    out += line;
+}
+
+void Box3Web::handle_metrics(AsyncWebServerRequest *request) const {
+    global_metrics.request(RequestKind::METRICS);
+    std::string out;
+    out.reserve(4096);
+    global_metrics.write(out);
+    for (auto direction : {TransferDirection::DOWNLOAD, TransferDirection::UPLOAD}) {
+        bool download = direction == TransferDirection::DOWNLOAD;
+        const char *labels = download ? "{direction=\"download\"}" : "{direction=\"upload\"}";
+        write_sample(out, "box3web_active_transfers", "gauge", download ? "Transfers under way." : nullptr, labels,
+                     this->admission_->active(direction));
+    }
+    for (auto direction : {TransferDirection::DOWNLOAD, TransferDirection::UPLOAD}) {
+        bool download = direction == TransferDirection::DOWNLOAD;
+        const char *labels = download ? "{direction=\"download\"}" : "{direction=\"upload\"}";
+        write_sample(out, "box3web_refused_transfers_total", "counter",
+                     download ? "Transfers answered 503 over a cap." : nullptr, labels,
+                     this->admission_->refused(direction));
+    }
+    write_sample(out, "box3web_buffer_pool_free", "gauge", "Transfer buffers free.", "",
+                 this->buffer_pool_->available());
+    write_sample(out, "box3web_buffer_pool_low_water", "gauge", "Fewest transfer buffers free so far.", "",
+                 this->buffer_pool_->low_water());
+    write_sample(out, "box3web_buffer_pool_exhausted_total", "counter", "Waits for a transfer buffer that timed out.",
+                 "", this->buffer_pool_->exhaustions());
+    if (this->listing_cache_ != nullptr) {
+        write_sample(out, "box3web_listing_cache_hits_total", "counter", "Listings served from the cache.", "",
+                     this->listing_cache_->hits());
+        write_sample(out, "box3web_listing_cache_misses_total", "counter", "Listings read from the card.", "",
+                     this->listing_cache_->misses());
+        write_sample(out, "box3web_listing_cache_bytes", "gauge", "Memory held by cached listings.", "",
+                     this->listing_cache_->bytes());
+    }
+    if (this->search_index_ != nullptr) {
+        write_sample(out, "box3web_search_index_entries", "gauge", "Entries in the search index.", "",
+                     this->search_index_->entries());
+        write_sample(out, "box3web_search_index_journal", "gauge", "Changes journaled since the last build.", "",
+                     this->search_index_->journal_size());
+    }
+    write_sample(out, "box3web_resumable_uploads", "gauge", "Resumable uploads pending.", "",
+                 this->resumable_->size());
+    if (this->change_feed_ != nullptr) {
+        write_sample(out, "box3web_change_feed_subscribers", "gauge", "Clients following a directory.", "",
+                     this->change_feed_->subscribers());
+    }
+    send_text(request, 200, "text/plain; version=0.0.4", out, {{"Cache-Control", "no-store"}});
+}
+
+void Box3Web::publish_metrics() {
+#ifdef USE_SENSOR
+    if (this->requests_sensor_ != nullptr)
+        this->requests_sensor_->publish_state(global_metrics.requests());
+    if (this->errors_sensor_ != nullptr)
+        this->errors_sensor_->publish_state(global_metrics.errors());
+    if (this->bytes_sent_sensor_ != nullptr)
+        this->bytes_sent_sensor_->publish_state(global_metrics.bytes_sent());
+    if (this->bytes_received_sensor_ != nullptr)
+        this->bytes_received_sensor_->publish_state(global_metrics.bytes_received());
+    if (this->active_transfers_sensor_ != nullptr) {
+        this->active_transfers_sensor_->publish_state(this->admission_->active(TransferDirection::DOWNLOAD) +
+                                                      this->admission_->active(TransferDirection::UPLOAD));
+    }
+    // Mean latency in ms over the interval, NAN when the card was not touched.
+    auto mean = [](LatencyHistogram const &histogram, uint32_t &count, uint64_t &sum_us) {
+        uint32_t total = histogram.count();
+        uint64_t total_us = histogram.sum_us();
+        uint32_t calls = total - count;
+        uint64_t us = total_us - sum_us;
+        count = total;
+        sum_us = total_us;
+        return calls > 0 ? us / 1000.0f / calls : NAN;
+    };
+    float read = mean(global_metrics.card_read(), this->published_reads_, this->published_read_us_);
+    float write = mean(global_metrics.card_write(), this->published_writes_, this->published_write_us_);
+    if (this->card_read_latency_sensor_ != nullptr)
+        this->card_read_latency_sensor_->publish_state(read);
+    if (this->card_write_latency_sensor_ != nullptr)
+        this->card_write_latency_sensor_->publish_state(write);
 #endif
-    request->send(response);
 }
 
-void Box3Web::handle_delete(AsyncWebServerRequest *request) {
-    if (!this->deletion_enabled_) {
-        request->send(401, "application/json", "{ \"error\": \"file deletion is disabled\" }");
+void Box3Web::invalidate_directory(std::string const &path) {
+    if (this->listing_cache_ != nullptr)
+        this->listing_cache_->invalidate(path);
+    this->bump_listing_generation();
+}
+
+void Box3Web::invalidate_batch(std::set<std::string> const &directories, std::set<std::string> const &trees) {
+    if (this->listing_cache_ != nullptr) {
+        for (auto const &directory : directories)
+            this->listing_cache_->invalidate(directory);
+        for (auto const &tree : trees)
+            this->listing_cache_->invalidate_tree(tree);
+    }
+    this->bump_listing_generation();
+}
+
+void Box3Web::notify_change(ChangeKind kind, std::string const &path, bool tree) {
+    if (this->change_feed_ != nullptr)
+        this->change_feed_->publish(kind, path, tree);
+}
+
+void Box3Web::index_change(std::string const &path, bool tree) {
+    if (this->search_index_ == nullptr)
+        return;
+    if (tree) {
+        this->search_index_->update_tree(path);
+    } else {
+        this->search_index_->update(path);
+    }
+}
+
+void Box3Web::bump_listing_generation() {
+    this->listing_generation_++;
+    time_t now = ::time(nullptr);
+    this->last_write_ = now >= MIN_VALID_TIME ? now : 0;
+}
+
+std::string Box3Web::cache_control_for(Mount const &mount, std::string const &content_type) const {
+    for (auto const &rule : mount.cache_control) {
+        if (str_startswith(content_type, rule.first))
+            return rule.second;
+    }
+    for (auto const &rule : this->cache_control_) {
+        if (str_startswith(content_type, rule.first))
+            return rule.second;
+    }
+    return "no-cache";
+}
+
+Headers Box3Web::listing_validators(AsyncWebServerRequest *request, Mount const &mount, std::string const &path,
+                                    std::string const &content_type) const {
+    // Every query argument shaping the page is part of the representation, and so is the mount: the same
+    // folder gets other links and buttons under another prefix.
+    std::string key = mount.prefix + '\n' + path;
+    for (const char *arg : {"format", "sort", "cursor", "limit"}) {
+        key += '\n';
+        if (request->hasArg(arg))
+            key += request->arg(arg).c_str();
+    }
+    // The folder page carries the id of the last change; a page revalidated with an older one would be told to
+    // reset by the feed, reload and get the same page again.
+    if (this->change_feed_ != nullptr)
+        key += '\n' + this->change_feed_->last_id();
+    char etag[40];
+    snprintf(etag, sizeof(etag), "W/\"%08x-%x-%08x\"", (unsigned) this->boot_id_,
+             (unsigned) this->listing_generation_.load(), (unsigned) fnv1_hash(key));
+    Headers headers;
+    headers.emplace_back("ETag", etag);
+    headers.emplace_back("Cache-Control", this->cache_control_for(mount, content_type));
+    if (this->last_write_ != 0)
+        headers.emplace_back("Last-Modified", http_date(this->last_write_));
+    return headers;
+}
+
+std::shared_ptr<ChunkSource> Box3Web::make_file_source(std::unique_ptr<SdFile> file, size_t offset,
+                                                       size_t length) const {
+#ifdef USE_BOX3WEB_READ_AHEAD
+    // Prefetching only pays off once there is more than one block to overlap.
+    if (length > this->buffer_pool_->buffer_size()) {
+        auto source = std::make_shared<ReadAheadSource>(std::move(file), offset, length, this->buffer_pool_.get(),
+                                                        this->read_ahead_depth_);
+        if (!source->start())
+            ESP_LOGW(TAG, "Read-ahead unavailable, reading inline");
+        return source;
+    }
+#endif
+    return std::make_shared<FileSource>(std::move(file), offset, length);
+}
+
+void Box3Web::handle_delete(AsyncWebServerRequest *request, Mount const &mount, std::string const &path) {
+    global_metrics.request(RequestKind::DELETE);
+    if (!mount.deletion_enabled) {
+        send_text(request, 401, "application/json", "{ \"error\": \"file deletion is disabled\" }");
         return;
     }
-    std::string extracted = this->extract_path_from_url(std::string(request->url().c_str()));
-    std::string path = this->build_absolute_path(extracted);
     if (this->sd_mmc_card_->is_directory(path)) {
-        request->send(401, "application/json", "{ \"error\": \"cannot delete a directory\" }");
+        send_text(request, 401, "application/json", "{ \"error\": \"cannot delete a directory\" }");
         return;
     }
     if (this->sd_mmc_card_->delete_file(path)) {
-        request->send(204, "application/json", "{}");
+        remove_digest(path);
+        this->invalidate_directory(Path::parent(path));
+        this->index_change(path);
+        this->notify_change(ChangeKind::REMOVE, path);
+        send_text(request, 204, "application/json", "{}");
         return;
     }
-    request->send(401, "application/json", "{ \"error\": \"failed to delete file\" }");
+    send_text(request, 401, "application/json", "{ \"error\": \"failed to delete file\" }");
 }
 
-std::string Box3Web::build_prefix() const {
-    if (this->url_prefix_.length() == 0 || this->url_prefix_.at(0) != '/')
-        return "/" + this->url_prefix_;
-    return this->url_prefix_;
+void Box3Web::handle_batch(AsyncWebServerRequest *request, Mount const &mount, std::string const &path) {
+    global_metrics.request(RequestKind::BATCH);
+    if (!mount.deletion_enabled && !mount.upload_enabled) {
+        send_text(request, 401, "application/json", "{ \"error\": \"file operations are disabled\" }");
+        return;
+    }
+    if (!this->sd_mmc_card_->is_directory(path)) {
+        send_text(request, 400, "application/json", "{ \"error\": \"invalid batch folder\" }");
+        return;
+    }
+    if (request->contentLength() > MAX_BATCH_BODY) {
+        send_text(request, 413, "application/json", "{ \"error\": \"batch body too large\" }");
+        return;
+    }
+    std::unique_ptr<BatchParser> parser;
+#ifdef USE_ESP_IDF
+    // As for PATCH, web_server_idf leaves the body unread.
+    PoolBuffer chunk = this->buffer_pool_->acquire(BUFFER_WAIT_MS);
+    if (!chunk) {
+        send_busy(request);
+        return;
+    }
+    parser.reset(new BatchParser());
+    httpd_req_t *req = *request;
+    size_t remaining = request->contentLength();
+    int timeouts = 0;
+    while (remaining > 0) {
+        int received = httpd_req_recv(req, reinterpret_cast<char *>(chunk.data()), std::min(remaining, chunk.size()));
+        if (received == HTTPD_SOCK_ERR_TIMEOUT && ++timeouts < PATCH_RECV_RETRIES)
+            continue;
+        if (received <= 0)
+            return;
+        timeouts = 0;
+        global_metrics.received(received);
+        if (!parser->feed(reinterpret_cast<const char *>(chunk.data()), received))
+            break;
+        remaining -= received;
+    }
+    // send_stream() takes a buffer of its own.
+    chunk.release();
+#else
+    {
+        LockGuard guard(this->uploads_mutex_);
+        auto it = this->batches_.find(request);
+        if (it != this->batches_.end()) {
+            parser = std::move(it->second);
+            this->batches_.erase(it);
+        }
+    }
+#endif
+    if (parser == nullptr || !parser->finish()) {
+        int status = parser != nullptr ? parser->status() : 400;
+        std::string error = parser != nullptr ? parser->error() : "empty batch";
+        send_text(request, status, "application/json", "{ \"error\": \"" + error + "\" }");
+        return;
+    }
+    StreamHead head;
+    head.content_type = "application/x-ndjson";
+    head.headers.emplace_back("Cache-Control", "no-store");
+    auto source = std::make_shared<BatchSource>(this, &mount, path, parser->take_ops());
+    send_stream(request, head, source, this->buffer_pool_.get());
 }
 
-std::string Box3Web::extract_path_from_url(std::string const &url) const {
-    std::string prefix = this->build_prefix();
-    return url.substr(prefix.size(), url.size() - prefix.size());
+PathError Box3Web::resolve_path(AsyncWebServerRequest *request, const Mount *&mount, PathBuffer &path) const {
+    // Both web server backends hand url() over already percent-decoded, so only normalize here.
+    const auto &url = request->url();
+    std::string_view relative;
+    mount = this->mounts_.find(std::string_view(url.c_str(), url.length()), relative);
+    if (mount == nullptr)
+        return PathError::MALFORMED;
+    if (!path.append(mount->root_base))
+        return PathError::TOO_LONG;
+    PathError error = append_url_path(relative, false, path);
+    if (error == PathError::NONE && path.empty())
+        path.push_back(Path::separator);
+    return error;
 }
 
-std::string Box3Web::build_absolute_path(std::string relative_path) const {
-    if (relative_path.size() == 0)
-        return this->root_path_;
-    std::string absolute = Path::join(this->root_path_, relative_path);
-    return absolute;
+void Box3Web::send_path_error(AsyncWebServerRequest *request, PathError error) const {
+    int code = 400;
+    if (error == PathError::TRAVERSAL || error == PathError::RESERVED) {
+        code = 403;
+    } else if (error == PathError::TOO_LONG) {
+        code = 414;
+    }
+    send_text(request, code, "application/json", path_error_message(error));
 }
 
 std::string Path::file_name(std::string const &path) {
@@ -379,12 +1510,24 @@ std::string Path::join(std::string const &first, std::string const &second) {
     return result;
 }
 
-std::string Path::remove_root_path(std::string path, std::string const &root) {
+std::string Path::parent(std::string const &path) {
+    std::string trimmed = path;
+    while (trimmed.size() > 1 && trailing_slash(trimmed))
+        trimmed.pop_back();
+    size_t pos = trimmed.rfind(Path::separator);
+    if (pos == std::string::npos)
+        return "";
+    if (pos == 0)
+        return "/";
+    return trimmed.substr(0, pos);
+}
+
+std::string Path::remove_root_path(std::string const &path, std::string const &root) {
     if (!str_startswith(path, root))
         return path;
     if (path.size() == root.size() || path.size() < 2)
         return "/";
-    return path.erase(0, root.size());
+    return path.substr(root.size());
 }
 
 }  // namespace box3web
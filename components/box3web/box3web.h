@@ -1,9 +1,37 @@
 #pragma once
 
+#include <atomic>
+#include <ctime>
+#include <map>
+#include <memory>
+#include <set>
 #include <string>
 #include "esphome/components/web_server_base/web_server_base.h"
 #include "../sd_mmc_card/sd_mmc_card.h"
+#include "admission.h"
+#include "archive.h"
+#include "batch.h"
+#include "buffer_pool.h"
+#include "change_feed.h"
+#include "transfer.h"
+#include "content_type.h"
+#include "url_path.h"
+#include "upload.h"
+#include "pipeline.h"
+#include "readahead.h"
+#include "resumable.h"
+#include "search_index.h"
+#include "listing_cache.h"
+#include "listing.h"
+#include "mount.h"
+#include "deflate.h"
+#include "metrics.h"
+#include "esphome/core/defines.h"
+#include "esphome/core/helpers.h"
 #include "esphome/core/component.h"  // Ajout de Component
+#ifdef USE_SENSOR
+#include "esphome/components/sensor/sensor.h"
+#endif
 
 namespace esphome {
 namespace box3web {
@@ -15,16 +43,23 @@ class Path {
   static bool is_absolute(std::string const &path);
   static bool trailing_slash(std::string const &path);
   static std::string join(std::string const &first, std::string const &second);
-  static std::string remove_root_path(std::string path, std::string const &root);
+  static std::string remove_root_path(std::string const &path, std::string const &root);
+  static std::string parent(std::string const &path);
 };
 
+static const uint32_t DEFAULT_RESUMABLE_EXPIRY = 24 * 60 * 60 * 1000;
+
 class Box3Web : public Component, public AsyncWebHandler {  // Héritage de Component
+  friend class HtmlListingSource;
+  friend class BatchSource;
+
  public:
   Box3Web(web_server_base::WebServerBase *base);
 
   void setup() override;  // Méthode obligatoire
   void dump_config() override;  // Méthode obligatoire
 
+  // url_prefix, root_path and the enable flags describe the primary mount.
   void set_url_prefix(std::string const &prefix);
   void set_root_path(std::string const &path);
   void set_sd_mmc_card(sd_mmc_card::SdMmc *card);
@@ -32,11 +67,64 @@ class Box3Web : public Component, public AsyncWebHandler {  // Héritage de Comp
   void set_deletion_enabled(bool allow);
   void set_download_enabled(bool allow);
   void set_upload_enabled(bool allow);
+  // Additional mounts, served by the same handler.
+  void add_mount(std::string const &url_prefix, std::string const &root_path, bool deletion, bool download,
+                 bool upload);
+  void add_mount_cache_control(std::string const &url_prefix, std::string const &content_type,
+                               std::string const &value);
+  // Shared transfer buffers for downloads, uploads and listings, allocated once in setup().
+  void set_buffer_pool(size_t buffer_size, size_t count, size_t per_request);
+  BufferPool *get_buffer_pool() const { return this->buffer_pool_.get(); }
+  // Caps on concurrent transfers, 0 = unlimited. Requests over a cap are answered 503 with Retry-After.
+  void set_transfer_limits(uint8_t max_downloads, uint8_t max_uploads, uint8_t per_client_downloads,
+                           uint8_t per_client_uploads);
+  // Per-client token buckets in bytes per second, 0 = unshaped.
+  void set_transfer_rates(uint32_t download_rate, uint32_t upload_rate, uint32_t burst);
+  // Bounded wait for servers streaming from worker tasks, e.g. EspHttpServer::set_admission().
+  void set_admission_queue(uint8_t size, uint32_t timeout_ms, uint32_t retry_after);
+  AdmissionControl *get_admission() const { return this->admission_.get(); }
+  // Resumable uploads (tus-like): POST with Upload-Length creates one, HEAD ?upload=<id> reports the committed
+  // Upload-Offset and PATCH ?upload=<id> appends at it. Partials idle for longer than the expiry are removed.
+  void set_resumable_upload_expiry(uint32_t expiry_ms);
+  void set_listing_cache_size(size_t size);
+  // Persistent on-card index answering GET <dir>?search=<glob>, rebuilt after refresh_ms (0 = only when stale).
+  void set_search_index(uint32_t refresh_ms, size_t max_entries);
+  void set_index_sort_limit(size_t limit);
+  // Gzip compressed file of the folder page, generated at build time and served from flash under
+  // /<prefix>/_assets/<name>. name carries a hash of the content, so browsers keep it for good.
+  void add_ui_asset(const char *name, const char *content_type, const uint8_t *data, size_t size);
+  // Serves GET <dir>?events as a stream of server-sent events for changes made through the component, to at
+  // most max_subscribers clients at once. Quiet streams carry a comment every keepalive_ms.
+  void set_change_feed(size_t max_subscribers, uint32_t keepalive_ms);
+  // Serves GET /<prefix>/_metrics in Prometheus text format and publishes the metric sensors every
+  // update_interval ms.
+  void set_metrics(uint32_t update_interval);
+#ifdef USE_SENSOR
+  void set_requests_sensor(sensor::Sensor *sensor) { this->requests_sensor_ = sensor; }
+  void set_errors_sensor(sensor::Sensor *sensor) { this->errors_sensor_ = sensor; }
+  void set_bytes_sent_sensor(sensor::Sensor *sensor) { this->bytes_sent_sensor_ = sensor; }
+  void set_bytes_received_sensor(sensor::Sensor *sensor) { this->bytes_received_sensor_ = sensor; }
+  void set_active_transfers_sensor(sensor::Sensor *sensor) { this->active_transfers_sensor_ = sensor; }
+  void set_card_read_latency_sensor(sensor::Sensor *sensor) { this->card_read_latency_sensor_ = sensor; }
+  void set_card_write_latency_sensor(sensor::Sensor *sensor) { this->card_write_latency_sensor_ = sensor; }
+#endif
+  // Adds or overrides a file extension in the content type table both servers share.
+  void add_content_type(const char *extension, const char *mime, ContentCategory category);
+  // Cache-Control value for responses whose content type starts with the given prefix, first match wins.
+  void add_cache_control(std::string const &content_type, std::string const &value);
+  void set_listing_compression(bool enabled, size_t window);
+#ifdef USE_BOX3WEB_READ_AHEAD
+  void set_read_ahead(size_t depth);
+#endif
+#ifdef USE_BOX3WEB_UPLOAD_PIPELINE
+  void set_upload_pipeline(size_t buffer_size, uint8_t task_priority);
+#endif
 
   bool canHandle(AsyncWebServerRequest *request) override;
   void handleRequest(AsyncWebServerRequest *request) override;
   void handleUpload(AsyncWebServerRequest *request, const String &filename, size_t index, uint8_t *data,
                     size_t len, bool final) override;
+  void handleBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) override;
 
  private:
   web_server_base::WebServerBase *base_{nullptr};
@@ -49,17 +137,126 @@ class Box3Web : public Component, public AsyncWebHandler {  // Héritage de Comp
   bool download_enabled_{true};
   bool upload_enabled_{true};
 
-  void handle_get(AsyncWebServerRequest *request) const;
-  void handle_index(AsyncWebServerRequest *request, std::string const &path) const;
-  void handle_download(AsyncWebServerRequest *request, std::string const &path) const;
-  void handle_delete(AsyncWebServerRequest *request);
+  // Extra mounts come from codegen, the primary one is added in setup() once its setters have run.
+  MountTable mounts_;
+
+  std::unique_ptr<BufferPool> buffer_pool_;
+  std::unique_ptr<AdmissionControl> admission_{new AdmissionControl()};
+  std::unique_ptr<ResumableUploads> resumable_{new ResumableUploads(DEFAULT_RESUMABLE_EXPIRY)};
+  std::unique_ptr<SearchIndex> search_index_;
+  std::unique_ptr<ChangeFeed> change_feed_;
+  struct UiAsset {
+    const char *name;
+    const char *content_type;
+    const uint8_t *data;
+    size_t size;
+  };
+  std::vector<UiAsset> ui_assets_;
+  bool metrics_enabled_{false};
+  uint32_t metrics_interval_{60000};
+#ifdef USE_SENSOR
+  sensor::Sensor *requests_sensor_{nullptr};
+  sensor::Sensor *errors_sensor_{nullptr};
+  sensor::Sensor *bytes_sent_sensor_{nullptr};
+  sensor::Sensor *bytes_received_sensor_{nullptr};
+  sensor::Sensor *active_transfers_sensor_{nullptr};
+  sensor::Sensor *card_read_latency_sensor_{nullptr};
+  sensor::Sensor *card_write_latency_sensor_{nullptr};
+  // Histogram totals at the last publish, the latency sensors show the mean since then.
+  uint32_t published_reads_{0};
+  uint64_t published_read_us_{0};
+  uint32_t published_writes_{0};
+  uint64_t published_write_us_{0};
+#endif
+  size_t index_sort_limit_{256};
+  bool compress_listings_{false};
+  size_t compression_window_{2048};
+#ifdef USE_BOX3WEB_READ_AHEAD
+  size_t read_ahead_depth_{2};
+#endif
+
+  std::unique_ptr<ListingCache> listing_cache_;
+
+  std::vector<std::pair<std::string, std::string>> cache_control_;
+  // Listing validators: bumped on every write, salted per boot since the counter restarts.
+  uint32_t boot_id_{0};
+  std::atomic<uint32_t> listing_generation_{0};
+  time_t last_write_{0};
+
+  // Open uploads keyed by request, touched from the web server task and swept from the main loop.
+  std::map<AsyncWebServerRequest *, std::unique_ptr<UploadSession>> uploads_;
+  // Status for PATCH bodies refused while they were streaming in, answered once the request completes.
+  std::map<AsyncWebServerRequest *, int> refused_bodies_;
+  // Batch bodies being parsed as they arrive on the Arduino backend.
+  std::map<AsyncWebServerRequest *, std::unique_ptr<BatchParser>> batches_;
+  Mutex uploads_mutex_;
+#ifdef USE_BOX3WEB_UPLOAD_PIPELINE
+  std::unique_ptr<UploadPipeline> upload_pipeline_;
+#endif
+
+  void handle_get(AsyncWebServerRequest *request, Mount const &mount, std::string const &path) const;
+  void handle_index(AsyncWebServerRequest *request, Mount const &mount, std::string const &path) const;
+  void handle_json_index(AsyncWebServerRequest *request, Mount const &mount, std::string const &path) const;
+  void handle_download(AsyncWebServerRequest *request, Mount const &mount, std::string const &path) const;
+  // ?archive=zip|tar on a directory streams the whole tree below it.
+  void handle_archive(AsyncWebServerRequest *request, Mount const &mount, std::string const &path) const;
+  void handle_search(AsyncWebServerRequest *request, Mount const &mount, std::string const &path) const;
+  void handle_events(AsyncWebServerRequest *request, std::string const &path) const;
+  void handle_delete(AsyncWebServerRequest *request, Mount const &mount, std::string const &path);
+  void handle_metrics(AsyncWebServerRequest *request) const;
+  void handle_asset(AsyncWebServerRequest *request, std::string const &name) const;
+  void publish_metrics();
+  // POST <dir>?batch with a JSON array of delete, mkdir and move items, answered with one NDJSON line per item.
+  void handle_batch(AsyncWebServerRequest *request, Mount const &mount, std::string const &path);
+
+  // Must be called by every operation that adds, removes or changes entries of a directory.
+  void invalidate_directory(std::string const &path);
+  // Same for a whole batch at once: directories changed, trees were removed or moved away with all below them.
+  void invalidate_batch(std::set<std::string> const &directories, std::set<std::string> const &trees);
+  void bump_listing_generation();
+  // Keeps the search index in step with a change made through the component. tree marks a folder removed or
+  // moved in with everything below it.
+  void index_change(std::string const &path, bool tree = false);
+  // Tells the clients following the parent directory, tree as for index_change().
+  void notify_change(ChangeKind kind, std::string const &path, bool tree = false);
+
+  std::string cache_control_for(Mount const &mount, std::string const &content_type) const;
+  bool listing_gzip(AsyncWebServerRequest *request, Headers &validators) const;
+  void send_listing(AsyncWebServerRequest *request, StreamHead &head, std::shared_ptr<ChunkSource> source,
+                    bool gzip) const;
+  Headers listing_validators(AsyncWebServerRequest *request, Mount const &mount, std::string const &path,
+                             std::string const &content_type) const;
+
+  std::shared_ptr<ChunkSource> make_file_source(std::unique_ptr<SdFile> file, size_t offset, size_t length) const;
+
+  // Resumable upload a request refers to.
+  struct ResumableTarget {
+    std::string path;
+    std::string partial;
+    size_t length{0};
+  };
+  // The helpers return 0 on success, the HTTP status to answer otherwise.
+  int find_resumable(AsyncWebServerRequest *request, ResumableTarget &target);
+  int check_patch_offset(AsyncWebServerRequest *request, ResumableTarget const &target) const;
+  // Opens the session appending to the partial, uploads_mutex_ must be held. 423 while another request is
+  // already appending to it.
+  int begin_patch(AsyncWebServerRequest *request, ResumableTarget const &target);
+  void handle_resumable(AsyncWebServerRequest *request, int method, Mount const &mount, std::string const &path);
+  void handle_resumable_create(AsyncWebServerRequest *request, Mount const &mount, std::string const &path);
+  void handle_patch(AsyncWebServerRequest *request, ResumableTarget const &target);
+  void send_resumable_error(AsyncWebServerRequest *request, int status, ResumableTarget const &target);
+
+  void abort_upload(AsyncWebServerRequest *request);
+  void expire_uploads();
 
-  void write_row(AsyncResponseStream *response, sd_mmc_card::FileInfo const &info) const;
+  void write_index_head(std::string &out, Mount const &mount, std::string const &path) const;
+  void write_row(std::string &out, Mount const &mount, sd_mmc_card::FileInfo const &info) const;
+  void write_index_tail(std::string &out) const;
 
-  String get_content_type(const std::string &path) const;
-  std::string build_prefix() const;
-  std::string extract_path_from_url(std::string const &url) const;
-  std::string build_absolute_path(std::string relative_path) const;
+  // Mount serving the request url (nullptr if none) and the normalized card path below it, written into a
+  // stack buffer.
+  PathError resolve_path(AsyncWebServerRequest *request, const Mount *&mount, PathBuffer &path) const;
+  void send_path_error(AsyncWebServerRequest *request, PathError error) const;
 
   const char *component_source_{nullptr};  // Variable pour set_component_source (facultatif)
 };
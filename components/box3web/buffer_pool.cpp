@@ -0,0 +1,155 @@
+#include "buffer_pool.h"
+#include "esphome/core/defines.h"
+#include "esphome/core/log.h"
+
+#include <algorithm>
+#include <cstdlib>
+#ifdef USE_ESP32
+#include <esp_heap_caps.h>
+#endif
+
+namespace esphome {
+namespace box3web {
+
+static const char *TAG = "box3web.pool";
+
+// Largest data cache line among the supported chips, DMA descriptors want at least word alignment.
+static const size_t BUFFER_ALIGNMENT = 64;
+// Smallest buffer a short pool falls back to, still a few TCP segments and a multiple of the alignment.
+static const size_t MIN_BUFFER_SIZE = 4096;
+
+PoolBuffer::PoolBuffer(PoolBuffer &&other) noexcept : pool_(other.pool_), data_(other.data_) {
+    other.pool_ = nullptr;
+    other.data_ = nullptr;
+}
+
+PoolBuffer &PoolBuffer::operator=(PoolBuffer &&other) noexcept {
+    if (this != &other) {
+        this->release();
+        this->pool_ = other.pool_;
+        this->data_ = other.data_;
+        other.pool_ = nullptr;
+        other.data_ = nullptr;
+    }
+    return *this;
+}
+
+void PoolBuffer::release() {
+    if (this->data_ != nullptr)
+        this->pool_->release(this->data_);
+    this->pool_ = nullptr;
+    this->data_ = nullptr;
+}
+
+size_t PoolBuffer::size() const { return this->pool_ != nullptr ? this->pool_->buffer_size() : 0; }
+
+BufferPool::BufferPool(size_t buffer_size, size_t count, size_t per_request)
+    : buffer_size_((buffer_size + BUFFER_ALIGNMENT - 1) / BUFFER_ALIGNMENT * BUFFER_ALIGNMENT),
+      count_(count),
+      per_request_(per_request) {}
+
+BufferPool::~BufferPool() {
+    if (this->free_ != nullptr)
+        vQueueDelete(this->free_);
+#ifdef USE_ESP32
+    heap_caps_free(this->storage_);
+#else
+    free(this->storage_);
+#endif
+}
+
+static uint8_t *allocate_storage(size_t total) {
+#ifdef USE_ESP32
+    return static_cast<uint8_t *>(
+        heap_caps_aligned_alloc(BUFFER_ALIGNMENT, total, MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT));
+#else
+    return static_cast<uint8_t *>(aligned_alloc(BUFFER_ALIGNMENT, total));
+#endif
+}
+
+bool BufferPool::setup() {
+    size_t wanted_count = this->count_;
+    size_t wanted_size = this->buffer_size_;
+    // On a tight heap fewer buffers first, then a single smaller one, rather than no transfers at all.
+    while ((this->storage_ = allocate_storage(this->buffer_size_ * this->count_)) == nullptr) {
+        if (this->count_ > 1) {
+            this->count_--;
+        } else if (this->buffer_size_ / 2 >= MIN_BUFFER_SIZE) {
+            this->buffer_size_ = this->buffer_size_ / 2 / BUFFER_ALIGNMENT * BUFFER_ALIGNMENT;
+        } else {
+            break;
+        }
+    }
+    QueueHandle_t queue = this->storage_ != nullptr ? xQueueCreate(this->count_, sizeof(uint8_t *)) : nullptr;
+    if (queue == nullptr) {
+        ESP_LOGE(TAG, "Cannot allocate %u transfer buffers of %u bytes", (unsigned) wanted_count,
+                 (unsigned) wanted_size);
+        return false;
+    }
+    if (this->count_ != wanted_count || this->buffer_size_ != wanted_size) {
+        ESP_LOGW(TAG, "Not enough memory for %u transfer buffers of %u bytes, using %u of %u bytes",
+                 (unsigned) wanted_count, (unsigned) wanted_size, (unsigned) this->count_,
+                 (unsigned) this->buffer_size_);
+    }
+    this->per_request_ = std::min(this->per_request_, this->count_);
+    for (size_t i = 0; i < this->count_; i++) {
+        uint8_t *buffer = this->storage_ + i * this->buffer_size_;
+        xQueueSend(queue, &buffer, 0);
+    }
+    this->free_ = queue;
+    this->available_ = this->count_;
+    this->low_water_ = this->count_;
+    return true;
+}
+
+uint8_t *BufferPool::take(uint32_t wait_ms) {
+    uint8_t *data = nullptr;
+    if (this->free_ == nullptr || xQueueReceive(this->free_, &data, pdMS_TO_TICKS(wait_ms)) != pdTRUE)
+        return nullptr;
+    size_t available = --this->available_;
+    size_t low = this->low_water_;
+    while (available < low && !this->low_water_.compare_exchange_weak(low, available)) {
+    }
+    return data;
+}
+
+PoolBuffer BufferPool::acquire(uint32_t wait_ms) {
+    uint8_t *data = this->take(wait_ms);
+    if (data == nullptr) {
+        // Logged on the first exhaustion and then every 16th, it can happen in bursts.
+        if ((this->exhaustions_++ & 15) == 0) {
+            ESP_LOGW(TAG, "Transfer buffer pool exhausted (%u buffers, %u times so far)", (unsigned) this->count_,
+                     (unsigned) this->exhaustions_.load());
+        }
+        return PoolBuffer();
+    }
+    return PoolBuffer(this, data);
+}
+
+std::vector<PoolBuffer> BufferPool::acquire_for_request(size_t wanted, uint32_t wait_ms) {
+    std::vector<PoolBuffer> buffers;
+    wanted = std::min(wanted, this->per_request_);
+    if (wanted == 0)
+        return buffers;
+    PoolBuffer first = this->acquire(wait_ms);
+    if (!first)
+        return buffers;
+    buffers.reserve(wanted);
+    buffers.push_back(std::move(first));
+    // Extra buffers only when free right now, a busy pool shrinks the request rather than stalling it.
+    while (buffers.size() < wanted) {
+        uint8_t *data = this->take(0);
+        if (data == nullptr)
+            break;
+        buffers.emplace_back(this, data);
+    }
+    return buffers;
+}
+
+void BufferPool::release(uint8_t *data) {
+    xQueueSend(this->free_, &data, 0);
+    this->available_++;
+}
+
+}  // namespace box3web
+}  // namespace esphome
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+
+namespace esphome {
+namespace box3web {
+
+class BufferPool;
+
+// Exclusive loan of one pool buffer, handed back when destroyed.
+class PoolBuffer {
+ public:
+  PoolBuffer() = default;
+  PoolBuffer(BufferPool *pool, uint8_t *data) : pool_(pool), data_(data) {}
+  PoolBuffer(PoolBuffer &&other) noexcept;
+  PoolBuffer &operator=(PoolBuffer &&other) noexcept;
+  PoolBuffer(PoolBuffer const &) = delete;
+  PoolBuffer &operator=(PoolBuffer const &) = delete;
+  ~PoolBuffer() { this->release(); }
+
+  void release();
+  uint8_t *data() const { return this->data_; }
+  size_t size() const;
+  explicit operator bool() const { return this->data_ != nullptr; }
+
+ protected:
+  BufferPool *pool_{nullptr};
+  uint8_t *data_{nullptr};
+};
+
+// Fixed set of equally sized, DMA-capable, cache-line aligned buffers carved out of one allocation at
+// setup, so transfers never touch the heap and cannot fragment it over time.
+class BufferPool {
+ public:
+  BufferPool(size_t buffer_size, size_t count, size_t per_request);
+  ~BufferPool();
+
+  // Falls back to fewer buffers, then to one smaller buffer, when the heap is short. False only when not even
+  // that one fits.
+  bool setup();
+
+  // One buffer, waiting up to wait_ms for another transfer to return one.
+  PoolBuffer acquire(uint32_t wait_ms = 0);
+  // Up to min(wanted, per_request) buffers for one request. Empty only when the pool stayed exhausted for wait_ms.
+  std::vector<PoolBuffer> acquire_for_request(size_t wanted, uint32_t wait_ms = 0);
+
+  size_t buffer_size() const { return this->buffer_size_; }
+  size_t count() const { return this->count_; }
+  size_t per_request() const { return this->per_request_; }
+  size_t available() const { return this->available_; }
+  size_t low_water() const { return this->low_water_; }
+  uint32_t exhaustions() const { return this->exhaustions_; }
+
+ protected:
+  friend class PoolBuffer;
+  void release(uint8_t *data);
+  uint8_t *take(uint32_t wait_ms);
+
+  size_t buffer_size_;
+  size_t count_;
+  size_t per_request_;
+  uint8_t *storage_{nullptr};
+  QueueHandle_t free_{nullptr};  // pointers of the buffers not on loan
+  std::atomic<size_t> available_{0};
+  std::atomic<size_t> low_water_{0};
+  std::atomic<uint32_t> exhaustions_{0};
+};
+
+}  // namespace box3web
+}  // namespace esphome
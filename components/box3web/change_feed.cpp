@@ -0,0 +1,273 @@
+#include "change_feed.h"
+#include "box3web.h"
+#include "content_type.h"
+#include "directory.h"
+#include "metrics.h"
+#include "transfer.h"
+#include "esphome/core/hal.h"
+#include "esphome/core/log.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/stat.h>
+
+namespace esphome {
+namespace box3web {
+
+static const char *TAG = "box3web.feed";
+
+// Events a subscriber may fall behind by; past that it is reset instead of holding more.
+static const size_t FEED_QUEUE_SIZE = 16;
+// Changes remembered for clients reconnecting with an older id.
+static const size_t RECENT_CHANGES = 16;
+// Sent first: how long a client waits before reconnecting, in ms.
+static const char *const FEED_PREAMBLE = "retry: 5000\n\n";
+// Event names, in the order of ChangeKind.
+static const char *const EVENT_NAMES[] = {"add", "update", "remove"};
+
+FeedSubscriber::FeedSubscriber(ChangeFeed *feed, std::string directory)
+    : feed_(feed), directory_(std::move(directory)), last_send_(millis()) {}
+
+FeedSubscriber::~FeedSubscriber() { this->feed_->unsubscribe_(this); }
+
+bool FeedSubscriber::take(std::string &out) {
+    LockGuard guard(this->feed_->lock_);
+    return this->take_(out);
+}
+
+bool FeedSubscriber::take_(std::string &out) {
+    size_t start = out.size();
+    if (this->reset_pending_) {
+        // EventSource drops events without data.
+        out += "event: reset\ndata: {}\n\n";
+        this->reset_pending_ = false;
+    }
+    for (auto const &event : this->queue_)
+        out += *event;
+    if (!this->queue_.empty())
+        this->sent_id_ = this->queued_id_;
+    this->queue_.clear();
+    // An id without data is not dispatched, EventSource only takes it as the last event id.
+    uint32_t current = this->feed_->sequence_;
+    if (this->sent_id_ != current) {
+        out += "id: ";
+        out += std::to_string(current);
+        out += "\n\n";
+        this->sent_id_ = current;
+    }
+    uint32_t now = millis();
+    // A comment now and then lets a dead connection show up as a failed write.
+    if (out.size() == start && now - this->last_send_ >= this->feed_->keepalive_ms_)
+        out += ":\n\n";
+    if (out.size() == start)
+        return false;
+    this->last_send_ = now;
+    return true;
+}
+
+void FeedSubscriber::push_(std::shared_ptr<const std::string> const &event, uint32_t id) {
+    if (this->reset_pending_)
+        return;
+    if (this->queue_.size() == FEED_QUEUE_SIZE) {
+        this->reset_();
+        return;
+    }
+    this->queue_.push_back(event);
+    this->queued_id_ = id;
+}
+
+void FeedSubscriber::reset_() {
+    this->queue_.clear();
+    this->reset_pending_ = true;
+}
+
+ChangeFeed::ChangeFeed(size_t max_subscribers, uint32_t keepalive_ms)
+    : max_subscribers_(max_subscribers), keepalive_ms_(keepalive_ms), sequence_(random_uint32()) {}
+
+size_t ChangeFeed::subscribers() const {
+    LockGuard guard(this->lock_);
+    return this->subscribers_.size();
+}
+
+std::shared_ptr<FeedSubscriber> ChangeFeed::subscribe_(std::string const &directory, std::string const &since) {
+    LockGuard guard(this->lock_);
+    if (this->subscribers_.size() >= this->max_subscribers_)
+        return nullptr;
+    auto subscriber = std::make_shared<FeedSubscriber>(this, directory);
+    subscriber->sent_id_ = this->sequence_;
+    if (!since.empty() && this->missed_(directory, since)) {
+        subscriber->reset_pending_ = true;
+    } else if (!since.empty()) {
+        // Brought up to the current id by the first take.
+        subscriber->sent_id_ = strtoul(since.c_str(), nullptr, 10);
+    }
+    this->subscribers_.push_back(subscriber.get());
+    return subscriber;
+}
+
+bool ChangeFeed::missed_(std::string const &directory, std::string const &since) const {
+    char *end;
+    unsigned long id = strtoul(since.c_str(), &end, 10);
+    if (*end != '\0' || id > UINT32_MAX)
+        return true;
+    // Ids start at random, so an id from before a reboot falls outside the recent changes but by chance.
+    uint32_t behind = this->sequence_ - static_cast<uint32_t>(id);
+    if (behind > this->recent_.size())
+        return true;
+    for (size_t i = this->recent_.size() - behind; i < this->recent_.size(); i++) {
+        Change const &change = this->recent_[i];
+        if (Path::parent(change.path) == directory)
+            return true;
+        if (change.tree && (directory == change.path || str_startswith(directory, change.path + Path::separator)))
+            return true;
+    }
+    return false;
+}
+
+void ChangeFeed::unsubscribe_(FeedSubscriber *subscriber) {
+    LockGuard guard(this->lock_);
+    auto it = std::find(this->subscribers_.begin(), this->subscribers_.end(), subscriber);
+    if (it != this->subscribers_.end())
+        this->subscribers_.erase(it);
+}
+
+void ChangeFeed::serve(AsyncWebServerRequest *request, std::string const &directory, std::string const &since) {
+    std::shared_ptr<FeedSubscriber> subscriber = this->subscribe_(directory, since);
+    if (subscriber == nullptr) {
+        ESP_LOGD(TAG, "All %u change feed subscriptions taken", (unsigned) this->max_subscribers_);
+        send_busy(request, this->keepalive_ms_ / 1000 + 1);
+        return;
+    }
+    std::string preamble = FEED_PREAMBLE;
+    subscriber->take(preamble);
+#ifdef USE_ESP_IDF
+    httpd_req_t *req = *request;
+    httpd_resp_set_status(req, http_status_line(200));
+    httpd_resp_set_type(req, "text/event-stream");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    global_metrics.response(200);
+    if (httpd_resp_send_chunk(req, preamble.data(), preamble.size()) != ESP_OK)
+        return;
+    global_metrics.sent(preamble.size());
+    {
+        LockGuard guard(this->lock_);
+        subscriber->handle_ = req->handle;
+        subscriber->fd_ = httpd_req_to_sockfd(req);
+    }
+    // The handler returns with the body still open. The session owns the subscriber from here on and httpd
+    // frees it, leaving the feed, once the client goes away.
+    req->sess_ctx = new std::shared_ptr<FeedSubscriber>(std::move(subscriber));
+    req->free_ctx = [](void *ctx) { delete static_cast<std::shared_ptr<FeedSubscriber> *>(ctx); };
+#else
+    // The body never ends. AsyncTCP polls the filler, which asks to be called again while nothing is queued;
+    // dropping the response on disconnect releases the subscriber.
+    struct Stream {
+        std::shared_ptr<FeedSubscriber> subscriber;
+        std::string pending;
+        size_t pos{0};
+    };
+    auto stream = std::make_shared<Stream>();
+    stream->subscriber = std::move(subscriber);
+    stream->pending = std::move(preamble);
+    auto *response = request->beginChunkedResponse(
+        "text/event-stream", [stream](uint8_t *buffer, size_t max_len, size_t index) -> size_t {
+            if (stream->pos == stream->pending.size()) {
+                stream->pending.clear();
+                stream->pos = 0;
+                if (!stream->subscriber->take(stream->pending))
+                    return RESPONSE_TRY_AGAIN;
+            }
+            size_t len = std::min(max_len, stream->pending.size() - stream->pos);
+            memcpy(buffer, stream->pending.data() + stream->pos, len);
+            stream->pos += len;
+            global_metrics.sent(len);
+            return len;
+        });
+    response->addHeader("Cache-Control", "no-store");
+    global_metrics.response(200);
+    request->send(response);
+#endif
+}
+
+void ChangeFeed::publish(ChangeKind kind, std::string const &path, bool tree) {
+    std::string directory = Path::parent(path);
+    std::string below = path + Path::separator;
+    LockGuard guard(this->lock_);
+    uint32_t id = ++this->sequence_;
+    this->recent_.push_back(Change{path, tree});
+    if (this->recent_.size() > RECENT_CHANGES)
+        this->recent_.pop_front();
+    std::shared_ptr<const std::string> event;
+    for (auto *subscriber : this->subscribers_) {
+        if (subscriber->directory_ == directory) {
+            if (event == nullptr)
+                event = this->render_(kind, path, id);
+            subscriber->push_(event, id);
+        } else if (tree && (subscriber->directory_ == path || str_startswith(subscriber->directory_, below))) {
+            subscriber->reset_();
+        }
+    }
+}
+
+std::shared_ptr<const std::string> ChangeFeed::render_(ChangeKind kind, std::string const &path, uint32_t id) const {
+    struct stat st;
+    // An entry gone by the time its change is published, e.g. a failed upload, was removed after all.
+    if (kind != ChangeKind::REMOVE && stat(SdFile::real_path(path).c_str(), &st) != 0)
+        kind = ChangeKind::REMOVE;
+    std::string name = Path::file_name(path);
+    auto event = std::make_shared<std::string>();
+    *event += "id: ";
+    *event += std::to_string(id);
+    *event += "\nevent: ";
+    *event += EVENT_NAMES[static_cast<size_t>(kind)];
+    *event += "\ndata: {\"name\":\"";
+    *event += json_escape(name);
+    *event += '"';
+    if (kind != ChangeKind::REMOVE) {
+        // The fields of a JSON listing entry, plus the category the folder page shows as the type.
+        bool directory = S_ISDIR(st.st_mode);
+        *event += ",\"type\":\"";
+        *event += directory ? "directory" : "file";
+        *event += "\",\"size\":";
+        *event += std::to_string(directory ? 0 : (size_t) st.st_size);
+        if (!directory) {
+            *event += ",\"category\":\"";
+            *event += category_name(content_type_for(name).category);
+            *event += '"';
+        }
+    }
+    *event += "}\n\n";
+    return event;
+}
+
+void ChangeFeed::flush() {
+#ifdef USE_ESP_IDF
+    LockGuard guard(this->lock_);
+    for (auto *subscriber : this->subscribers_) {
+        if (subscriber->fd_ < 0)
+            continue;
+        std::string chunk;
+        if (!subscriber->take_(chunk))
+            continue;
+        // httpd_resp_send_chunk() began a chunked body, every write is one more chunk of it.
+        char size[12];
+        snprintf(size, sizeof(size), "%x\r\n", (unsigned) chunk.size());
+        chunk.insert(0, size);
+        chunk += "\r\n";
+        int sent = httpd_socket_send(subscriber->handle_, subscriber->fd_, chunk.data(), chunk.size(), 0);
+        if (sent != (int) chunk.size()) {
+            // httpd closes the session on its own task, which frees the subscriber.
+            ESP_LOGD(TAG, "Change feed client on socket %d gone", subscriber->fd_);
+            httpd_sess_trigger_close(subscriber->handle_, subscriber->fd_);
+            subscriber->fd_ = -1;
+            continue;
+        }
+        global_metrics.sent(chunk.size());
+    }
+#endif
+}
+
+}  // namespace box3web
+}  // namespace esphome
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+#include "esphome/components/web_server_base/web_server_base.h"
+#include "esphome/core/defines.h"
+#include "esphome/core/helpers.h"
+#ifdef USE_ESP_IDF
+#include "esp_http_server.h"
+#endif
+
+namespace esphome {
+namespace box3web {
+
+enum class ChangeKind : uint8_t { ADD, UPDATE, REMOVE };
+
+class ChangeFeed;
+
+// One client following a directory. Its events are queued here until the connection takes them.
+class FeedSubscriber {
+ public:
+  FeedSubscriber(ChangeFeed *feed, std::string directory);
+  ~FeedSubscriber();
+  FeedSubscriber(FeedSubscriber const &) = delete;
+  FeedSubscriber &operator=(FeedSubscriber const &) = delete;
+
+  // Appends the queued events to out, or a comment when the stream has been quiet for the keepalive period.
+  // False when there is nothing to send yet.
+  bool take(std::string &out);
+
+ protected:
+  friend class ChangeFeed;
+
+  bool take_(std::string &out);
+  void push_(std::shared_ptr<const std::string> const &event, uint32_t id);
+  void reset_();
+
+  ChangeFeed *feed_;
+  std::string directory_;
+  // Everything below is guarded by the feed's lock.
+  std::deque<std::shared_ptr<const std::string>> queue_;
+  // Events were lost, the client has to list the directory again.
+  bool reset_pending_{false};
+  // Id of the last queued event and the last id the client was given. Changes elsewhere advance the ids too,
+  // the client is sent the current one so it comes back with it after a reconnect.
+  uint32_t queued_id_{0};
+  uint32_t sent_id_{0};
+  uint32_t last_send_;
+#ifdef USE_ESP_IDF
+  // web_server_idf has no long lived responses, events are written to the session socket from the main loop.
+  httpd_handle_t handle_{nullptr};
+  int fd_{-1};
+#endif
+};
+
+// Pushes add, update and remove events to clients following a directory over server-sent events, so a page
+// stays current without listing the folder again. A change is rendered into an event once and queued by
+// reference with each subscriber of its directory; nobody following the directory costs nothing but a
+// counter. Event ids count changes anywhere. A client coming back with an older id is only told to reset when
+// one of the changes since touched its directory, or they are too far back to tell.
+class ChangeFeed {
+ public:
+  ChangeFeed(size_t max_subscribers, uint32_t keepalive_ms);
+
+  // Answers GET <dir>?events[=<id>] with the event stream. since is the last id the client has seen, empty
+  // for none; a client that missed changes starts with a reset event.
+  void serve(AsyncWebServerRequest *request, std::string const &directory, std::string const &since);
+  // path is the entry that changed. For a folder changed as a whole, removed or moved away, tree also resets
+  // every subscriber below it.
+  void publish(ChangeKind kind, std::string const &path, bool tree = false);
+  // Writes the queued events of web_server_idf subscribers, from the main loop.
+  void flush();
+
+  std::string last_id() const { return std::to_string(this->sequence_.load()); }
+  size_t subscribers() const;
+  size_t max_subscribers() const { return this->max_subscribers_; }
+  uint32_t keepalive_ms() const { return this->keepalive_ms_; }
+
+ protected:
+  friend class FeedSubscriber;
+
+  std::shared_ptr<FeedSubscriber> subscribe_(std::string const &directory, std::string const &since);
+  void unsubscribe_(FeedSubscriber *subscriber);
+  std::shared_ptr<const std::string> render_(ChangeKind kind, std::string const &path, uint32_t id) const;
+  // Whether a client following directory since that id has missed a change.
+  bool missed_(std::string const &directory, std::string const &since) const;
+
+  struct Change {
+    std::string path;
+    bool tree;
+  };
+
+  size_t max_subscribers_;
+  uint32_t keepalive_ms_;
+  mutable Mutex lock_;
+  // A handful at most, each holds a socket, so a scan per change is cheaper than an index.
+  std::vector<FeedSubscriber *> subscribers_;
+  std::atomic<uint32_t> sequence_;
+  // The latest changes, oldest first, the last one has id sequence_.
+  std::deque<Change> recent_;
+};
+
+}  // namespace box3web
+}  // namespace esphome
@@ -0,0 +1,119 @@
+#include "content_type.h"
+
+#include <cstring>
+#include <vector>
+
+namespace esphome {
+namespace box3web {
+
+// Sorted by extension, enforced at compile time below.
+static constexpr ContentType CONTENT_TYPES[] = {
+        {"aac", "audio/aac", ContentCategory::AUDIO},
+        {"avi", "video/x-msvideo", ContentCategory::VIDEO},
+        {"bmp", "image/bmp", ContentCategory::IMAGE},
+        {"css", "text/css", ContentCategory::TEXT},
+        {"csv", "text/csv", ContentCategory::TEXT},
+        {"flac", "audio/flac", ContentCategory::AUDIO},
+        {"gif", "image/gif", ContentCategory::IMAGE},
+        {"gz", "application/gzip", ContentCategory::FILE},
+        {"htm", "text/html", ContentCategory::TEXT},
+        {"html", "text/html", ContentCategory::TEXT},
+        {"ico", "image/x-icon", ContentCategory::IMAGE},
+        {"jpeg", "image/jpeg", ContentCategory::IMAGE},
+        {"jpg", "image/jpeg", ContentCategory::IMAGE},
+        {"js", "application/javascript", ContentCategory::FILE},
+        {"json", "application/json", ContentCategory::FILE},
+        {"log", "text/plain", ContentCategory::TEXT},
+        {"m4a", "audio/mp4", ContentCategory::AUDIO},
+        {"md", "text/markdown", ContentCategory::TEXT},
+        {"mkv", "video/x-matroska", ContentCategory::VIDEO},
+        {"mov", "video/quicktime", ContentCategory::VIDEO},
+        {"mp3", "audio/mpeg", ContentCategory::AUDIO},
+        {"mp4", "video/mp4", ContentCategory::VIDEO},
+        {"ogg", "audio/ogg", ContentCategory::AUDIO},
+        {"pdf", "application/pdf", ContentCategory::FILE},
+        {"png", "image/png", ContentCategory::IMAGE},
+        {"svg", "image/svg+xml", ContentCategory::IMAGE},
+        {"tar", "application/x-tar", ContentCategory::FILE},
+        {"txt", "text/plain", ContentCategory::TEXT},
+        {"wav", "audio/wav", ContentCategory::AUDIO},
+        {"webm", "video/webm", ContentCategory::VIDEO},
+        {"webp", "image/webp", ContentCategory::IMAGE},
+        {"xml", "application/xml", ContentCategory::FILE},
+        {"zip", "application/zip", ContentCategory::FILE},
+};
+
+static constexpr size_t CONTENT_TYPE_COUNT = sizeof(CONTENT_TYPES) / sizeof(CONTENT_TYPES[0]);
+static constexpr ContentType DEFAULT_CONTENT_TYPE = {"", "application/octet-stream", ContentCategory::FILE};
+// Longest extension considered; anything longer cannot be in either table.
+static constexpr size_t MAX_EXTENSION = 15;
+
+static constexpr int compare(const char *a, const char *b) {
+    return *a != *b ? (*a < *b ? -1 : 1) : (*a == '\0' ? 0 : compare(a + 1, b + 1));
+}
+
+static constexpr bool is_sorted(size_t i = 1) {
+    return i >= CONTENT_TYPE_COUNT || (compare(CONTENT_TYPES[i - 1].extension, CONTENT_TYPES[i].extension) < 0 && is_sorted(i + 1));
+}
+
+static_assert(is_sorted(), "CONTENT_TYPES must stay sorted by extension");
+
+static std::vector<ContentType> &registered() {
+    static std::vector<ContentType> types;
+    return types;
+}
+
+void register_content_type(const char *extension, const char *mime, ContentCategory category) {
+    registered().push_back({extension, mime, category});
+}
+
+ContentType const &content_type_for(const char *path, size_t len) {
+    size_t dot = len;
+    while (dot > 0 && path[dot - 1] != '.' && path[dot - 1] != '/')
+        dot--;
+    if (dot == 0 || path[dot - 1] != '.' || len - dot > MAX_EXTENSION)
+        return DEFAULT_CONTENT_TYPE;
+    char extension[MAX_EXTENSION + 1];
+    size_t ext_len = len - dot;
+    for (size_t i = 0; i < ext_len; i++) {
+        char c = path[dot + i];
+        extension[i] = (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+    }
+    extension[ext_len] = '\0';
+
+    for (auto const &type : registered()) {
+        if (strcmp(type.extension, extension) == 0)
+            return type;
+    }
+    size_t low = 0, high = CONTENT_TYPE_COUNT;
+    while (low < high) {
+        size_t mid = (low + high) / 2;
+        int cmp = strcmp(CONTENT_TYPES[mid].extension, extension);
+        if (cmp == 0)
+            return CONTENT_TYPES[mid];
+        if (cmp < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return DEFAULT_CONTENT_TYPE;
+}
+
+const char *category_name(ContentCategory category) {
+    switch (category) {
+        case ContentCategory::TEXT:
+            return "Text";
+        case ContentCategory::IMAGE:
+            return "Image";
+        case ContentCategory::AUDIO:
+            return "Audio";
+        case ContentCategory::VIDEO:
+            return "Video";
+        default:
+            return "File";
+    }
+}
+
+}  // namespace box3web
+}  // namespace esphome
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace esphome {
+namespace box3web {
+
+enum class ContentCategory : uint8_t { FILE, TEXT, IMAGE, AUDIO, VIDEO };
+
+struct ContentType {
+  const char *extension;  // lower case, without the dot
+  const char *mime;
+  ContentCategory category;
+};
+
+// Case-insensitive lookup by the extension of a path. Binary search over a sorted
+// constexpr table, preceded by the few types registered from YAML. Never allocates.
+ContentType const &content_type_for(const char *path, size_t len);
+inline ContentType const &content_type_for(std::string const &path) {
+  return content_type_for(path.data(), path.size());
+}
+
+// Adds or overrides an extension at setup, the strings must outlive the program (codegen literals).
+void register_content_type(const char *extension, const char *mime, ContentCategory category);
+
+const char *category_name(ContentCategory category);
+
+}  // namespace box3web
+}  // namespace esphome
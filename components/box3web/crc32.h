@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome {
+namespace box3web {
+
+// Incremental CRC-32 (IEEE 802.3, as used by gzip and zip): crc = crc32_update(crc, ...) starting from 0.
+uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t len);
+
+}  // namespace box3web
+}  // namespace esphome
@@ -0,0 +1,226 @@
+#include "deflate.h"
+#include "crc32.h"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+namespace esphome {
+namespace box3web {
+
+static const size_t MIN_MATCH = 3;
+static const size_t MAX_MATCH = 258;
+static const size_t HASH_BITS = 11;
+static const size_t HASH_SIZE = 1 << HASH_BITS;
+static const uint16_t NIL = 0xFFFF;
+static const size_t MAX_CHAIN = 16;
+// Compressed bytes gathered per produce() call.
+static const size_t OUTPUT_CHUNK = 512;
+
+static const uint16_t LENGTH_BASE[29] = {3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+                                         31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t LENGTH_EXTRA[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+                                         2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const uint16_t DIST_BASE[30] = {1,   2,   3,   4,   5,   7,    9,    13,   17,   25,   33,   49,   65,    97,    129,
+                                       193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const uint8_t DIST_EXTRA[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6,
+                                       6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+GzipSource::GzipSource(std::shared_ptr<ChunkSource> inner, size_t window) : inner_(std::move(inner)), window_(window) {}
+
+bool GzipSource::start() {
+    this->buffer_.reset(new (std::nothrow) uint8_t[2 * this->window_]);
+    this->head_.reset(new (std::nothrow) uint16_t[HASH_SIZE]);
+    this->prev_.reset(new (std::nothrow) uint16_t[this->window_]);
+    if (!this->buffer_ || !this->head_ || !this->prev_)
+        return false;
+    std::fill(this->head_.get(), this->head_.get() + HASH_SIZE, NIL);
+    std::fill(this->prev_.get(), this->prev_.get() + this->window_, NIL);
+    return true;
+}
+
+void GzipSource::put_bits(uint32_t value, uint8_t count, std::string &out) {
+    this->bits_ |= value << this->bit_count_;
+    this->bit_count_ += count;
+    while (this->bit_count_ >= 8) {
+        out += static_cast<char>(this->bits_ & 0xFF);
+        this->bits_ >>= 8;
+        this->bit_count_ -= 8;
+    }
+}
+
+void GzipSource::put_code(uint32_t code, uint8_t length, std::string &out) {
+    // Huffman codes are stored most significant bit first.
+    uint32_t reversed = 0;
+    for (uint8_t i = 0; i < length; i++)
+        reversed |= ((code >> i) & 1) << (length - 1 - i);
+    this->put_bits(reversed, length, out);
+}
+
+void GzipSource::put_literal(uint16_t symbol, std::string &out) {
+    if (symbol < 144) {
+        this->put_code(0x30 + symbol, 8, out);
+    } else if (symbol < 256) {
+        this->put_code(0x190 + symbol - 144, 9, out);
+    } else if (symbol < 280) {
+        this->put_code(symbol - 256, 7, out);
+    } else {
+        this->put_code(0xC0 + symbol - 280, 8, out);
+    }
+}
+
+void GzipSource::put_match(size_t length, size_t distance, std::string &out) {
+    size_t code = 28;
+    while (LENGTH_BASE[code] > length)
+        code--;
+    this->put_literal(257 + code, out);
+    this->put_bits(length - LENGTH_BASE[code], LENGTH_EXTRA[code], out);
+    code = 29;
+    while (DIST_BASE[code] > distance)
+        code--;
+    this->put_code(code, 5, out);
+    this->put_bits(distance - DIST_BASE[code], DIST_EXTRA[code], out);
+}
+
+void GzipSource::flush_bits(std::string &out) {
+    if (this->bit_count_ > 0)
+        out += static_cast<char>(this->bits_ & 0xFF);
+    this->bits_ = 0;
+    this->bit_count_ = 0;
+}
+
+uint32_t GzipSource::hash_at(size_t pos) const {
+    const uint8_t *p = this->buffer_.get() + pos;
+    return ((p[0] << 10) ^ (p[1] << 5) ^ p[2]) & (HASH_SIZE - 1);
+}
+
+void GzipSource::insert(size_t pos) {
+    if (pos + MIN_MATCH > this->end_)
+        return;
+    uint32_t hash = this->hash_at(pos);
+    this->prev_[pos & (this->window_ - 1)] = this->head_[hash];
+    this->head_[hash] = pos;
+}
+
+size_t GzipSource::longest_match(size_t pos, size_t &distance) const {
+    if (pos + MIN_MATCH > this->end_)
+        return 0;
+    const uint8_t *data = this->buffer_.get();
+    size_t max_length = std::min(MAX_MATCH, this->end_ - pos);
+    size_t best = 0;
+    uint16_t candidate = this->head_[this->hash_at(pos)];
+    for (size_t chain = 0; chain < MAX_CHAIN && candidate != NIL && candidate < pos; chain++) {
+        if (pos - candidate > this->window_ - MAX_MATCH)
+            break;
+        size_t length = 0;
+        while (length < max_length && data[candidate + length] == data[pos + length])
+            length++;
+        if (length > best) {
+            best = length;
+            distance = pos - candidate;
+            if (length == max_length)
+                break;
+        }
+        candidate = this->prev_[candidate & (this->window_ - 1)];
+    }
+    return best >= MIN_MATCH ? best : 0;
+}
+
+void GzipSource::slide() {
+    // Keep the last window of history, rebase every stored position.
+    memmove(this->buffer_.get(), this->buffer_.get() + this->window_, this->end_ - this->window_);
+    this->pos_ -= this->window_;
+    this->end_ -= this->window_;
+    for (size_t i = 0; i < HASH_SIZE; i++)
+        this->head_[i] = this->head_[i] != NIL && this->head_[i] >= this->window_ ? this->head_[i] - this->window_ : NIL;
+    for (size_t i = 0; i < this->window_; i++)
+        this->prev_[i] = this->prev_[i] != NIL && this->prev_[i] >= this->window_ ? this->prev_[i] - this->window_ : NIL;
+}
+
+void GzipSource::refill() {
+    if (this->pos_ >= this->window_ + this->window_ / 2 && this->end_ > this->window_)
+        this->slide();
+    while (!this->input_done_ && this->end_ < 2 * this->window_) {
+        size_t len = this->inner_->fill(this->buffer_.get() + this->end_, 2 * this->window_ - this->end_);
+        if (len == 0) {
+            this->input_done_ = true;
+            break;
+        }
+        this->crc_ = crc32_update(this->crc_, this->buffer_.get() + this->end_, len);
+        this->input_size_ += len;
+        this->end_ += len;
+    }
+}
+
+bool GzipSource::produce(std::string &out) {
+    switch (this->state_) {
+        case State::HEADER: {
+            static const uint8_t HEADER[10] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 0xff};
+            out.append(reinterpret_cast<const char *>(HEADER), sizeof(HEADER));
+            // One open-ended block with the fixed codes, BFINAL = 0, BTYPE = 01.
+            this->put_bits(0b010, 3, out);
+            this->state_ = State::BODY;
+            return true;
+        }
+        case State::BODY:
+            while (out.size() < OUTPUT_CHUNK) {
+                if (this->end_ - this->pos_ < MAX_MATCH && !this->input_done_)
+                    this->refill();
+                if (this->pos_ == this->end_) {
+                    this->state_ = State::TRAILER;
+                    break;
+                }
+                size_t distance = 0;
+                size_t length = this->longest_match(this->pos_, distance);
+                if (length == 0) {
+                    this->put_literal(this->buffer_[this->pos_], out);
+                    this->insert(this->pos_++);
+                    continue;
+                }
+                this->put_match(length, distance, out);
+                for (size_t i = 0; i < length; i++)
+                    this->insert(this->pos_++);
+            }
+            return true;
+        case State::TRAILER: {
+            this->put_literal(256, out);
+            // Empty final block closes the stream.
+            this->put_bits(0b011, 3, out);
+            this->put_literal(256, out);
+            this->flush_bits(out);
+            for (uint32_t value : {this->crc_, this->input_size_}) {
+                for (int i = 0; i < 4; i++)
+                    out += static_cast<char>((value >> (8 * i)) & 0xFF);
+            }
+            this->state_ = State::DONE;
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+bool accepts_gzip(std::string const &accept_encoding) {
+    size_t pos = 0;
+    while (pos < accept_encoding.size()) {
+        size_t comma = accept_encoding.find(',', pos);
+        if (comma == std::string::npos)
+            comma = accept_encoding.size();
+        std::string token = accept_encoding.substr(pos, comma - pos);
+        pos = comma + 1;
+        size_t begin = token.find_first_not_of(' ');
+        if (begin == std::string::npos || token.compare(begin, 4, "gzip") != 0)
+            continue;
+        size_t q = token.find("q=");
+        return q == std::string::npos || atof(token.c_str() + q + 2) > 0;
+    }
+    return false;
+}
+
+bool is_compressible(std::string const &content_type) {
+    return content_type.compare(0, 5, "text/") == 0 || content_type == "application/javascript" ||
+           content_type == "application/json" || content_type == "application/xml" || content_type == "image/svg+xml";
+}
+
+}  // namespace box3web
+}  // namespace esphome
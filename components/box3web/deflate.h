@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include "transfer.h"
+
+namespace esphome {
+namespace box3web {
+
+// Streaming gzip stage for generated bodies. LZ77 over a bounded window with fixed
+// Huffman codes: roughly 5 * window bytes of state, no dynamic trees, no second pass.
+class GzipSource : public TextSource {
+ public:
+  // window must be a power of two between 1 KiB and 16 KiB.
+  GzipSource(std::shared_ptr<ChunkSource> inner, size_t window);
+
+  bool start();
+
+ protected:
+  bool produce(std::string &out) override;
+
+  void put_bits(uint32_t value, uint8_t count, std::string &out);
+  void put_code(uint32_t code, uint8_t length, std::string &out);
+  void put_literal(uint16_t symbol, std::string &out);
+  void put_match(size_t length, size_t distance, std::string &out);
+  void flush_bits(std::string &out);
+
+  uint32_t hash_at(size_t pos) const;
+  void insert(size_t pos);
+  size_t longest_match(size_t pos, size_t &distance) const;
+  void refill();
+  void slide();
+
+  enum class State { HEADER, BODY, TRAILER, DONE };
+
+  std::shared_ptr<ChunkSource> inner_;
+  size_t window_;
+  std::unique_ptr<uint8_t[]> buffer_;
+  std::unique_ptr<uint16_t[]> head_;
+  std::unique_ptr<uint16_t[]> prev_;
+  size_t pos_{0};
+  size_t end_{0};
+  bool input_done_{false};
+
+  uint32_t bits_{0};
+  uint8_t bit_count_{0};
+  uint32_t crc_{0};
+  uint32_t input_size_{0};
+  State state_{State::HEADER};
+};
+
+// True when an Accept-Encoding header allows gzip.
+bool accepts_gzip(std::string const &accept_encoding);
+// Content types worth compressing: text, scripts, JSON, XML, SVG.
+bool is_compressible(std::string const &content_type);
+
+}  // namespace box3web
+}  // namespace esphome
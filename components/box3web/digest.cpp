@@ -0,0 +1,181 @@
+#include "digest.h"
+#include "transfer.h"
+#include "esphome/core/helpers.h"
+#include "esphome/core/log.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+
+namespace esphome {
+namespace box3web {
+
+static const char *TAG = "box3web.digest";
+
+static const char *const SIDECAR_PREFIX = ".box3web-sum.";
+
+#ifdef USE_ESP32
+
+Sha256::Sha256() {
+    mbedtls_sha256_init(&this->context_);
+    mbedtls_sha256_starts(&this->context_, 0);
+}
+
+Sha256::~Sha256() { mbedtls_sha256_free(&this->context_); }
+
+void Sha256::update(const uint8_t *data, size_t len) { mbedtls_sha256_update(&this->context_, data, len); }
+
+void Sha256::finish(uint8_t *digest) { mbedtls_sha256_finish(&this->context_, digest); }
+
+#else
+
+static const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+static inline uint32_t rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+Sha256::Sha256() {
+    static const uint32_t INITIAL[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    memcpy(this->state_, INITIAL, sizeof(this->state_));
+}
+
+Sha256::~Sha256() = default;
+
+void Sha256::transform_(const uint8_t *block) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) {
+        w[i] = (uint32_t(block[i * 4]) << 24) | (uint32_t(block[i * 4 + 1]) << 16) | (uint32_t(block[i * 4 + 2]) << 8) |
+               block[i * 4 + 3];
+    }
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    uint32_t a = this->state_[0], b = this->state_[1], c = this->state_[2], d = this->state_[3];
+    uint32_t e = this->state_[4], f = this->state_[5], g = this->state_[6], h = this->state_[7];
+    for (int i = 0; i < 64; i++) {
+        uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+        uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    this->state_[0] += a;
+    this->state_[1] += b;
+    this->state_[2] += c;
+    this->state_[3] += d;
+    this->state_[4] += e;
+    this->state_[5] += f;
+    this->state_[6] += g;
+    this->state_[7] += h;
+}
+
+void Sha256::update(const uint8_t *data, size_t len) {
+    this->length_ += len;
+    while (len > 0) {
+        if (this->used_ == 0 && len >= sizeof(this->block_)) {
+            this->transform_(data);
+            data += sizeof(this->block_);
+            len -= sizeof(this->block_);
+            continue;
+        }
+        size_t count = std::min(len, sizeof(this->block_) - this->used_);
+        memcpy(this->block_ + this->used_, data, count);
+        this->used_ += count;
+        data += count;
+        len -= count;
+        if (this->used_ == sizeof(this->block_)) {
+            this->transform_(this->block_);
+            this->used_ = 0;
+        }
+    }
+}
+
+void Sha256::finish(uint8_t *digest) {
+    uint64_t bits = this->length_ * 8;
+    uint8_t padding[72] = {0x80};
+    size_t pad = (this->used_ < 56 ? 56 : 120) - this->used_;
+    for (int i = 0; i < 8; i++)
+        padding[pad + i] = bits >> (56 - i * 8);
+    this->update(padding, pad + 8);
+    for (int i = 0; i < 8; i++) {
+        digest[i * 4] = this->state_[i] >> 24;
+        digest[i * 4 + 1] = this->state_[i] >> 16;
+        digest[i * 4 + 2] = this->state_[i] >> 8;
+        digest[i * 4 + 3] = this->state_[i];
+    }
+}
+
+#endif
+
+std::string ContentDigest::sha256_hex() const { return format_hex(this->sha256, sizeof(this->sha256)); }
+
+std::string ContentDigest::digest_header() const {
+    return "sha-256=" + base64_encode(this->sha256, sizeof(this->sha256));
+}
+
+std::string ContentDigest::crc32_hex() const {
+    char hex[9];
+    snprintf(hex, sizeof(hex), "%08" PRIx32, this->crc32);
+    return hex;
+}
+
+static std::string sidecar_path(std::string const &path) {
+    size_t slash = path.rfind('/');
+    return path.substr(0, slash + 1) + SIDECAR_PREFIX + path.substr(slash + 1);
+}
+
+bool write_digest(std::string const &path, ContentDigest const &digest) {
+    FILE *file = fopen(SdFile::real_path(sidecar_path(path)).c_str(), "w");
+    if (file == nullptr) {
+        ESP_LOGW(TAG, "Cannot store the digest of %s", path.c_str());
+        return false;
+    }
+    bool ok = fprintf(file, "%s %s %zu %llx\n", digest.crc32_hex().c_str(), digest.sha256_hex().c_str(), digest.size,
+                      (unsigned long long) digest.mtime) > 0;
+    return fclose(file) == 0 && ok;
+}
+
+bool read_digest(std::string const &path, size_t size, time_t mtime, ContentDigest &digest) {
+    FILE *file = fopen(SdFile::real_path(sidecar_path(path)).c_str(), "r");
+    if (file == nullptr)
+        return false;
+    char sha[2 * Sha256::SIZE + 1];
+    unsigned long long stored_mtime = 0;
+    bool ok = fscanf(file, "%" SCNx32 " %64s %zu %llx", &digest.crc32, sha, &digest.size, &stored_mtime) == 4;
+    fclose(file);
+    digest.mtime = stored_mtime;
+    if (!ok || strlen(sha) != sizeof(sha) - 1 || digest.size != size || digest.mtime != mtime)
+        return false;
+    for (size_t i = 0; i < Sha256::SIZE; i++) {
+        unsigned byte;
+        if (sscanf(sha + i * 2, "%2x", &byte) != 1)
+            return false;
+        digest.sha256[i] = byte;
+    }
+    return true;
+}
+
+void remove_digest(std::string const &path) { remove(SdFile::real_path(sidecar_path(path)).c_str()); }
+
+void move_digest(std::string const &from, std::string const &to) {
+    rename(SdFile::real_path(sidecar_path(from)).c_str(), SdFile::real_path(sidecar_path(to)).c_str());
+}
+
+}  // namespace box3web
+}  // namespace esphome
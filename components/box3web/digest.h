@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include "esphome/core/defines.h"
+#ifdef USE_ESP32
+#include <mbedtls/sha256.h>
+#endif
+
+namespace esphome {
+namespace box3web {
+
+// Incremental SHA-256. On the ESP32 it runs through mbedtls, which uses the SHA accelerator when it is free,
+// elsewhere in software.
+class Sha256 {
+ public:
+  static const size_t SIZE = 32;
+
+  Sha256();
+  ~Sha256();
+  Sha256(Sha256 const &) = delete;
+  Sha256 &operator=(Sha256 const &) = delete;
+
+  void update(const uint8_t *data, size_t len);
+  void finish(uint8_t *digest);
+
+ protected:
+#ifdef USE_ESP32
+  mbedtls_sha256_context context_;
+#else
+  void transform_(const uint8_t *block);
+
+  uint32_t state_[8];
+  uint64_t length_{0};
+  uint8_t block_[64];
+  size_t used_{0};
+#endif
+};
+
+// Checksums of a file as it was uploaded, with the size and mtime it had then so a copy changed behind the
+// component's back is not vouched for.
+struct ContentDigest {
+  uint32_t crc32{0};
+  uint8_t sha256[Sha256::SIZE]{};
+  size_t size{0};
+  time_t mtime{0};
+
+  std::string sha256_hex() const;
+  // Digest header value (RFC 3230): sha-256=<base64>
+  std::string digest_header() const;
+  std::string crc32_hex() const;
+};
+
+// The digest of a file lives in a sidecar next to it, .box3web-sum.<name>, hidden from listings and urls like
+// every internal file. One line: crc32 sha256 size mtime, all hex but the decimal size.
+bool write_digest(std::string const &path, ContentDigest const &digest);
+// False when there is no sidecar or it does not describe the file of that size and mtime any more.
+bool read_digest(std::string const &path, size_t size, time_t mtime, ContentDigest &digest);
+void remove_digest(std::string const &path);
+void move_digest(std::string const &from, std::string const &to);
+
+}  // namespace box3web
+}  // namespace esphome
@@ -0,0 +1,108 @@
+#include "directory.h"
+#include "transfer.h"
+#include "url_path.h"
+
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+
+namespace esphome {
+namespace box3web {
+
+bool DirIterator::open(std::string const &path) {
+    this->close();
+    this->dir_ = opendir(SdFile::real_path(path).c_str());
+    this->path_ = path;
+    if (this->path_.size() > 1 && this->path_.back() == '/')
+        this->path_.pop_back();
+    return this->dir_ != nullptr;
+}
+
+void DirIterator::close() {
+    if (this->dir_ != nullptr) {
+        closedir(this->dir_);
+        this->dir_ = nullptr;
+    }
+}
+
+bool DirIterator::next_name(std::string &name) {
+    if (this->dir_ == nullptr)
+        return false;
+    struct dirent *entry;
+    while ((entry = readdir(this->dir_)) != nullptr) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0 || is_internal_name(entry->d_name))
+            continue;
+        name = entry->d_name;
+        return true;
+    }
+    return false;
+}
+
+bool DirIterator::next(sd_mmc_card::FileInfo &info) {
+    std::string name;
+    if (!this->next_name(name))
+        return false;
+    info.path = this->path_ == "/" ? "/" + name : this->path_ + "/" + name;
+    struct stat st;
+    if (stat(SdFile::real_path(info.path).c_str(), &st) == 0) {
+        info.is_directory = S_ISDIR(st.st_mode);
+        info.size = info.is_directory ? 0 : st.st_size;
+        this->mtime_ = st.st_mtime;
+    } else {
+        info.is_directory = false;
+        info.size = 0;
+        this->mtime_ = 0;
+    }
+    return true;
+}
+
+bool DirIterator::skip(size_t count) {
+    std::string name;
+    for (size_t i = 0; i < count; i++) {
+        if (!this->next_name(name))
+            return false;
+    }
+    return true;
+}
+
+std::string json_escape(std::string const &text) {
+    std::string escaped;
+    escaped.reserve(text.size() + 2);
+    for (char c : text) {
+        switch (c) {
+            case '"': escaped += "\\\""; break;
+            case '\\': escaped += "\\\\"; break;
+            case '\n': escaped += "\\n"; break;
+            case '\r': escaped += "\\r"; break;
+            case '\t': escaped += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    char buffer[8];
+                    snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+                    escaped += buffer;
+                } else {
+                    escaped += c;
+                }
+        }
+    }
+    return escaped;
+}
+
+std::string html_escape(std::string const &text) {
+    std::string escaped;
+    escaped.reserve(text.size());
+    for (char c : text) {
+        switch (c) {
+            case '&': escaped += "&amp;"; break;
+            case '<': escaped += "&lt;"; break;
+            case '>': escaped += "&gt;"; break;
+            case '"': escaped += "&quot;"; break;
+            case '\'': escaped += "&#39;"; break;
+            default: escaped += c;
+        }
+    }
+    return escaped;
+}
+
+}  // namespace box3web
+}  // namespace esphome
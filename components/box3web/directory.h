@@ -0,0 +1,42 @@
+#pragma once
+
+#include <ctime>
+#include <dirent.h>
+#include <string>
+#include "../sd_mmc_card/sd_mmc_card.h"
+
+namespace esphome {
+namespace box3web {
+
+// Walks one directory of the card entry by entry, without materializing the listing.
+class DirIterator {
+ public:
+  DirIterator() = default;
+  ~DirIterator() { this->close(); }
+  DirIterator(DirIterator const &) = delete;
+  DirIterator &operator=(DirIterator const &) = delete;
+
+  bool open(std::string const &path);
+  void close();
+  bool is_open() const { return this->dir_ != nullptr; }
+  // Fills info with the next entry, paths are card relative like sd_mmc_card::FileInfo. False at the end.
+  bool next(sd_mmc_card::FileInfo &info);
+  // Modification time of the entry next() returned last, 0 if unknown.
+  time_t mtime() const { return this->mtime_; }
+  // Skips count entries, false if the directory ended first.
+  bool skip(size_t count);
+
+ protected:
+  bool next_name(std::string &name);
+
+  DIR *dir_{nullptr};
+  std::string path_;
+  time_t mtime_{0};
+};
+
+std::string json_escape(std::string const &text);
+// For element text and quoted attribute values alike.
+std::string html_escape(std::string const &text);
+
+}  // namespace box3web
+}  // namespace esphome
@@ -5,9 +5,25 @@
 #include "esp_http_server.h"
 #include "esp_system.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_idf_version.h"
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <new>
 #include <string>
 #include <vector>
 
+// httpd_req_async_handler_begin() is available from ESP-IDF 5.2 on
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 2, 0)
+#define ESP_HTTP_SERVER_ASYNC_WORKERS
+#endif
+
 namespace esphome {
 namespace esp_http_server {
 
@@ -24,6 +40,47 @@ public:
         // Perform any periodic tasks if needed
     }
 
+#ifdef USE_BOX3WEB_READ_AHEAD
+    void set_read_ahead(size_t depth) {
+        read_ahead_depth_ = depth;
+    }
+#endif
+
+    // Worker tasks streaming files off the httpd task; 0 workers serves everything inline.
+    // chunk_size sizes the transfer buffers when no pool is shared through set_buffer_pool()
+    void set_worker_pool(size_t workers, size_t chunk_size) {
+        workers_ = workers;
+        chunk_size_ = chunk_size;
+    }
+
+    // Borrow transfer buffers from a pool shared with other servers, e.g. Box3Web::get_buffer_pool()
+    void set_buffer_pool(box3web::BufferPool* pool) {
+        pool_ = pool;
+    }
+
+    // Caps and per-client shaping for bulk downloads, typically shared with Box3Web::get_admission().
+    // Workers wait in its bounded queue for a slot, inline transfers over the cap are answered 503
+    void set_admission(box3web::AdmissionControl* admission) {
+        admission_ = admission;
+    }
+
+    // Latency percentile (0-100) of the recent short requests in microseconds, 0 before any was served
+    uint32_t short_latency_us(uint8_t percentile) {
+        std::array<uint32_t, LATENCY_SAMPLES> sorted;
+        size_t count;
+        {
+            LockGuard guard(latency_mutex_);
+            count = std::min<size_t>(latency_count_, LATENCY_SAMPLES);
+            std::copy(latency_samples_.begin(), latency_samples_.begin() + count, sorted.begin());
+        }
+        if (count == 0) {
+            return 0;
+        }
+        size_t index = (count - 1) * std::min<uint8_t>(percentile, 100) / 100;
+        std::nth_element(sorted.begin(), sorted.begin() + index, sorted.begin() + count);
+        return sorted[index];
+    }
+
     void stop_server() {
         if (server_handle_ != nullptr) {
             httpd_stop(server_handle_);
@@ -34,57 +91,306 @@ public:
 
 private:
     static const char* TAG;
+    // Files up to this size are short requests, scheduled ahead of bulk downloads
+    static constexpr size_t SHORT_TRANSFER_SIZE = 16384;
+    // After this many short requests in a row a waiting bulk transfer gets its turn
+    static constexpr uint32_t SHORT_BURST = 4;
+    static constexpr UBaseType_t TRANSFER_QUEUE_DEPTH = 8;
+    static constexpr uint32_t WORKER_STACK_SIZE = 4096;
+    static constexpr size_t LATENCY_SAMPLES = 64;
+
     httpd_handle_t server_handle_ = nullptr;
+#ifdef USE_BOX3WEB_READ_AHEAD
+    size_t read_ahead_depth_ = 2;
+#endif
+    size_t workers_ = 2;
+    size_t chunk_size_ = 4096;
+    box3web::BufferPool* pool_ = nullptr;
+    std::unique_ptr<box3web::BufferPool> own_pool_;
+    box3web::AdmissionControl* admission_ = nullptr;
+
+    // A response handed from the httpd task to a worker, owning everything it needs
+    struct Transfer {
+        httpd_req_t* req;  // async copy, completed by the worker
+        box3web::SdFile* file;
+        const char* content_type;
+        bool compressible;
+        bool gzip;
+        bool bulk;
+        int64_t started_us;
+    };
+
+    QueueHandle_t short_queue_ = nullptr;
+    QueueHandle_t bulk_queue_ = nullptr;
+    SemaphoreHandle_t wake_ = nullptr;
+    // At most max_bulk_ workers stream bulk transfers, so one stays free for short requests. With a single worker
+    // that leaves none: bulk transfers are then served inline, as without workers
+    std::atomic<size_t> active_bulk_{0};
+    size_t max_bulk_ = 0;
+    bool workers_started_ = false;
+
+    Mutex latency_mutex_;
+    std::array<uint32_t, LATENCY_SAMPLES> latency_samples_{};
+    size_t latency_count_ = 0;
+
+    void record_latency(int64_t started_us) {
+        uint32_t elapsed = static_cast<uint32_t>(esp_timer_get_time() - started_us);
+        bool report;
+        {
+            LockGuard guard(latency_mutex_);
+            latency_samples_[latency_count_ % LATENCY_SAMPLES] = elapsed;
+            latency_count_++;
+            report = latency_count_ % LATENCY_SAMPLES == 0;
+        }
+        if (report) {
+            ESP_LOGD(TAG, "Short request latency: p50 %u us, p99 %u us", (unsigned) short_latency_us(50),
+                     (unsigned) short_latency_us(99));
+        }
+    }
+
+    static void send_busy(httpd_req_t* req, uint32_t retry_after = 2) {
+        char seconds[12];
+        snprintf(seconds, sizeof(seconds), "%u", (unsigned) retry_after);
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_set_hdr(req, "Retry-After", seconds);
+        httpd_resp_send(req, "Server busy", HTTPD_RESP_USE_STRLEN);
+    }
 
-    // Helper function to set content type based on file extension
-    static std::string get_content_type(const std::string& filename) {
-        if (filename.ends_with(".html")) return "text/html";
-        if (filename.ends_with(".css")) return "text/css";
-        if (filename.ends_with(".js")) return "application/javascript";
-        if (filename.ends_with(".json")) return "application/json";
-        if (filename.ends_with(".png")) return "image/png";
-        if (filename.ends_with(".jpg") || filename.ends_with(".jpeg")) return "image/jpeg";
-        if (filename.ends_with(".gif")) return "image/gif";
-        if (filename.ends_with(".svg")) return "image/svg+xml";
-        return "application/octet-stream";
+    // Admission ticket for a bulk download, empty when admission control is off or the cap was reached
+    box3web::TransferTicket admit(httpd_req_t* req, bool wait) {
+        if (admission_ == nullptr) {
+            return box3web::TransferTicket();
+        }
+        return admission_->admit(box3web::client_address(req), box3web::TransferDirection::DOWNLOAD, wait);
     }
 
+    // Sets the response headers and streams the file through pool buffers, lent to the socket as they are
+    // when read-ahead is running. A ticket charges the body to its client's download rate; only a worker, which
+    // serves this one transfer, may be paced, the httpd task serves every client and must not sleep
+    static esp_err_t send_file(EspHttpServer* self, httpd_req_t* req, std::unique_ptr<box3web::SdFile> file,
+                               const char* content_type, bool compressible, bool gzip,
+                               box3web::TransferTicket* ticket = nullptr, bool on_worker = false) {
+        size_t size = file->size();
+
+        std::unique_ptr<box3web::ChunkSource> source;
+#ifdef USE_BOX3WEB_READ_AHEAD
+        // Prefetch the next blocks while the current one is on the wire, once there is more than one block to
+        // overlap, as Box3Web::make_file_source() does
+        if (size > self->pool_->buffer_size()) {
+            auto* read_ahead = new box3web::ReadAheadSource(std::move(file), 0, size, self->pool_,
+                                                            self->read_ahead_depth_);
+            read_ahead->start();
+            source.reset(read_ahead);
+        }
+#endif
+        if (!source) {
+            source.reset(new box3web::FileSource(std::move(file), 0, size));
+        }
+        box3web::PoolBuffer buffer;
+        if (!source->zero_copy()) {
+            buffer = self->pool_->acquire(box3web::BUFFER_WAIT_MS);
+            if (!buffer) {
+                send_busy(req);
+                return ESP_OK;
+            }
+        }
+
+        httpd_resp_set_type(req, content_type);
+        if (compressible) {
+            httpd_resp_set_hdr(req, "Vary", "Accept-Encoding");
+        }
+        if (gzip) {
+            httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+        }
+
+        const uint8_t* data = buffer.data();
+        size_t bytes_read;
+        while ((bytes_read = buffer ? source->fill(buffer.data(), buffer.size()) : source->borrow(data)) > 0) {
+            if (httpd_resp_send_chunk(req, reinterpret_cast<const char*>(data), bytes_read) != ESP_OK) {
+                ESP_LOGW(TAG, "Client closed connection during transfer");
+                return ESP_FAIL;
+            }
+            if (ticket != nullptr && on_worker) {
+                ticket->pace(bytes_read);
+            } else if (ticket != nullptr) {
+                ticket->consume(bytes_read);
+            }
+        }
+
+        // End chunked transfer
+        return httpd_resp_send_chunk(req, nullptr, 0);
+    }
+
+#ifdef ESP_HTTP_SERVER_ASYNC_WORKERS
+    bool start_workers(UBaseType_t priority) {
+        if (workers_ == 0) {
+            return false;
+        }
+        short_queue_ = xQueueCreate(TRANSFER_QUEUE_DEPTH, sizeof(Transfer*));
+        bulk_queue_ = xQueueCreate(TRANSFER_QUEUE_DEPTH, sizeof(Transfer*));
+        wake_ = xSemaphoreCreateCounting(2 * TRANSFER_QUEUE_DEPTH + workers_, 0);
+        if (short_queue_ == nullptr || bulk_queue_ == nullptr || wake_ == nullptr) {
+            ESP_LOGE(TAG, "Not enough memory for the worker pool, serving inline");
+            return false;
+        }
+        size_t started = 0;
+        for (size_t i = 0; i < workers_; i++) {
+            if (xTaskCreate(worker_task, "esp_http_worker", WORKER_STACK_SIZE, this, priority, nullptr) == pdPASS) {
+                started++;
+            }
+        }
+        max_bulk_ = started > 1 ? started - 1 : 0;
+        ESP_LOGI(TAG, "Started %u transfer workers", (unsigned) started);
+        if (started == 1) {
+            ESP_LOGW(TAG, "A single transfer worker only takes short requests, bulk downloads are served inline and "
+                          "hold them up; use two or more");
+        }
+        return started > 0;
+    }
+
+    // Hands the response to the pool, false when the matching queue is full
+    bool dispatch(httpd_req_t* req, std::unique_ptr<box3web::SdFile>& file, const char* content_type,
+                  bool compressible, bool gzip, bool bulk, int64_t started_us) {
+        httpd_req_t* copy = nullptr;
+        if (httpd_req_async_handler_begin(req, &copy) != ESP_OK) {
+            return false;
+        }
+        auto* transfer = new Transfer{copy, file.release(), content_type, compressible, gzip, bulk, started_us};
+        if (xQueueSend(bulk ? bulk_queue_ : short_queue_, &transfer, 0) != pdTRUE) {
+            file.reset(transfer->file);
+            httpd_req_async_handler_complete(copy);
+            delete transfer;
+            return false;
+        }
+        xSemaphoreGive(wake_);
+        return true;
+    }
+
+    // Short requests go first, but after SHORT_BURST of them a waiting bulk transfer is served so neither starves
+    Transfer* next_transfer(uint32_t& shorts_in_row) {
+        Transfer* transfer = nullptr;
+        bool bulk_turn = shorts_in_row >= SHORT_BURST && uxQueueMessagesWaiting(bulk_queue_) > 0;
+        if (!bulk_turn && xQueueReceive(short_queue_, &transfer, 0) == pdTRUE) {
+            shorts_in_row++;
+            return transfer;
+        }
+        if (active_bulk_.fetch_add(1) < max_bulk_ && xQueueReceive(bulk_queue_, &transfer, 0) == pdTRUE) {
+            shorts_in_row = 0;
+            return transfer;
+        }
+        active_bulk_--;
+        if (bulk_turn && xQueueReceive(short_queue_, &transfer, 0) == pdTRUE) {
+            shorts_in_row++;
+            return transfer;
+        }
+        return nullptr;
+    }
+
+    static void worker_task(void* param) {
+        static_cast<EspHttpServer*>(param)->run_worker();
+        vTaskDelete(nullptr);
+    }
+
+    void run_worker() {
+        uint32_t shorts_in_row = 0;
+        while (true) {
+            Transfer* transfer = next_transfer(shorts_in_row);
+            if (transfer == nullptr) {
+                // Woken per queued transfer and whenever a bulk slot frees up; the timeout covers missed wakes
+                xSemaphoreTake(wake_, pdMS_TO_TICKS(100));
+                continue;
+            }
+            // Bulk transfers queue for an admission slot here, the transfers holding them finish on other workers
+            box3web::TransferTicket ticket;
+            if (transfer->bulk && admission_ != nullptr) {
+                ticket = admit(transfer->req, true);
+            }
+            if (transfer->bulk && admission_ != nullptr && !ticket) {
+                delete transfer->file;
+                send_busy(transfer->req, admission_->retry_after());
+            } else {
+                send_file(this, transfer->req, std::unique_ptr<box3web::SdFile>(transfer->file), transfer->content_type,
+                          transfer->compressible, transfer->gzip, &ticket, true);
+            }
+            httpd_req_async_handler_complete(transfer->req);
+            if (transfer->bulk) {
+                active_bulk_--;
+                xSemaphoreGive(wake_);
+            } else {
+                record_latency(transfer->started_us);
+            }
+            delete transfer;
+        }
+    }
+#endif
+
     // HTTP GET handler example
     static esp_err_t get_handler(httpd_req_t* req) {
-        // Extract the requested file path
-        std::string file_path = std::string(req->uri);
-        
-        // Basic security: prevent directory traversal
-        if (file_path.find("..") != std::string::npos) {
+        int64_t started_us = esp_timer_get_time();
+
+        // Decode and normalize the raw uri; traversal and encoded separators are refused
+        box3web::PathBuffer resolved;
+        box3web::PathError error = box3web::append_url_path(req->uri, true, resolved);
+        if (error == box3web::PathError::TRAVERSAL || error == box3web::PathError::RESERVED) {
             httpd_resp_send_err(req, HTTPD_403_FORBIDDEN, "Access denied");
             return ESP_FAIL;
         }
+        if (error != box3web::PathError::NONE) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid path");
+            return ESP_FAIL;
+        }
+        std::string file_path = resolved.str();
 
-        // Prepend a base path (modify as needed)
-        file_path = "/sdcard" + file_path;
+        // Determine content type (the table entries have static storage, httpd keeps the pointer)
+        const char *content_type = box3web::content_type_for(file_path).mime;
+        bool compressible = box3web::is_compressible(content_type);
 
-        // Open the file
-        FILE* file = fopen(file_path.c_str(), "rb");
-        if (!file) {
+        // Open the file, relative to the card mount point, preferring a precompressed sibling
+        auto file = std::unique_ptr<box3web::SdFile>(new box3web::SdFile());
+        bool gzip = false;
+        if (compressible) {
+            char accept_encoding[128] = {0};
+            if (httpd_req_get_hdr_value_str(req, "Accept-Encoding", accept_encoding, sizeof(accept_encoding)) == ESP_OK &&
+                box3web::accepts_gzip(accept_encoding)) {
+                gzip = file->open(file_path + ".gz");
+            }
+        }
+        if (!gzip && !file->open(file_path)) {
             httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "File not found");
             return ESP_FAIL;
         }
+        bool bulk = file->size() > SHORT_TRANSFER_SIZE;
+        auto *self = static_cast<EspHttpServer*>(req->user_ctx);
 
-        // Determine content type
-        httpd_resp_set_type(req, get_content_type(file_path).c_str());
-
-        // Stream file in chunks
-        char chunk[1024];
-        size_t bytes_read;
-        while ((bytes_read = fread(chunk, 1, sizeof(chunk), file)) > 0) {
-            httpd_resp_send_chunk(req, chunk, bytes_read);
+#ifdef ESP_HTTP_SERVER_ASYNC_WORKERS
+        // Free the httpd task right away, a slow client then only holds a worker
+        if (self->workers_started_ && (!bulk || self->max_bulk_ > 0)) {
+            if (self->dispatch(req, file, content_type, compressible, gzip, bulk, started_us)) {
+                return ESP_OK;
+            }
+            if (bulk) {
+                send_busy(req);
+                return ESP_OK;
+            }
         }
+#endif
 
-        // End chunked transfer
-        httpd_resp_send_chunk(req, nullptr, 0);
-
-        fclose(file);
-        return ESP_OK;
+        // Short requests the pool cannot take, bulk ones with no worker to spare, or no pool at all: serve on the
+        // httpd task, which must not wait for an admission slot. A client that overdrew its rate inline is refused
+        // here until it has paid it off
+        box3web::TransferTicket ticket;
+        if (bulk && self->admission_ != nullptr) {
+            ticket = self->admit(req, false);
+            if (!ticket) {
+                send_busy(req, self->admission_->retry_after());
+                return ESP_OK;
+            }
+        }
+        esp_err_t result = send_file(self, req, std::move(file), content_type, compressible, gzip, &ticket);
+        if (!bulk) {
+            self->record_latency(started_us);
+        }
+        return result;
     }
 
     // HTTP POST handler example for file upload
@@ -99,12 +405,17 @@ private:
             if (strstr(content_type, "multipart/form-data") != nullptr) {
                 // Implement file upload logic
                 // This is a basic example and needs more robust implementation
-                char buffer[1024];
+                auto *self = static_cast<EspHttpServer*>(req->user_ctx);
+                box3web::PoolBuffer buffer = self->pool_->acquire(box3web::BUFFER_WAIT_MS);
+                if (!buffer) {
+                    send_busy(req);
+                    return ESP_OK;
+                }
                 int received = 0;
                 FILE* uploaded_file = nullptr;
 
                 while (true) {
-                    received = httpd_req_recv(req, buffer, sizeof(buffer));
+                    received = httpd_req_recv(req, reinterpret_cast<char*>(buffer.data()), buffer.size());
                     
                     if (received < 0) {
                         // Error in receiving
@@ -127,7 +438,7 @@ private:
                     }
 
                     // Write received data
-                    fwrite(buffer, 1, received, uploaded_file);
+                    fwrite(buffer.data(), 1, received, uploaded_file);
                 }
 
                 // Close the file
@@ -152,19 +463,34 @@ private:
         config.max_open_sockets = 7;  // Adjust based on your memory constraints
         config.server_port = 80;       // Customize port if needed
 
+        // Transfer buffers: two per worker for read-ahead plus two for inline requests, unless a pool is shared
+        if (pool_ == nullptr) {
+            own_pool_.reset(new box3web::BufferPool(chunk_size_, 2 * (workers_ + 1), 2));
+            if (!own_pool_->setup()) {
+                own_pool_.reset();
+                return ESP_ERR_NO_MEM;
+            }
+            pool_ = own_pool_.get();
+        }
+
         // Start the server
         esp_err_t result = httpd_start(&server_handle_, &config);
         if (result != ESP_OK) {
             ESP_LOGE(TAG, "Failed to start HTTP server");
             return result;
         }
+#ifdef ESP_HTTP_SERVER_ASYNC_WORKERS
+        if (!workers_started_) {
+            workers_started_ = start_workers(config.task_priority);
+        }
+#endif
 
         // Register URI handlers
         httpd_uri_t get_uri = {
             .uri = "/*",
             .method = HTTP_GET,
             .handler = get_handler,
-            .user_ctx = nullptr
+            .user_ctx = this
         };
         httpd_register_uri_handler(server_handle_, &get_uri);
 
@@ -172,7 +498,7 @@ private:
             .uri = "/upload",
             .method = HTTP_POST,
             .handler = post_handler,
-            .user_ctx = nullptr
+            .user_ctx = this
         };
         httpd_register_uri_handler(server_handle_, &post_uri);
 
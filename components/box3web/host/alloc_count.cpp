@@ -0,0 +1,51 @@
+#include "alloc_count.h"
+
+#include <cstdlib>
+#include <malloc.h>
+#include <new>
+
+namespace alloc_count {
+
+std::atomic<size_t> allocations{0};
+std::atomic<size_t> live_bytes{0};
+std::atomic<size_t> peak_bytes{0};
+
+}  // namespace alloc_count
+
+using alloc_count::live_bytes;
+using alloc_count::peak_bytes;
+
+// Hands out exactly the pointer malloc returned, so free always gets it back unchanged.
+void *operator new(size_t size, std::nothrow_t const &) noexcept {
+    void *ptr = malloc(size != 0 ? size : 1);
+    if (ptr == nullptr)
+        return nullptr;
+    alloc_count::allocations++;
+    size_t live = live_bytes += malloc_usable_size(ptr);
+    size_t peak = peak_bytes;
+    while (live > peak && !peak_bytes.compare_exchange_weak(peak, live)) {
+    }
+    return ptr;
+}
+
+void operator delete(void *ptr) noexcept {
+    if (ptr == nullptr)
+        return;
+    live_bytes -= malloc_usable_size(ptr);
+    free(ptr);
+}
+
+void *operator new(size_t size) {
+    void *ptr = operator new(size, std::nothrow);
+    if (ptr == nullptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void *operator new[](size_t size) { return operator new(size); }
+void *operator new[](size_t size, std::nothrow_t const &) noexcept { return operator new(size, std::nothrow); }
+void operator delete[](void *ptr) noexcept { operator delete(ptr); }
+void operator delete(void *ptr, size_t) noexcept { operator delete(ptr); }
+void operator delete[](void *ptr, size_t) noexcept { operator delete(ptr); }
+void operator delete(void *ptr, std::nothrow_t const &) noexcept { operator delete(ptr); }
+void operator delete[](void *ptr, std::nothrow_t const &) noexcept { operator delete(ptr); }
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+// Counters kept by the global operator new and delete replaced in alloc_count.cpp. They live in a translation
+// unit of their own so the compiler never inlines them into code that also sees the matching malloc and free.
+namespace alloc_count {
+
+extern std::atomic<size_t> allocations;
+// Usable size of the live blocks, which is what they really take, and its high-water mark.
+extern std::atomic<size_t> live_bytes;
+extern std::atomic<size_t> peak_bytes;
+
+}  // namespace alloc_count
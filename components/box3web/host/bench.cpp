@@ -0,0 +1,397 @@
+// Benchmarks of Box3Web on the host: folder listings, whole and ranged downloads, chunked uploads and a mix
+// of them in flight at once. Requests go through the same handler entry points ESPAsyncWebServer calls and
+// responses are drained the way AsyncTCP does, one send window at a time.
+//
+// Reported per case: throughput, p50/p99 latency of a request, C++ allocations per request and peak heap
+// above the level before the case. With --baseline the allocation and heap figures are compared with the
+// file and the run fails on a regression; timings depend on the machine and are shown for information only.
+#include "../box3web.h"
+#include "alloc_count.h"
+#include "esphome/core/log.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <new>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+using namespace esphome;
+using namespace esphome::box3web;
+using alloc_count::allocations;
+using alloc_count::live_bytes;
+using alloc_count::peak_bytes;
+
+// Room AsyncTCP offers a response per call on the ESP32 (TCP_SND_BUF), and the segment size uploads arrive in.
+static const size_t SEND_WINDOW = 5744;
+static const size_t SEGMENT_SIZE = 1436;
+static const uint32_t CLIENT_ADDRESS = 0x0100007f;
+
+struct Result {
+    std::string name;
+    size_t requests{0};
+    size_t bytes{0};
+    double seconds{0};
+    std::vector<uint32_t> latencies_us;
+    size_t allocations{0};
+    size_t peak_heap{0};
+
+    uint32_t percentile(unsigned p) const {
+        if (this->latencies_us.empty())
+            return 0;
+        std::vector<uint32_t> sorted = this->latencies_us;
+        size_t index = (sorted.size() - 1) * p / 100;
+        std::nth_element(sorted.begin(), sorted.begin() + index, sorted.end());
+        return sorted[index];
+    }
+    double allocations_per_request() const { return this->requests ? double(this->allocations) / this->requests : 0; }
+    double mib_per_second() const { return this->seconds > 0 ? this->bytes / this->seconds / 1048576.0 : 0; }
+};
+
+// Baseline figures of one case.
+struct Baseline {
+    double allocations_per_request;
+    size_t peak_heap;
+    uint32_t p50_us;
+    uint32_t p99_us;
+    double mib_per_second;
+};
+
+static bool write_file(std::string const &path, size_t size) {
+    FILE *file = fopen(SdFile::real_path(path).c_str(), "wb");
+    if (file == nullptr)
+        return false;
+    uint8_t chunk[4096];
+    bool ok = true;
+    for (size_t offset = 0; ok && offset < size; offset += sizeof(chunk)) {
+        size_t len = std::min(sizeof(chunk), size - offset);
+        for (size_t i = 0; i < len; i++)
+            chunk[i] = static_cast<uint8_t>((offset + i) * 31 + ((offset + i) >> 8));
+        ok = fwrite(chunk, 1, len, file) == len;
+    }
+    return fclose(file) == 0 && ok;
+}
+
+static bool make_folder(std::string const &path) {
+    return mkdir(SdFile::real_path(path).c_str(), 0755) == 0 || errno == EEXIST;
+}
+
+// Folders of 100 and 1000 entries with mixed types, two files to download and an upload folder.
+static bool make_fixture() {
+    static const char *const EXTENSIONS[] = {".jpg", ".mp4", ".txt", ".json", ".wav", ".bin"};
+    if (!make_folder("/bench") || !make_folder("/bench/uploads"))
+        return false;
+    for (size_t count : {100, 1000}) {
+        std::string folder = "/bench/dir" + std::to_string(count);
+        if (!make_folder(folder))
+            return false;
+        for (size_t i = 0; i < count; i++) {
+            char name[48];
+            snprintf(name, sizeof(name), "/entry_%04u%s", (unsigned) i, EXTENSIONS[i % 6]);
+            struct stat st;
+            std::string path = folder + name;
+            if (stat(SdFile::real_path(path).c_str(), &st) != 0 && !write_file(path, (i * 97) % 4096))
+                return false;
+        }
+    }
+    return write_file("/bench/blob_1m.bin", 1 << 20) && write_file("/bench/blob_256k.bin", 256 << 10);
+}
+
+class Harness {
+ public:
+    Harness() : web_(&base_) {
+        this->web_.set_url_prefix("file");
+        this->web_.set_root_path("/");
+        this->web_.set_sd_mmc_card(&this->card_);
+        this->web_.set_download_enabled(true);
+        this->web_.set_upload_enabled(true);
+        this->web_.set_deletion_enabled(true);
+        // Listings are measured as generated; revalidation covers the cheap path.
+        this->web_.set_listing_cache_size(0);
+        this->web_.setup();
+    }
+
+    bool ok() const { return !this->web_.is_failed(); }
+
+    std::unique_ptr<AsyncWebServerRequest> begin(WebRequestMethod method, std::string const &url,
+                                                 std::vector<std::pair<std::string, std::string>> const &headers) {
+        auto request = std::unique_ptr<AsyncWebServerRequest>(new AsyncWebServerRequest(method, url, CLIENT_ADDRESS));
+        for (auto const &header : headers)
+            request->add_header(header.first, header.second);
+        if (this->web_.canHandle(request.get()))
+            this->web_.handleRequest(request.get());
+        return request;
+    }
+
+    // Multipart upload of size bytes into folder, delivered one segment at a time.
+    std::unique_ptr<AsyncWebServerRequest> upload(std::string const &folder, std::string const &name, size_t size) {
+        auto request =
+            std::unique_ptr<AsyncWebServerRequest>(new AsyncWebServerRequest(HTTP_POST, folder, CLIENT_ADDRESS));
+        request->set_content_length(size);
+        if (!this->web_.canHandle(request.get()))
+            return request;
+        std::vector<uint8_t> segment(SEGMENT_SIZE);
+        for (size_t index = 0; index < size; index += SEGMENT_SIZE) {
+            size_t len = std::min(SEGMENT_SIZE, size - index);
+            for (size_t i = 0; i < len; i++)
+                segment[i] = static_cast<uint8_t>(index + i);
+            this->web_.handleUpload(request.get(), name.c_str(), index, segment.data(), len, index + len == size);
+        }
+        this->web_.handleRequest(request.get());
+        return request;
+    }
+
+    // One send window of the response; false once the body is complete or there is no response.
+    bool pump(AsyncWebServerRequest *request, size_t &sent) {
+        AsyncWebServerResponse *response = request->response();
+        if (response == nullptr)
+            return false;
+        size_t len = response->fill(this->window_, sizeof(this->window_));
+        if (len == RESPONSE_TRY_AGAIN)
+            return true;
+        sent += len;
+        return len != 0;
+    }
+
+    size_t drain(AsyncWebServerRequest *request) {
+        size_t sent = 0;
+        while (this->pump(request, sent)) {
+        }
+        return sent;
+    }
+
+ protected:
+    web_server_base::WebServerBase base_;
+    sd_mmc_card::SdMmc card_;
+    Box3Web web_;
+    uint8_t window_[SEND_WINDOW];
+};
+
+typedef std::function<size_t()> Request;
+
+// Runs request once to warm up, then iterations times, recording each one.
+static Result run_case(std::string const &name, size_t iterations, Request const &request) {
+    Result result;
+    result.name = name;
+    request();
+    result.latencies_us.reserve(iterations);
+    size_t base_allocations = allocations;
+    size_t base_live = live_bytes;
+    peak_bytes = base_live;
+    auto started = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; i++) {
+        auto begin = std::chrono::steady_clock::now();
+        result.bytes += request();
+        result.latencies_us.push_back(
+            std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - begin).count());
+    }
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    result.requests = iterations;
+    result.allocations = allocations - base_allocations;
+    result.peak_heap = peak_bytes - base_live;
+    return result;
+}
+
+// rounds of a mix kept in flight together: four downloads, two listings and two ranges, each request getting
+// one send window in turn like connections served by one AsyncTCP task. Round 0 warms up and is not counted.
+static Result run_mix(Harness &harness, size_t rounds) {
+    struct Flight {
+        std::unique_ptr<AsyncWebServerRequest> request;
+        std::chrono::steady_clock::time_point begin;
+        size_t sent{0};
+    };
+    Result result;
+    result.name = "mix_8";
+    std::vector<Flight> flights(8);
+    result.latencies_us.reserve((rounds + 1) * flights.size());
+    size_t base_allocations = 0;
+    size_t base_live = 0;
+    std::chrono::steady_clock::time_point started;
+    for (size_t round = 0; round <= rounds; round++) {
+        if (round == 1) {
+            result.requests = 0;
+            result.bytes = 0;
+            result.latencies_us.clear();
+            base_allocations = allocations;
+            base_live = live_bytes;
+            peak_bytes = base_live;
+            started = std::chrono::steady_clock::now();
+        }
+        for (size_t i = 0; i < flights.size(); i++) {
+            Flight &flight = flights[i];
+            flight.begin = std::chrono::steady_clock::now();
+            flight.sent = 0;
+            if (i < 4) {
+                flight.request = harness.begin(HTTP_GET, "/file/bench/blob_256k.bin", {});
+            } else if (i < 6) {
+                flight.request = harness.begin(HTTP_GET, "/file/bench/dir100", {});
+            } else {
+                flight.request = harness.begin(HTTP_GET, "/file/bench/blob_1m.bin", {{"Range", "bytes=65536-131071"}});
+            }
+        }
+        size_t open = flights.size();
+        while (open > 0) {
+            for (auto &flight : flights) {
+                if (flight.request == nullptr || harness.pump(flight.request.get(), flight.sent))
+                    continue;
+                result.bytes += flight.sent;
+                result.latencies_us.push_back(std::chrono::duration_cast<std::chrono::microseconds>(
+                                                  std::chrono::steady_clock::now() - flight.begin)
+                                                  .count());
+                flight.request.reset();
+                open--;
+            }
+        }
+        result.requests += flights.size();
+    }
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    result.allocations = allocations - base_allocations;
+    result.peak_heap = peak_bytes - base_live;
+    return result;
+}
+
+static std::map<std::string, Baseline> read_baseline(const char *path) {
+    std::map<std::string, Baseline> baseline;
+    FILE *file = fopen(path, "r");
+    if (file == nullptr)
+        return baseline;
+    char line[256];
+    while (fgets(line, sizeof(line), file) != nullptr) {
+        char name[64];
+        Baseline entry;
+        unsigned long peak;
+        if (line[0] != '#' && sscanf(line, "%63s %lf %lu %u %u %lf", name, &entry.allocations_per_request, &peak,
+                                     &entry.p50_us, &entry.p99_us, &entry.mib_per_second) == 6) {
+            entry.peak_heap = peak;
+            baseline[name] = entry;
+        }
+    }
+    fclose(file);
+    return baseline;
+}
+
+static bool write_baseline(const char *path, std::vector<Result> const &results) {
+    FILE *file = fopen(path, "w");
+    if (file == nullptr)
+        return false;
+    fprintf(file, "# Written by box3web_bench --write-baseline. Allocation and heap figures are checked, timings\n"
+                  "# come from the machine that wrote the file and are only shown next to new ones.\n"
+                  "# case allocations/request peak_heap_bytes p50_us p99_us MiB/s\n");
+    for (auto const &result : results) {
+        fprintf(file, "%s %.1f %u %u %u %.1f\n", result.name.c_str(), result.allocations_per_request(),
+                (unsigned) result.peak_heap, (unsigned) result.percentile(50), (unsigned) result.percentile(99),
+                result.mib_per_second());
+    }
+    return fclose(file) == 0;
+}
+
+// Allowed growth over the baseline before a figure counts as a regression.
+static bool regressed(double value, double baseline, double slack) { return value > baseline * 1.1 + slack; }
+
+int main(int argc, char **argv) {
+    const char *baseline_path = nullptr;
+    const char *write_path = nullptr;
+    bool quick = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) {
+            baseline_path = argv[++i];
+        } else if (strcmp(argv[i], "--write-baseline") == 0 && i + 1 < argc) {
+            write_path = argv[++i];
+        } else if (strcmp(argv[i], "--latency-us") == 0 && i + 1 < argc) {
+            sd_mmc_card::SdMmc::set_latency_us(strtoul(argv[++i], nullptr, 10));
+        } else if (strcmp(argv[i], "--quick") == 0) {
+            quick = true;
+        } else {
+            fprintf(stderr,
+                    "usage: %s [--quick] [--latency-us N] [--baseline FILE] [--write-baseline FILE]\n"
+                    "  --quick           a few iterations per case, for ctest\n"
+                    "  --latency-us N    adds N us to every card access\n"
+                    "  --baseline        fails when allocations or peak heap grew past FILE\n",
+                    argv[0]);
+            return 2;
+        }
+    }
+    if (!make_fixture()) {
+        fprintf(stderr, "Cannot create the fixture below %s\n", SD_MOUNT_POINT);
+        return 1;
+    }
+    Harness harness;
+    if (!harness.ok()) {
+        fprintf(stderr, "Box3Web setup failed\n");
+        return 1;
+    }
+    size_t scale = quick ? 1 : 10;
+
+    auto get = [&harness](std::string const &url, std::vector<std::pair<std::string, std::string>> headers = {}) {
+        return [&harness, url, headers]() {
+            auto request = harness.begin(HTTP_GET, url, headers);
+            return harness.drain(request.get());
+        };
+    };
+    std::string listing_etag;
+    {
+        auto request = harness.begin(HTTP_GET, "/file/bench/dir1000", {});
+        harness.drain(request.get());
+        const String *etag = request->response() != nullptr ? request->response()->header("ETag") : nullptr;
+        if (etag != nullptr)
+            listing_etag = *etag;
+    }
+    size_t uploads = 0;
+
+    std::vector<Result> results;
+    results.push_back(run_case("listing_100", 20 * scale, get("/file/bench/dir100")));
+    results.push_back(run_case("listing_1000", 5 * scale, get("/file/bench/dir1000")));
+    results.push_back(run_case("listing_1000_json", 5 * scale, get("/file/bench/dir1000?format=json")));
+    results.push_back(
+        run_case("listing_1000_revalidate", 50 * scale, get("/file/bench/dir1000", {{"If-None-Match", listing_etag}})));
+    results.push_back(run_case("download_1m", 5 * scale, get("/file/bench/blob_1m.bin")));
+    results.push_back(
+        run_case("range_64k", 20 * scale, get("/file/bench/blob_1m.bin", {{"Range", "bytes=524288-589823"}})));
+    results.push_back(run_case("upload_1m", 5 * scale, [&harness, &uploads]() {
+        // Alternating names, every upload after the first two replaces a file.
+        auto request = harness.upload("/file/bench/uploads", "up_" + std::to_string(uploads++ % 2) + ".bin", 1 << 20);
+        harness.drain(request.get());
+        return size_t(1) << 20;
+    }));
+    results.push_back(run_mix(harness, 2 * scale));
+
+    std::map<std::string, Baseline> baseline;
+    if (baseline_path != nullptr) {
+        baseline = read_baseline(baseline_path);
+        if (baseline.empty()) {
+            fprintf(stderr, "No baseline in %s\n", baseline_path);
+            return 1;
+        }
+    }
+    bool failed = false;
+    printf("%-24s %8s %10s %10s %10s %12s %12s\n", "case", "requests", "MiB/s", "p50 us", "p99 us", "allocs/req",
+           "peak heap");
+    for (auto const &result : results) {
+        printf("%-24s %8u %10.1f %10u %10u %12.1f %12u\n", result.name.c_str(), (unsigned) result.requests,
+               result.mib_per_second(), (unsigned) result.percentile(50), (unsigned) result.percentile(99),
+               result.allocations_per_request(), (unsigned) result.peak_heap);
+        auto it = baseline.find(result.name);
+        if (it == baseline.end())
+            continue;
+        Baseline const &base = it->second;
+        bool allocations_up = regressed(result.allocations_per_request(), base.allocations_per_request, 2);
+        bool heap_up = regressed(result.peak_heap, base.peak_heap, 1024);
+        printf("%-24s %8s %10.1f %10u %10u %12.1f %12u%s\n", "  baseline", "", base.mib_per_second,
+               (unsigned) base.p50_us, (unsigned) base.p99_us, base.allocations_per_request, (unsigned) base.peak_heap,
+               allocations_up || heap_up ? "  REGRESSION" : "");
+        failed = failed || allocations_up || heap_up;
+    }
+    if (write_path != nullptr && !write_baseline(write_path, results)) {
+        fprintf(stderr, "Cannot write %s\n", write_path);
+        return 1;
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,157 @@
+// Latency of short requests on the ESP-IDF server while bulk downloads keep it busy. A client fetches a small
+// page now and then while three others download a large file back to back over links of a fixed rate; the
+// page's p50/p99 from request to last byte is compared with the same requests on an idle server, for 0 to 3
+// transfer workers.
+//
+// Responses other than 200 fail the run. Timings depend on the machine and are shown for information only.
+#include "../esp_http_server.cpp"
+#include "esphome/core/log.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace esphome;
+
+static const size_t PAGE_SIZE = 4096;
+static const size_t BULK_SIZE = 1 << 20;
+static const size_t BULK_CLIENTS = 3;
+static const size_t CHUNK_SIZE = 16384;
+// Pause of the page client between two requests.
+static const uint32_t THINK_MS = 20;
+
+static bool write_file(std::string const &path, size_t size) {
+    FILE *file = fopen(box3web::SdFile::real_path(path).c_str(), "wb");
+    if (file == nullptr)
+        return false;
+    std::vector<uint8_t> data(size, 0x5a);
+    bool ok = fwrite(data.data(), 1, size, file) == size;
+    return fclose(file) == 0 && ok;
+}
+
+static bool make_fixture() {
+    if (mkdir(box3web::SdFile::real_path("/idf").c_str(), 0755) != 0 && errno != EEXIST)
+        return false;
+    return write_file("/idf/page.html", PAGE_SIZE) && write_file("/idf/bulk.bin", BULK_SIZE);
+}
+
+static uint32_t percentile(std::vector<uint32_t> samples, unsigned p) {
+    if (samples.empty())
+        return 0;
+    size_t index = (samples.size() - 1) * p / 100;
+    std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+    return samples[index];
+}
+
+struct Run {
+    std::vector<uint32_t> idle_us;
+    std::vector<uint32_t> loaded_us;
+    size_t bulk_bytes{0};
+    double bulk_seconds{0};
+    size_t failures{0};
+};
+
+// Page requests one after the other with a pause in between, latencies in microseconds.
+static std::vector<uint32_t> fetch_pages(httpd_handle_t handle, size_t count, size_t &failures) {
+    std::vector<uint32_t> latencies;
+    for (size_t i = 0; i < count; i++) {
+        auto exchange = host_httpd_submit(handle, HTTP_GET, "/idf/page.html");
+        host_httpd_wait(exchange);
+        if (exchange->status != 200 || exchange->body_bytes != PAGE_SIZE)
+            failures++;
+        latencies.push_back(static_cast<uint32_t>(exchange->completed_us - exchange->submitted_us));
+        std::this_thread::sleep_for(std::chrono::milliseconds(THINK_MS));
+    }
+    return latencies;
+}
+
+static Run run_workers(size_t workers, size_t pages) {
+    Run run;
+    // Left running: the server has no way to stop its workers, as on the device.
+    auto *server = new esp_http_server::EspHttpServer();
+    server->set_worker_pool(workers, CHUNK_SIZE);
+    server->setup();
+    httpd_handle_t handle = host_httpd_last_started();
+
+    run.idle_us = fetch_pages(handle, pages, run.failures);
+
+    std::atomic<bool> stop{false};
+    std::atomic<size_t> bulk_bytes{0};
+    std::atomic<size_t> bulk_failures{0};
+    std::vector<std::thread> clients;
+    auto started = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < BULK_CLIENTS; i++) {
+        clients.emplace_back([handle, &stop, &bulk_bytes, &bulk_failures]() {
+            while (!stop) {
+                auto exchange = host_httpd_submit(handle, HTTP_GET, "/idf/bulk.bin");
+                host_httpd_wait(exchange);
+                if (exchange->status != 200 || exchange->body_bytes != BULK_SIZE)
+                    bulk_failures++;
+                bulk_bytes += exchange->body_bytes;
+            }
+        });
+    }
+    // Let the downloads get going before the first page.
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    run.loaded_us = fetch_pages(handle, pages, run.failures);
+    stop = true;
+    for (auto &client : clients)
+        client.join();
+    run.bulk_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    run.bulk_bytes = bulk_bytes;
+    run.failures += bulk_failures;
+    return run;
+}
+
+int main(int argc, char **argv) {
+    bool quick = false;
+    uint32_t link_rate = 2000000;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--latency-us") == 0 && i + 1 < argc) {
+            sd_mmc_card::SdMmc::set_latency_us(strtoul(argv[++i], nullptr, 10));
+        } else if (strcmp(argv[i], "--link-rate") == 0 && i + 1 < argc) {
+            link_rate = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--quick") == 0) {
+            quick = true;
+        } else {
+            fprintf(stderr,
+                    "usage: %s [--quick] [--latency-us N] [--link-rate N]\n"
+                    "  --quick           a few page requests per case and fast links, for ctest\n"
+                    "  --latency-us N    adds N us to every card access\n"
+                    "  --link-rate N     bytes per second of each client's link, 2000000 by default\n",
+                    argv[0]);
+            return 2;
+        }
+    }
+    if (!make_fixture()) {
+        fprintf(stderr, "Cannot create the fixture below %s\n", box3web::SD_MOUNT_POINT);
+        return 1;
+    }
+    host_set_log_level(HOST_LOG_ERROR);
+    host_httpd_set_link_rate(quick ? 8 * link_rate : link_rate);
+    size_t pages = quick ? 5 : 40;
+
+    bool failed = false;
+    printf("%-8s %12s %12s %12s %12s %10s\n", "workers", "idle p50 us", "idle p99 us", "bulk p50 us", "bulk p99 us",
+           "bulk MiB/s");
+    for (size_t workers = 0; workers <= 3; workers++) {
+        Run run = run_workers(workers, pages);
+        printf("%-8u %12u %12u %12u %12u %10.2f%s\n", (unsigned) workers, (unsigned) percentile(run.idle_us, 50),
+               (unsigned) percentile(run.idle_us, 99), (unsigned) percentile(run.loaded_us, 50),
+               (unsigned) percentile(run.loaded_us, 99), run.bulk_bytes / run.bulk_seconds / 1048576.0,
+               run.failures != 0 ? "  FAILED" : "");
+        failed = failed || run.failures != 0;
+    }
+    fflush(stdout);
+    // The servers' workers are still waiting for transfers, exit without tearing down what they use.
+    _exit(failed ? 1 : 0);
+}
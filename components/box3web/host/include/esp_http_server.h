@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+// The ESP-IDF header brings in string.h as well.
+#include <cstring>
+#include <memory>
+#include <string>
+#include <sys/types.h>
+#include <utility>
+#include <vector>
+// Request methods are the ones of the web_server_base stand-in, a single set for both servers.
+#include "esphome/components/web_server_base/web_server_base.h"
+
+// ESP-IDF httpd with a single task handling requests one after the other, as the real one does. Each request
+// stands for one client connection; what is sent on it is paced to the link rate and counted.
+
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_NO_MEM 0x101
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_NOT_FOUND 0x105
+#define ESP_ERR_HTTPD_RESULT_TRUNC 0xb004
+
+#define HTTPD_RESP_USE_STRLEN -1
+#define HTTPD_SOCK_ERR_TIMEOUT -3
+#define CONFIG_HTTPD_MAX_URI_LEN 512
+
+struct HostHttpd;
+typedef HostHttpd *httpd_handle_t;
+typedef void (*httpd_free_ctx_fn_t)(void *ctx);
+
+struct HostHttpExchange;
+
+typedef struct httpd_req {
+  httpd_handle_t handle;
+  int method;
+  char uri[CONFIG_HTTPD_MAX_URI_LEN + 1];
+  size_t content_len;
+  void *aux;
+  void *user_ctx;
+  void *sess_ctx;
+  httpd_free_ctx_fn_t free_ctx;
+} httpd_req_t;
+
+typedef struct httpd_uri {
+  const char *uri;
+  int method;
+  esp_err_t (*handler)(httpd_req_t *req);
+  void *user_ctx;
+} httpd_uri_t;
+
+typedef struct httpd_config {
+  unsigned task_priority{5};
+  size_t stack_size{4096};
+  uint16_t server_port{80};
+  uint16_t max_open_sockets{7};
+  uint16_t max_uri_handlers{8};
+} httpd_config_t;
+#define HTTPD_DEFAULT_CONFIG() httpd_config_t()
+
+typedef enum {
+  HTTPD_500_INTERNAL_SERVER_ERROR = 0,
+  HTTPD_400_BAD_REQUEST,
+  HTTPD_403_FORBIDDEN,
+  HTTPD_404_NOT_FOUND,
+} httpd_err_code_t;
+
+esp_err_t httpd_start(httpd_handle_t *handle, const httpd_config_t *config);
+esp_err_t httpd_stop(httpd_handle_t handle);
+esp_err_t httpd_register_uri_handler(httpd_handle_t handle, const httpd_uri_t *uri_handler);
+
+size_t httpd_req_get_hdr_value_len(httpd_req_t *req, const char *field);
+esp_err_t httpd_req_get_hdr_value_str(httpd_req_t *req, const char *field, char *value, size_t value_size);
+int httpd_req_recv(httpd_req_t *req, char *buf, size_t buf_len);
+int httpd_req_to_sockfd(httpd_req_t *req);
+esp_err_t httpd_req_async_handler_begin(httpd_req_t *req, httpd_req_t **out);
+esp_err_t httpd_req_async_handler_complete(httpd_req_t *req);
+
+esp_err_t httpd_resp_set_status(httpd_req_t *req, const char *status);
+esp_err_t httpd_resp_set_type(httpd_req_t *req, const char *type);
+esp_err_t httpd_resp_set_hdr(httpd_req_t *req, const char *field, const char *value);
+esp_err_t httpd_resp_send(httpd_req_t *req, const char *buf, ssize_t buf_len);
+esp_err_t httpd_resp_send_chunk(httpd_req_t *req, const char *buf, ssize_t buf_len);
+esp_err_t httpd_resp_send_err(httpd_req_t *req, httpd_err_code_t error, const char *message);
+
+// Host side: a client's view of one request.
+struct HostHttpExchange {
+  int method{0};
+  std::string uri;
+  std::vector<std::pair<std::string, std::string>> headers;
+  int status{0};
+  size_t body_bytes{0};
+  bool complete{false};
+  int64_t submitted_us{0};
+  int64_t completed_us{0};
+};
+
+// Bytes per second each connection carries, 0 for no limit.
+void host_httpd_set_link_rate(uint32_t bytes_per_second);
+// The server httpd_start() started last, for owners that keep their handle to themselves.
+httpd_handle_t host_httpd_last_started();
+// Queues a request for the httpd task; wait for it with host_httpd_wait().
+std::shared_ptr<HostHttpExchange> host_httpd_submit(httpd_handle_t handle, int method, std::string const &uri,
+                                                    std::vector<std::pair<std::string, std::string>> headers = {});
+void host_httpd_wait(std::shared_ptr<HostHttpExchange> const &exchange);
@@ -0,0 +1,5 @@
+#pragma once
+
+#define ESP_IDF_VERSION_VAL(major, minor, patch) (((major) << 16) | ((minor) << 8) | (patch))
+// The version with httpd_req_async_handler_begin(), so esp_http_server.cpp builds its worker pool.
+#define ESP_IDF_VERSION ESP_IDF_VERSION_VAL(5, 2, 0)
@@ -0,0 +1,4 @@
+#pragma once
+
+// The ESP_LOGx macros come from esphome/core/log.h.
+#include "esphome/core/log.h"
@@ -0,0 +1,3 @@
+#pragma once
+
+// Nothing of it is used on the host.
@@ -0,0 +1,6 @@
+#pragma once
+
+#include <cstdint>
+
+// Microseconds since start, as esp_timer counts them since boot.
+int64_t esp_timer_get_time();
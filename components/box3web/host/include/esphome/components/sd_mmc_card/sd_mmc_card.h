@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace esphome {
+namespace sd_mmc_card {
+
+struct FileInfo {
+  std::string path;
+  size_t size;
+  bool is_directory;
+
+  FileInfo(std::string const &path, size_t size, bool is_directory)
+      : path(path), size(size), is_directory(is_directory) {}
+  FileInfo() = default;
+};
+
+// Card backed by the local folder BOX3WEB_SD_MOUNT_POINT. Paths are card paths, as with the driver.
+class SdMmc {
+ public:
+  bool delete_file(std::string const &path);
+  bool is_directory(std::string const &path);
+  bool create_directory(const char *path);
+  bool remove_directory(const char *path);
+  size_t file_size(std::string const &path);
+  std::vector<FileInfo> list_directory_file_info(std::string path, uint8_t depth);
+
+  // Delay added to every card access, here and in the stdio reads and writes of the component when the
+  // program is linked with --wrap=fread,--wrap=fwrite; 0 by default.
+  static void set_latency_us(uint32_t latency_us);
+  static void card_access();
+};
+
+}  // namespace sd_mmc_card
+}  // namespace esphome
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// The part of ESPAsyncWebServer the component uses, with the request built by hand and the response kept for
+// the caller to drain instead of going out on a socket.
+
+class String : public std::string {
+ public:
+  String() = default;
+  String(const char *text) : std::string(text != nullptr ? text : "") {}
+  String(std::string text) : std::string(std::move(text)) {}
+};
+
+enum WebRequestMethod : uint8_t {
+  HTTP_GET = 0b00000001,
+  HTTP_POST = 0b00000010,
+  HTTP_DELETE = 0b00000100,
+  HTTP_PUT = 0b00001000,
+  HTTP_PATCH = 0b00010000,
+  HTTP_HEAD = 0b00100000,
+  HTTP_OPTIONS = 0b01000000,
+};
+
+// Returned by a filler that has nothing to send yet; the server calls it again later.
+#define RESPONSE_TRY_AGAIN 0xFFFFFFFF
+
+typedef std::function<size_t(uint8_t *buffer, size_t max_len, size_t index)> AwsResponseFiller;
+typedef std::function<void()> ArDisconnectHandler;
+
+class AsyncWebHeader {
+ public:
+  AsyncWebHeader(String name, String value) : name_(std::move(name)), value_(std::move(value)) {}
+  const String &name() const { return this->name_; }
+  const String &value() const { return this->value_; }
+
+ protected:
+  String name_;
+  String value_;
+};
+
+class IPAddress {
+ public:
+  explicit IPAddress(uint32_t address = 0) : address_(address) {}
+  operator uint32_t() const { return this->address_; }
+
+ protected:
+  uint32_t address_;
+};
+
+class AsyncClient {
+ public:
+  explicit AsyncClient(uint32_t address) : address_(address) {}
+  IPAddress remoteIP() const { return IPAddress(this->address_); }
+
+ protected:
+  uint32_t address_;
+};
+
+class AsyncWebServerResponse {
+ public:
+  // content_length SIZE_MAX for a chunked body.
+  AsyncWebServerResponse(int code, String content_type, size_t content_length)
+      : code_(code), content_type_(std::move(content_type)), content_length_(content_length) {}
+  virtual ~AsyncWebServerResponse() = default;
+
+  void setCode(int code) { this->code_ = code; }
+  void setContentLength(size_t length) { this->content_length_ = length; }
+  void addHeader(const String &name, const String &value) { this->headers_.emplace_back(name, value); }
+
+  int code() const { return this->code_; }
+  const String &content_type() const { return this->content_type_; }
+  size_t content_length() const { return this->content_length_; }
+  std::vector<std::pair<String, String>> const &headers() const { return this->headers_; }
+  // nullptr when the header was not set.
+  const String *header(const char *name) const;
+
+  // Produces the next piece of the body, 0 once it is complete, RESPONSE_TRY_AGAIN when nothing is ready yet.
+  virtual size_t fill(uint8_t *buffer, size_t max_len) = 0;
+
+ protected:
+  int code_;
+  String content_type_;
+  size_t content_length_;
+  std::vector<std::pair<String, String>> headers_;
+};
+
+class AsyncWebServerRequest {
+ public:
+  // url may carry a query string; path and arguments are percent-decoded like the real server does.
+  AsyncWebServerRequest(WebRequestMethod method, std::string const &url, uint32_t client_address = 0x0100007f);
+  // Runs the disconnect handler, the server drops a request once its connection is gone.
+  ~AsyncWebServerRequest();
+  AsyncWebServerRequest(AsyncWebServerRequest const &) = delete;
+  AsyncWebServerRequest &operator=(AsyncWebServerRequest const &) = delete;
+
+  // Host side: request headers and body length, set before the handler sees the request.
+  void add_header(std::string const &name, std::string const &value);
+  void set_content_length(size_t length) { this->content_length_ = length; }
+  // The response the handler sent, nullptr while it has not answered.
+  AsyncWebServerResponse *response() const { return this->response_.get(); }
+
+  int method() const { return this->method_; }
+  const String &url() const { return this->url_; }
+  size_t contentLength() const { return this->content_length_; }
+  AsyncClient *client() { return &this->client_; }
+
+  bool hasArg(const char *name) const { return this->args_.count(name) != 0; }
+  const String &arg(const char *name) const;
+  const String &arg(const String &name) const { return this->arg(name.c_str()); }
+  bool hasHeader(const char *name) const { return this->getHeader(name) != nullptr; }
+  AsyncWebHeader *getHeader(const char *name) const;
+
+  void onDisconnect(ArDisconnectHandler handler) { this->on_disconnect_ = std::move(handler); }
+
+  AsyncWebServerResponse *beginResponse(int code, const String &content_type, const String &content = String());
+  AsyncWebServerResponse *beginResponse(const String &content_type, size_t length, AwsResponseFiller filler);
+  AsyncWebServerResponse *beginChunkedResponse(const String &content_type, AwsResponseFiller filler);
+  void send(AsyncWebServerResponse *response);
+  void send(int code, const String &content_type = String(), const String &content = String());
+
+ protected:
+  int method_;
+  String url_;
+  std::map<std::string, String> args_;
+  std::vector<std::unique_ptr<AsyncWebHeader>> headers_;
+  size_t content_length_{0};
+  AsyncClient client_;
+  ArDisconnectHandler on_disconnect_;
+  std::unique_ptr<AsyncWebServerResponse> response_;
+};
+
+class AsyncWebHandler {
+ public:
+  virtual ~AsyncWebHandler() = default;
+  virtual bool canHandle(AsyncWebServerRequest *request) { return false; }
+  virtual void handleRequest(AsyncWebServerRequest *request) {}
+  virtual void handleUpload(AsyncWebServerRequest *request, const String &filename, size_t index, uint8_t *data,
+                            size_t len, bool final) {}
+  virtual void handleBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {}
+  virtual bool isRequestHandlerTrivial() { return true; }
+};
+
+namespace esphome {
+namespace web_server_base {
+
+class WebServerBase {
+ public:
+  void add_handler(AsyncWebHandler *handler) { this->handlers_.push_back(handler); }
+  uint16_t get_port() const { return 80; }
+  std::vector<AsyncWebHandler *> const &handlers() const { return this->handlers_; }
+
+ protected:
+  std::vector<AsyncWebHandler *> handlers_;
+};
+
+}  // namespace web_server_base
+}  // namespace esphome
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+
+namespace esphome {
+
+// Enough of Component for one instance driven by hand: intervals run when run_scheduled() is called, the way
+// the main loop would run them.
+class Component {
+ public:
+  virtual ~Component() = default;
+  virtual void setup() {}
+  virtual void loop() {}
+  virtual void dump_config() {}
+
+  void mark_failed() { this->failed_ = true; }
+  bool is_failed() const { return this->failed_; }
+  // Runs the intervals due at millis().
+  void run_scheduled();
+
+ protected:
+  void set_interval(std::string const &name, uint32_t interval, std::function<void()> &&f);
+  bool cancel_interval(std::string const &name);
+
+  struct Interval {
+    uint32_t interval;
+    uint32_t last;
+    std::function<void()> callback;
+    bool cancelled;
+  };
+
+  std::map<std::string, Interval> intervals_;
+  bool failed_{false};
+};
+
+}  // namespace esphome
@@ -0,0 +1,3 @@
+#pragma once
+
+// Host build: the features are picked with compile definitions in host/CMakeLists.txt instead of codegen.
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+namespace esphome {
+
+inline bool str_startswith(std::string const &str, std::string const &start) {
+  return str.compare(0, start.size(), start) == 0;
+}
+inline bool str_endswith(std::string const &str, std::string const &end) {
+  return str.size() >= end.size() && str.compare(str.size() - end.size(), end.size(), end) == 0;
+}
+
+uint32_t random_uint32();
+uint32_t fnv1_hash(std::string const &str);
+std::string format_hex(const uint8_t *data, size_t length);
+std::string base64_encode(const uint8_t *buf, size_t buf_len);
+
+// Same contract as on the device: not recursive, and the requests of a benchmark may run on several threads.
+class Mutex {
+ public:
+  void lock() { this->mutex_.lock(); }
+  bool try_lock() { return this->mutex_.try_lock(); }
+  void unlock() { this->mutex_.unlock(); }
+
+ protected:
+  std::mutex mutex_;
+};
+
+class LockGuard {
+ public:
+  LockGuard(Mutex &mutex) : mutex_(mutex) { mutex_.lock(); }
+  ~LockGuard() { this->mutex_.unlock(); }
+
+ protected:
+  Mutex &mutex_;
+};
+
+}  // namespace esphome
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstdarg>
+
+namespace esphome {
+
+enum HostLogLevel { HOST_LOG_ERROR = 1, HOST_LOG_WARN, HOST_LOG_INFO, HOST_LOG_CONFIG, HOST_LOG_DEBUG, HOST_LOG_VERBOSE };
+
+// Messages above the level are dropped; warnings and errors by default, so benchmark output stays readable.
+void host_set_log_level(HostLogLevel level);
+void host_log(HostLogLevel level, const char *tag, const char *format, ...) __attribute__((format(printf, 3, 4)));
+
+}  // namespace esphome
+
+#define ESP_LOGE(tag, ...) ::esphome::host_log(::esphome::HOST_LOG_ERROR, tag, __VA_ARGS__)
+#define ESP_LOGW(tag, ...) ::esphome::host_log(::esphome::HOST_LOG_WARN, tag, __VA_ARGS__)
+#define ESP_LOGI(tag, ...) ::esphome::host_log(::esphome::HOST_LOG_INFO, tag, __VA_ARGS__)
+#define ESP_LOGCONFIG(tag, ...) ::esphome::host_log(::esphome::HOST_LOG_CONFIG, tag, __VA_ARGS__)
+#define ESP_LOGD(tag, ...) ::esphome::host_log(::esphome::HOST_LOG_DEBUG, tag, __VA_ARGS__)
+#define ESP_LOGV(tag, ...) ::esphome::host_log(::esphome::HOST_LOG_VERBOSE, tag, __VA_ARGS__)
+#define TRUEFALSE(x) ((x) ? "TRUE" : "FALSE")
+#define YESNO(x) ((x) ? "YES" : "NO")
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstdint>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS pdTRUE
+#define portMAX_DELAY 0xffffffffu
+#define portTICK_PERIOD_MS 1
+// One tick per millisecond, as configured on the device.
+#define pdMS_TO_TICKS(ms) ((TickType_t) (ms))
@@ -0,0 +1,12 @@
+#pragma once
+
+#include "FreeRTOS.h"
+
+// Counting semaphore, safe across threads like the FreeRTOS one.
+struct HostSemaphore;
+typedef HostSemaphore *SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max_count, UBaseType_t initial_count);
+void vSemaphoreDelete(SemaphoreHandle_t semaphore);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t wait);
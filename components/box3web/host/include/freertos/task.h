@@ -0,0 +1,13 @@
+#pragma once
+
+#include "FreeRTOS.h"
+
+// Tasks run as detached threads; stack size and priority are ignored.
+typedef void *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char *name, uint32_t stack_size, void *param,
+                       UBaseType_t priority, TaskHandle_t *handle);
+// Only a task deleting itself is supported, its function is expected to return right after.
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
@@ -0,0 +1,129 @@
+#include "esphome/core/component.h"
+#include "esphome/core/hal.h"
+#include "esphome/core/helpers.h"
+#include "esphome/core/log.h"
+#include "esphome/components/network/util.h"
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace esphome {
+
+static const auto START = std::chrono::steady_clock::now();
+static HostLogLevel log_level = HOST_LOG_WARN;
+
+uint32_t millis() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - START).count();
+}
+
+uint32_t micros() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - START).count();
+}
+
+void delay(uint32_t ms) { std::this_thread::sleep_for(std::chrono::milliseconds(ms)); }
+
+uint32_t random_uint32() {
+    static std::mt19937 engine(std::random_device{}());
+    return engine();
+}
+
+uint32_t fnv1_hash(std::string const &str) {
+    uint32_t hash = 2166136261UL;
+    for (char c : str) {
+        hash *= 16777619UL;
+        hash ^= static_cast<uint8_t>(c);
+    }
+    return hash;
+}
+
+std::string format_hex(const uint8_t *data, size_t length) {
+    static const char *const DIGITS = "0123456789abcdef";
+    std::string hex;
+    hex.reserve(length * 2);
+    for (size_t i = 0; i < length; i++) {
+        hex += DIGITS[data[i] >> 4];
+        hex += DIGITS[data[i] & 0x0f];
+    }
+    return hex;
+}
+
+std::string base64_encode(const uint8_t *buf, size_t buf_len) {
+    static const char *const ALPHABET = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    out.reserve((buf_len + 2) / 3 * 4);
+    for (size_t i = 0; i < buf_len; i += 3) {
+        uint32_t group = buf[i] << 16;
+        if (i + 1 < buf_len)
+            group |= buf[i + 1] << 8;
+        if (i + 2 < buf_len)
+            group |= buf[i + 2];
+        out += ALPHABET[(group >> 18) & 0x3f];
+        out += ALPHABET[(group >> 12) & 0x3f];
+        out += i + 1 < buf_len ? ALPHABET[(group >> 6) & 0x3f] : '=';
+        out += i + 2 < buf_len ? ALPHABET[group & 0x3f] : '=';
+    }
+    return out;
+}
+
+void host_set_log_level(HostLogLevel level) { log_level = level; }
+
+void host_log(HostLogLevel level, const char *tag, const char *format, ...) {
+    static const char LETTERS[] = "?EWICDV";
+    if (level > log_level)
+        return;
+    fprintf(stderr, "[%c][%s] ", LETTERS[level], tag);
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fputc('\n', stderr);
+}
+
+void Component::set_interval(std::string const &name, uint32_t interval, std::function<void()> &&f) {
+    this->intervals_[name] = Interval{interval, millis(), std::move(f), false};
+}
+
+bool Component::cancel_interval(std::string const &name) {
+    auto it = this->intervals_.find(name);
+    if (it == this->intervals_.end() || it->second.cancelled)
+        return false;
+    // May be called from the interval itself, run_scheduled() erases it afterwards.
+    it->second.cancelled = true;
+    return true;
+}
+
+void Component::run_scheduled() {
+    uint32_t now = millis();
+    std::vector<std::string> due;
+    for (auto const &it : this->intervals_) {
+        if (!it.second.cancelled && now - it.second.last >= it.second.interval)
+            due.push_back(it.first);
+    }
+    for (auto const &name : due) {
+        auto it = this->intervals_.find(name);
+        if (it == this->intervals_.end() || it->second.cancelled)
+            continue;
+        it->second.last = now;
+        // A copy, the callback may replace its own entry.
+        std::function<void()> callback = it->second.callback;
+        callback();
+    }
+    for (auto it = this->intervals_.begin(); it != this->intervals_.end();) {
+        if (it->second.cancelled) {
+            it = this->intervals_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+namespace network {
+
+std::string get_use_address() { return "localhost"; }
+
+}  // namespace network
+
+}  // namespace esphome
@@ -0,0 +1,252 @@
+#include <esp_http_server.h>
+#include <esp_timer.h>
+#include "../../admission.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <strings.h>
+#include <thread>
+
+static const auto START = std::chrono::steady_clock::now();
+
+int64_t esp_timer_get_time() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - START).count();
+}
+
+struct HostHttpd {
+    std::vector<httpd_uri_t> handlers;
+    std::deque<std::shared_ptr<HostHttpExchange>> pending;
+    std::mutex mutex;
+    std::condition_variable changed;
+    bool stopping{false};
+    std::thread task;
+};
+
+namespace {
+
+// One connection: the exchange it answers and the requests referring to it, the one httpd handed to the
+// handler and an async copy.
+struct Connection {
+    std::shared_ptr<HostHttpExchange> exchange;
+    int status{200};
+    int references{1};
+};
+
+std::mutex exchange_mutex;
+std::condition_variable exchange_done;
+std::atomic<uint32_t> link_rate{0};
+std::atomic<HostHttpd *> last_started{nullptr};
+
+Connection *connection(httpd_req_t *req) { return static_cast<Connection *>(req->aux); }
+
+void finish(httpd_req_t *req, int status) {
+    std::lock_guard<std::mutex> lock(exchange_mutex);
+    HostHttpExchange &exchange = *connection(req)->exchange;
+    if (exchange.complete)
+        return;
+    exchange.status = status;
+    exchange.complete = true;
+    exchange.completed_us = esp_timer_get_time();
+    exchange_done.notify_all();
+}
+
+// Drops a request, ending the connection with the last one; a handler that sent nothing failed.
+void release(httpd_req_t *req) {
+    Connection *conn = connection(req);
+    bool last;
+    {
+        std::lock_guard<std::mutex> lock(exchange_mutex);
+        last = --conn->references == 0;
+    }
+    if (!last)
+        return;
+    finish(req, 500);
+    if (req->sess_ctx != nullptr && req->free_ctx != nullptr)
+        req->free_ctx(req->sess_ctx);
+    delete conn;
+}
+
+bool matches(httpd_uri_t const &handler, int method, std::string const &path) {
+    if (handler.method != method)
+        return false;
+    size_t length = strlen(handler.uri);
+    if (length > 0 && handler.uri[length - 1] == '*')
+        return path.compare(0, length - 1, handler.uri, length - 1) == 0;
+    return path == handler.uri;
+}
+
+void run_httpd(HostHttpd *server) {
+    while (true) {
+        std::shared_ptr<HostHttpExchange> exchange;
+        {
+            std::unique_lock<std::mutex> lock(server->mutex);
+            server->changed.wait(lock, [server]() { return server->stopping || !server->pending.empty(); });
+            if (server->stopping)
+                return;
+            exchange = server->pending.front();
+            server->pending.pop_front();
+        }
+        auto *req = new httpd_req_t{};
+        req->handle = server;
+        req->method = exchange->method;
+        strncpy(req->uri, exchange->uri.c_str(), CONFIG_HTTPD_MAX_URI_LEN);
+        req->aux = new Connection{exchange};
+        std::string path = exchange->uri.substr(0, exchange->uri.find('?'));
+        const httpd_uri_t *handler = nullptr;
+        for (auto const &candidate : server->handlers) {
+            if (matches(candidate, exchange->method, path)) {
+                handler = &candidate;
+                break;
+            }
+        }
+        if (handler == nullptr) {
+            httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Not found");
+        } else {
+            req->user_ctx = handler->user_ctx;
+            handler->handler(req);
+        }
+        release(req);
+        delete req;
+    }
+}
+
+}  // namespace
+
+esp_err_t httpd_start(httpd_handle_t *handle, const httpd_config_t *config) {
+    auto *server = new HostHttpd();
+    server->task = std::thread(run_httpd, server);
+    *handle = server;
+    last_started = server;
+    return ESP_OK;
+}
+
+esp_err_t httpd_stop(httpd_handle_t handle) {
+    {
+        std::lock_guard<std::mutex> lock(handle->mutex);
+        handle->stopping = true;
+        handle->changed.notify_all();
+    }
+    handle->task.join();
+    delete handle;
+    return ESP_OK;
+}
+
+esp_err_t httpd_register_uri_handler(httpd_handle_t handle, const httpd_uri_t *uri_handler) {
+    std::lock_guard<std::mutex> lock(handle->mutex);
+    handle->handlers.push_back(*uri_handler);
+    return ESP_OK;
+}
+
+static const std::string *find_header(httpd_req_t *req, const char *field) {
+    for (auto const &header : connection(req)->exchange->headers) {
+        if (strcasecmp(header.first.c_str(), field) == 0)
+            return &header.second;
+    }
+    return nullptr;
+}
+
+size_t httpd_req_get_hdr_value_len(httpd_req_t *req, const char *field) {
+    const std::string *value = find_header(req, field);
+    return value != nullptr ? value->size() : 0;
+}
+
+esp_err_t httpd_req_get_hdr_value_str(httpd_req_t *req, const char *field, char *value, size_t value_size) {
+    const std::string *found = find_header(req, field);
+    if (found == nullptr)
+        return ESP_ERR_NOT_FOUND;
+    if (value_size == 0)
+        return ESP_ERR_INVALID_ARG;
+    size_t length = std::min(found->size(), value_size - 1);
+    memcpy(value, found->data(), length);
+    value[length] = '\0';
+    return length < found->size() ? ESP_ERR_HTTPD_RESULT_TRUNC : ESP_OK;
+}
+
+int httpd_req_recv(httpd_req_t *req, char *buf, size_t buf_len) { return 0; }
+
+int httpd_req_to_sockfd(httpd_req_t *req) { return 3; }
+
+esp_err_t httpd_req_async_handler_begin(httpd_req_t *req, httpd_req_t **out) {
+    {
+        std::lock_guard<std::mutex> lock(exchange_mutex);
+        connection(req)->references++;
+    }
+    *out = new httpd_req_t(*req);
+    return ESP_OK;
+}
+
+esp_err_t httpd_req_async_handler_complete(httpd_req_t *req) {
+    release(req);
+    delete req;
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_status(httpd_req_t *req, const char *status) {
+    connection(req)->status = atoi(status);
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_type(httpd_req_t *req, const char *type) { return ESP_OK; }
+
+esp_err_t httpd_resp_set_hdr(httpd_req_t *req, const char *field, const char *value) { return ESP_OK; }
+
+esp_err_t httpd_resp_send_chunk(httpd_req_t *req, const char *buf, ssize_t buf_len) {
+    if (buf == nullptr) {
+        finish(req, connection(req)->status);
+        return ESP_OK;
+    }
+    size_t len = buf_len == HTTPD_RESP_USE_STRLEN ? strlen(buf) : buf_len;
+    uint32_t rate = link_rate;
+    if (rate != 0)
+        std::this_thread::sleep_for(std::chrono::microseconds(static_cast<uint64_t>(len) * 1000000 / rate));
+    std::lock_guard<std::mutex> lock(exchange_mutex);
+    connection(req)->exchange->body_bytes += len;
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_send(httpd_req_t *req, const char *buf, ssize_t buf_len) {
+    httpd_resp_send_chunk(req, buf, buf_len);
+    finish(req, connection(req)->status);
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_send_err(httpd_req_t *req, httpd_err_code_t error, const char *message) {
+    static const int STATUS[] = {500, 400, 403, 404};
+    connection(req)->status = STATUS[error];
+    return httpd_resp_send(req, message, HTTPD_RESP_USE_STRLEN);
+}
+
+void host_httpd_set_link_rate(uint32_t bytes_per_second) { link_rate = bytes_per_second; }
+
+httpd_handle_t host_httpd_last_started() { return last_started; }
+
+std::shared_ptr<HostHttpExchange> host_httpd_submit(httpd_handle_t handle, int method, std::string const &uri,
+                                                    std::vector<std::pair<std::string, std::string>> headers) {
+    auto exchange = std::make_shared<HostHttpExchange>();
+    exchange->method = method;
+    exchange->uri = uri;
+    exchange->headers = std::move(headers);
+    exchange->submitted_us = esp_timer_get_time();
+    std::lock_guard<std::mutex> lock(handle->mutex);
+    handle->pending.push_back(exchange);
+    handle->changed.notify_all();
+    return exchange;
+}
+
+void host_httpd_wait(std::shared_ptr<HostHttpExchange> const &exchange) {
+    std::unique_lock<std::mutex> lock(exchange_mutex);
+    exchange_done.wait(lock, [&exchange]() { return exchange->complete; });
+}
+
+namespace esphome {
+namespace box3web {
+
+uint32_t client_address(httpd_req_t *req) { return 0x0100007f; }
+
+}  // namespace box3web
+}  // namespace esphome
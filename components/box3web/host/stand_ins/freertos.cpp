@@ -0,0 +1,130 @@
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A ring over storage allocated once, so passing items does not show up in the allocation counts.
+struct HostQueue {
+    size_t length;
+    size_t item_size;
+    std::vector<uint8_t> storage;
+    size_t head{0};
+    size_t count{0};
+    std::mutex mutex;
+    std::condition_variable changed;
+
+    uint8_t *slot(size_t index) { return &this->storage[(index % this->length) * this->item_size]; }
+};
+
+static bool wait_for(HostQueue *queue, std::unique_lock<std::mutex> &lock, TickType_t wait,
+                     bool (*ready)(HostQueue *)) {
+    if (wait == portMAX_DELAY) {
+        queue->changed.wait(lock, [queue, ready]() { return ready(queue); });
+        return true;
+    }
+    return queue->changed.wait_for(lock, std::chrono::milliseconds(wait), [queue, ready]() { return ready(queue); });
+}
+
+static BaseType_t send(QueueHandle_t queue, const void *item, TickType_t wait, bool front) {
+    std::unique_lock<std::mutex> lock(queue->mutex);
+    if (!wait_for(queue, lock, wait, [](HostQueue *q) { return q->count < q->length; }))
+        return pdFALSE;
+    if (front) {
+        queue->head = (queue->head + queue->length - 1) % queue->length;
+        memcpy(queue->slot(queue->head), item, queue->item_size);
+    } else {
+        memcpy(queue->slot(queue->head + queue->count), item, queue->item_size);
+    }
+    queue->count++;
+    queue->changed.notify_all();
+    return pdTRUE;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+    auto *queue = new HostQueue();
+    queue->length = length;
+    queue->item_size = item_size;
+    queue->storage.resize(length * item_size);
+    return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue) { delete queue; }
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t wait) {
+    return send(queue, item, wait, false);
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t queue, const void *item, TickType_t wait) {
+    return send(queue, item, wait, true);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t wait) {
+    std::unique_lock<std::mutex> lock(queue->mutex);
+    if (!wait_for(queue, lock, wait, [](HostQueue *q) { return q->count != 0; }))
+        return pdFALSE;
+    memcpy(item, queue->slot(queue->head), queue->item_size);
+    queue->head = (queue->head + 1) % queue->length;
+    queue->count--;
+    queue->changed.notify_all();
+    return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    return queue->count;
+}
+
+struct HostSemaphore {
+    UBaseType_t max_count;
+    UBaseType_t count;
+    std::mutex mutex;
+    std::condition_variable changed;
+};
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max_count, UBaseType_t initial_count) {
+    auto *semaphore = new HostSemaphore();
+    semaphore->max_count = max_count;
+    semaphore->count = initial_count;
+    return semaphore;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t semaphore) { delete semaphore; }
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+    std::lock_guard<std::mutex> lock(semaphore->mutex);
+    if (semaphore->count >= semaphore->max_count)
+        return pdFALSE;
+    semaphore->count++;
+    semaphore->changed.notify_one();
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t wait) {
+    std::unique_lock<std::mutex> lock(semaphore->mutex);
+    auto ready = [semaphore]() { return semaphore->count != 0; };
+    if (wait == portMAX_DELAY) {
+        semaphore->changed.wait(lock, ready);
+    } else if (!semaphore->changed.wait_for(lock, std::chrono::milliseconds(wait), ready)) {
+        return pdFALSE;
+    }
+    semaphore->count--;
+    return pdTRUE;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char *name, uint32_t stack_size, void *param,
+                       UBaseType_t priority, TaskHandle_t *handle) {
+    std::thread(function, param).detach();
+    if (handle != nullptr)
+        *handle = nullptr;
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task) {}
+
+void vTaskDelay(TickType_t ticks) { std::this_thread::sleep_for(std::chrono::milliseconds(ticks)); }
@@ -0,0 +1,95 @@
+#include "esphome/components/sd_mmc_card/sd_mmc_card.h"
+#include "../../transfer.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+namespace esphome {
+namespace sd_mmc_card {
+
+static std::atomic<uint32_t> latency_us{0};
+
+static std::string real_path(std::string const &path) { return box3web::SdFile::real_path(path); }
+
+void SdMmc::set_latency_us(uint32_t latency) { latency_us = latency; }
+
+void SdMmc::card_access() {
+    uint32_t latency = latency_us;
+    if (latency != 0)
+        std::this_thread::sleep_for(std::chrono::microseconds(latency));
+}
+
+bool SdMmc::delete_file(std::string const &path) {
+    card_access();
+    return unlink(real_path(path).c_str()) == 0;
+}
+
+bool SdMmc::is_directory(std::string const &path) {
+    card_access();
+    struct stat st;
+    return stat(real_path(path).c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+bool SdMmc::create_directory(const char *path) {
+    card_access();
+    return mkdir(real_path(path).c_str(), 0755) == 0;
+}
+
+bool SdMmc::remove_directory(const char *path) {
+    card_access();
+    return rmdir(real_path(path).c_str()) == 0;
+}
+
+size_t SdMmc::file_size(std::string const &path) {
+    card_access();
+    struct stat st;
+    return stat(real_path(path).c_str(), &st) == 0 ? st.st_size : static_cast<size_t>(-1);
+}
+
+std::vector<FileInfo> SdMmc::list_directory_file_info(std::string path, uint8_t depth) {
+    std::vector<FileInfo> list;
+    card_access();
+    DIR *dir = opendir(real_path(path).c_str());
+    if (dir == nullptr)
+        return list;
+    while (struct dirent *entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if (name == "." || name == "..")
+            continue;
+        std::string child = path == "/" ? "/" + name : path + "/" + name;
+        struct stat st;
+        if (stat(real_path(child).c_str(), &st) != 0)
+            continue;
+        list.emplace_back(child, S_ISDIR(st.st_mode) ? 0 : st.st_size, S_ISDIR(st.st_mode));
+        if (S_ISDIR(st.st_mode) && depth > 0) {
+            auto below = this->list_directory_file_info(child, depth - 1);
+            list.insert(list.end(), below.begin(), below.end());
+        }
+    }
+    closedir(dir);
+    return list;
+}
+
+}  // namespace sd_mmc_card
+}  // namespace esphome
+
+#ifdef BOX3WEB_HOST_WRAP_STDIO
+// The component reads and writes the card through stdio, linking with --wrap routes those calls here.
+extern "C" size_t __real_fread(void *ptr, size_t size, size_t count, FILE *stream);
+extern "C" size_t __real_fwrite(const void *ptr, size_t size, size_t count, FILE *stream);
+
+extern "C" size_t __wrap_fread(void *ptr, size_t size, size_t count, FILE *stream) {
+    esphome::sd_mmc_card::SdMmc::card_access();
+    return __real_fread(ptr, size, count, stream);
+}
+
+extern "C" size_t __wrap_fwrite(const void *ptr, size_t size, size_t count, FILE *stream) {
+    esphome::sd_mmc_card::SdMmc::card_access();
+    return __real_fwrite(ptr, size, count, stream);
+}
+#endif
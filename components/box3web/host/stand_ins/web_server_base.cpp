@@ -0,0 +1,152 @@
+#include "esphome/components/web_server_base/web_server_base.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <strings.h>
+
+namespace {
+
+// Body held in memory, e.g. an error message.
+class BasicResponse : public AsyncWebServerResponse {
+ public:
+    BasicResponse(int code, String const &content_type, String const &content)
+        : AsyncWebServerResponse(code, content_type, content.size()), content_(content) {}
+
+    size_t fill(uint8_t *buffer, size_t max_len) override {
+        size_t len = std::min(max_len, this->content_.size() - this->pos_);
+        memcpy(buffer, this->content_.data() + this->pos_, len);
+        this->pos_ += len;
+        return len;
+    }
+
+ protected:
+    String content_;
+    size_t pos_{0};
+};
+
+// Body produced by a filler, up to a known length or, chunked, until the filler returns 0.
+class CallbackResponse : public AsyncWebServerResponse {
+ public:
+    CallbackResponse(String const &content_type, size_t length, AwsResponseFiller filler)
+        : AsyncWebServerResponse(200, content_type, length), filler_(std::move(filler)) {}
+
+    size_t fill(uint8_t *buffer, size_t max_len) override {
+        if (this->content_length_ != SIZE_MAX)
+            max_len = std::min(max_len, this->content_length_ - this->index_);
+        if (max_len == 0)
+            return 0;
+        size_t len = this->filler_(buffer, max_len, this->index_);
+        if (len != RESPONSE_TRY_AGAIN)
+            this->index_ += len;
+        return len;
+    }
+
+ protected:
+    AwsResponseFiller filler_;
+    size_t index_{0};
+};
+
+int hex_value(char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+// Only the query string uses '+' for spaces.
+std::string url_decode(std::string const &text, bool query) {
+    std::string decoded;
+    decoded.reserve(text.size());
+    for (size_t i = 0; i < text.size(); i++) {
+        if (text[i] == '%' && i + 2 < text.size() && hex_value(text[i + 1]) >= 0 && hex_value(text[i + 2]) >= 0) {
+            decoded += static_cast<char>(hex_value(text[i + 1]) * 16 + hex_value(text[i + 2]));
+            i += 2;
+        } else if (query && text[i] == '+') {
+            decoded += ' ';
+        } else {
+            decoded += text[i];
+        }
+    }
+    return decoded;
+}
+
+}  // namespace
+
+const String *AsyncWebServerResponse::header(const char *name) const {
+    for (auto const &header : this->headers_) {
+        if (strcasecmp(header.first.c_str(), name) == 0)
+            return &header.second;
+    }
+    return nullptr;
+}
+
+AsyncWebServerRequest::AsyncWebServerRequest(WebRequestMethod method, std::string const &url,
+                                             uint32_t client_address)
+    : method_(method), client_(client_address) {
+    size_t query = url.find('?');
+    this->url_ = url_decode(url.substr(0, query), false);
+    if (query == std::string::npos)
+        return;
+    size_t start = query + 1;
+    while (start <= url.size()) {
+        size_t end = url.find('&', start);
+        if (end == std::string::npos)
+            end = url.size();
+        std::string pair = url.substr(start, end - start);
+        if (!pair.empty()) {
+            size_t equals = pair.find('=');
+            std::string name = url_decode(pair.substr(0, equals), true);
+            std::string value = equals == std::string::npos ? "" : url_decode(pair.substr(equals + 1), true);
+            this->args_[name] = value;
+        }
+        start = end + 1;
+    }
+}
+
+AsyncWebServerRequest::~AsyncWebServerRequest() {
+    if (this->on_disconnect_)
+        this->on_disconnect_();
+}
+
+void AsyncWebServerRequest::add_header(std::string const &name, std::string const &value) {
+    this->headers_.emplace_back(new AsyncWebHeader(name, value));
+}
+
+const String &AsyncWebServerRequest::arg(const char *name) const {
+    static const String EMPTY;
+    auto it = this->args_.find(name);
+    return it != this->args_.end() ? it->second : EMPTY;
+}
+
+AsyncWebHeader *AsyncWebServerRequest::getHeader(const char *name) const {
+    for (auto const &header : this->headers_) {
+        if (strcasecmp(header->name().c_str(), name) == 0)
+            return header.get();
+    }
+    return nullptr;
+}
+
+AsyncWebServerResponse *AsyncWebServerRequest::beginResponse(int code, const String &content_type,
+                                                             const String &content) {
+    return new BasicResponse(code, content_type, content);
+}
+
+AsyncWebServerResponse *AsyncWebServerRequest::beginResponse(const String &content_type, size_t length,
+                                                             AwsResponseFiller filler) {
+    return new CallbackResponse(content_type, length, std::move(filler));
+}
+
+AsyncWebServerResponse *AsyncWebServerRequest::beginChunkedResponse(const String &content_type,
+                                                                    AwsResponseFiller filler) {
+    return new CallbackResponse(content_type, SIZE_MAX, std::move(filler));
+}
+
+void AsyncWebServerRequest::send(AsyncWebServerResponse *response) { this->response_.reset(response); }
+
+void AsyncWebServerRequest::send(int code, const String &content_type, const String &content) {
+    this->send(this->beginResponse(code, content_type, content));
+}
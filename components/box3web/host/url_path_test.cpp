@@ -0,0 +1,238 @@
+// Checks of the request path rules in url_path.h, run by ctest:
+//
+//   build/box3web_url_path_test [--iterations N]
+//
+// Fixed cases cover each refusal, then random paths built from the characters that matter check the invariants of
+// every accepted result and that out is left untouched on error.
+#include "url_path.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+
+using esphome::box3web::append_file_name;
+using esphome::box3web::append_url_path;
+using esphome::box3web::PathBuffer;
+using esphome::box3web::PathError;
+
+namespace {
+
+int failures = 0;
+
+const char *error_name(PathError error) {
+    switch (error) {
+        case PathError::NONE:
+            return "NONE";
+        case PathError::MALFORMED:
+            return "MALFORMED";
+        case PathError::TRAVERSAL:
+            return "TRAVERSAL";
+        case PathError::TOO_LONG:
+            return "TOO_LONG";
+        case PathError::RESERVED:
+            return "RESERVED";
+    }
+    return "?";
+}
+
+std::string printable(std::string const &text) {
+    std::string result;
+    for (unsigned char c : text) {
+        if (c < 0x20 || c >= 0x7f) {
+            char escaped[5];
+            snprintf(escaped, sizeof(escaped), "\\x%02x", c);
+            result += escaped;
+        } else {
+            result += static_cast<char>(c);
+        }
+    }
+    return result;
+}
+
+// Appends url to a buffer already holding base, checks the error and, on success, the appended part.
+void expect_path(std::string const &url, bool decode, PathError expected, std::string const &appended = "") {
+    const std::string base = "/sdcard";
+    PathBuffer out;
+    out.append(base);
+    PathError error = append_url_path(url, decode, out);
+    std::string result = out.str();
+    bool ok = error == expected;
+    if (expected == PathError::NONE)
+        ok = ok && result == base + appended;
+    else
+        ok = ok && result == base;
+    if (!ok) {
+        fprintf(stderr, "FAIL append_url_path(\"%s\", %s): %s \"%s\", expected %s \"%s\"\n", printable(url).c_str(),
+                decode ? "true" : "false", error_name(error), printable(result).c_str(), error_name(expected),
+                printable(expected == PathError::NONE ? base + appended : base).c_str());
+        failures++;
+    }
+}
+
+// Both with and without decoding, for inputs without '%' or '?'.
+void expect_both(std::string const &url, PathError expected, std::string const &appended = "") {
+    expect_path(url, false, expected, appended);
+    expect_path(url, true, expected, appended);
+}
+
+void expect_file_name(std::string const &name, PathError expected) {
+    PathBuffer out;
+    out.append("/sdcard/uploads");
+    PathError error = append_file_name(name, out);
+    std::string want = expected == PathError::NONE ? "/sdcard/uploads/" + name : "/sdcard/uploads";
+    if (error != expected || out.str() != want) {
+        fprintf(stderr, "FAIL append_file_name(\"%s\"): %s \"%s\", expected %s \"%s\"\n", printable(name).c_str(),
+                error_name(error), printable(out.str()).c_str(), error_name(expected), printable(want).c_str());
+        failures++;
+    }
+}
+
+void fixed_cases() {
+    // Accepted, with empty and "." segments dropped and no trailing separator.
+    expect_both("", PathError::NONE, "");
+    expect_both("/", PathError::NONE, "");
+    expect_both("/music/a.mp3", PathError::NONE, "/music/a.mp3");
+    expect_both("music//./a.mp3/", PathError::NONE, "/music/a.mp3");
+    expect_both("/.../..a/a../.hidden", PathError::NONE, "/.../..a/a../.hidden");
+    expect_both("/box3web/x.box3web", PathError::NONE, "/box3web/x.box3web");
+    expect_both("/caf\xc3\xa9", PathError::NONE, "/caf\xc3\xa9");
+    expect_path("/a%20b/c+d", true, PathError::NONE, "/a b/c+d");
+    expect_path("/a%20b", false, PathError::NONE, "/a%20b");
+    expect_path("/a/b?path=/../x", true, PathError::NONE, "/a/b");
+    expect_path("/a/b?x", false, PathError::NONE, "/a/b?x");
+
+    // "..", literal or encoded, is refused rather than resolved.
+    expect_both("..", PathError::TRAVERSAL);
+    expect_both("/..", PathError::TRAVERSAL);
+    expect_both("/a/../b", PathError::TRAVERSAL);
+    expect_both("/a/..", PathError::TRAVERSAL);
+    expect_both("/a/../", PathError::TRAVERSAL);
+    expect_path("/a/%2e%2e/b", true, PathError::TRAVERSAL);
+    expect_path("/a/.%2E", true, PathError::TRAVERSAL);
+
+    // Internal names, in any segment.
+    expect_both("/.box3web", PathError::RESERVED);
+    expect_both("/.box3web.part.1", PathError::RESERVED);
+    expect_both("/a/.box3web-index/b", PathError::RESERVED);
+    expect_path("/%2ebox3web", true, PathError::RESERVED);
+
+    // Control characters, DEL, backslashes and overlong UTF-8 leads, literal or encoded.
+    for (int c = 1; c < 0x20; c++)
+        expect_both(std::string("/a") + static_cast<char>(c) + "b", PathError::MALFORMED);
+    expect_both(std::string("/a\0b", 4), PathError::MALFORMED);
+    expect_both("/a\x7f", PathError::MALFORMED);
+    expect_both("/a\\..\\b", PathError::MALFORMED);
+    expect_both("/\xc0\xae\xc0\xae/x", PathError::MALFORMED);
+    expect_both("/\xc1\xbf", PathError::MALFORMED);
+    expect_path("/a%0ab", true, PathError::MALFORMED);
+    expect_path("/a%7F", true, PathError::MALFORMED);
+    expect_path("/a%5c..%5cb", true, PathError::MALFORMED);
+    expect_path("/%c0%ae%c0%ae/x", true, PathError::MALFORMED);
+    expect_path("/%C1%81", true, PathError::MALFORMED);
+
+    // An encoded separator or NUL, and broken escapes.
+    expect_path("/a%2f..%2fb", true, PathError::MALFORMED);
+    expect_path("/..%2F", true, PathError::MALFORMED);
+    expect_path("/a%00b", true, PathError::MALFORMED);
+    expect_path("/a%", true, PathError::MALFORMED);
+    expect_path("/a%2", true, PathError::MALFORMED);
+    expect_path("/a%zz", true, PathError::MALFORMED);
+
+    // Length, counting the buffer's existing content.
+    std::string segment(esphome::box3web::MAX_PATH_LENGTH - strlen("/sdcard") - 1, 'x');
+    expect_both("/" + segment, PathError::NONE, "/" + segment);
+    expect_both("/" + segment + "x", PathError::TOO_LONG);
+    expect_both("/" + segment + "/", PathError::NONE, "/" + segment);
+
+    // A file name must be a single plain segment.
+    expect_file_name("song.mp3", PathError::NONE);
+    expect_file_name("..a", PathError::NONE);
+    expect_file_name("", PathError::MALFORMED);
+    expect_file_name(".", PathError::MALFORMED);
+    expect_file_name("..", PathError::TRAVERSAL);
+    expect_file_name("a/b", PathError::MALFORMED);
+    expect_file_name("/a", PathError::MALFORMED);
+    expect_file_name("a\\b", PathError::MALFORMED);
+    expect_file_name("a\nb", PathError::MALFORMED);
+    expect_file_name("\xc0\xaf", PathError::MALFORMED);
+    expect_file_name(".box3web.part", PathError::RESERVED);
+    expect_file_name("a%2fb", PathError::NONE);
+}
+
+// Every accepted result is a sequence of "/segment" with no empty, ".", ".." or internal segment and no forbidden
+// byte.
+bool valid_result(std::string const &path) {
+    if (path.empty())
+        return true;
+    if (path.front() != '/')
+        return false;
+    size_t start = 1;
+    while (start <= path.size()) {
+        size_t end = path.find('/', start);
+        if (end == std::string::npos)
+            end = path.size();
+        std::string segment = path.substr(start, end - start);
+        if (segment.empty() || segment == "." || segment == ".." || esphome::box3web::is_internal_name(segment))
+            return false;
+        for (unsigned char c : segment) {
+            if (c < 0x20 || c == 0x7f || c == '\\' || c == 0xc0 || c == 0xc1)
+                return false;
+        }
+        start = end + 1;
+    }
+    return true;
+}
+
+void random_cases(unsigned iterations) {
+    static const char *const PIECES[] = {"/",   "//",  ".",   "..",  "a",   "bc",  ".box3web", "box3web",
+                                         "%2e", "%2E", "%2f", "%2F", "%00", "%5c", "%c0",      "%c1",
+                                         "%41", "%",   "%4",  "?",   "\\",  "\n",  "\x7f",     "\xc0",
+                                         "\xc1", "\xc3\xa9", "+"};
+    const size_t piece_count = sizeof(PIECES) / sizeof(PIECES[0]);
+    std::mt19937 random(12345);
+    for (unsigned i = 0; i < iterations; i++) {
+        std::string url;
+        size_t pieces = random() % 12;
+        for (size_t p = 0; p < pieces; p++)
+            url += PIECES[random() % piece_count];
+        if (random() % 64 == 0)
+            url += std::string(random() % 300, 'x');
+        for (bool decode : {false, true}) {
+            PathBuffer out;
+            out.append("/base");
+            PathError error = append_url_path(url, decode, out);
+            std::string result = out.str();
+            bool ok = error == PathError::NONE ? result.compare(0, 5, "/base") == 0 && valid_result(result.substr(5))
+                                               : result == "/base";
+            if (!ok) {
+                fprintf(stderr, "FAIL append_url_path(\"%s\", %s): %s \"%s\"\n", printable(url).c_str(),
+                        decode ? "true" : "false", error_name(error), printable(result).c_str());
+                failures++;
+            }
+        }
+    }
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    unsigned iterations = 200000;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+            iterations = strtoul(argv[++i], nullptr, 10);
+        } else {
+            fprintf(stderr, "usage: %s [--iterations N]\n", argv[0]);
+            return 2;
+        }
+    }
+    fixed_cases();
+    random_cases(iterations);
+    if (failures != 0) {
+        fprintf(stderr, "%d failures\n", failures);
+        return 1;
+    }
+    printf("url_path: all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,228 @@
+#include "listing.h"
+#include "box3web.h"
+
+#include <algorithm>
+#include <strings.h>
+
+namespace esphome {
+namespace box3web {
+
+std::string UrlMapping::uri_for(std::string const &path) const {
+    std::string relative = Path::remove_root_path(path, this->root_path);
+    if (this->url_prefix.empty())
+        return Path::is_absolute(relative) ? relative : "/" + relative;
+    return "/" + Path::join(this->url_prefix, relative);
+}
+
+// Card path as seen from the mount, always with a leading separator.
+static std::string mount_relative(std::string const &path, std::string const &root_path) {
+    std::string relative = Path::remove_root_path(path, root_path);
+    if (!Path::is_absolute(relative))
+        relative.insert(0, 1, Path::separator);
+    return relative;
+}
+
+JsonListingSource::JsonListingSource(std::unique_ptr<DirIterator> dir, std::string const &path, UrlMapping mapping,
+                                     size_t cursor, size_t limit)
+    : dir_(std::move(dir)), path_(path), mapping_(std::move(mapping)), cursor_(cursor), limit_(limit) {}
+
+bool JsonListingSource::produce(std::string &out) {
+    switch (this->state_) {
+        case State::HEADER: {
+            out += "{\"path\":\"";
+            out += json_escape(mount_relative(this->path_, this->mapping_.root_path));
+            out += "\",\"entries\":[";
+            this->state_ = State::ENTRIES;
+            return true;
+        }
+        case State::ENTRIES: {
+            sd_mmc_card::FileInfo info;
+            if (!this->dir_->next(info)) {
+                out += "],\"next\":null}";
+                this->state_ = State::DONE;
+                return true;
+            }
+            if (this->emitted_ == this->limit_) {
+                // One entry past the page proves there is another page.
+                out += "],\"next\":\"";
+                out += std::to_string(this->cursor_ + this->emitted_);
+                out += "\"}";
+                this->state_ = State::DONE;
+                return true;
+            }
+            if (this->emitted_++ > 0)
+                out += ',';
+            out += "{\"name\":\"";
+            out += json_escape(Path::file_name(info.path));
+            out += "\",\"type\":\"";
+            out += info.is_directory ? "directory" : "file";
+            out += "\",\"size\":";
+            out += std::to_string(info.size);
+            out += ",\"uri\":\"";
+            out += json_escape(this->mapping_.uri_for(info.path));
+            out += "\"}";
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+JsonSearchSource::JsonSearchSource(std::vector<IndexEntry> results, std::string const &path, UrlMapping mapping,
+                                   bool truncated)
+    : results_(std::move(results)), path_(path), mapping_(std::move(mapping)), truncated_(truncated) {}
+
+bool JsonSearchSource::produce(std::string &out) {
+    if (!this->started_) {
+        this->started_ = true;
+        out += "{\"path\":\"";
+        out += json_escape(mount_relative(this->path_, this->mapping_.root_path));
+        out += "\",\"entries\":[";
+        return true;
+    }
+    if (this->index_ > this->results_.size())
+        return false;
+    if (this->index_ == this->results_.size()) {
+        out += "],\"truncated\":";
+        out += this->truncated_ ? "true}" : "false}";
+        this->index_++;
+        return true;
+    }
+    IndexEntry const &entry = this->results_[this->index_];
+    if (this->index_++ > 0)
+        out += ',';
+    out += "{\"name\":\"";
+    out += json_escape(Path::file_name(entry.path));
+    out += "\",\"path\":\"";
+    out += json_escape(mount_relative(entry.path, this->mapping_.root_path));
+    out += "\",\"type\":\"";
+    out += entry.is_directory ? "directory" : "file";
+    out += "\",\"size\":";
+    out += std::to_string(entry.size);
+    out += ",\"mtime\":";
+    out += std::to_string(entry.mtime);
+    out += ",\"uri\":\"";
+    out += json_escape(this->mapping_.uri_for(entry.path));
+    out += "\"}";
+    return true;
+}
+
+HtmlListingSource::HtmlListingSource(const Box3Web *parent, const Mount *mount, std::string const &path,
+                                     IndexSort sort, size_t sort_limit)
+    : parent_(parent),
+      mount_(mount),
+      path_(path),
+      sort_(sort_limit > 0 ? sort : IndexSort::NONE),
+      sort_limit_(sort_limit) {}
+
+bool HtmlListingSource::open() {
+    ListingCache *cache = this->parent_->listing_cache_.get();
+    if (cache != nullptr)
+        this->cached_ = cache->get(this->path_);
+    if (this->cached_ != nullptr)
+        return true;
+    // Taken before the directory is read: a change while the page streams makes what it collects stale.
+    this->generation_ = this->parent_->listing_generation_.load();
+    this->dir_ = std::unique_ptr<DirIterator>(new DirIterator());
+    if (!this->dir_->open(this->path_))
+        return false;
+    if (cache != nullptr)
+        this->collected_ = std::make_shared<Listing>();
+    return true;
+}
+
+bool HtmlListingSource::read_directory(sd_mmc_card::FileInfo &info) {
+    if (!this->dir_->next(info)) {
+        if (this->collected_ != nullptr) {
+            if (this->parent_->listing_generation_.load() == this->generation_)
+                this->parent_->listing_cache_->put(this->path_, this->collected_);
+            this->collected_.reset();
+        }
+        return false;
+    }
+    if (this->collected_ != nullptr) {
+        this->collected_bytes_ += sizeof(sd_mmc_card::FileInfo) + info.path.size();
+        if (this->collected_bytes_ > this->parent_->listing_cache_->max_bytes()) {
+            this->collected_.reset();
+        } else {
+            this->collected_->push_back(info);
+        }
+    }
+    return true;
+}
+
+bool HtmlListingSource::next_unsorted(sd_mmc_card::FileInfo &info) {
+    if (this->cached_ != nullptr) {
+        if (this->cached_pos_ == this->cached_->size())
+            return false;
+        info = (*this->cached_)[this->cached_pos_++];
+        return true;
+    }
+    return this->read_directory(info);
+}
+
+bool HtmlListingSource::next_entry(sd_mmc_card::FileInfo &info) {
+    if (this->sorted_pos_ < this->sorted_.size()) {
+        info = std::move(this->sorted_[this->sorted_pos_++]);
+        if (this->sorted_pos_ == this->sorted_.size()) {
+            this->sorted_.clear();
+            this->sorted_.shrink_to_fit();
+        }
+        return true;
+    }
+    return this->next_unsorted(info);
+}
+
+void HtmlListingSource::prepare_sort() {
+    sd_mmc_card::FileInfo info;
+    while (this->sorted_.size() < this->sort_limit_ && this->next_unsorted(info))
+        this->sorted_.push_back(std::move(info));
+    // One more entry tells a folder of exactly sort_limit entries from a larger one; it then leads the unsorted
+    // tail.
+    if (this->sorted_.size() == this->sort_limit_ && this->next_unsorted(info)) {
+        // Bounded sort: anything past the limit cannot be ordered without unbounded memory.
+        this->sorted_.push_back(std::move(info));
+        this->sort_overflow_ = true;
+        return;
+    }
+    IndexSort sort = this->sort_;
+    std::sort(this->sorted_.begin(), this->sorted_.end(),
+              [sort](sd_mmc_card::FileInfo const &a, sd_mmc_card::FileInfo const &b) {
+                  if (a.is_directory != b.is_directory)
+                      return a.is_directory;
+                  if (sort == IndexSort::SIZE && a.size != b.size)
+                      return a.size > b.size;
+                  return strcasecmp(Path::file_name(a.path).c_str(), Path::file_name(b.path).c_str()) < 0;
+              });
+}
+
+bool HtmlListingSource::produce(std::string &out) {
+    switch (this->state_) {
+        case State::HEAD:
+            this->parent_->write_index_head(out, *this->mount_, this->path_);
+            if (this->sort_ != IndexSort::NONE)
+                this->prepare_sort();
+            this->state_ = State::ROWS;
+            return true;
+        case State::ROWS: {
+            sd_mmc_card::FileInfo info;
+            if (this->next_entry(info)) {
+                this->parent_->write_row(out, *this->mount_, info);
+                return true;
+            }
+            this->state_ = State::TAIL;
+            return true;
+        }
+        case State::TAIL:
+            if (this->sort_overflow_)
+                out += "<tr><td colspan=\"4\">Folder too large to sort, shown in card order.</td></tr>";
+            this->parent_->write_index_tail(out);
+            this->state_ = State::DONE;
+            return true;
+        default:
+            return false;
+    }
+}
+
+}  // namespace box3web
+}  // namespace esphome
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include "directory.h"
+#include "listing_cache.h"
+#include "search_index.h"
+#include "transfer.h"
+
+namespace esphome {
+namespace box3web {
+
+class Box3Web;
+struct Mount;
+
+// Maps a card path to the URL it is served under.
+struct UrlMapping {
+  std::string url_prefix;
+  std::string root_path;
+
+  std::string uri_for(std::string const &path) const;
+};
+
+// One page of a directory as JSON, emitted entry by entry while the directory is read:
+// {"path":...,"entries":[{"name","type","size","uri"}...],"next":"<cursor>"|null}
+class JsonListingSource : public TextSource {
+ public:
+  JsonListingSource(std::unique_ptr<DirIterator> dir, std::string const &path, UrlMapping mapping, size_t cursor,
+                    size_t limit);
+
+ protected:
+  bool produce(std::string &out) override;
+
+  enum class State { HEADER, ENTRIES, DONE };
+
+  std::unique_ptr<DirIterator> dir_;
+  std::string path_;
+  UrlMapping mapping_;
+  size_t cursor_;
+  size_t limit_;
+  size_t emitted_{0};
+  State state_{State::HEADER};
+};
+
+// Search results in the shape of a JSON listing, with the path of each entry relative to the mount:
+// {"path":...,"entries":[{"name","path","type","size","mtime","uri"}...],"truncated":bool}
+class JsonSearchSource : public TextSource {
+ public:
+  JsonSearchSource(std::vector<IndexEntry> results, std::string const &path, UrlMapping mapping, bool truncated);
+
+ protected:
+  bool produce(std::string &out) override;
+
+  std::vector<IndexEntry> results_;
+  std::string path_;
+  UrlMapping mapping_;
+  bool truncated_;
+  size_t index_{0};
+  bool started_{false};
+};
+
+enum class IndexSort { NONE, NAME, SIZE };
+
+// Pull-based HTML index: rows are rendered only when the socket asks for more bytes.
+// Per request it holds a directory iterator (or a cached listing), one row of text and,
+// when sorting, at most sort_limit entries plus one. Larger folders are sent in card order.
+class HtmlListingSource : public TextSource {
+ public:
+  HtmlListingSource(const Box3Web *parent, const Mount *mount, std::string const &path, IndexSort sort,
+                    size_t sort_limit);
+
+  bool open();
+
+ protected:
+  bool produce(std::string &out) override;
+  bool next_entry(sd_mmc_card::FileInfo &info);
+  bool next_unsorted(sd_mmc_card::FileInfo &info);
+  bool read_directory(sd_mmc_card::FileInfo &info);
+  void prepare_sort();
+
+  enum class State { HEAD, ROWS, TAIL, DONE };
+
+  const Box3Web *parent_;
+  const Mount *mount_;
+  std::string path_;
+  IndexSort sort_;
+  size_t sort_limit_;
+  State state_{State::HEAD};
+
+  std::shared_ptr<const Listing> cached_;
+  size_t cached_pos_{0};
+  std::unique_ptr<DirIterator> dir_;
+  // Listing rebuilt for the cache while streaming, dropped once it outgrows the cache.
+  std::shared_ptr<Listing> collected_;
+  size_t collected_bytes_{0};
+  // Listing generation when the directory was opened, the collected listing is only cached if it still holds.
+  uint32_t generation_{0};
+
+  Listing sorted_;
+  size_t sorted_pos_{0};
+  bool sort_overflow_{false};
+};
+
+}  // namespace box3web
+}  // namespace esphome
@@ -0,0 +1,83 @@
+#include "listing_cache.h"
+
+namespace esphome {
+namespace box3web {
+
+std::string ListingCache::key(std::string const &directory) {
+    if (directory.size() > 1 && directory.back() == '/')
+        return directory.substr(0, directory.size() - 1);
+    return directory;
+}
+
+size_t ListingCache::estimate(std::string const &directory, Listing const &listing) {
+    size_t bytes = sizeof(Entry) + directory.capacity() + sizeof(Listing) + listing.capacity() * sizeof(sd_mmc_card::FileInfo);
+    for (auto const &info : listing)
+        bytes += info.path.capacity();
+    return bytes;
+}
+
+std::shared_ptr<const Listing> ListingCache::get(std::string const &directory) {
+    LockGuard guard(this->mutex_);
+    auto it = this->index_.find(key(directory));
+    if (it == this->index_.end()) {
+        this->misses_++;
+        return nullptr;
+    }
+    this->hits_++;
+    this->entries_.splice(this->entries_.begin(), this->entries_, it->second);
+    return it->second->listing;
+}
+
+void ListingCache::put(std::string const &directory, std::shared_ptr<const Listing> listing) {
+    std::string k = key(directory);
+    size_t bytes = estimate(k, *listing);
+    if (bytes > this->max_bytes_)
+        return;
+    LockGuard guard(this->mutex_);
+    auto existing = this->index_.find(k);
+    if (existing != this->index_.end())
+        this->erase_(existing->second);
+    while (!this->entries_.empty() && this->bytes_ + bytes > this->max_bytes_)
+        this->erase_(std::prev(this->entries_.end()));
+    this->entries_.push_front(Entry{k, std::move(listing), bytes});
+    this->index_[k] = this->entries_.begin();
+    this->bytes_ += bytes;
+}
+
+void ListingCache::invalidate(std::string const &directory) {
+    LockGuard guard(this->mutex_);
+    auto it = this->index_.find(key(directory));
+    if (it != this->index_.end())
+        this->erase_(it->second);
+}
+
+void ListingCache::invalidate_tree(std::string const &directory) {
+    std::string k = key(directory);
+    std::string below = k == "/" ? k : k + "/";
+    LockGuard guard(this->mutex_);
+    auto it = this->index_.find(k);
+    if (it != this->index_.end())
+        this->erase_(it->second);
+    it = this->index_.lower_bound(below);
+    while (it != this->index_.end() && it->first.compare(0, below.size(), below) == 0) {
+        auto next = std::next(it);
+        this->erase_(it->second);
+        it = next;
+    }
+}
+
+void ListingCache::clear() {
+    LockGuard guard(this->mutex_);
+    this->entries_.clear();
+    this->index_.clear();
+    this->bytes_ = 0;
+}
+
+void ListingCache::erase_(std::list<Entry>::iterator it) {
+    this->bytes_ -= it->bytes;
+    this->index_.erase(it->directory);
+    this->entries_.erase(it);
+}
+
+}  // namespace box3web
+}  // namespace esphome
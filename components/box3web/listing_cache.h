@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "../sd_mmc_card/sd_mmc_card.h"
+#include "esphome/core/helpers.h"
+
+namespace esphome {
+namespace box3web {
+
+using Listing = std::vector<sd_mmc_card::FileInfo>;
+
+// LRU cache of directory listings bounded by an estimate of the heap they hold.
+class ListingCache {
+ public:
+  explicit ListingCache(size_t max_bytes) : max_bytes_(max_bytes) {}
+
+  // Listings are shared so one being rendered survives its eviction.
+  std::shared_ptr<const Listing> get(std::string const &directory);
+  void put(std::string const &directory, std::shared_ptr<const Listing> listing);
+  void invalidate(std::string const &directory);
+  // Drops the listing of directory and of every folder below it.
+  void invalidate_tree(std::string const &directory);
+  void clear();
+
+  size_t max_bytes() const { return this->max_bytes_; }
+  size_t bytes() const { return this->bytes_; }
+  size_t size() const { return this->entries_.size(); }
+  uint32_t hits() const { return this->hits_; }
+  uint32_t misses() const { return this->misses_; }
+
+  static std::string key(std::string const &directory);
+
+ protected:
+  struct Entry {
+    std::string directory;
+    std::shared_ptr<const Listing> listing;
+    size_t bytes;
+  };
+
+  static size_t estimate(std::string const &directory, Listing const &listing);
+  void erase_(std::list<Entry>::iterator it);
+
+  size_t max_bytes_;
+  size_t bytes_{0};
+  uint32_t hits_{0};
+  uint32_t misses_{0};
+  // Most recently used first.
+  std::list<Entry> entries_;
+  std::map<std::string, std::list<Entry>::iterator> index_;
+  Mutex mutex_;
+};
+
+}  // namespace box3web
+}  // namespace esphome
@@ -0,0 +1,156 @@
+#include "metrics.h"
+#include "esphome/core/defines.h"
+
+#include <cinttypes>
+#include <cstdio>
+#ifdef USE_ESP32
+#include <esp_heap_caps.h>
+#endif
+
+namespace esphome {
+namespace box3web {
+
+Metrics global_metrics;
+
+// Upper bounds of the latency buckets in microseconds, and the same as le labels in seconds.
+static const uint32_t LATENCY_BOUNDS_US[LatencyHistogram::BUCKETS] = {250, 500, 1000, 2500, 5000, 10000, 25000,
+                                                                      100000};
+static const char *const LATENCY_BOUNDS[LatencyHistogram::BUCKETS] = {"0.00025", "0.0005", "0.001", "0.0025",
+                                                                      "0.005",   "0.01",   "0.025", "0.1"};
+
+// Statuses the component answers with, in the order of Metrics::responses_.
+static const int STATUS_CODES[] = {200, 201, 204, 206, 304, 400, 401, 403, 404, 405, 409, 413, 414, 416, 500, 503};
+static_assert(sizeof(STATUS_CODES) / sizeof(STATUS_CODES[0]) + 1 == 17, "one response slot per status plus other");
+
+// Handler labels, in the order of RequestKind.
+static const char *const REQUEST_KINDS[static_cast<size_t>(RequestKind::COUNT)] = {
+    "index", "json_index", "download", "archive", "search", "upload",
+    "resumable", "delete", "batch", "metrics", "asset", "events"};
+
+// Free heap when the request on this task started, 0 outside of a request.
+static thread_local uint32_t request_heap_base = 0;
+
+static uint32_t free_heap() {
+#ifdef USE_ESP32
+    return heap_caps_get_free_size(MALLOC_CAP_8BIT);
+#else
+    return 0;
+#endif
+}
+
+void LatencyHistogram::record(uint32_t us) {
+    size_t bucket = 0;
+    while (bucket < BUCKETS && us > LATENCY_BOUNDS_US[bucket])
+        bucket++;
+    this->buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+    this->count_.fetch_add(1, std::memory_order_relaxed);
+    this->sum_us_.fetch_add(us, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::write(std::string &out, const char *name, const char *help) const {
+    char line[160];
+    snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+    out += line;
+    uint32_t cumulative = 0;
+    for (size_t i = 0; i <= BUCKETS; i++) {
+        cumulative += this->buckets_[i].load(std::memory_order_relaxed);
+        snprintf(line, sizeof(line), "%s_bucket{le=\"%s\"} %" PRIu32 "\n", name,
+                 i < BUCKETS ? LATENCY_BOUNDS[i] : "+Inf", cumulative);
+        out += line;
+    }
+    uint64_t sum = this->sum_us();
+    snprintf(line, sizeof(line), "%s_sum %" PRIu64 ".%06" PRIu64 "\n%s_count %" PRIu32 "\n", name, sum / 1000000,
+             sum % 1000000, name, this->count());
+    out += line;
+}
+
+void Metrics::response(int code) {
+    size_t slot = 0;
+    while (slot < STATUS_SLOTS - 1 && STATUS_CODES[slot] != code)
+        slot++;
+    this->responses_[slot].fetch_add(1, std::memory_order_relaxed);
+}
+
+void Metrics::heap_used(uint32_t bytes) {
+    // Racing tasks may lose an update to each other, the next sample makes up for it.
+    if (bytes > this->heap_high_water_.load(std::memory_order_relaxed))
+        this->heap_high_water_.store(bytes, std::memory_order_relaxed);
+}
+
+uint32_t Metrics::requests() const {
+    uint32_t total = 0;
+    for (auto const &count : this->requests_)
+        total += count.load(std::memory_order_relaxed);
+    return total;
+}
+
+uint32_t Metrics::errors() const {
+    uint32_t total = 0;
+    for (size_t slot = 0; slot < STATUS_SLOTS - 1; slot++) {
+        if (STATUS_CODES[slot] >= 400)
+            total += this->responses_[slot].load(std::memory_order_relaxed);
+    }
+    // Statuses outside the table are all errors in practice.
+    return total + this->responses_[STATUS_SLOTS - 1].load(std::memory_order_relaxed);
+}
+
+void Metrics::write(std::string &out) const {
+    char line[160];
+    out += "# HELP box3web_requests_total Requests by the handler serving them.\n"
+           "# TYPE box3web_requests_total counter\n";
+    for (size_t i = 0; i < static_cast<size_t>(RequestKind::COUNT); i++) {
+        snprintf(line, sizeof(line), "box3web_requests_total{handler=\"%s\"} %" PRIu32 "\n", REQUEST_KINDS[i],
+                 this->requests_[i].load(std::memory_order_relaxed));
+        out += line;
+    }
+    out += "# HELP box3web_responses_total Responses by HTTP status.\n"
+           "# TYPE box3web_responses_total counter\n";
+    for (size_t slot = 0; slot < STATUS_SLOTS; slot++) {
+        uint32_t count = this->responses_[slot].load(std::memory_order_relaxed);
+        if (slot < STATUS_SLOTS - 1) {
+            snprintf(line, sizeof(line), "box3web_responses_total{code=\"%d\"} %" PRIu32 "\n", STATUS_CODES[slot],
+                     count);
+        } else {
+            snprintf(line, sizeof(line), "box3web_responses_total{code=\"other\"} %" PRIu32 "\n", count);
+        }
+        out += line;
+    }
+    snprintf(line, sizeof(line),
+             "# TYPE box3web_sent_bytes_total counter\nbox3web_sent_bytes_total %" PRIu64 "\n", this->bytes_sent());
+    out += line;
+    snprintf(line, sizeof(line),
+             "# TYPE box3web_received_bytes_total counter\nbox3web_received_bytes_total %" PRIu64 "\n",
+             this->bytes_received());
+    out += line;
+    this->card_read_.write(out, "box3web_card_read_seconds", "Duration of one read from the card.");
+    this->card_write_.write(out, "box3web_card_write_seconds", "Duration of one write to the card.");
+    out += "# HELP box3web_request_heap_high_water_bytes Most heap a single request took so far.\n";
+    snprintf(line, sizeof(line),
+             "# TYPE box3web_request_heap_high_water_bytes gauge\nbox3web_request_heap_high_water_bytes %" PRIu32 "\n",
+             this->heap_high_water());
+    out += line;
+}
+
+RequestScope::RequestScope() {
+    this->outermost_ = request_heap_base == 0;
+    if (this->outermost_)
+        request_heap_base = free_heap();
+}
+
+RequestScope::~RequestScope() {
+    if (!this->outermost_)
+        return;
+    sample_request_heap();
+    request_heap_base = 0;
+}
+
+void sample_request_heap() {
+    if (request_heap_base == 0)
+        return;
+    uint32_t free = free_heap();
+    if (free < request_heap_base)
+        global_metrics.heap_used(request_heap_base - free);
+}
+
+}  // namespace box3web
+}  // namespace esphome
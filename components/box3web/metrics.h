@@ -0,0 +1,102 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace esphome {
+namespace box3web {
+
+// What a request was dispatched to, the handler label of box3web_requests_total.
+enum class RequestKind : uint8_t {
+  INDEX,
+  JSON_INDEX,
+  DOWNLOAD,
+  ARCHIVE,
+  SEARCH,
+  UPLOAD,
+  RESUMABLE,
+  DELETE,
+  BATCH,
+  METRICS,
+  ASSET,
+  EVENTS,
+  COUNT
+};
+
+// Latency histogram over fixed bounds, recorded from any task without locking.
+class LatencyHistogram {
+ public:
+  static const size_t BUCKETS = 8;
+
+  void record(uint32_t us);
+  uint32_t count() const { return this->count_.load(std::memory_order_relaxed); }
+  uint64_t sum_us() const { return this->sum_us_.load(std::memory_order_relaxed); }
+  // Appends the histogram in Prometheus text format, in seconds.
+  void write(std::string &out, const char *name, const char *help) const;
+
+ protected:
+  // Per bucket, not cumulative; the last one is +Inf.
+  std::atomic<uint32_t> buckets_[BUCKETS + 1]{};
+  std::atomic<uint32_t> count_{0};
+  std::atomic<uint64_t> sum_us_{0};
+};
+
+// Counters behind /<prefix>/_metrics and the metric sensors. Card I/O is counted down in SdFile, which knows
+// nothing of the component, so there is one set for the whole node. Every update is a relaxed atomic add,
+// cheap enough for each chunk of a transfer.
+class Metrics {
+ public:
+  void request(RequestKind kind) { this->requests_[static_cast<size_t>(kind)].fetch_add(1, std::memory_order_relaxed); }
+  void response(int code);
+  void sent(size_t len) { this->bytes_sent_.fetch_add(len, std::memory_order_relaxed); }
+  void received(size_t len) { this->bytes_received_.fetch_add(len, std::memory_order_relaxed); }
+  void heap_used(uint32_t bytes);
+
+  LatencyHistogram &card_read() { return this->card_read_; }
+  LatencyHistogram &card_write() { return this->card_write_; }
+
+  uint32_t requests() const;
+  // Responses with a 4xx or 5xx status.
+  uint32_t errors() const;
+  uint64_t bytes_sent() const { return this->bytes_sent_.load(std::memory_order_relaxed); }
+  uint64_t bytes_received() const { return this->bytes_received_.load(std::memory_order_relaxed); }
+  uint32_t heap_high_water() const { return this->heap_high_water_.load(std::memory_order_relaxed); }
+
+  // Appends everything counted here in Prometheus text format.
+  void write(std::string &out) const;
+
+ protected:
+  static const size_t STATUS_SLOTS = 17;
+
+  std::atomic<uint32_t> requests_[static_cast<size_t>(RequestKind::COUNT)]{};
+  // One slot per status in STATUS_CODES, the last one for any other.
+  std::atomic<uint32_t> responses_[STATUS_SLOTS]{};
+  std::atomic<uint64_t> bytes_sent_{0};
+  std::atomic<uint64_t> bytes_received_{0};
+  std::atomic<uint32_t> heap_high_water_{0};
+  LatencyHistogram card_read_;
+  LatencyHistogram card_write_;
+};
+
+extern Metrics global_metrics;
+
+// Marks the request handled on the calling task from construction to destruction, so the heap it takes can
+// be sampled with sample_request_heap() wherever its allocations peak.
+class RequestScope {
+ public:
+  RequestScope();
+  ~RequestScope();
+  RequestScope(RequestScope const &) = delete;
+  RequestScope &operator=(RequestScope const &) = delete;
+
+ protected:
+  // False for a scope opened inside another one on the same task, which keeps measuring.
+  bool outermost_{false};
+};
+
+void sample_request_heap();
+
+}  // namespace box3web
+}  // namespace esphome
@@ -0,0 +1,75 @@
+#include "mount.h"
+#include "url_path.h"
+
+namespace esphome {
+namespace box3web {
+
+// Returns the next non-empty segment of text at or after pos and moves pos past it.
+static std::string_view next_segment(std::string_view text, size_t &pos) {
+    while (pos < text.size() && text[pos] == '/')
+        pos++;
+    size_t start = pos;
+    while (pos < text.size() && text[pos] != '/')
+        pos++;
+    return text.substr(start, pos - start);
+}
+
+MountTable::Node *MountTable::node_for(std::string_view prefix, bool create) {
+    Node *node = &this->root_;
+    size_t pos = 0;
+    for (std::string_view segment = next_segment(prefix, pos); !segment.empty();
+         segment = next_segment(prefix, pos)) {
+        auto it = node->children.find(segment);
+        if (it == node->children.end()) {
+            if (!create)
+                return nullptr;
+            it = node->children.emplace(std::string(segment), std::unique_ptr<Node>(new Node())).first;
+        }
+        node = it->second.get();
+    }
+    return node;
+}
+
+Mount *MountTable::add(std::string const &url_prefix, std::string const &root_path) {
+    Node *node = this->node_for(url_prefix, true);
+    if (node->mount != nullptr)
+        return nullptr;
+    auto mount = std::unique_ptr<Mount>(new Mount());
+    mount->prefix = normalize_url_prefix(url_prefix);
+    mount->mapping.url_prefix = mount->prefix.substr(1);
+    mount->mapping.root_path = root_path;
+    mount->root_base = root_path;
+    while (!mount->root_base.empty() && mount->root_base.back() == '/')
+        mount->root_base.pop_back();
+    node->mount = mount.get();
+    this->mounts_.push_back(std::move(mount));
+    return node->mount;
+}
+
+Mount *MountTable::get(std::string const &url_prefix) {
+    Node *node = this->node_for(url_prefix, false);
+    return node != nullptr ? node->mount : nullptr;
+}
+
+const Mount *MountTable::find(std::string_view url, std::string_view &rest) const {
+    const Node *node = &this->root_;
+    const Mount *best = node->mount;
+    size_t best_end = 0;
+    size_t pos = 0;
+    for (std::string_view segment = next_segment(url, pos); !segment.empty(); segment = next_segment(url, pos)) {
+        auto it = node->children.find(segment);
+        if (it == node->children.end())
+            break;
+        node = it->second.get();
+        if (node->mount != nullptr) {
+            best = node->mount;
+            best_end = pos;
+        }
+    }
+    if (best != nullptr)
+        rest = url.substr(best_end);
+    return best;
+}
+
+}  // namespace box3web
+}  // namespace esphome
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "listing.h"
+
+namespace esphome {
+namespace box3web {
+
+// A folder of the card published under a URL prefix, with its own permissions and caching rules.
+struct Mount {
+  UrlMapping mapping;     // url_prefix without surrounding separators, root_path as configured
+  std::string prefix;     // "/" + url_prefix, matched against request urls
+  std::string root_base;  // root_path without a trailing separator, "" for the card root
+  bool deletion_enabled{false};
+  bool download_enabled{false};
+  bool upload_enabled{false};
+  // Checked before the component-wide rules, first match wins.
+  std::vector<std::pair<std::string, std::string>> cache_control;
+};
+
+// Prefix trie over URL segments. A lookup walks the segments of the request url once, so its cost
+// depends on the depth of the url and not on the number of mounts.
+class MountTable {
+ public:
+  // nullptr when another mount already uses the same prefix.
+  Mount *add(std::string const &url_prefix, std::string const &root_path);
+  // Deepest mount covering url; rest receives the part of url below its prefix.
+  const Mount *find(std::string_view url, std::string_view &rest) const;
+  Mount *get(std::string const &url_prefix);
+  std::vector<std::unique_ptr<Mount>> const &mounts() const { return this->mounts_; }
+
+ protected:
+  struct Node {
+    std::map<std::string, std::unique_ptr<Node>, std::less<>> children;
+    Mount *mount{nullptr};
+  };
+
+  Node *node_for(std::string_view prefix, bool create);
+
+  Node root_;
+  std::vector<std::unique_ptr<Mount>> mounts_;
+};
+
+}  // namespace box3web
+}  // namespace esphome
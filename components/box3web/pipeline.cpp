@@ -0,0 +1,111 @@
+#include "pipeline.h"
+#ifdef USE_BOX3WEB_UPLOAD_PIPELINE
+
+#include "upload.h"
+#include "esphome/core/hal.h"
+#include "esphome/core/log.h"
+
+namespace esphome {
+namespace box3web {
+
+static const char *TAG = "box3web.pipeline";
+
+static const size_t WRITER_CHUNK_SIZE = 4096;
+static const uint32_t WRITER_STACK_SIZE = 4096;
+// Longest the network task may be held back by a full buffer before the upload is failed.
+static const uint32_t MAX_STALL_MS = 10000;
+
+bool UploadPipeline::start() {
+    this->ring_ = RingBuffer::create(this->buffer_size_);
+    if (this->ring_ == nullptr) {
+        ESP_LOGE(TAG, "Cannot allocate %u bytes upload ring buffer", (unsigned) this->buffer_size_);
+        return false;
+    }
+    if (xTaskCreate(UploadPipeline::writer_task, "box3web_writer", WRITER_STACK_SIZE, this, this->task_priority_,
+                    &this->task_) != pdPASS) {
+        ESP_LOGE(TAG, "Cannot start upload writer task");
+        this->ring_.reset();
+        return false;
+    }
+    return true;
+}
+
+bool UploadPipeline::attach(UploadSession *session) {
+    if (this->ring_ == nullptr)
+        return false;
+    bool expected = false;
+    if (!this->attached_.compare_exchange_strong(expected, true))
+        return false;
+    // Bytes of an aborted upload may still be on their way to the bin.
+    if (this->pending_ != 0) {
+        this->attached_ = false;
+        return false;
+    }
+    LockGuard guard(this->session_mutex_);
+    this->failed_ = false;
+    this->session_ = session;
+    return true;
+}
+
+bool UploadPipeline::push(const uint8_t *data, size_t len) {
+    bool stalled = false;
+    uint32_t stall_start = 0;
+    while (len > 0) {
+        if (this->failed_)
+            return false;
+        // Count before the writer can see the bytes so pending_ never underflows for long.
+        this->pending_ += len;
+        size_t written = this->ring_->write_without_replacement(data, len, stalled ? pdMS_TO_TICKS(20) : 0);
+        this->pending_ -= len - written;
+        data += written;
+        len -= written;
+        if (len == 0)
+            break;
+        uint32_t now = millis();
+        if (!stalled) {
+            stalled = true;
+            stall_start = now;
+            this->backpressure_events_++;
+        } else if (now - stall_start > MAX_STALL_MS) {
+            ESP_LOGE(TAG, "Card stalled for %u ms, failing upload", (unsigned) (now - stall_start));
+            this->failed_ = true;
+        }
+    }
+    if (stalled)
+        this->backpressure_ms_ += millis() - stall_start;
+    return !this->failed_;
+}
+
+bool UploadPipeline::detach(bool drain) {
+    if (drain) {
+        while (this->pending_ > 0 && !this->failed_)
+            vTaskDelay(pdMS_TO_TICKS(1));
+    }
+    LockGuard guard(this->session_mutex_);
+    // Without a session the writer discards whatever is left in the buffer.
+    this->session_ = nullptr;
+    this->attached_ = false;
+    return !this->failed_;
+}
+
+void UploadPipeline::writer_task(void *param) { static_cast<UploadPipeline *>(param)->run_writer(); }
+
+void UploadPipeline::run_writer() {
+    std::unique_ptr<uint8_t[]> chunk(new uint8_t[WRITER_CHUNK_SIZE]);
+    while (true) {
+        size_t len = this->ring_->read(chunk.get(), WRITER_CHUNK_SIZE, pdMS_TO_TICKS(100));
+        if (len == 0)
+            continue;
+        {
+            LockGuard guard(this->session_mutex_);
+            if (this->session_ != nullptr && !this->failed_ && !this->session_->write_direct(chunk.get(), len))
+                this->failed_ = true;
+        }
+        this->pending_ -= len;
+    }
+}
+
+}  // namespace box3web
+}  // namespace esphome
+
+#endif  // USE_BOX3WEB_UPLOAD_PIPELINE
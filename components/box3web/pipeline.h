@@ -0,0 +1,63 @@
+#pragma once
+
+#include "esphome/core/defines.h"
+#ifdef USE_BOX3WEB_UPLOAD_PIPELINE
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include "esphome/core/helpers.h"
+#include "esphome/core/ring_buffer.h"
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+namespace esphome {
+namespace box3web {
+
+class UploadSession;
+
+// Decouples the network receive path from card writes: chunks are copied into a ring buffer
+// (PSRAM when available) and a dedicated task drains it into the attached upload session.
+class UploadPipeline {
+ public:
+  UploadPipeline(size_t buffer_size, UBaseType_t task_priority)
+      : buffer_size_(buffer_size), task_priority_(task_priority) {}
+
+  bool start();
+
+  // Only one session streams through the pipeline at a time, false when busy.
+  bool attach(UploadSession *session);
+  // Blocks while the ring buffer is full. False once the writer failed or the card stalled too long.
+  bool push(const uint8_t *data, size_t len);
+  // With drain, waits for every pushed byte to reach the session; otherwise pending data is dropped.
+  bool detach(bool drain);
+
+  size_t buffer_size() const { return this->buffer_size_; }
+  uint32_t backpressure_events() const { return this->backpressure_events_; }
+  uint32_t backpressure_ms() const { return this->backpressure_ms_; }
+
+ protected:
+  static void writer_task(void *param);
+  void run_writer();
+
+  size_t buffer_size_;
+  UBaseType_t task_priority_;
+  std::unique_ptr<RingBuffer> ring_;
+  TaskHandle_t task_{nullptr};
+
+  // Held by the writer while it uses session_, so detach never frees a session mid-write.
+  Mutex session_mutex_;
+  UploadSession *session_{nullptr};
+  std::atomic<bool> attached_{false};
+  std::atomic<bool> failed_{false};
+  // Bytes pushed and not yet consumed by the writer, in the ring or in its hands.
+  std::atomic<int32_t> pending_{0};
+
+  std::atomic<uint32_t> backpressure_events_{0};
+  std::atomic<uint32_t> backpressure_ms_{0};
+};
+
+}  // namespace box3web
+}  // namespace esphome
+
+#endif  // USE_BOX3WEB_UPLOAD_PIPELINE
@@ -0,0 +1,139 @@
+#include "readahead.h"
+#ifdef USE_BOX3WEB_READ_AHEAD
+
+#include "esphome/core/log.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace esphome {
+namespace box3web {
+
+static const char *TAG = "box3web.readahead";
+
+static const uint32_t PREFETCH_STACK_SIZE = 3072;
+static const UBaseType_t PREFETCH_PRIORITY = 5;
+// Upper bound on how long the sender waits for the card before giving up on the transfer.
+static const TickType_t BLOCK_TIMEOUT = pdMS_TO_TICKS(5000);
+
+ReadAheadSource::ReadAheadSource(std::unique_ptr<SdFile> file, size_t offset, size_t length, BufferPool *pool,
+                                 size_t depth)
+    : file_(std::move(file)), remaining_(length), pool_(pool), block_size_(pool->buffer_size()), depth_(depth) {
+    if (offset != 0 && !this->file_->seek(offset))
+        this->remaining_ = 0;
+}
+
+ReadAheadSource::~ReadAheadSource() {
+    this->stop_ = true;
+    while (this->running_)
+        vTaskDelay(pdMS_TO_TICKS(1));
+    if (this->free_ != nullptr)
+        vQueueDelete(this->free_);
+    if (this->full_ != nullptr)
+        vQueueDelete(this->full_);
+}
+
+bool ReadAheadSource::start() {
+    this->blocks_ = this->pool_->acquire_for_request(this->depth_);
+    // A single block cannot overlap anything, leave it to the sender.
+    if (this->blocks_.size() < 2) {
+        this->blocks_.clear();
+        return false;
+    }
+    this->depth_ = this->blocks_.size();
+    this->free_ = xQueueCreate(this->depth_, sizeof(Block));
+    this->full_ = xQueueCreate(this->depth_, sizeof(Block));
+    if (this->free_ == nullptr || this->full_ == nullptr) {
+        this->blocks_.clear();
+        return false;
+    }
+    for (auto const &buffer : this->blocks_) {
+        Block block{buffer.data(), 0};
+        xQueueSend(this->free_, &block, 0);
+    }
+    this->running_ = true;
+    if (xTaskCreate(ReadAheadSource::prefetch_task, "box3web_prefetch", PREFETCH_STACK_SIZE, this, PREFETCH_PRIORITY,
+                    nullptr) != pdPASS) {
+        this->running_ = false;
+        this->blocks_.clear();
+        return false;
+    }
+    this->prefetching_ = true;
+    return true;
+}
+
+void ReadAheadSource::prefetch_task(void *param) {
+    static_cast<ReadAheadSource *>(param)->run_prefetch();
+    vTaskDelete(nullptr);
+}
+
+void ReadAheadSource::run_prefetch() {
+    while (!this->stop_) {
+        Block block;
+        if (xQueueReceive(this->free_, &block, pdMS_TO_TICKS(100)) != pdTRUE)
+            continue;
+        block.len = 0;
+        if (this->remaining_ > 0)
+            block.len = this->file_->read(block.data, std::min(this->block_size_, this->remaining_));
+        this->remaining_ -= block.len;
+        // An empty block tells the sender the range is complete (or the card failed).
+        xQueueSend(this->full_, &block, portMAX_DELAY);
+        if (block.len == 0)
+            break;
+    }
+    this->running_ = false;
+}
+
+bool ReadAheadSource::next_block() {
+    if (xQueueReceive(this->full_, &this->current_, BLOCK_TIMEOUT) != pdTRUE) {
+        ESP_LOGW(TAG, "Timed out waiting for the card");
+        this->current_ = {nullptr, 0};
+        this->eof_ = true;
+        return false;
+    }
+    this->current_pos_ = 0;
+    if (this->current_.len == 0) {
+        this->eof_ = true;
+        return false;
+    }
+    return true;
+}
+
+size_t ReadAheadSource::borrow(const uint8_t *&data) {
+    // The block lent last time has been sent, hand it back to the prefetch task.
+    if (this->current_.data != nullptr) {
+        xQueueSend(this->free_, &this->current_, 0);
+        this->current_ = {nullptr, 0};
+    }
+    if (this->eof_ || !this->next_block())
+        return 0;
+    data = this->current_.data;
+    return this->current_.len;
+}
+
+size_t ReadAheadSource::fill(uint8_t *buffer, size_t len) {
+    if (!this->prefetching_) {
+        size_t read = this->remaining_ > 0 ? this->file_->read(buffer, std::min(len, this->remaining_)) : 0;
+        this->remaining_ = read == 0 ? 0 : this->remaining_ - read;
+        return read;
+    }
+    size_t written = 0;
+    while (written < len && !this->eof_) {
+        if (this->current_.data == nullptr && !this->next_block())
+            break;
+        size_t count = std::min(len - written, this->current_.len - this->current_pos_);
+        memcpy(buffer + written, this->current_.data + this->current_pos_, count);
+        this->current_pos_ += count;
+        written += count;
+        if (this->current_pos_ == this->current_.len) {
+            xQueueSend(this->free_, &this->current_, 0);
+            this->current_ = {nullptr, 0};
+        }
+    }
+    return written;
+}
+
+}  // namespace box3web
+}  // namespace esphome
+
+#endif  // USE_BOX3WEB_READ_AHEAD
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "esphome/core/defines.h"
+#ifdef USE_BOX3WEB_READ_AHEAD
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "buffer_pool.h"
+#include "transfer.h"
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+
+namespace esphome {
+namespace box3web {
+
+// Sequential reader that prefetches up to `depth` pool buffers on a helper task while the
+// previous block is being sent, so card and network latency overlap. The blocks are lent to
+// the sender as they are, the card reads straight into the memory the socket sends from.
+class ReadAheadSource : public ChunkSource {
+ public:
+  ReadAheadSource(std::unique_ptr<SdFile> file, size_t offset, size_t length, BufferPool *pool, size_t depth);
+  ~ReadAheadSource() override;
+
+  // False when fewer than two buffers or no prefetch task could be had, reads then happen inline.
+  bool start();
+  size_t fill(uint8_t *buffer, size_t len) override;
+  bool zero_copy() const override { return this->prefetching_; }
+  size_t borrow(const uint8_t *&data) override;
+
+ protected:
+  struct Block {
+    uint8_t *data;
+    size_t len;
+  };
+
+  static void prefetch_task(void *param);
+  void run_prefetch();
+  // Next block from the prefetch task, false at the end of the range or when the card stalls.
+  bool next_block();
+
+  std::unique_ptr<SdFile> file_;
+  size_t remaining_;
+  BufferPool *pool_;
+  size_t block_size_;
+  size_t depth_;
+  std::vector<PoolBuffer> blocks_;
+
+  QueueHandle_t free_{nullptr};
+  QueueHandle_t full_{nullptr};
+  std::atomic<bool> stop_{false};
+  std::atomic<bool> running_{false};
+  bool prefetching_{false};
+
+  Block current_{nullptr, 0};
+  size_t current_pos_{0};
+  bool eof_{false};
+};
+
+}  // namespace box3web
+}  // namespace esphome
+
+#endif  // USE_BOX3WEB_READ_AHEAD
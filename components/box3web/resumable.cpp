@@ -0,0 +1,163 @@
+#include "resumable.h"
+#include "digest.h"
+#include "transfer.h"
+#include "url_path.h"
+#include "esphome/core/hal.h"
+#include "esphome/core/log.h"
+
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <sys/stat.h>
+
+namespace esphome {
+namespace box3web {
+
+static const char *TAG = "box3web.resumable";
+
+static const char *const PARTIAL_PREFIX = ".box3web-upload-";
+static const size_t ID_RANDOM_DIGITS = 8;
+
+static bool is_hex_digit(char c) { return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'); }
+
+std::string ResumableUploads::partial_path(std::string const &target, std::string const &id) {
+    size_t pos = target.rfind('/');
+    std::string directory = pos == std::string::npos ? std::string() : target.substr(0, pos);
+    return directory + "/" + PARTIAL_PREFIX + id;
+}
+
+std::string ResumableUploads::create(std::string const &target, size_t length) {
+    char random[ID_RANDOM_DIGITS + 1];
+    snprintf(random, sizeof(random), "%08x", (unsigned) random_uint32());
+    std::string id = std::string(random) + "-" + std::to_string(length);
+    std::string partial = partial_path(target, id);
+    SdFile file;
+    if (!file.open(partial, "wb")) {
+        ESP_LOGE(TAG, "Cannot create %s", partial.c_str());
+        return "";
+    }
+    file.close();
+    LockGuard guard(this->lock_);
+    this->partials_[partial] = millis();
+    return id;
+}
+
+bool ResumableUploads::find(std::string const &target, std::string const &id, std::string &partial,
+                            size_t &length) {
+    // The id ends up in a file name, so nothing but the exact format is accepted.
+    if (id.size() < ID_RANDOM_DIGITS + 2 || id[ID_RANDOM_DIGITS] != '-')
+        return false;
+    for (size_t i = 0; i < ID_RANDOM_DIGITS; i++) {
+        if (!is_hex_digit(id[i]))
+            return false;
+    }
+    if (!parse_decimal(id.substr(ID_RANDOM_DIGITS + 1), length))
+        return false;
+    partial = partial_path(target, id);
+    struct stat st;
+    if (stat(SdFile::real_path(partial).c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+        return false;
+    this->touch(partial);
+    return true;
+}
+
+size_t ResumableUploads::offset(std::string const &partial) {
+    struct stat st;
+    if (stat(SdFile::real_path(partial).c_str(), &st) != 0)
+        return 0;
+    return st.st_size;
+}
+
+void ResumableUploads::touch(std::string const &partial) {
+    LockGuard guard(this->lock_);
+    this->partials_[partial] = millis();
+}
+
+bool ResumableUploads::complete(std::string const &partial, std::string const &target, bool &replaced) {
+    std::string from = SdFile::real_path(partial);
+    std::string to = SdFile::real_path(target);
+    struct stat st;
+    replaced = stat(to.c_str(), &st) == 0;
+    if (replaced && remove(to.c_str()) != 0) {
+        ESP_LOGE(TAG, "Cannot replace %s", target.c_str());
+        return false;
+    }
+    if (rename(from.c_str(), to.c_str()) != 0) {
+        ESP_LOGE(TAG, "Cannot move %s into place", target.c_str());
+        return false;
+    }
+    // Whatever was stored for the file replaced does not describe this one.
+    remove_digest(target);
+    LockGuard guard(this->lock_);
+    this->partials_.erase(partial);
+    return true;
+}
+
+void ResumableUploads::cancel(std::string const &partial) {
+    remove(SdFile::real_path(partial).c_str());
+    LockGuard guard(this->lock_);
+    this->partials_.erase(partial);
+}
+
+void ResumableUploads::expire() {
+    uint32_t now = millis();
+    LockGuard guard(this->lock_);
+    for (auto it = this->partials_.begin(); it != this->partials_.end();) {
+        if (now - it->second > this->expiry_ms_) {
+            ESP_LOGI(TAG, "Resumable upload %s expired", it->first.c_str());
+            remove(SdFile::real_path(it->first).c_str());
+            it = this->partials_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void ResumableUploads::start_scan(std::string const &root) {
+    LockGuard guard(this->lock_);
+    this->scan_queue_.push_back(root.empty() ? "/" : root);
+}
+
+bool ResumableUploads::scan_step() {
+    std::string directory;
+    {
+        LockGuard guard(this->lock_);
+        if (this->scan_queue_.empty())
+            return false;
+        directory = std::move(this->scan_queue_.back());
+        this->scan_queue_.pop_back();
+    }
+    if (directory.size() > 1 && directory.back() == '/')
+        directory.pop_back();
+    // Listings hide internal files, so this walks the directory itself.
+    DIR *dir = opendir(SdFile::real_path(directory).c_str());
+    if (dir == nullptr)
+        return true;
+    std::vector<std::string> subdirectories;
+    std::vector<std::string> found;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+        std::string path = (directory == "/" ? "" : directory) + "/" + entry->d_name;
+        if (strncmp(entry->d_name, PARTIAL_PREFIX, strlen(PARTIAL_PREFIX)) == 0) {
+            found.push_back(std::move(path));
+        } else if (entry->d_type == DT_DIR && !is_internal_name(entry->d_name)) {
+            subdirectories.push_back(std::move(path));
+        }
+    }
+    closedir(dir);
+    LockGuard guard(this->lock_);
+    uint32_t now = millis();
+    for (auto &partial : found) {
+        // Unknown partials get a full expiry period from now, the clock may not be set yet.
+        if (this->partials_.emplace(std::move(partial), now).second)
+            ESP_LOGD(TAG, "Found an orphaned partial upload in %s", directory.c_str());
+    }
+    for (auto &subdirectory : subdirectories)
+        this->scan_queue_.push_back(std::move(subdirectory));
+    return true;
+}
+
+}  // namespace box3web
+}  // namespace esphome
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+#include "esphome/core/helpers.h"
+
+namespace esphome {
+namespace box3web {
+
+// Card side of tus-like resumable uploads. The partial file lives next to its target as
+// .box3web-upload-<id>, and the id ("<8 hex digits>-<length>") carries the announced length, so the
+// committed offset is just the size of that file and an upload survives a reboot of the device.
+class ResumableUploads {
+ public:
+  explicit ResumableUploads(uint32_t expiry_ms) : expiry_ms_(expiry_ms) {}
+
+  // Creates the empty partial of an upload of length bytes to target. Empty id on failure.
+  std::string create(std::string const &target, size_t length);
+  // Partial file and announced length of an upload, false for malformed ids and partials that are gone.
+  bool find(std::string const &target, std::string const &id, std::string &partial, size_t &length);
+  // Bytes committed so far.
+  static size_t offset(std::string const &partial);
+  // Marks the upload as alive so it does not expire while in use.
+  void touch(std::string const &partial);
+  // Renames a complete partial onto its target. A new target appears atomically; an existing one is
+  // removed first since FAT cannot rename over a file, and replaced is set.
+  bool complete(std::string const &partial, std::string const &target, bool &replaced);
+  void cancel(std::string const &partial);
+
+  // Removes partials idle for longer than the expiry.
+  void expire();
+  // Looks for partials a reboot left behind, walking the tree below root one directory per step; they
+  // then expire like any other. scan_step() returns false once the walk is done.
+  void start_scan(std::string const &root);
+  bool scan_step();
+
+  uint32_t expiry_ms() const { return this->expiry_ms_; }
+  void set_expiry_ms(uint32_t expiry_ms) { this->expiry_ms_ = expiry_ms; }
+  size_t size() const { return this->partials_.size(); }
+
+ protected:
+  static std::string partial_path(std::string const &target, std::string const &id);
+
+  uint32_t expiry_ms_;
+  Mutex lock_;
+  std::map<std::string, uint32_t> partials_;  // partial path -> last activity in millis
+  std::vector<std::string> scan_queue_;
+};
+
+}  // namespace box3web
+}  // namespace esphome
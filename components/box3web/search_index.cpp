@@ -0,0 +1,648 @@
+#include "search_index.h"
+#include "crc32.h"
+#include "transfer.h"
+#include "url_path.h"
+#include "esphome/core/hal.h"
+#include "esphome/core/log.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <sys/stat.h>
+
+namespace esphome {
+namespace box3web {
+
+static const char *TAG = "box3web.search";
+
+static const char *const INDEX_PATH = "/.box3web-index";
+static const char *const INDEX_BUILD_PATH = "/.box3web-index.new";
+static const char *const JOURNAL_PATH = "/.box3web-index.log";
+static const char INDEX_MAGIC[4] = {'B', '3', 'W', 'I'};
+static const uint16_t INDEX_VERSION = 1;
+// magic, version, block size, entries, blocks, table offset, root signature, build time, table CRC
+static const size_t HEADER_SIZE = 32;
+// flags, size, mtime, path length
+static const size_t RECORD_HEAD_SIZE = 11;
+static const uint8_t RECORD_DIRECTORY = 0x01;
+// Clock readings before 2020 mean SNTP has not synced yet.
+static const time_t MIN_VALID_TIME = 1577836800;
+
+static void put16(std::string &out, uint16_t value) {
+    out += static_cast<char>(value & 0xff);
+    out += static_cast<char>(value >> 8);
+}
+
+static void put32(std::string &out, uint32_t value) {
+    put16(out, value & 0xffff);
+    put16(out, value >> 16);
+}
+
+static uint16_t get16(const uint8_t *data) { return data[0] | (data[1] << 8); }
+
+static uint32_t get32(const uint8_t *data) { return get16(data) | (static_cast<uint32_t>(get16(data + 2)) << 16); }
+
+static std::string lower(std::string const &text) {
+    std::string result = text;
+    for (char &c : result)
+        c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+    return result;
+}
+
+static std::string name_key(std::string const &path) { return lower(path.substr(path.rfind('/') + 1)); }
+
+// * matches any run of bytes, ? a single one.
+static bool glob_match(std::string const &pattern, std::string const &text) {
+    size_t p = 0;
+    size_t t = 0;
+    size_t star = std::string::npos;
+    size_t mark = 0;
+    while (t < text.size()) {
+        if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == text[t])) {
+            p++;
+            t++;
+        } else if (p < pattern.size() && pattern[p] == '*') {
+            star = p++;
+            mark = t;
+        } else if (star != std::string::npos) {
+            p = star + 1;
+            t = ++mark;
+        } else {
+            return false;
+        }
+    }
+    while (p < pattern.size() && pattern[p] == '*')
+        p++;
+    return p == pattern.size();
+}
+
+// Size of a table record: offset, length, CRC, count, size and mtime ranges, then the two name keys.
+static const size_t TABLE_RECORD_SIZE = 8 * 4 + 2 * 12;
+
+static bool parse_record(const uint8_t *&data, const uint8_t *end, IndexEntry &entry) {
+    if (end - data < static_cast<ptrdiff_t>(RECORD_HEAD_SIZE))
+        return false;
+    size_t length = get16(data + 9);
+    if (length == 0 || length > MAX_PATH_LENGTH || static_cast<size_t>(end - data) < RECORD_HEAD_SIZE + length)
+        return false;
+    entry.is_directory = (data[0] & RECORD_DIRECTORY) != 0;
+    entry.size = get32(data + 1);
+    entry.mtime = get32(data + 5);
+    entry.path.assign(reinterpret_cast<const char *>(data + RECORD_HEAD_SIZE), length);
+    data += RECORD_HEAD_SIZE + length;
+    return true;
+}
+
+void SearchIndex::step(uint32_t budget_ms) {
+    if (!this->loaded_) {
+        this->load_();
+        return;
+    }
+    if (!this->building_) {
+        bool start;
+        {
+            LockGuard guard(this->lock_);
+            if (this->build_reason_ == nullptr && this->ready_ && this->refresh_ms_ != 0 &&
+                millis() - this->built_ms_ >= this->refresh_ms_)
+                this->build_reason_ = "refresh";
+            start = this->build_reason_ != nullptr;
+        }
+        if (start)
+            this->start_build_();
+        return;
+    }
+    uint32_t started = millis();
+    while (this->building_ && millis() - started < budget_ms) {
+        if (!this->build_next_())
+            this->finish_build_();
+    }
+}
+
+void SearchIndex::request_build(const char *reason) {
+    LockGuard guard(this->lock_);
+    if (this->build_reason_ == nullptr)
+        this->build_reason_ = reason;
+}
+
+void SearchIndex::load_() {
+    this->loaded_ = true;
+    this->built_ms_ = millis();
+    FILE *file = fopen(SdFile::real_path(INDEX_PATH).c_str(), "rb");
+    if (file == nullptr) {
+        // Built on first use, no point walking the card for a feature nobody asked for yet.
+        LockGuard guard(this->lock_);
+        this->load_journal_();
+        ESP_LOGI(TAG, "No search index yet");
+        return;
+    }
+    uint8_t header[HEADER_SIZE];
+    bool ok = fread(header, 1, sizeof(header), file) == sizeof(header) &&
+              memcmp(header, INDEX_MAGIC, sizeof(INDEX_MAGIC)) == 0 && get16(header + 4) == INDEX_VERSION &&
+              get16(header + 6) == BLOCK_ENTRIES;
+    uint32_t blocks = get32(header + 12);
+    std::vector<Block> table;
+    uint32_t crc = 0;
+    if (ok)
+        ok = fseek(file, get32(header + 16), SEEK_SET) == 0;
+    for (uint32_t i = 0; ok && i < blocks; i++) {
+        uint8_t record[TABLE_RECORD_SIZE];
+        ok = fread(record, 1, sizeof(record), file) == sizeof(record);
+        if (!ok)
+            break;
+        crc = crc32_update(crc, record, sizeof(record));
+        Block block;
+        block.offset = get32(record);
+        block.length = get32(record + 4);
+        block.crc = get32(record + 8);
+        block.count = get32(record + 12);
+        block.min_size = get32(record + 16);
+        block.max_size = get32(record + 20);
+        block.min_mtime = get32(record + 24);
+        block.max_mtime = get32(record + 28);
+        memcpy(block.first, record + 32, NAME_KEY);
+        memcpy(block.last, record + 32 + NAME_KEY, NAME_KEY);
+        table.push_back(block);
+    }
+    fclose(file);
+    ok = ok && crc == get32(header + 28);
+    LockGuard guard(this->lock_);
+    if (!ok) {
+        ESP_LOGW(TAG, "Search index damaged, rebuilding");
+        this->load_journal_();
+        this->build_reason_ = "index damaged";
+        return;
+    }
+    this->table_ = std::move(table);
+    this->entry_count_ = get32(header + 8);
+    this->signature_ = get32(header + 20);
+    this->built_ = get32(header + 24);
+    this->ready_ = true;
+    // The journal may carry a newer root signature than the header.
+    if (!this->load_journal_()) {
+        this->build_reason_ = "journal damaged";
+    } else if (root_signature() != this->signature_) {
+        this->build_reason_ = "card changed";
+    }
+    ESP_LOGI(TAG, "Search index: %u entries, %u journaled changes", (unsigned) this->entry_count_,
+             (unsigned) this->changes_.size());
+    if (this->build_reason_ != nullptr)
+        ESP_LOGI(TAG, "Search index is stale (%s), rebuilding", this->build_reason_);
+}
+
+bool SearchIndex::load_journal_() {
+    FILE *file = fopen(SdFile::real_path(JOURNAL_PATH).c_str(), "r");
+    if (file == nullptr)
+        return true;
+    char line[MAX_PATH_LENGTH + 48];
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), file) != nullptr) {
+        size_t length = strlen(line);
+        // A line without its newline was torn by a power loss.
+        if (length == 0 || line[length - 1] != '\n') {
+            ok = false;
+            break;
+        }
+        line[length - 1] = '\0';
+        if (line[0] == 's') {
+            unsigned signature;
+            ok = sscanf(line, "s %u", &signature) == 1;
+            this->signature_ = signature;
+            continue;
+        }
+        Change change;
+        const char *path = nullptr;
+        if (line[0] == '+') {
+            unsigned size;
+            unsigned mtime;
+            char type;
+            int consumed = 0;
+            ok = sscanf(line, "+ %u %u %c %n", &size, &mtime, &type, &consumed) == 3 && consumed > 0;
+            change.kind = ChangeKind::PRESENT;
+            change.entry.size = size;
+            change.entry.mtime = mtime;
+            change.entry.is_directory = type == 'd';
+            path = line + consumed;
+        } else if ((line[0] == '-' || line[0] == 'x') && line[1] == ' ') {
+            change.kind = line[0] == '-' ? ChangeKind::REMOVED : ChangeKind::TREE_REMOVED;
+            path = line + 2;
+        } else {
+            ok = false;
+        }
+        if (!ok || path[0] != '/') {
+            ok = false;
+            break;
+        }
+        change.entry.path = path;
+        change.sequence = this->sequence_++;
+        if (change.kind == ChangeKind::TREE_REMOVED) {
+            this->removed_trees_.insert(change.entry.path);
+            std::string below = change.entry.path + "/";
+            for (auto it = this->changes_.lower_bound(below);
+                 it != this->changes_.end() && it->first.compare(0, below.size(), below) == 0;)
+                it = this->changes_.erase(it);
+        }
+        this->changes_[change.entry.path] = std::move(change);
+    }
+    fclose(file);
+    return ok;
+}
+
+void SearchIndex::update(std::string const &path) {
+    Change change;
+    change.entry.path = path;
+    struct stat st;
+    if (stat(SdFile::real_path(path).c_str(), &st) == 0) {
+        change.kind = ChangeKind::PRESENT;
+        change.entry.is_directory = S_ISDIR(st.st_mode);
+        change.entry.size = change.entry.is_directory ? 0 : st.st_size;
+        change.entry.mtime = std::max<time_t>(st.st_mtime, 0);
+    } else {
+        change.kind = ChangeKind::REMOVED;
+    }
+    LockGuard guard(this->lock_);
+    this->record_(std::move(change));
+}
+
+void SearchIndex::update_tree(std::string const &path) {
+    struct stat st;
+    if (stat(SdFile::real_path(path).c_str(), &st) == 0) {
+        this->update(path);
+        this->request_build("folder moved in");
+        return;
+    }
+    Change change;
+    change.kind = ChangeKind::TREE_REMOVED;
+    change.entry.path = path;
+    LockGuard guard(this->lock_);
+    this->record_(std::move(change));
+}
+
+void SearchIndex::record_(Change change) {
+    change.sequence = this->sequence_++;
+    if (change.kind == ChangeKind::TREE_REMOVED) {
+        this->removed_trees_.insert(change.entry.path);
+        std::string below = change.entry.path + "/";
+        for (auto it = this->changes_.lower_bound(below);
+             it != this->changes_.end() && it->first.compare(0, below.size(), below) == 0;)
+            it = this->changes_.erase(it);
+    }
+    this->append_journal_(change);
+    bool in_root = change.entry.path.rfind('/') == 0;
+    this->changes_[change.entry.path] = std::move(change);
+    // Keeps the next boot from taking this change for one made behind the component's back.
+    if (in_root) {
+        this->signature_ = root_signature();
+        FILE *file = fopen(SdFile::real_path(JOURNAL_PATH).c_str(), "a");
+        if (file != nullptr) {
+            fprintf(file, "s %u\n", (unsigned) this->signature_);
+            fclose(file);
+        }
+    }
+    if (this->changes_.size() > MAX_JOURNAL && this->build_reason_ == nullptr && !this->building_)
+        this->build_reason_ = "journal full";
+}
+
+void SearchIndex::append_journal_(Change const &change) {
+    FILE *file = fopen(SdFile::real_path(JOURNAL_PATH).c_str(), "a");
+    if (file == nullptr) {
+        ESP_LOGW(TAG, "Cannot write the search index journal");
+        this->build_reason_ = "journal unwritable";
+        return;
+    }
+    if (change.kind == ChangeKind::PRESENT) {
+        fprintf(file, "+ %u %u %c %s\n", (unsigned) change.entry.size, (unsigned) change.entry.mtime,
+                change.entry.is_directory ? 'd' : 'f', change.entry.path.c_str());
+    } else {
+        fprintf(file, "%c %s\n", static_cast<char>(change.kind), change.entry.path.c_str());
+    }
+    fclose(file);
+}
+
+void SearchIndex::rewrite_journal_() {
+    std::string real = SdFile::real_path(JOURNAL_PATH);
+    if (this->changes_.empty()) {
+        remove(real.c_str());
+        return;
+    }
+    // Replayed in the order they happened, a tree removal must come before what was created below it since.
+    std::vector<Change const *> ordered;
+    for (auto const &it : this->changes_)
+        ordered.push_back(&it.second);
+    std::sort(ordered.begin(), ordered.end(),
+              [](Change const *a, Change const *b) { return a->sequence < b->sequence; });
+    if (FILE *file = fopen(real.c_str(), "w")) {
+        fclose(file);
+    }
+    for (auto const *change : ordered)
+        this->append_journal_(*change);
+}
+
+bool SearchIndex::overridden_(std::map<std::string, Change> const &changes,
+                              std::set<std::string> const &removed_trees, std::string const &path) {
+    if (changes.count(path) != 0)
+        return true;
+    for (auto const &tree : removed_trees) {
+        if (path.size() > tree.size() && path[tree.size()] == '/' && path.compare(0, tree.size(), tree) == 0)
+            return true;
+    }
+    return false;
+}
+
+uint32_t SearchIndex::root_signature() {
+    // FNV-1a over the names, sizes and mtimes of the root folder. Cheap enough for every boot, and a card
+    // edited elsewhere rarely leaves the root exactly as it was.
+    uint32_t hash = 2166136261u;
+    auto mix = [&hash](const void *data, size_t len) {
+        for (size_t i = 0; i < len; i++) {
+            hash ^= static_cast<const uint8_t *>(data)[i];
+            hash *= 16777619u;
+        }
+    };
+    DirIterator dir;
+    if (!dir.open("/"))
+        return 0;
+    sd_mmc_card::FileInfo info;
+    while (dir.next(info)) {
+        uint32_t values[2] = {static_cast<uint32_t>(info.size), static_cast<uint32_t>(dir.mtime())};
+        mix(info.path.data(), info.path.size() + 1);
+        mix(values, sizeof(values));
+    }
+    return hash;
+}
+
+void SearchIndex::start_build_() {
+    const char *reason;
+    {
+        LockGuard guard(this->lock_);
+        reason = this->build_reason_;
+        this->build_reason_ = nullptr;
+        this->build_sequence_ = this->sequence_;
+    }
+    ESP_LOGI(TAG, "Building the search index (%s)", reason);
+    this->out_ = fopen(SdFile::real_path(INDEX_BUILD_PATH).c_str(), "wb");
+    if (this->out_ == nullptr) {
+        ESP_LOGE(TAG, "Cannot create %s", INDEX_BUILD_PATH);
+        return;
+    }
+    uint8_t header[HEADER_SIZE] = {};
+    if (fwrite(header, 1, sizeof(header), this->out_) != sizeof(header) || !this->walker_.open("/")) {
+        this->abort_build_();
+        return;
+    }
+    this->out_offset_ = HEADER_SIZE;
+    this->out_entries_ = 0;
+    this->block_.clear();
+    this->out_table_.clear();
+    this->building_ = true;
+}
+
+bool SearchIndex::build_next_() {
+    if (this->out_entries_ + this->block_.size() >= this->max_entries_) {
+        ESP_LOGW(TAG, "More than %u entries on the card, the search index stops there",
+                 (unsigned) this->max_entries_);
+        return false;
+    }
+    sd_mmc_card::FileInfo info;
+    if (!this->walker_.next(info))
+        return false;
+    IndexEntry entry;
+    entry.path = std::move(info.path);
+    entry.size = info.size;
+    entry.mtime = std::max<time_t>(this->walker_.mtime(), 0);
+    entry.is_directory = info.is_directory;
+    this->block_.push_back(std::move(entry));
+    if (this->block_.size() == BLOCK_ENTRIES)
+        this->flush_block_();
+    return this->building_;
+}
+
+void SearchIndex::flush_block_() {
+    std::vector<std::pair<std::string, size_t>> keys;
+    keys.reserve(this->block_.size());
+    for (size_t i = 0; i < this->block_.size(); i++)
+        keys.emplace_back(name_key(this->block_[i].path), i);
+    std::sort(keys.begin(), keys.end());
+    Block block{};
+    block.offset = this->out_offset_;
+    block.count = keys.size();
+    block.min_size = UINT32_MAX;
+    block.min_mtime = UINT32_MAX;
+    // Fixed-width fields: NUL padded by the zero-initialised block, not terminated when the key fills them.
+    auto copy_key = [](char *field, std::string const &key) {
+        memcpy(field, key.data(), key.size() < NAME_KEY ? key.size() : NAME_KEY);
+    };
+    copy_key(block.first, keys.front().first);
+    copy_key(block.last, keys.back().first);
+    std::string data;
+    for (auto const &key : keys) {
+        IndexEntry const &entry = this->block_[key.second];
+        block.min_size = std::min(block.min_size, entry.size);
+        block.max_size = std::max(block.max_size, entry.size);
+        block.min_mtime = std::min(block.min_mtime, entry.mtime);
+        block.max_mtime = std::max(block.max_mtime, entry.mtime);
+        data += static_cast<char>(entry.is_directory ? RECORD_DIRECTORY : 0);
+        put32(data, entry.size);
+        put32(data, entry.mtime);
+        put16(data, entry.path.size());
+        data += entry.path;
+    }
+    this->block_.clear();
+    block.length = data.size();
+    block.crc = crc32_update(0, reinterpret_cast<const uint8_t *>(data.data()), data.size());
+    if (fwrite(data.data(), 1, data.size(), this->out_) != data.size()) {
+        ESP_LOGE(TAG, "Writing the search index failed");
+        this->abort_build_();
+        return;
+    }
+    this->out_offset_ += data.size();
+    this->out_entries_ += block.count;
+    this->out_table_.push_back(block);
+}
+
+void SearchIndex::finish_build_() {
+    if (!this->block_.empty())
+        this->flush_block_();
+    if (!this->building_)
+        return;
+    std::string table;
+    for (auto const &block : this->out_table_) {
+        put32(table, block.offset);
+        put32(table, block.length);
+        put32(table, block.crc);
+        put32(table, block.count);
+        put32(table, block.min_size);
+        put32(table, block.max_size);
+        put32(table, block.min_mtime);
+        put32(table, block.max_mtime);
+        table.append(block.first, NAME_KEY);
+        table.append(block.last, NAME_KEY);
+    }
+    uint32_t signature = root_signature();
+    time_t now = ::time(nullptr);
+    uint32_t built = now >= MIN_VALID_TIME ? now : 0;
+    std::string header(INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    put16(header, INDEX_VERSION);
+    put16(header, BLOCK_ENTRIES);
+    put32(header, this->out_entries_);
+    put32(header, this->out_table_.size());
+    put32(header, this->out_offset_);
+    put32(header, signature);
+    put32(header, built);
+    put32(header, crc32_update(0, reinterpret_cast<const uint8_t *>(table.data()), table.size()));
+    bool ok = fwrite(table.data(), 1, table.size(), this->out_) == table.size() &&
+              fseek(this->out_, 0, SEEK_SET) == 0 && fwrite(header.data(), 1, header.size(), this->out_) == header.size();
+    ok = fclose(this->out_) == 0 && ok;
+    this->out_ = nullptr;
+    this->building_ = false;
+    std::string fresh = SdFile::real_path(INDEX_BUILD_PATH);
+    if (!ok) {
+        ESP_LOGE(TAG, "Writing the search index failed");
+        remove(fresh.c_str());
+        return;
+    }
+    LockGuard guard(this->lock_);
+    // FAT cannot rename over a file. A search reading the old one meanwhile sees the generation change and
+    // starts over.
+    std::string current = SdFile::real_path(INDEX_PATH);
+    remove(current.c_str());
+    if (rename(fresh.c_str(), current.c_str()) != 0) {
+        ESP_LOGE(TAG, "Cannot move the search index into place");
+        this->ready_ = false;
+        return;
+    }
+    this->table_ = std::move(this->out_table_);
+    this->generation_++;
+    this->entry_count_ = this->out_entries_;
+    this->signature_ = signature;
+    this->built_ = built;
+    this->built_ms_ = millis();
+    this->ready_ = true;
+    // The walk saw everything changed before it started; later changes may have been missed and stay.
+    this->removed_trees_.clear();
+    for (auto it = this->changes_.begin(); it != this->changes_.end();) {
+        if (it->second.sequence < this->build_sequence_) {
+            it = this->changes_.erase(it);
+            continue;
+        }
+        if (it->second.kind == ChangeKind::TREE_REMOVED)
+            this->removed_trees_.insert(it->first);
+        ++it;
+    }
+    this->rewrite_journal_();
+    ESP_LOGI(TAG, "Search index built: %u entries in %u blocks", (unsigned) this->entry_count_,
+             (unsigned) this->table_.size());
+}
+
+void SearchIndex::abort_build_() {
+    if (this->out_ != nullptr) {
+        fclose(this->out_);
+        this->out_ = nullptr;
+    }
+    remove(SdFile::real_path(INDEX_BUILD_PATH).c_str());
+    this->building_ = false;
+    this->block_.clear();
+    this->out_table_.clear();
+    // Retried on the next refresh or, without an index, on the next search.
+    this->built_ms_ = millis();
+}
+
+bool SearchIndex::search(SearchQuery const &query, std::vector<IndexEntry> &results, bool &truncated) {
+    truncated = false;
+    std::string pattern = lower(query.pattern);
+    if (pattern.find_first_of("*?") == std::string::npos)
+        pattern = "*" + pattern + "*";
+    // Literal start of the pattern, compared against the name ranges of the blocks.
+    size_t literal = pattern.find_first_of("*?");
+    std::string prefix = pattern.substr(0, literal < NAME_KEY ? literal : NAME_KEY);
+    std::string scope = query.scope;
+    if (scope.empty() || scope.back() != '/')
+        scope += '/';
+    auto matches = [&](IndexEntry const &entry) {
+        if (query.type == SearchType::FILES && entry.is_directory)
+            return false;
+        if (query.type == SearchType::DIRECTORIES && !entry.is_directory)
+            return false;
+        return entry.size >= query.min_size && entry.size <= query.max_size && entry.mtime >= query.after &&
+               entry.mtime <= query.before && entry.path.size() > scope.size() &&
+               entry.path.compare(0, scope.size(), scope) == 0 && glob_match(pattern, name_key(entry.path));
+    };
+
+    // The blocks are read without the lock, a build finishing meanwhile only waits for the copies taken here.
+    // A read that fails while the index was replaced under it is tried once more against the new one.
+    for (int attempt = 0;; attempt++) {
+        std::vector<Block> table;
+        std::map<std::string, Change> changes;
+        std::set<std::string> removed_trees;
+        uint32_t generation;
+        {
+            LockGuard guard(this->lock_);
+            if (!this->ready_) {
+                if (this->loaded_ && !this->building_ && this->build_reason_ == nullptr)
+                    this->build_reason_ = "first search";
+                return false;
+            }
+            table = this->table_;
+            changes = this->changes_;
+            removed_trees = this->removed_trees_;
+            generation = this->generation_;
+        }
+        FILE *file = fopen(SdFile::real_path(INDEX_PATH).c_str(), "rb");
+        bool damaged = file == nullptr;
+        std::string data;
+        for (size_t b = 0; !damaged && !truncated && b < table.size(); b++) {
+            Block const &block = table[b];
+            if (block.max_size < query.min_size || block.min_size > query.max_size || block.max_mtime < query.after ||
+                block.min_mtime > query.before)
+                continue;
+            if (!prefix.empty() && (strncmp(prefix.c_str(), block.first, prefix.size()) < 0 ||
+                                    strncmp(prefix.c_str(), block.last, prefix.size()) > 0))
+                continue;
+            // One block is read whole, it is small and its CRC catches a card that rotted meanwhile.
+            data.resize(block.length);
+            damaged = fseek(file, block.offset, SEEK_SET) != 0 ||
+                      fread(&data[0], 1, data.size(), file) != data.size() ||
+                      crc32_update(0, reinterpret_cast<const uint8_t *>(data.data()), data.size()) != block.crc;
+            const uint8_t *next = reinterpret_cast<const uint8_t *>(data.data());
+            const uint8_t *end = next + data.size();
+            IndexEntry entry;
+            for (uint32_t i = 0; !damaged && i < block.count; i++) {
+                damaged = !parse_record(next, end, entry);
+                if (damaged || !matches(entry) || overridden_(changes, removed_trees, entry.path))
+                    continue;
+                if (results.size() == query.limit) {
+                    truncated = true;
+                    break;
+                }
+                results.push_back(entry);
+            }
+        }
+        if (file != nullptr)
+            fclose(file);
+        if (damaged) {
+            results.clear();
+            LockGuard guard(this->lock_);
+            if (attempt == 0 && this->generation_ != generation)
+                continue;
+            ESP_LOGW(TAG, "Search index unreadable, rebuilding");
+            this->ready_ = false;
+            if (!this->building_ && this->build_reason_ == nullptr)
+                this->build_reason_ = "index damaged";
+            return false;
+        }
+        for (auto const &it : changes) {
+            if (truncated)
+                break;
+            if (it.second.kind != ChangeKind::PRESENT || !matches(it.second.entry))
+                continue;
+            if (results.size() == query.limit) {
+                truncated = true;
+                break;
+            }
+            results.push_back(it.second.entry);
+        }
+        return true;
+    }
+}
+
+}  // namespace box3web
+}  // namespace esphome
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "esphome/core/helpers.h"
+#include "archive.h"
+
+namespace esphome {
+namespace box3web {
+
+struct IndexEntry {
+  std::string path;
+  uint32_t size{0};
+  uint32_t mtime{0};
+  bool is_directory{false};
+};
+
+enum class SearchType { ANY, FILES, DIRECTORIES };
+
+struct SearchQuery {
+  // Glob on the file name, case-insensitive, with * and ?. Without wildcards it matches anywhere in the name.
+  std::string pattern;
+  // Card folder the results must lie below.
+  std::string scope;
+  uint32_t min_size{0};
+  uint32_t max_size{UINT32_MAX};
+  // Modification time range in seconds since the epoch, inclusive.
+  uint32_t after{0};
+  uint32_t before{UINT32_MAX};
+  SearchType type{SearchType::ANY};
+  size_t limit{100};
+};
+
+// Persistent index of every file and folder on the card, answering ?search= without walking the tree.
+//
+// /.box3web-index holds the entries in blocks of up to BLOCK_ENTRIES, in walk order from block to block and
+// sorted by lower cased name within one. A table behind the blocks keeps the name, size and mtime ranges and
+// the CRC of each block, so a query only reads the blocks that can match; the table stays in memory.
+// Changes made through the component are appended to /.box3web-index.log and override the blocks until the
+// next build. The index is built in the background on first use and rebuilt when it is found stale: a bad
+// header or table, a torn journal line, a root folder that changed behind the component's back, a journal
+// grown past MAX_JOURNAL or refresh_ms since the last build.
+class SearchIndex {
+ public:
+  static const size_t BLOCK_ENTRIES = 64;
+  static const size_t MAX_JOURNAL = 512;
+
+  SearchIndex(uint32_t refresh_ms, size_t max_entries) : refresh_ms_(refresh_ms), max_entries_(max_entries) {}
+
+  // Called from the main loop: loads the index the first time, then runs a pending build for up to
+  // budget_ms at a time.
+  void step(uint32_t budget_ms);
+  void request_build(const char *reason);
+
+  // Records path as it is on the card now, present or gone.
+  void update(std::string const &path);
+  // Same for a folder whose content changed as a whole: gone, or moved in and only known after a build.
+  void update_tree(std::string const &path);
+
+  // Appends up to query.limit matches to results; false while the index cannot answer, a build is then
+  // under way. truncated tells whether more entries matched.
+  bool search(SearchQuery const &query, std::vector<IndexEntry> &results, bool &truncated);
+
+  bool ready() const { return this->ready_; }
+  bool building() const { return this->building_; }
+  size_t entries() const { return this->entry_count_; }
+  size_t journal_size() const { return this->changes_.size(); }
+  time_t built() const { return this->built_; }
+
+ protected:
+  static const size_t NAME_KEY = 12;
+
+  // Zone map of one block, names lower cased, cut to NAME_KEY bytes and NUL padded.
+  struct Block {
+    uint32_t offset;
+    uint32_t length;
+    uint32_t crc;
+    uint32_t count;
+    uint32_t min_size;
+    uint32_t max_size;
+    uint32_t min_mtime;
+    uint32_t max_mtime;
+    char first[NAME_KEY];
+    char last[NAME_KEY];
+  };
+
+  enum class ChangeKind : char { PRESENT = '+', REMOVED = '-', TREE_REMOVED = 'x' };
+
+  struct Change {
+    ChangeKind kind;
+    IndexEntry entry;
+    uint32_t sequence;
+  };
+
+  void load_();
+  bool load_journal_();
+  // Records a change in memory and in the journal, lock_ must be held.
+  void record_(Change change);
+  void append_journal_(Change const &change);
+  void rewrite_journal_();
+  static bool overridden_(std::map<std::string, Change> const &changes, std::set<std::string> const &removed_trees,
+                          std::string const &path);
+  static uint32_t root_signature();
+
+  void start_build_();
+  bool build_next_();
+  void flush_block_();
+  void finish_build_();
+  void abort_build_();
+
+  uint32_t refresh_ms_;
+  size_t max_entries_;
+  Mutex lock_;
+
+  bool loaded_{false};
+  bool ready_{false};
+  std::vector<Block> table_;
+  // Counts the tables put in place, so a search can tell the index was replaced while it read.
+  uint32_t generation_{0};
+  size_t entry_count_{0};
+  uint32_t signature_{0};
+  time_t built_{0};
+  uint32_t built_ms_{0};
+
+  // Journal, by path. Trees removed are also kept apart since they hide everything below them.
+  std::map<std::string, Change> changes_;
+  std::set<std::string> removed_trees_;
+  uint32_t sequence_{0};
+
+  const char *build_reason_{nullptr};
+  bool building_{false};
+  uint32_t build_sequence_{0};
+  TreeWalker walker_;
+  FILE *out_{nullptr};
+  uint32_t out_offset_{0};
+  size_t out_entries_{0};
+  std::vector<IndexEntry> block_;
+  std::vector<Block> out_table_;
+};
+
+}  // namespace box3web
+}  // namespace esphome
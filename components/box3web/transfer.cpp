@@ -0,0 +1,447 @@
+#include "transfer.h"
+#include "metrics.h"
+#include "esphome/core/hal.h"
+#include "esphome/core/log.h"
+
+#include <algorithm>
+#include <cstring>
+#include <sys/stat.h>
+
+#ifdef USE_ESP_IDF
+#include "esp_http_server.h"
+#endif
+
+namespace esphome {
+namespace box3web {
+
+static const char *TAG = "box3web.transfer";
+
+std::string SdFile::real_path(std::string const &path) { return std::string(SD_MOUNT_POINT) + path; }
+
+bool SdFile::open(std::string const &path, const char *mode) {
+    this->close();
+    std::string real = real_path(path);
+    this->file_ = fopen(real.c_str(), mode);
+    if (this->file_ == nullptr)
+        return false;
+    struct stat st;
+    if (fstat(fileno(this->file_), &st) == 0) {
+        this->size_ = st.st_size;
+        this->mtime_ = st.st_mtime;
+    }
+    return true;
+}
+
+void SdFile::close() {
+    if (this->file_ != nullptr) {
+        fclose(this->file_);
+        this->file_ = nullptr;
+    }
+    this->size_ = 0;
+    this->mtime_ = 0;
+}
+
+bool SdFile::seek(size_t offset) { return this->file_ != nullptr && fseek(this->file_, offset, SEEK_SET) == 0; }
+
+size_t SdFile::read(uint8_t *buffer, size_t len) {
+    if (this->file_ == nullptr)
+        return 0;
+    uint32_t start = micros();
+    size_t read = fread(buffer, 1, len, this->file_);
+    global_metrics.card_read().record(micros() - start);
+    return read;
+}
+
+size_t SdFile::write(const uint8_t *buffer, size_t len) {
+    if (this->file_ == nullptr)
+        return 0;
+    uint32_t start = micros();
+    size_t written = fwrite(buffer, 1, len, this->file_);
+    global_metrics.card_write().record(micros() - start);
+    return written;
+}
+
+void SdFile::disable_buffering() {
+    if (this->file_ != nullptr)
+        setvbuf(this->file_, nullptr, _IONBF, 0);
+}
+
+size_t StaticSource::fill(uint8_t *buffer, size_t len) {
+    len = std::min(len, this->remaining_);
+    memcpy(buffer, this->data_, len);
+    this->data_ += len;
+    this->remaining_ -= len;
+    return len;
+}
+
+size_t StaticSource::borrow(const uint8_t *&data) {
+    data = this->data_;
+    size_t len = this->remaining_;
+    this->data_ += len;
+    this->remaining_ = 0;
+    return len;
+}
+
+size_t TextSource::fill(uint8_t *buffer, size_t len) {
+    size_t written = 0;
+    while (written < len) {
+        if (this->pending_pos_ == this->pending_.size()) {
+            this->pending_.clear();
+            this->pending_pos_ = 0;
+            if (this->done_ || !this->produce(this->pending_)) {
+                this->done_ = true;
+                break;
+            }
+            continue;
+        }
+        size_t count = std::min(len - written, this->pending_.size() - this->pending_pos_);
+        memcpy(buffer + written, this->pending_.data() + this->pending_pos_, count);
+        this->pending_pos_ += count;
+        written += count;
+    }
+    return written;
+}
+
+FileSource::FileSource(std::unique_ptr<SdFile> file, size_t offset, size_t length)
+    : file_(std::move(file)), remaining_(length) {
+    if (offset != 0 && !this->file_->seek(offset))
+        this->remaining_ = 0;
+}
+
+size_t FileSource::fill(uint8_t *buffer, size_t len) {
+    if (this->remaining_ == 0)
+        return 0;
+    size_t read = this->file_->read(buffer, std::min(len, this->remaining_));
+    if (read == 0) {
+        ESP_LOGW(TAG, "Short read, %u bytes left", (unsigned) this->remaining_);
+        this->remaining_ = 0;
+        return 0;
+    }
+    this->remaining_ -= read;
+    return read;
+}
+
+bool parse_decimal(std::string const &text, size_t &value) {
+    if (text.empty())
+        return false;
+    value = 0;
+    for (char c : text) {
+        if (c < '0' || c > '9')
+            return false;
+        size_t digit = c - '0';
+        // size_t is 32 bits on the ESP32, a wrapped value would pass for a small one.
+        if (value > (SIZE_MAX - digit) / 10)
+            return false;
+        value = value * 10 + digit;
+    }
+    return true;
+}
+
+static std::string trim(std::string const &text) {
+    size_t begin = text.find_first_not_of(" \t");
+    if (begin == std::string::npos)
+        return "";
+    size_t end = text.find_last_not_of(" \t");
+    return text.substr(begin, end - begin + 1);
+}
+
+RangeResult parse_range_header(std::string const &header, size_t size, std::vector<ByteRange> &ranges) {
+    ranges.clear();
+    static const std::string UNIT = "bytes=";
+    if (header.compare(0, UNIT.size(), UNIT) != 0)
+        return RangeResult::NONE;
+    size_t specs = 0;
+    size_t pos = UNIT.size();
+    while (pos <= header.size()) {
+        size_t comma = header.find(',', pos);
+        if (comma == std::string::npos)
+            comma = header.size();
+        std::string spec = trim(header.substr(pos, comma - pos));
+        pos = comma + 1;
+        if (spec.empty())
+            continue;
+        if (++specs > MAX_RANGES)
+            return RangeResult::NONE;
+        size_t dash = spec.find('-');
+        if (dash == std::string::npos)
+            return RangeResult::NONE;
+        std::string first_text = spec.substr(0, dash);
+        std::string last_text = spec.substr(dash + 1);
+        size_t first, last;
+        if (first_text.empty()) {
+            // Suffix range: the final N bytes.
+            if (!parse_decimal(last_text, last))
+                return RangeResult::NONE;
+            if (last == 0 || size == 0)
+                continue;
+            ranges.push_back({size - std::min(last, size), size - 1});
+            continue;
+        }
+        if (!parse_decimal(first_text, first))
+            return RangeResult::NONE;
+        if (last_text.empty()) {
+            last = size - 1;
+        } else if (!parse_decimal(last_text, last) || last < first) {
+            return RangeResult::NONE;
+        }
+        if (first >= size)
+            continue;
+        ranges.push_back({first, std::min(last, size - 1)});
+    }
+    if (specs == 0)
+        return RangeResult::NONE;
+    return ranges.empty() ? RangeResult::UNSATISFIABLE : RangeResult::SATISFIABLE;
+}
+
+std::string content_range(ByteRange const &range, size_t size) {
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "bytes %u-%u/%u", (unsigned) range.first, (unsigned) range.last, (unsigned) size);
+    return buffer;
+}
+
+MultipartRangeSource::MultipartRangeSource(std::unique_ptr<SdFile> file, std::vector<ByteRange> ranges,
+                                           std::string const &content_type, std::string const &boundary)
+    : file_(std::move(file)), ranges_(std::move(ranges)), content_type_(content_type), boundary_(boundary) {
+    this->size_ = this->file_->size();
+    this->pending_ = this->part_header(0);
+}
+
+std::string MultipartRangeSource::part_header(size_t index) const {
+    return "\r\n--" + this->boundary_ + "\r\nContent-Type: " + this->content_type_ +
+           "\r\nContent-Range: " + content_range(this->ranges_[index], this->size_) + "\r\n\r\n";
+}
+
+std::string MultipartRangeSource::trailer() const { return "\r\n--" + this->boundary_ + "--\r\n"; }
+
+size_t MultipartRangeSource::content_length() const {
+    size_t length = this->trailer().size();
+    for (size_t i = 0; i < this->ranges_.size(); i++)
+        length += this->part_header(i).size() + this->ranges_[i].length();
+    return length;
+}
+
+size_t MultipartRangeSource::fill(uint8_t *buffer, size_t len) {
+    size_t written = 0;
+    while (written < len && !this->done_) {
+        if (this->pending_pos_ < this->pending_.size()) {
+            size_t count = std::min(len - written, this->pending_.size() - this->pending_pos_);
+            memcpy(buffer + written, this->pending_.data() + this->pending_pos_, count);
+            this->pending_pos_ += count;
+            written += count;
+            if (this->pending_pos_ < this->pending_.size())
+                break;
+            // Header fully emitted, the range body comes next unless this was the trailer.
+            if (this->index_ == this->ranges_.size()) {
+                this->done_ = true;
+                break;
+            }
+            ByteRange const &range = this->ranges_[this->index_];
+            this->remaining_ = this->file_->seek(range.first) ? range.length() : 0;
+            continue;
+        }
+        if (this->remaining_ > 0) {
+            size_t read = this->file_->read(buffer + written, std::min(len - written, this->remaining_));
+            if (read == 0) {
+                ESP_LOGW(TAG, "Short read in range %u", (unsigned) this->index_);
+                this->done_ = true;
+                break;
+            }
+            this->remaining_ -= read;
+            written += read;
+            continue;
+        }
+        this->index_++;
+        this->pending_ = this->index_ < this->ranges_.size() ? this->part_header(this->index_) : this->trailer();
+        this->pending_pos_ = 0;
+    }
+    return written;
+}
+
+std::string get_header(AsyncWebServerRequest *request, const char *name) {
+#ifdef USE_ESP_IDF
+    auto value = request->get_header(name);
+    return value.has_value() ? value.value() : "";
+#else
+    AsyncWebHeader *header = request->getHeader(name);
+    return header != nullptr ? std::string(header->value().c_str()) : "";
+#endif
+}
+
+std::string make_etag(size_t size, time_t mtime) {
+    char buffer[40];
+    snprintf(buffer, sizeof(buffer), "\"%x-%llx\"", (unsigned) size, (unsigned long long) mtime);
+    return buffer;
+}
+
+std::string http_date(time_t time) {
+    struct tm tm;
+    gmtime_r(&time, &tm);
+    char buffer[32];
+    strftime(buffer, sizeof(buffer), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    return buffer;
+}
+
+bool parse_http_date(std::string const &text, time_t &time) {
+    static const char *const MONTHS = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    char month_name[4] = {0};
+    int day, year, hour, minute, second;
+    if (sscanf(text.c_str(), "%*3s, %d %3s %d %d:%d:%d", &day, month_name, &year, &hour, &minute, &second) != 6)
+        return false;
+    const char *found = strstr(MONTHS, month_name);
+    if (found == nullptr || strlen(month_name) != 3 || (found - MONTHS) % 3 != 0)
+        return false;
+    int month = (found - MONTHS) / 3 + 1;
+    // Days from civil date, valid for the proleptic Gregorian calendar.
+    int y = year - (month <= 2);
+    int era = (y >= 0 ? y : y - 399) / 400;
+    int yoe = y - era * 400;
+    int doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    long long days = (long long) era * 146097 + doe - 719468;
+    time = static_cast<time_t>(days * 86400 + hour * 3600 + minute * 60 + second);
+    return true;
+}
+
+static bool etag_list_matches(std::string const &list, std::string const &etag) {
+    if (trim(list) == "*")
+        return true;
+    // Weak comparison: W/ prefixes are ignored on both sides.
+    std::string bare = etag.compare(0, 2, "W/") == 0 ? etag.substr(2) : etag;
+    size_t pos = 0;
+    while (pos < list.size()) {
+        size_t comma = list.find(',', pos);
+        if (comma == std::string::npos)
+            comma = list.size();
+        std::string candidate = trim(list.substr(pos, comma - pos));
+        if (candidate.compare(0, 2, "W/") == 0)
+            candidate.erase(0, 2);
+        if (candidate == bare)
+            return true;
+        pos = comma + 1;
+    }
+    return false;
+}
+
+bool is_not_modified(AsyncWebServerRequest *request, std::string const &etag, time_t last_modified) {
+    std::string if_none_match = get_header(request, "If-None-Match");
+    if (!if_none_match.empty())
+        return etag_list_matches(if_none_match, etag);
+    std::string if_modified_since = get_header(request, "If-Modified-Since");
+    time_t since;
+    if (last_modified == 0 || if_modified_since.empty() || !parse_http_date(if_modified_since, since))
+        return false;
+    return last_modified <= since;
+}
+
+void send_not_modified(AsyncWebServerRequest *request, Headers const &headers) {
+    global_metrics.response(304);
+    auto *response = request->beginResponse(304, "text/plain", "");
+    for (auto const &header : headers)
+        response->addHeader(header.first.c_str(), header.second.c_str());
+    request->send(response);
+}
+
+const char *http_status_line(int code) {
+    switch (code) {
+        case 200: return "200 OK";
+        case 201: return "201 Created";
+        case 204: return "204 No Content";
+        case 206: return "206 Partial Content";
+        case 304: return "304 Not Modified";
+        case 400: return "400 Bad Request";
+        case 401: return "401 Unauthorized";
+        case 403: return "403 Forbidden";
+        case 404: return "404 Not Found";
+        case 405: return "405 Method Not Allowed";
+        case 409: return "409 Conflict";
+        case 412: return "412 Precondition Failed";
+        case 413: return "413 Payload Too Large";
+        case 416: return "416 Range Not Satisfiable";
+        case 503: return "503 Service Unavailable";
+        default: return "500 Internal Server Error";
+    }
+}
+
+void send_text(AsyncWebServerRequest *request, int code, const char *content_type, std::string const &body,
+               Headers const &headers) {
+    global_metrics.response(code);
+    auto *response = request->beginResponse(code, content_type, body.c_str());
+    for (auto const &header : headers)
+        response->addHeader(header.first.c_str(), header.second.c_str());
+    request->send(response);
+}
+
+void send_busy(AsyncWebServerRequest *request, uint32_t retry_after) {
+    global_metrics.response(503);
+    auto *response = request->beginResponse(503, "application/json", "{ \"error\": \"server busy\" }");
+    response->addHeader("Retry-After", std::to_string(retry_after).c_str());
+    request->send(response);
+}
+
+void send_stream(AsyncWebServerRequest *request, StreamHead const &head, std::shared_ptr<ChunkSource> source,
+                 BufferPool *pool, std::shared_ptr<TransferTicket> ticket) {
+#ifdef USE_ESP_IDF
+    httpd_req_t *req = *request;
+    PoolBuffer buffer;
+    if (!source->zero_copy()) {
+        buffer = pool->acquire(BUFFER_WAIT_MS);
+        if (!buffer) {
+            send_busy(request);
+            return;
+        }
+    }
+    global_metrics.response(head.code);
+    // httpd keeps pointers to the header strings, head must outlive the transfer.
+    httpd_resp_set_status(req, http_status_line(head.code));
+    httpd_resp_set_type(req, head.content_type.c_str());
+    for (auto const &header : head.headers)
+        httpd_resp_set_hdr(req, header.first.c_str(), header.second.c_str());
+    const uint8_t *data = buffer.data();
+    size_t len;
+    bool first = true;
+    while ((len = buffer ? source->fill(buffer.data(), buffer.size()) : source->borrow(data)) > 0) {
+        // The source has set itself up by now, so the request holds about the most heap it ever will.
+        if (first)
+            sample_request_heap();
+        first = false;
+        global_metrics.sent(len);
+        if (httpd_resp_send_chunk(req, reinterpret_cast<const char *>(data), len) != ESP_OK) {
+            ESP_LOGW(TAG, "Client closed connection during transfer");
+            return;
+        }
+        // The httpd task serves every client, a shaped transfer must not sleep on it.
+        if (ticket != nullptr)
+            ticket->consume(len);
+    }
+    httpd_resp_send_chunk(req, nullptr, 0);
+#else
+    // AsyncTCP hands out its own send buffer, the body is produced straight into it. The callback must not
+    // block, a shaped client over its rate is asked to come back later instead.
+    auto filler = [source, ticket](uint8_t *buffer, size_t max_len, size_t index) -> size_t {
+        if (ticket != nullptr) {
+            max_len = ticket->grant(max_len);
+            if (max_len == 0)
+                return RESPONSE_TRY_AGAIN;
+        }
+        size_t len = source->fill(buffer, max_len);
+        if (ticket != nullptr)
+            ticket->consume(len);
+        global_metrics.sent(len);
+        return len;
+    };
+    AsyncWebServerResponse *response;
+    if (head.content_length != UNKNOWN_LENGTH) {
+        response = request->beginResponse(head.content_type.c_str(), head.content_length, filler);
+    } else {
+        response = request->beginChunkedResponse(head.content_type.c_str(), filler);
+    }
+    response->setCode(head.code);
+    for (auto const &header : head.headers)
+        response->addHeader(header.first.c_str(), header.second.c_str());
+    global_metrics.response(head.code);
+    request->send(response);
+#endif
+}
+
+}  // namespace box3web
+}  // namespace esphome
@@ -0,0 +1,185 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "esphome/components/web_server_base/web_server_base.h"
+#include "admission.h"
+#include "buffer_pool.h"
+
+namespace esphome {
+namespace box3web {
+
+// Mount point of the card, identical for the ESP-IDF and Arduino sd_mmc_card drivers. The host build points it
+// at a local folder instead.
+#ifndef BOX3WEB_SD_MOUNT_POINT
+#define BOX3WEB_SD_MOUNT_POINT "/sdcard"
+#endif
+static const char *const SD_MOUNT_POINT = BOX3WEB_SD_MOUNT_POINT;
+
+static const size_t UNKNOWN_LENGTH = SIZE_MAX;
+
+// Thin RAII wrapper around a stdio handle on the mounted card.
+class SdFile {
+ public:
+  SdFile() = default;
+  ~SdFile() { this->close(); }
+  SdFile(SdFile const &) = delete;
+  SdFile &operator=(SdFile const &) = delete;
+
+  bool open(std::string const &path, const char *mode = "rb");
+  void close();
+  bool is_open() const { return this->file_ != nullptr; }
+  size_t size() const { return this->size_; }
+  time_t mtime() const { return this->mtime_; }
+  bool seek(size_t offset);
+  size_t read(uint8_t *buffer, size_t len);
+  size_t write(const uint8_t *buffer, size_t len);
+  void disable_buffering();
+
+  static std::string real_path(std::string const &path);
+
+ protected:
+  FILE *file_{nullptr};
+  size_t size_{0};
+  time_t mtime_{0};
+};
+
+// Pull-based body producer. fill() returns 0 once the body is complete.
+class ChunkSource {
+ public:
+  virtual ~ChunkSource() = default;
+  virtual size_t fill(uint8_t *buffer, size_t len) = 0;
+  // Sources that already hold the body in buffers of their own can lend them instead of copying:
+  // borrow() points data at the next piece, valid until the following call, and returns 0 at the end.
+  virtual bool zero_copy() const { return false; }
+  virtual size_t borrow(const uint8_t *&data) { return 0; }
+};
+
+// Source for generated text: produce() appends the next piece, fill() drains it.
+class TextSource : public ChunkSource {
+ public:
+  size_t fill(uint8_t *buffer, size_t len) override;
+
+ protected:
+  // Appends the next piece of the body to out, false once nothing is left.
+  virtual bool produce(std::string &out) = 0;
+
+  std::string pending_;
+  size_t pending_pos_{0};
+  bool done_{false};
+};
+
+// Streams [offset, offset + length) of an open file.
+class FileSource : public ChunkSource {
+ public:
+  FileSource(std::unique_ptr<SdFile> file, size_t offset, size_t length);
+  size_t fill(uint8_t *buffer, size_t len) override;
+
+ protected:
+  std::unique_ptr<SdFile> file_;
+  size_t remaining_;
+};
+
+// Body already in memory or in memory mapped flash, lent out as a whole.
+class StaticSource : public ChunkSource {
+ public:
+  StaticSource(const uint8_t *data, size_t size) : data_(data), remaining_(size) {}
+  size_t fill(uint8_t *buffer, size_t len) override;
+  bool zero_copy() const override { return true; }
+  size_t borrow(const uint8_t *&data) override;
+
+ protected:
+  const uint8_t *data_;
+  size_t remaining_;
+};
+
+// Inclusive byte range of a Range request, already clamped to the file size.
+struct ByteRange {
+  size_t first;
+  size_t last;
+  size_t length() const { return this->last - this->first + 1; }
+};
+
+enum class RangeResult { NONE, SATISFIABLE, UNSATISFIABLE };
+
+static const size_t MAX_RANGES = 8;
+
+// Parses a "bytes=" Range header. NONE means the header must be ignored and the whole file served.
+RangeResult parse_range_header(std::string const &header, size_t size, std::vector<ByteRange> &ranges);
+
+std::string content_range(ByteRange const &range, size_t size);
+
+// Emits a multipart/byteranges body for several ranges of one file.
+class MultipartRangeSource : public ChunkSource {
+ public:
+  MultipartRangeSource(std::unique_ptr<SdFile> file, std::vector<ByteRange> ranges, std::string const &content_type,
+                       std::string const &boundary);
+  size_t fill(uint8_t *buffer, size_t len) override;
+  size_t content_length() const;
+
+ protected:
+  std::string part_header(size_t index) const;
+  std::string trailer() const;
+
+  std::unique_ptr<SdFile> file_;
+  std::vector<ByteRange> ranges_;
+  std::string content_type_;
+  std::string boundary_;
+  size_t size_;
+  size_t index_{0};
+  std::string pending_;
+  size_t pending_pos_{0};
+  size_t remaining_{0};
+  bool done_{false};
+};
+
+using Headers = std::vector<std::pair<std::string, std::string>>;
+
+struct StreamHead {
+  int code{200};
+  std::string content_type;
+  size_t content_length{UNKNOWN_LENGTH};
+  Headers headers;
+};
+
+const char *http_status_line(int code);
+
+bool parse_decimal(std::string const &text, size_t &value);
+
+// Request header value, or an empty string when absent.
+std::string get_header(AsyncWebServerRequest *request, const char *name);
+
+// Validators for conditional requests.
+std::string make_etag(size_t size, time_t mtime);
+std::string http_date(time_t time);
+bool parse_http_date(std::string const &text, time_t &time);
+// Evaluates If-None-Match, then If-Modified-Since when no entity tag was sent (RFC 9110 13.2.2).
+// last_modified of 0 means unknown.
+bool is_not_modified(AsyncWebServerRequest *request, std::string const &etag, time_t last_modified);
+// Answers 304 with the validators and caching headers the full response would have carried.
+void send_not_modified(AsyncWebServerRequest *request, Headers const &headers);
+
+// Answers with a short body held in memory. Every response goes out through this, send_not_modified(),
+// send_busy() or send_stream(), which count it by status; only the open ended event streams of ChangeFeed
+// count their own.
+void send_text(AsyncWebServerRequest *request, int code, const char *content_type, std::string const &body,
+               Headers const &headers = {});
+
+// Answers 503 with Retry-After when no transfer buffer or admission ticket could be had.
+void send_busy(AsyncWebServerRequest *request, uint32_t retry_after = 1);
+
+// Sends the response head, then drains the source into the socket through one pool buffer, or none at all
+// for zero-copy sources. A ticket charges the body to its client's download rate and is held until the end.
+void send_stream(AsyncWebServerRequest *request, StreamHead const &head, std::shared_ptr<ChunkSource> source,
+                 BufferPool *pool, std::shared_ptr<TransferTicket> ticket = nullptr);
+
+// How long a transfer waits for a pool buffer before the client is told to come back later.
+static const uint32_t BUFFER_WAIT_MS = 1000;
+
+}  // namespace box3web
+}  // namespace esphome
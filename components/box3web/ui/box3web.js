@@ -0,0 +1,116 @@
+// Behaviour of the folder page. The page itself only carries the listing: links, checkboxes and
+// data-delete buttons, all handled by one click listener on the document.
+const files = document.getElementById('files');
+// With the change feed on, the table follows the folder through server-sent events and nothing reloads.
+let feed = null;
+
+function refresh() {
+  if (!feed || feed.readyState === EventSource.CLOSED) {
+    location.reload();
+  }
+}
+
+function delete_file(uri) {
+  if (!confirm('Are you sure you want to delete this file?')) {
+    return;
+  }
+  fetch(uri, {method: 'DELETE'})
+    .then(response => {
+      if (response.ok) {
+        refresh();
+      } else {
+        alert('Error deleting file');
+      }
+    })
+    .catch(error => alert('Error: ' + error));
+}
+
+function delete_selected() {
+  const ops = Array.from(document.querySelectorAll('.select:checked'))
+    .map(box => ({op: 'delete', path: box.value, recursive: true}));
+  if (!ops.length || !confirm('Delete ' + ops.length + ' selected item(s), folders with their content?')) {
+    return;
+  }
+  fetch('?batch=1', {method: 'POST', headers: {'Content-Type': 'application/json'}, body: JSON.stringify(ops)})
+    .then(response => response.ok ? response.text() : response.json().then(body => { throw body.error; }))
+    .then(text => {
+      const failed = text.trim().split('\n').map(line => JSON.parse(line)).filter(item => item.error);
+      if (failed.length) {
+        alert('Not deleted: ' + failed.map(item => item.path + ' (' + item.error + ')').join(', '));
+      }
+      refresh();
+    })
+    .catch(error => alert('Error: ' + error));
+}
+
+function find_row(name) {
+  return Array.from(files.tBodies[0].rows).find(row => row.dataset.name === name);
+}
+
+// Same cells as the rows the server renders.
+function make_row(entry) {
+  const row = document.createElement('tr');
+  row.dataset.name = entry.name;
+  const directory = entry.type === 'directory';
+  const uri = location.pathname.replace(/\/$/, '') + '/' + encodeURIComponent(entry.name);
+  const [name, type, size, actions] = [0, 1, 2, 3].map(() => row.insertCell());
+  if ('deletion' in files.dataset) {
+    const box = name.appendChild(document.createElement('input'));
+    box.type = 'checkbox';
+    box.className = 'select';
+    box.value = entry.name;
+  }
+  const link = name.appendChild(document.createElement('a'));
+  link.href = uri;
+  link.textContent = directory ? entry.name + '/' : entry.name;
+  type.textContent = directory ? 'Directory' : entry.category;
+  size.textContent = directory ? '-' : entry.size;
+  if (!directory && 'download' in files.dataset) {
+    const download = actions.appendChild(document.createElement('a'));
+    download.className = 'button';
+    download.href = uri;
+    download.download = entry.name;
+    download.textContent = 'Download';
+  }
+  if (!directory && 'deletion' in files.dataset) {
+    const button = actions.appendChild(document.createElement('button'));
+    button.className = 'delete';
+    button.dataset.delete = uri;
+    button.textContent = 'Delete';
+  }
+  return row;
+}
+
+function show_entry(event) {
+  const entry = JSON.parse(event.data);
+  const row = make_row(entry);
+  const old = find_row(entry.name);
+  if (old) {
+    old.replaceWith(row);
+  } else {
+    files.tBodies[0].appendChild(row);
+  }
+}
+
+if (files && 'events' in files.dataset && window.EventSource) {
+  feed = new EventSource('?events=' + files.dataset.events);
+  feed.addEventListener('add', show_entry);
+  feed.addEventListener('update', show_entry);
+  feed.addEventListener('remove', event => {
+    const row = find_row(JSON.parse(event.data).name);
+    if (row) {
+      row.remove();
+    }
+  });
+  // Changes were missed, only a fresh listing is sure to be right.
+  feed.addEventListener('reset', () => location.reload());
+}
+
+document.addEventListener('click', event => {
+  const button = event.target.closest('button[data-delete]');
+  if (button) {
+    delete_file(button.dataset.delete);
+  } else if (event.target.id === 'delete-selected') {
+    delete_selected();
+  }
+});
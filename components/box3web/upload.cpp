@@ -0,0 +1,150 @@
+#include "upload.h"
+#include "crc32.h"
+#include "pipeline.h"
+#include "esphome/core/hal.h"
+#include "esphome/core/log.h"
+
+#include <algorithm>
+#include <cstring>
+#include <sys/stat.h>
+
+namespace esphome {
+namespace box3web {
+
+static const char *TAG = "box3web.upload";
+
+UploadSession::UploadSession(std::string path, PoolBuffer buffer, bool resume)
+    : path_(std::move(path)), resume_(resume), buffer_(std::move(buffer)), buffer_size_(buffer_.size()) {}
+
+UploadSession::~UploadSession() {
+    if (this->file_.is_open())
+        this->abort();
+}
+
+bool UploadSession::open() {
+    if (!this->buffer_)
+        return false;
+    struct stat st;
+    this->replaced_ = !this->resume_ && stat(SdFile::real_path(this->path_).c_str(), &st) == 0;
+    if (!this->file_.open(this->path_, this->resume_ ? "ab" : "wb")) {
+        ESP_LOGE(TAG, "Cannot open %s for writing", this->path_.c_str());
+        return false;
+    }
+    // Writes are already cluster sized, stdio buffering would only add a copy.
+    this->file_.disable_buffering();
+    // A resumed upload arrives over several sessions and maybe reboots, only whole ones are hashed.
+    if (!this->resume_) {
+        remove_digest(this->path_);
+        this->sha256_.reset(new Sha256());
+    }
+    this->last_activity_ = millis();
+    return true;
+}
+
+bool UploadSession::flush_() {
+    if (this->buffered_ == 0)
+        return true;
+    size_t written = this->file_.write(this->buffer_.data(), this->buffered_);
+    if (written != this->buffered_) {
+        ESP_LOGE(TAG, "Write to %s failed after %u bytes", this->path_.c_str(), (unsigned) this->received_);
+        return false;
+    }
+    this->buffered_ = 0;
+    return true;
+}
+
+#ifdef USE_BOX3WEB_UPLOAD_PIPELINE
+bool UploadSession::attach_pipeline(UploadPipeline *pipeline) {
+    if (!pipeline->attach(this))
+        return false;
+    this->pipeline_ = pipeline;
+    return true;
+}
+#endif
+
+bool UploadSession::write(const uint8_t *data, size_t len) {
+    this->last_activity_ = millis();
+    this->received_ += len;
+    if (this->sha256_ != nullptr) {
+        this->digest_.crc32 = crc32_update(this->digest_.crc32, data, len);
+        this->sha256_->update(data, len);
+    }
+    // This runs on the web server task, which serves every client and must not sleep. The upload only spends
+    // the client's budget, an overdrawn client is refused its next transfer until the debt is paid off.
+    this->ticket_.consume(len);
+#ifdef USE_BOX3WEB_UPLOAD_PIPELINE
+    if (this->pipeline_ != nullptr)
+        return this->pipeline_->push(data, len);
+#endif
+    return this->write_direct(data, len);
+}
+
+bool UploadSession::write_direct(const uint8_t *data, size_t len) {
+    while (len > 0) {
+        if (this->buffered_ == 0 && len >= this->buffer_size_) {
+            // Whole clusters straight from the network buffer, no copy needed.
+            size_t direct = len - len % this->buffer_size_;
+            if (this->file_.write(data, direct) != direct) {
+                ESP_LOGE(TAG, "Write to %s failed", this->path_.c_str());
+                return false;
+            }
+            data += direct;
+            len -= direct;
+            continue;
+        }
+        size_t count = std::min(len, this->buffer_size_ - this->buffered_);
+        memcpy(this->buffer_.data() + this->buffered_, data, count);
+        this->buffered_ += count;
+        data += count;
+        len -= count;
+        if (this->buffered_ == this->buffer_size_ && !this->flush_())
+            return false;
+    }
+    return true;
+}
+
+bool UploadSession::finish() {
+    bool ok = true;
+#ifdef USE_BOX3WEB_UPLOAD_PIPELINE
+    if (this->pipeline_ != nullptr) {
+        ok = this->pipeline_->detach(true);
+        this->pipeline_ = nullptr;
+    }
+#endif
+    ok = ok && this->flush_();
+    this->file_.close();
+    this->buffer_.release();
+    this->ticket_.release();
+    if (!ok && !this->resume_)
+        remove(SdFile::real_path(this->path_).c_str());
+    struct stat st;
+    if (ok && this->sha256_ != nullptr && stat(SdFile::real_path(this->path_).c_str(), &st) == 0) {
+        this->sha256_->finish(this->digest_.sha256);
+        this->digest_.size = st.st_size;
+        this->digest_.mtime = st.st_mtime;
+        this->digest_ready_ = write_digest(this->path_, this->digest_);
+    }
+    this->sha256_.reset();
+    return ok;
+}
+
+void UploadSession::abort() {
+    ESP_LOGW(TAG, "Upload of %s aborted after %u bytes", this->path_.c_str(), (unsigned) this->received_);
+#ifdef USE_BOX3WEB_UPLOAD_PIPELINE
+    if (this->pipeline_ != nullptr) {
+        this->pipeline_->detach(this->resume_);
+        this->pipeline_ = nullptr;
+    }
+#endif
+    // The client resumes from the size of the partial, so the buffered tail is worth keeping.
+    if (this->resume_)
+        this->flush_();
+    this->file_.close();
+    this->buffer_.release();
+    this->ticket_.release();
+    if (!this->resume_)
+        remove(SdFile::real_path(this->path_).c_str());
+}
+
+}  // namespace box3web
+}  // namespace esphome
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include "admission.h"
+#include "buffer_pool.h"
+#include "digest.h"
+#include "transfer.h"
+#include "esphome/core/defines.h"
+
+namespace esphome {
+namespace box3web {
+
+// One in-flight upload: a single open handle fed through a cluster-aligned write-behind buffer
+// borrowed from the transfer pool for the lifetime of the upload.
+class UploadPipeline;
+
+class UploadSession {
+ public:
+  // A resumed upload appends to its partial file and keeps whatever reached the card when it ends early.
+  UploadSession(std::string path, PoolBuffer buffer, bool resume = false);
+  ~UploadSession();
+
+  bool open();
+  // Admission ticket held for the lifetime of the upload, incoming data is charged to the client's rate.
+  void set_ticket(TransferTicket ticket) { this->ticket_ = std::move(ticket); }
+#ifdef USE_BOX3WEB_UPLOAD_PIPELINE
+  // Hands subsequent writes to the pipeline writer task, false when it is busy with another upload.
+  bool attach_pipeline(UploadPipeline *pipeline);
+#endif
+  bool write(const uint8_t *data, size_t len);
+  // Buffered write on the calling task, used by the pipeline writer.
+  bool write_direct(const uint8_t *data, size_t len);
+  // Also stores the digest of a whole upload next to the file.
+  bool finish();
+  // Closes the handle and removes the partial file, or keeps what was written for a resumed upload.
+  void abort();
+
+  std::string const &path() const { return this->path_; }
+  size_t received() const { return this->received_; }
+  uint32_t last_activity() const { return this->last_activity_; }
+  // A whole upload written over a file that was already there.
+  bool replaced() const { return this->replaced_; }
+  // Checksums of a whole upload once finish() succeeded, nullptr for resumed uploads which are not hashed.
+  const ContentDigest *digest() const { return this->digest_ready_ ? &this->digest_ : nullptr; }
+
+ protected:
+  bool flush_();
+
+  std::string path_;
+  bool resume_;
+  bool replaced_{false};
+  SdFile file_;
+  PoolBuffer buffer_;
+  TransferTicket ticket_;
+  size_t buffer_size_;
+  size_t buffered_{0};
+  size_t received_{0};
+  uint32_t last_activity_{0};
+  // Hashed as the data arrives, on the receiving task, so with the pipeline it overlaps the card writes.
+  std::unique_ptr<Sha256> sha256_;
+  ContentDigest digest_;
+  bool digest_ready_{false};
+#ifdef USE_BOX3WEB_UPLOAD_PIPELINE
+  UploadPipeline *pipeline_{nullptr};
+#endif
+};
+
+}  // namespace box3web
+}  // namespace esphome
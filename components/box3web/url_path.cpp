@@ -0,0 +1,152 @@
+#include "url_path.h"
+
+#include <cstring>
+
+namespace esphome {
+namespace box3web {
+
+bool PathBuffer::append(std::string_view text) {
+    if (text.size() > MAX_PATH_LENGTH - this->size_)
+        return false;
+    text.copy(this->data_ + this->size_, text.size());
+    this->size_ += text.size();
+    this->data_[this->size_] = '\0';
+    return true;
+}
+
+bool PathBuffer::push_back(char c) {
+    if (this->size_ >= MAX_PATH_LENGTH)
+        return false;
+    this->data_[this->size_++] = c;
+    this->data_[this->size_] = '\0';
+    return true;
+}
+
+void PathBuffer::truncate(size_t size) {
+    if (size < this->size_) {
+        this->size_ = size;
+        this->data_[size] = '\0';
+    }
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+// Characters no segment may contain, whether they arrived literally or percent-encoded.
+static bool is_forbidden(unsigned char c) { return c < 0x20 || c == 0x7f || c == '\\' || c == 0xc0 || c == 0xc1; }
+
+// Closes the segment opened by the separator at that position: empty and "." segments are removed, ".." is refused.
+static PathError close_segment(PathBuffer &out, size_t separator) {
+    std::string_view segment = out.view().substr(separator + 1);
+    if (segment.empty() || segment == ".") {
+        out.truncate(separator);
+        return PathError::NONE;
+    }
+    if (segment == "..")
+        return PathError::TRAVERSAL;
+    if (is_internal_name(segment))
+        return PathError::RESERVED;
+    return PathError::NONE;
+}
+
+bool is_internal_name(std::string_view name) { return name.substr(0, strlen(INTERNAL_PREFIX)) == INTERNAL_PREFIX; }
+
+PathError append_url_path(std::string_view url, bool decode, PathBuffer &out) {
+    const size_t initial = out.size();
+    // Position of the separator that opened the current segment.
+    size_t separator = out.size();
+    bool in_segment = false;
+    PathError error = PathError::NONE;
+
+    for (size_t i = 0; i < url.size() && error == PathError::NONE; i++) {
+        char c = url[i];
+        if (decode && c == '?')
+            break;
+        if (c == '/') {
+            if (in_segment)
+                error = close_segment(out, separator);
+            in_segment = false;
+            continue;
+        }
+        if (decode && c == '%') {
+            int high = i + 2 < url.size() ? hex_value(url[i + 1]) : -1;
+            int low = high >= 0 ? hex_value(url[i + 2]) : -1;
+            if (low < 0) {
+                error = PathError::MALFORMED;
+                break;
+            }
+            c = static_cast<char>(high * 16 + low);
+            i += 2;
+            // A separator smuggled in as %2F would bypass the segment checks.
+            if (c == '/' || c == '\0') {
+                error = PathError::MALFORMED;
+                break;
+            }
+        }
+        if (is_forbidden(static_cast<unsigned char>(c))) {
+            error = PathError::MALFORMED;
+            break;
+        }
+        if (!in_segment) {
+            separator = out.size();
+            in_segment = true;
+            if (!out.push_back('/')) {
+                error = PathError::TOO_LONG;
+                break;
+            }
+        }
+        if (!out.push_back(c))
+            error = PathError::TOO_LONG;
+    }
+    if (error == PathError::NONE && in_segment)
+        error = close_segment(out, separator);
+    if (error != PathError::NONE)
+        out.truncate(initial);
+    return error;
+}
+
+PathError append_file_name(std::string_view name, PathBuffer &out) {
+    if (name.empty() || name.find('/') != std::string_view::npos)
+        return PathError::MALFORMED;
+    const size_t initial = out.size();
+    PathError error = append_url_path(name, false, out);
+    // Only "." would vanish here.
+    if (error == PathError::NONE && out.size() == initial)
+        error = PathError::MALFORMED;
+    return error;
+}
+
+std::string normalize_url_prefix(std::string_view prefix) {
+    while (!prefix.empty() && prefix.front() == '/')
+        prefix.remove_prefix(1);
+    while (!prefix.empty() && prefix.back() == '/')
+        prefix.remove_suffix(1);
+    std::string result = "/";
+    result.append(prefix.data(), prefix.size());
+    return result;
+}
+
+const char *path_error_message(PathError error) {
+    switch (error) {
+        case PathError::MALFORMED:
+            return "{ \"error\": \"malformed path\" }";
+        case PathError::TRAVERSAL:
+            return "{ \"error\": \"path traversal is not allowed\" }";
+        case PathError::TOO_LONG:
+            return "{ \"error\": \"path too long\" }";
+        case PathError::RESERVED:
+            return "{ \"error\": \"reserved name\" }";
+        default:
+            return "{}";
+    }
+}
+
+}  // namespace box3web
+}  // namespace esphome
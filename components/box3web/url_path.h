@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace esphome {
+namespace box3web {
+
+static const size_t MAX_PATH_LENGTH = 255;
+
+// Fixed-capacity, NUL-terminated path that lives on the stack.
+class PathBuffer {
+ public:
+  bool append(std::string_view text);
+  bool push_back(char c);
+  void truncate(size_t size);
+  size_t size() const { return this->size_; }
+  bool empty() const { return this->size_ == 0; }
+  char back() const { return this->size_ ? this->data_[this->size_ - 1] : '\0'; }
+  const char *c_str() const { return this->data_; }
+  std::string_view view() const { return std::string_view(this->data_, this->size_); }
+  std::string str() const { return std::string(this->data_, this->size_); }
+
+ protected:
+  char data_[MAX_PATH_LENGTH + 1]{};
+  size_t size_{0};
+};
+
+enum class PathError { NONE, MALFORMED, TRAVERSAL, TOO_LONG, RESERVED };
+
+// Files the component keeps on the card for itself (partial uploads and the like) start with this. They are
+// left out of listings and no request path may name them.
+static const char *const INTERNAL_PREFIX = ".box3web";
+
+bool is_internal_name(std::string_view name);
+
+// Appends the segments of a request path to out in a single pass. Empty and "." segments are dropped, ".."
+// is refused rather than resolved, as are internal names, control characters, backslashes and overlong UTF-8
+// leads. With decode set, %XX escapes are decoded (an encoded separator or NUL is refused) and a query string
+// ends the path.
+// The appended part never ends with a separator; out is left untouched on error.
+PathError append_url_path(std::string_view url, bool decode, PathBuffer &out);
+
+// Appends "/" + name where name must be a single, plain path segment (e.g. an upload file name).
+PathError append_file_name(std::string_view name, PathBuffer &out);
+
+// "/" + prefix without trailing separators, computed once at setup.
+std::string normalize_url_prefix(std::string_view prefix);
+
+const char *path_error_message(PathError error);
+
+}  // namespace box3web
+}  // namespace esphome